@@ -71,6 +71,7 @@ PRODUCT_COPY_FILES += \
 
 PRODUCT_COPY_FILES += \
         device/moto/wingray/libaudio/audio_policy.conf:system/etc/audio_policy.conf \
+        device/moto/wingray/libaudio/audio_output_profiles.conf:system/etc/audio_output_profiles.conf \
         device/moto/wingray/audio_effects.conf:system/vendor/etc/audio_effects.conf
 
 PRODUCT_PACKAGES := \
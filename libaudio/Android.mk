@@ -38,13 +38,35 @@ LOCAL_SHARED_LIBRARIES := \
 LOCAL_SHARED_LIBRARIES += libdl
 
 LOCAL_SRC_FILES += \
-    AudioHardware.cpp
+    AudioHardware.cpp \
+    AudioDsp.cpp \
+    AudioPolyphaseSrc.cpp \
+    AudioRingBuffer.cpp \
+    AudioSinkWriter.cpp \
+    AudioPositionTracker.cpp \
+    AudioOutputProfiles.cpp \
+    AudioBufferTuner.cpp \
+    AudioStats.cpp \
+    AudioScratchArena.cpp \
+    AudioStreamLock.cpp \
+    AudioRoutingState.cpp \
+    AudioCaptureStage.cpp \
+    AudioCaptureSplitter.cpp \
+    AudioCaptureClock.cpp \
+    AudioTuningStore.cpp \
+    AudioOutputMixer.cpp \
+    AudioEqualizer.cpp \
+    AudioDeviceIo.cpp
 
 LOCAL_C_INCLUDES += \
     $(call include-path-for, audio-effects)
 
 LOCAL_CFLAGS += -fno-short-enums
 
+ifeq ($(ARCH_ARM_HAVE_NEON),true)
+LOCAL_ARM_NEON := true
+endif
+
 LOCAL_STATIC_LIBRARIES := \
     libmedia_helper
 
@@ -52,7 +74,9 @@ LOCAL_WHOLE_STATIC_LIBRARIES := \
     libaudiohw_legacy
 
 ifeq ($(USE_PROPRIETARY_AUDIO_EXTENSIONS),true)
-LOCAL_SRC_FILES += AudioPostProcessor.cpp
+LOCAL_SRC_FILES += \
+    AudioPostProcessor.cpp \
+    AudioDatalogWriter.cpp
 LOCAL_STATIC_LIBRARIES += \
     libEverest_motomm-r \
     libCortexA9_aie-r \
@@ -60,15 +84,116 @@ LOCAL_STATIC_LIBRARIES += \
     libCortexA9_se-r \
     libCortexA9_motovoice-r \
     libCortexA9_ecns-r \
-    libsamplerateconverter \
     libCortexA9_anm-r
 
 LOCAL_CFLAGS += -DUSE_PROPRIETARY_AUDIO_EXTENSIONS
 LOCAL_C_INCLUDES += vendor/motorola/stingray/motomm/ghdr
-LOCAL_C_INCLUDES += vendor/motorola/stingray/motomm/rate_conv
 endif
 
 include $(BUILD_SHARED_LIBRARY)
 
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+    bench/dsp_bench.cpp \
+    AudioPolyphaseSrc.cpp \
+    AudioEqualizer.cpp \
+    AudioDsp.cpp
+
+ifeq ($(ARCH_ARM_HAVE_NEON),true)
+LOCAL_ARM_NEON := true
+endif
+
+# libutils for the String8 of AudioEqualizer::dump()
+LOCAL_SHARED_LIBRARIES := liblog libutils
+
+# Also times the multimedia processing the device EQ replaces
+ifeq ($(USE_PROPRIETARY_AUDIO_EXTENSIONS),true)
+LOCAL_STATIC_LIBRARIES += \
+    libEverest_motomm-r \
+    libCortexA9_aie-r \
+    libCortexA9_sas-r \
+    libCortexA9_se-r
+LOCAL_CFLAGS += -DUSE_PROPRIETARY_AUDIO_EXTENSIONS
+LOCAL_C_INCLUDES += vendor/motorola/stingray/motomm/ghdr
+endif
+
+LOCAL_MODULE := audio_dsp_bench
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_EXECUTABLE)
+
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+    bench/dsp_bench.cpp \
+    AudioPolyphaseSrc.cpp \
+    AudioEqualizer.cpp \
+    AudioDsp.cpp
+
+LOCAL_STATIC_LIBRARIES := \
+    libutils \
+    libcutils \
+    liblog
+
+LOCAL_MODULE := audio_dsp_bench
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+    bench/hal_bench.cpp \
+    bench/AudioSimDeviceIo.cpp \
+    AudioHardware.cpp \
+    AudioDsp.cpp \
+    AudioPolyphaseSrc.cpp \
+    AudioRingBuffer.cpp \
+    AudioSinkWriter.cpp \
+    AudioPositionTracker.cpp \
+    AudioOutputProfiles.cpp \
+    AudioBufferTuner.cpp \
+    AudioStats.cpp \
+    AudioScratchArena.cpp \
+    AudioStreamLock.cpp \
+    AudioRoutingState.cpp \
+    AudioCaptureStage.cpp \
+    AudioCaptureSplitter.cpp \
+    AudioCaptureClock.cpp \
+    AudioTuningStore.cpp \
+    AudioOutputMixer.cpp \
+    AudioEqualizer.cpp \
+    AudioDeviceIo.cpp
+
+LOCAL_C_INCLUDES += \
+    $(LOCAL_PATH) \
+    $(LOCAL_PATH)/bench \
+    $(call include-path-for, audio-effects)
+
+LOCAL_CFLAGS += -fno-short-enums
+
+ifeq ($(ARCH_ARM_HAVE_NEON),true)
+LOCAL_ARM_NEON := true
+endif
+
+LOCAL_SHARED_LIBRARIES := \
+    libcutils \
+    libutils \
+    libhardware_legacy
+
+LOCAL_STATIC_LIBRARIES := \
+    libmedia_helper
+
+LOCAL_WHOLE_STATIC_LIBRARIES := \
+    libaudiohw_legacy
+
+LOCAL_MODULE := audio_hal_bench
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_EXECUTABLE)
+
 endif # not BUILD_TINY_ANDROID
 
@@ -0,0 +1,112 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "AudioBufferTuner"
+#include <utils/Log.h>
+
+#include <stdio.h>
+
+#include "AudioBufferTuner.h"
+
+namespace android_audio_legacy {
+
+// Hold period before the first decrease and its bounds
+#define TUNER_HOLD_NS       (10 * 1000000000LL)
+#define TUNER_MAX_HOLD_NS   (300 * 1000000000LL)
+
+AudioBufferTuner::AudioBufferTuner() :
+    mMinBufs(1), mMaxBufs(1), mNumBufs(1), mBufferNs(0), mHoldNs(TUNER_HOLD_NS),
+    mWindowStartNs(0), mWindowMaxIntervalNs(0), mLastWriteNs(0), mMaxIntervalNs(0),
+    mErrors(0), mRaises(0), mLowers(0)
+{
+}
+
+void AudioBufferTuner::reset(int minBufs, int maxBufs, nsecs_t bufferNs)
+{
+    mMinBufs = minBufs < maxBufs ? minBufs : maxBufs;
+    mMaxBufs = maxBufs;
+    mNumBufs = maxBufs;
+    mBufferNs = bufferNs;
+    mHoldNs = TUNER_HOLD_NS;
+    mLastWriteNs = 0;
+    restartWindow(0);
+}
+
+void AudioBufferTuner::restartWindow(nsecs_t now)
+{
+    mWindowStartNs = now;
+    mWindowMaxIntervalNs = 0;
+}
+
+bool AudioBufferTuner::onWrite(nsecs_t now, uint32_t errors)
+{
+    if (mLastWriteNs != 0) {
+        nsecs_t interval = now - mLastWriteNs;
+        if (interval > mWindowMaxIntervalNs) {
+            mWindowMaxIntervalNs = interval;
+        }
+        if (interval > mMaxIntervalNs) {
+            mMaxIntervalNs = interval;
+        }
+    } else if (mWindowStartNs == 0) {
+        mWindowStartNs = now;
+    }
+    mLastWriteNs = now;
+
+    if (errors) {
+        mErrors += errors;
+        restartWindow(now);
+        if (mNumBufs < mMaxBufs) {
+            mNumBufs++;
+            mRaises++;
+            mHoldNs = mHoldNs * 2 < TUNER_MAX_HOLD_NS ? mHoldNs * 2 : TUNER_MAX_HOLD_NS;
+            ALOGD("%u underruns, %d output buffers", errors, mNumBufs);
+            return true;
+        }
+        return false;
+    }
+
+    if (now - mWindowStartNs >= mHoldNs) {
+        // With n buffers queued, the driver runs dry after n buffer periods without write.
+        // Keep half a buffer of margin for the scheduling jitter of the next write.
+        if (mNumBufs > mMinBufs &&
+                mWindowMaxIntervalNs + mBufferNs / 2 <= (mNumBufs - 1) * mBufferNs) {
+            mNumBufs--;
+            mLowers++;
+            mHoldNs = mHoldNs / 2 > TUNER_HOLD_NS ? mHoldNs / 2 : TUNER_HOLD_NS;
+            ALOGV("no underrun for %d ms, %d output buffers", (int)ns2ms(now - mWindowStartNs),
+                  mNumBufs);
+        }
+        restartWindow(now);
+    }
+    return false;
+}
+
+void AudioBufferTuner::dump(String8& result) const
+{
+    const size_t SIZE = 256;
+    char buffer[SIZE];
+
+    snprintf(buffer, SIZE, "\toutput buffers: %d (%d..%d), hold %d s\n",
+             mNumBufs, mMinBufs, mMaxBufs, (int)(mHoldNs / 1000000000LL));
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tunderruns: %u, raises: %u, lowers: %u, longest write interval: %d us\n",
+             mErrors, mRaises, mLowers, (int)(mMaxIntervalNs / 1000));
+    result.append(buffer);
+}
+
+}; // namespace android_audio_legacy
@@ -0,0 +1,72 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_AUDIO_BUFFER_TUNER_H
+#define ANDROID_AUDIO_BUFFER_TUNER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/Timers.h>
+#include <utils/String8.h>
+
+namespace android_audio_legacy {
+    using android::String8;
+
+// Chooses the number of output driver buffers from the measured underruns.
+//
+// Buffers are added as soon as the driver reports an underrun, and removed one at a
+// time after a hold period without underruns during which the longest interval between
+// two writes would also have fitted in one buffer less. Every increase doubles the
+// hold period and every decrease halves it, so that a load that glitches at the lower
+// count does not make the count oscillate.
+class AudioBufferTuner
+{
+public:
+                        AudioBufferTuner();
+
+            // Starts over at maxBufs, the count known to be safe.
+            void        reset(int minBufs, int maxBufs, nsecs_t bufferNs);
+            // A buffer was written at time now and the driver reported errors underruns
+            // since the previous write. Returns true if the count was raised: the queue
+            // has drained, so the caller should apply numBufs() right away.
+            bool        onWrite(nsecs_t now, uint32_t errors);
+            // The gap between the writes before and after standby is not an underrun.
+            void        onStandby() { mLastWriteNs = 0; }
+
+            int         numBufs() const { return mNumBufs; }
+            void        dump(String8& result) const;
+
+private:
+            void        restartWindow(nsecs_t now);
+
+            int         mMinBufs;
+            int         mMaxBufs;
+            int         mNumBufs;
+            nsecs_t     mBufferNs;
+            nsecs_t     mHoldNs;
+            nsecs_t     mWindowStartNs;
+            nsecs_t     mWindowMaxIntervalNs;   // longest write interval since mWindowStartNs
+            nsecs_t     mLastWriteNs;
+            nsecs_t     mMaxIntervalNs;
+            uint32_t    mErrors;
+            uint32_t    mRaises;
+            uint32_t    mLowers;
+};
+
+}; // namespace android_audio_legacy
+
+#endif // ANDROID_AUDIO_BUFFER_TUNER_H
@@ -0,0 +1,124 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "AudioCaptureClock"
+#include <utils/Log.h>
+
+#include <limits.h>
+#include <stdio.h>
+
+#include "AudioCaptureClock.h"
+
+namespace android_audio_legacy {
+
+// The smallest lateness over this window is taken as clock drift
+static const nsecs_t kWindowNs = 1000000000LL;
+// Drift followed per window, 1000 ppm, well above any crystal
+static const nsecs_t kMaxDriftNs = 1000000LL;
+// Lateness beyond the driver buffer still taken as scheduling noise
+static const nsecs_t kToleranceNs = 2000000LL;
+
+AudioCaptureClock::AudioCaptureClock() :
+    mRate(0), mBufferNs(0), mStarted(false), mFrames(0), mAnchorFrame(0), mAnchorNs(0),
+    mWindowStartNs(0), mMinLateNs(LLONG_MAX), mMaxLateNs(0), mLostFrames(0), mGaps(0)
+{
+}
+
+void AudioCaptureClock::start(uint32_t rate, nsecs_t bufferNs)
+{
+    mRate = rate;
+    mBufferNs = bufferNs;
+    mStarted = false;
+    mFrames = 0;
+    mAnchorFrame = 0;
+    mAnchorNs = 0;
+    mMinLateNs = LLONG_MAX;
+    mMaxLateNs = 0;
+    mLostFrames = 0;
+    mGaps = 0;
+}
+
+nsecs_t AudioCaptureClock::timeOf(uint64_t frame) const
+{
+    if (mRate == 0) {
+        return mAnchorNs;
+    }
+    return mAnchorNs + ((int64_t)frame - (int64_t)mAnchorFrame) * 1000000000LL / mRate;
+}
+
+uint32_t AudioCaptureClock::onRead(size_t frames, nsecs_t now, bool overrun)
+{
+    if (mRate == 0 || frames == 0) {
+        return 0;
+    }
+    mFrames += frames;
+    if (!mStarted) {
+        // The newest frame of the first read was captured about when it completed
+        mAnchorFrame = mFrames;
+        mAnchorNs = now;
+        mWindowStartNs = now;
+        mStarted = true;
+        return 0;
+    }
+
+    uint32_t lost = 0;
+    nsecs_t late = now - timeOf(mFrames);
+    // What the driver may have held, besides these frames, without dropping any
+    nsecs_t held = mBufferNs - (nsecs_t)frames * 1000000000LL / mRate;
+    if (overrun && late > held + kToleranceNs) {
+        lost = (uint32_t)((late - held) * mRate / 1000000000LL);
+        mFrames += lost;
+        mLostFrames += lost;
+        mGaps++;
+        late = now - timeOf(mFrames);
+        ALOGW("%s: %u frames lost, read %d us late", __FUNCTION__, lost, (int)ns2us(late));
+    }
+
+    if (late < 0) {
+        // Earlier than predicted: the anchor was late
+        mAnchorFrame = mFrames;
+        mAnchorNs = now;
+        late = 0;
+    }
+    if (late > mMaxLateNs) {
+        mMaxLateNs = late;
+    }
+    if (late < mMinLateNs) {
+        mMinLateNs = late;
+    }
+    if (now - mWindowStartNs >= kWindowNs) {
+        // No read of the window was on time: the audio clock is slower than predicted
+        mAnchorNs += mMinLateNs < kMaxDriftNs ? mMinLateNs : kMaxDriftNs;
+        mWindowStartNs = now;
+        mMinLateNs = LLONG_MAX;
+    }
+    return lost;
+}
+
+void AudioCaptureClock::dump(String8& result)
+{
+    const size_t SIZE = 256;
+    char buffer[SIZE];
+
+    snprintf(buffer, SIZE, "\t  clock: %llu frames, %llu lost in %u gaps, "
+             "max lateness %d us, driver buffer %d us\n",
+             (unsigned long long)mFrames, (unsigned long long)mLostFrames, mGaps,
+             (int)ns2us(mMaxLateNs), (int)ns2us(mBufferNs));
+    result.append(buffer);
+}
+
+}; // namespace android_audio_legacy
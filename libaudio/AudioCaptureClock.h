@@ -0,0 +1,82 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_AUDIO_CAPTURE_CLOCK_H
+#define ANDROID_AUDIO_CAPTURE_CLOCK_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/Timers.h>
+#include <utils/String8.h>
+
+namespace android_audio_legacy {
+    using android::String8;
+
+// Maps the frames read from the capture driver to the time they were captured.
+//
+// Every driver read is timestamped when it completes, which is late by the scheduling
+// delay of the reader and by however long the frames waited in the driver. The clock
+// keeps an anchor (frame, time) and predicts the time of any later frame from the
+// rate: a read completing before its prediction moves the anchor back to it, and the
+// smallest lateness seen over a window is folded into the anchor so that the clock
+// follows the drift of the audio crystal without following the scheduling noise.
+//
+// The driver keeps the newest frames when the reader falls behind its buffer. Such an
+// overrun shows as a read completing later than its prediction by more than the
+// driver buffer can hold; the difference is the number of frames lost, and it is
+// added to the frame count so that later frames keep their true capture time.
+//
+// Not thread safe, the caller serializes.
+class AudioCaptureClock
+{
+public:
+                        AudioCaptureClock();
+
+            // Restarts the count at 0 for a capture at rate. bufferNs is the audio the
+            // driver holds before it overruns.
+            void        start(uint32_t rate, nsecs_t bufferNs);
+            // frames were read, the read completed at now. overrun is false when the
+            // driver reported that it did not drop anything. Returns the frames lost
+            // before these.
+            uint32_t    onRead(size_t frames, nsecs_t now, bool overrun);
+
+            // Frames captured since start(), lost ones included.
+            uint64_t    frames() const { return mFrames; }
+            // Capture time of frame, which may be in the past or in the future.
+            nsecs_t     timeOf(uint64_t frame) const;
+            bool        started() const { return mStarted; }
+            uint64_t    lostFrames() const { return mLostFrames; }
+
+            void        dump(String8& result);
+
+private:
+            uint32_t    mRate;
+            nsecs_t     mBufferNs;
+            bool        mStarted;
+            uint64_t    mFrames;
+            uint64_t    mAnchorFrame;
+            nsecs_t     mAnchorNs;
+            nsecs_t     mWindowStartNs;
+            nsecs_t     mMinLateNs;     // smallest lateness in the current window
+            nsecs_t     mMaxLateNs;     // largest lateness not taken as an overrun
+            uint64_t    mLostFrames;
+            uint32_t    mGaps;
+};
+
+}; // namespace android_audio_legacy
+
+#endif // ANDROID_AUDIO_CAPTURE_CLOCK_H
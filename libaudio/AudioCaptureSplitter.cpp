@@ -0,0 +1,420 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "AudioCaptureSplitter"
+#include <utils/Log.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <cutils/atomic.h>
+#include <utils/Timers.h>
+
+#include <linux/tegra_audio.h>
+
+#include "AudioDeviceIo.h"
+#include "AudioCaptureSplitter.h"
+
+namespace android_audio_legacy {
+
+using android::NO_ERROR;
+using android::BAD_VALUE;
+using android::NO_MEMORY;
+using android::NO_INIT;
+using android::TIMED_OUT;
+using android::WOULD_BLOCK;
+using android::INVALID_OPERATION;
+
+// A client waiting longer than this for a period gives up: the driver is stuck.
+static const nsecs_t kReadTimeoutNs = 1000000000LL;
+// Largest period: 20 ms of 48 kHz stereo
+static const size_t kMaxPeriodBytes = 48000 / 50 * 2 * sizeof(int16_t);
+// Driver buffers of one period each, when the driver cannot tell
+static const unsigned kDefaultNumBufs = 2;
+
+AudioCaptureSplitter::Client::Client() :
+    mGeneration(0), mReadPos(0), mLostFrames(0), mOverruns(0), mAttached(false)
+{
+}
+
+status_t AudioCaptureSplitter::Client::init(size_t ringBytes)
+{
+    if (mRing.initted()) {
+        return NO_ERROR;
+    }
+    return mRing.init(ringBytes);
+}
+
+// ----------------------------------------------------------------------------
+
+AudioCaptureSplitter::AudioCaptureSplitter() :
+    Thread(false),
+    mFd(-1), mFdCtl(-1), mState(STATE_IDLE), mMic(false), mBluetooth(false),
+    mRate(0), mChannels(1), mGeneration(0), mReading(false), mNumClients(0),
+    mPeriodBytes(0),
+#ifdef USE_PROPRIETARY_AUDIO_EXTENSIONS
+    mPostProcessor(NULL),
+#endif
+    mReads(0), mErrors(0), mOverruns(0)
+{
+    mPeriodBuf = new int16_t[kMaxPeriodBytes / sizeof(int16_t)];
+}
+
+AudioCaptureSplitter::~AudioCaptureSplitter()
+{
+    stopReader();
+    close();
+    delete[] mPeriodBuf;
+}
+
+status_t AudioCaptureSplitter::open()
+{
+    AudioDeviceIo *io = AudioDeviceIo::instance();
+
+    // Need to "restart" the driver when changing the buffer configuration.
+    if (mFdCtl >= 0 && io->ioctl(mFdCtl, TEGRA_AUDIO_IN_STOP) < 0) {
+        ALOGE("%s: could not stop recording: %s", __FUNCTION__, strerror(errno));
+    }
+    close();
+
+    mFd = io->open("/dev/audio1_in", O_RDWR);
+    if (mFd < 0) {
+        ALOGE("open /dev/audio1_in failed: %s", strerror(errno));
+        return NO_INIT;
+    }
+    mFdCtl = io->open("/dev/audio1_in_ctl", O_RDWR);
+    if (mFdCtl < 0) {
+        ALOGE("open /dev/audio1_in_ctl failed: %s", strerror(errno));
+        close();
+        return NO_INIT;
+    }
+    mState = STATE_CONFIG_REQ;
+    return NO_ERROR;
+}
+
+void AudioCaptureSplitter::close()
+{
+    AudioDeviceIo *io = AudioDeviceIo::instance();
+
+    if (mFd >= 0) {
+        io->close(mFd);
+        mFd = -1;
+    }
+    if (mFdCtl >= 0) {
+        io->close(mFdCtl);
+        mFdCtl = -1;
+    }
+    mState = STATE_IDLE;
+}
+
+void AudioCaptureSplitter::setPath(bool mic, bool bluetooth, int rate)
+{
+    ALOGV("%s: mic %d bluetooth %d rate %d", __FUNCTION__, mic, bluetooth, rate);
+    if (mState != STATE_IDLE) {
+        if (mic != mMic || bluetooth != mBluetooth) {
+            mState = STATE_CONFIG_REQ;
+        } else if (rate != mRate && mState > STATE_NEW_RATE_REQ) {
+            mState = STATE_NEW_RATE_REQ;
+        }
+    }
+    mMic = mic;
+    mBluetooth = bluetooth;
+}
+
+void AudioCaptureSplitter::setConfigured(int rate, int channels)
+{
+    Mutex::Autolock lock(mLock);
+
+    mRate = rate;
+    mChannels = channels;
+    mPeriodBytes = ((rate * PERIOD_MS / 1000 * channels * sizeof(int16_t)) + 7) & ~7;
+    if (mPeriodBytes > kMaxPeriodBytes) {
+        mPeriodBytes = kMaxPeriodBytes;
+    }
+    for (int i = 0; i < mNumClients; i++) {
+        mClients[i]->mRing.flush();
+        mClients[i]->mReadPos = 0;
+    }
+    mClock.start(rate, getBufferNs());
+    mGeneration++;
+    mState = STATE_CONFIGURED;
+    mCond.broadcast();
+    ALOGV("%s: generation %u, %d Hz, %d channels", __FUNCTION__, mGeneration, rate, channels);
+}
+
+status_t AudioCaptureSplitter::startReader()
+{
+    if (mReading) {
+        return NO_ERROR;
+    }
+    if (!isOpen() || mState != STATE_CONFIGURED) {
+        return INVALID_OPERATION;
+    }
+    getOverruns();  // clear the errors counted while capture was stopped
+    status_t status = run("AudioCaptureSplitter", ANDROID_PRIORITY_URGENT_AUDIO);
+    if (status == NO_ERROR) {
+        mReading = true;
+    }
+    return status;
+}
+
+void AudioCaptureSplitter::stopReader()
+{
+    if (!mReading) {
+        return;
+    }
+    // The reader returns from the driver within a period
+    requestExitAndWait();
+    mReading = false;
+}
+
+void AudioCaptureSplitter::stopDma()
+{
+    if (mFdCtl >= 0 && AudioDeviceIo::instance()->ioctl(mFdCtl, TEGRA_AUDIO_IN_STOP) < 0) {
+        ALOGE("could not stop recording: %d %s", errno, strerror(errno));
+    }
+}
+
+status_t AudioCaptureSplitter::attach(Client *client)
+{
+    Mutex::Autolock lock(mLock);
+
+    if (client->mAttached) {
+        return NO_ERROR;
+    }
+    if (mNumClients == MAX_CLIENTS || !client->mRing.initted()) {
+        ALOGE("%s: cannot attach client %p, %d clients", __FUNCTION__, client, mNumClients);
+        return NO_MEMORY;
+    }
+    client->mRing.flush();
+    client->mReadPos = mClock.frames();
+    client->mLostFrames = 0;
+    client->mOverruns = 0;
+    // A client always starts with a sync()
+    client->mGeneration = mGeneration - 1;
+    client->mAttached = true;
+    mClients[mNumClients++] = client;
+    ALOGV("%s: %p, %d clients", __FUNCTION__, client, mNumClients);
+    return NO_ERROR;
+}
+
+void AudioCaptureSplitter::detach(Client *client)
+{
+    Mutex::Autolock lock(mLock);
+
+    for (int i = 0; i < mNumClients; i++) {
+        if (mClients[i] == client) {
+            mClients[i] = mClients[--mNumClients];
+            client->mAttached = false;
+            break;
+        }
+    }
+    ALOGV("%s: %p, %d clients", __FUNCTION__, client, mNumClients);
+}
+
+void AudioCaptureSplitter::sync(Client *client, int *rate, int *channels)
+{
+    Mutex::Autolock lock(mLock);
+
+    client->mGeneration = mGeneration;
+    *rate = mRate;
+    *channels = mChannels;
+}
+
+ssize_t AudioCaptureSplitter::read(Client *client, void *buffer, size_t bytes)
+{
+    Mutex::Autolock lock(mLock);
+
+    // No more than half the ring, so that the reader can add to it while the client waits
+    size_t frameSize = mChannels * sizeof(int16_t);
+    size_t want = bytes < client->mRing.capacity() / 2 ? bytes : client->mRing.capacity() / 2;
+    want -= want % frameSize;
+    while (client->mGeneration == mGeneration && client->mRing.availableToRead() < want) {
+        if (mCond.waitRelative(mLock, kReadTimeoutNs) == TIMED_OUT) {
+            ALOGE("%s: no capture for %lld ms", __FUNCTION__, kReadTimeoutNs / 1000000);
+            return TIMED_OUT;
+        }
+    }
+    if (client->mGeneration != mGeneration) {
+        return WOULD_BLOCK;
+    }
+    size_t got = client->mRing.read(buffer, want);
+    client->mReadPos += got / frameSize;
+    return got;
+}
+
+uint32_t AudioCaptureSplitter::takeLostFrames(Client *client)
+{
+    Mutex::Autolock lock(mLock);
+
+    uint32_t lost = client->mLostFrames;
+    client->mLostFrames = 0;
+    return lost;
+}
+
+uint32_t AudioCaptureSplitter::takeOverruns(Client *client)
+{
+    Mutex::Autolock lock(mLock);
+
+    uint32_t overruns = client->mOverruns;
+    client->mOverruns = 0;
+    return overruns;
+}
+
+status_t AudioCaptureSplitter::captureTime(Client *client, size_t back, nsecs_t *time)
+{
+    Mutex::Autolock lock(mLock);
+
+    if (!mClock.started() || client->mGeneration != mGeneration) {
+        return INVALID_OPERATION;
+    }
+    *time = mClock.timeOf(client->mReadPos - back);
+    return NO_ERROR;
+}
+
+// The audio the driver buffers hold, read in periods, before it overruns
+nsecs_t AudioCaptureSplitter::getBufferNs()
+{
+    unsigned numBufs = kDefaultNumBufs;
+#ifdef TEGRA_AUDIO_IN_GET_NUM_BUFS
+    if (AudioDeviceIo::instance()->ioctl(mFdCtl, TEGRA_AUDIO_IN_GET_NUM_BUFS, &numBufs) < 0 ||
+            numBufs == 0) {
+        numBufs = kDefaultNumBufs;
+    }
+#endif
+    return (nsecs_t)numBufs * milliseconds(PERIOD_MS);
+}
+
+uint32_t AudioCaptureSplitter::getOverruns()
+{
+#ifdef TEGRA_AUDIO_IN_GET_ERROR_COUNT
+    struct tegra_audio_error_counts errors;
+    if (AudioDeviceIo::instance()->ioctl(mFdCtl, TEGRA_AUDIO_IN_GET_ERROR_COUNT, &errors) < 0) {
+        return 0;
+    }
+    return errors.late_dma + errors.full_empty;
+#else
+    return 0;
+#endif
+}
+
+bool AudioCaptureSplitter::threadLoop()
+{
+    // The format and the fds only change while the reader is stopped
+    ssize_t ret;
+    const int16_t *data = mPeriodBuf;
+#ifdef USE_PROPRIETARY_AUDIO_EXTENSIONS
+    bool uplink = false;
+#endif
+    {
+        Mutex::Autolock lock(mFdLock);
+#ifdef USE_PROPRIETARY_AUDIO_EXTENSIONS
+        if (mPostProcessor != NULL && mPostProcessor->isEcnsEnabled()) {
+            // Distribute the processed frame in place, it is released once copied
+            int avail = 0;
+            data = mPostProcessor->acquireUplink(mFd, mRate, &avail);
+            uplink = data != NULL;
+            ret = uplink ? avail : -1;
+        } else if (mPostProcessor != NULL) {
+            ret = mPostProcessor->read(mFd, mPeriodBuf, mPeriodBytes, mRate);
+        } else
+#endif
+        {
+            ret = AudioDeviceIo::instance()->read(mFd, mPeriodBuf, mPeriodBytes);
+        }
+    }
+    if (ret > (ssize_t)mPeriodBytes) {
+        ret = mPeriodBytes;
+    }
+    nsecs_t now = systemTime();
+    uint32_t overruns = getOverruns();
+
+    Mutex::Autolock lock(mLock);
+    if (ret <= 0) {
+        ALOGE("%s: read of %u bytes returned %d: %s", __FUNCTION__, (unsigned)mPeriodBytes,
+              (int)ret, ret < 0 ? strerror(errno) : "no data");
+        mErrors++;
+        // Do not spin on a failing driver
+        mCond.waitRelative(mLock, milliseconds(PERIOD_MS));
+        return true;
+    }
+
+    size_t frameSize = mChannels * sizeof(int16_t);
+    size_t bytes = ret - ret % frameSize;
+#ifdef TEGRA_AUDIO_IN_GET_ERROR_COUNT
+    bool overrun = overruns != 0;
+#else
+    bool overrun = true;
+#endif
+    uint32_t lost = mClock.onRead(bytes / frameSize, now, overrun);
+    uint64_t start = mClock.frames() - bytes / frameSize;
+    for (int i = 0; i < mNumClients; i++) {
+        Client *client = mClients[i];
+        size_t queued = client->mRing.availableToRead();
+        if (lost != 0 && queued != 0) {
+            // The frames queued before the gap would be given the wrong time
+            client->mRing.flush();
+            client->mLostFrames += queued / frameSize;
+        } else if (bytes > client->mRing.availableToWrite()) {
+            // Make room by dropping the oldest frames
+            size_t excess = bytes - client->mRing.availableToWrite();
+            excess = client->mRing.discard((excess + frameSize - 1) / frameSize * frameSize);
+            client->mReadPos += excess / frameSize;
+            client->mLostFrames += excess / frameSize;
+        }
+        if (client->mRing.availableToRead() == 0) {
+            client->mReadPos = start;
+        }
+        client->mRing.write(data, bytes);
+        client->mLostFrames += lost;
+        client->mOverruns += overruns;
+    }
+#ifdef USE_PROPRIETARY_AUDIO_EXTENSIONS
+    if (uplink) {
+        mPostProcessor->releaseUplink(bytes);
+    }
+#endif
+    mReads++;
+    mOverruns += overruns;
+    mCond.broadcast();
+    return true;
+}
+
+void AudioCaptureSplitter::dump(String8& result)
+{
+    const size_t SIZE = 256;
+    char buffer[SIZE];
+
+    Mutex::Autolock lock(mLock);
+    snprintf(buffer, SIZE, "\tcapture: state %d, %d Hz, %d channels, generation %u, "
+             "%d clients%s\n", mState, mRate, mChannels, mGeneration, mNumClients,
+             mReading ? ", reading" : "");
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\t  %u periods, %u errors, %u overruns\n", mReads, mErrors,
+             mOverruns);
+    result.append(buffer);
+    mClock.dump(result);
+    for (int i = 0; i < mNumClients; i++) {
+        snprintf(buffer, SIZE, "\t  client %p: %u bytes queued, %u frames lost\n", mClients[i],
+                 (unsigned)mClients[i]->mRing.availableToRead(), mClients[i]->mLostFrames);
+        result.append(buffer);
+    }
+}
+
+}; // namespace android_audio_legacy
@@ -0,0 +1,164 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_AUDIO_CAPTURE_SPLITTER_H
+#define ANDROID_AUDIO_CAPTURE_SPLITTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/threads.h>
+#include <utils/String8.h>
+
+#include "AudioRingBuffer.h"
+#include "AudioCaptureClock.h"
+#ifdef USE_PROPRIETARY_AUDIO_EXTENSIONS
+#include "AudioPostProcessor.h"
+#endif
+
+namespace android_audio_legacy {
+    using android::Mutex;
+    using android::Condition;
+    using android::Thread;
+    using android::String8;
+    using android::status_t;
+
+// Shares the capture driver between input streams.
+//
+// The driver nodes are opened once, and a single thread reads them in periods at the
+// hardware rate and copies each period to the ring of every attached client. Each
+// input stream converts from its ring to its own rate and channel count, so that
+// several recorders can run together. A client that does not keep up loses the oldest
+// frames of its own ring only; the loss is counted per client.
+//
+// The reads are timestamped by an AudioCaptureClock, which also counts the frames the
+// driver dropped. The frames of a ring are kept contiguous on the clock, so that the
+// capture time of any frame a client reads is known: frames queued before a driver
+// overrun are dropped with it.
+//
+// The driver control methods are called with AudioHardware::mLock held. The reader is
+// stopped while the driver is reconfigured; every reconfiguration empties the rings
+// and starts a new generation, which read() reports to clients still on the old one.
+class AudioCaptureSplitter : public Thread
+{
+public:
+    enum {
+        MAX_CLIENTS = 4,
+        PERIOD_MS   = 20,
+    };
+    // Driver state, ordered as the stream states of AudioHardware
+    enum {
+        STATE_IDLE = 0,         // driver closed
+        STATE_CONFIG_REQ,       // input path changed, the driver must be restarted
+        STATE_NEW_RATE_REQ,     // only the rate changed
+        STATE_CONFIGURED
+    };
+
+    class Client {
+    public:
+                            Client();
+                status_t    init(size_t ringBytes);
+    private:
+        friend class AudioCaptureSplitter;
+                AudioRingBuffer mRing;
+                uint32_t    mGeneration;
+                uint64_t    mReadPos;       // clock frame at the front of the ring
+                uint32_t    mLostFrames;    // at the driver rate
+                uint32_t    mOverruns;      // driver overruns seen while attached
+                bool        mAttached;
+    };
+
+                        AudioCaptureSplitter();
+    virtual             ~AudioCaptureSplitter();
+
+#ifdef USE_PROPRIETARY_AUDIO_EXTENSIONS
+            // Reads go through the EC/NS thread when it runs
+            void        setPostProcessor(AudioPostProcessor *pp) { mPostProcessor = pp; }
+#endif
+
+            // Driver control. The driver is open but not configured after open().
+            status_t    open();
+            void        close();
+            bool        isOpen() const { return mFd >= 0 && mFdCtl >= 0; }
+            int         fdCtl() const { return mFdCtl; }
+            int         state() const { return mState; }
+            // Records the path routing asks for and which part of the driver setup
+            // must be redone for it.
+            void        setPath(bool mic, bool bluetooth, int rate);
+            // The driver now captures at rate with channels: starts a new generation.
+            void        setConfigured(int rate, int channels);
+            status_t    startReader();
+            void        stopReader();
+            void        stopDma();
+            void        lockFd() { mFdLock.lock(); }
+            void        unlockFd() { mFdLock.unlock(); }
+            int         rate() const { return mRate; }
+            int         channels() const { return mChannels; }
+
+            // Clients
+            status_t    attach(Client *client);
+            void        detach(Client *client);
+            bool        hasClients() const { return mNumClients != 0; }
+            // Moves client to the current generation and returns its format.
+            void        sync(Client *client, int *rate, int *channels);
+            // Reads at most bytes, whole frames, from the ring of client. Waits for
+            // them unless the generation changed, in which case it returns WOULD_BLOCK.
+            ssize_t     read(Client *client, void *buffer, size_t bytes);
+            // Frames lost and driver overruns since the last call
+            uint32_t    takeLostFrames(Client *client);
+            uint32_t    takeOverruns(Client *client);
+            // Capture time of the frame back frames before the next one client reads.
+            // Returns INVALID_OPERATION until the capture was timestamped.
+            status_t    captureTime(Client *client, size_t back, nsecs_t *time);
+
+            void        dump(String8& result);
+
+private:
+        virtual bool    threadLoop();
+            uint32_t    getOverruns();
+            nsecs_t     getBufferNs();
+
+            Mutex       mLock;          // clients, rings and generation
+            Condition   mCond;          // a period was added, or the generation changed
+            Mutex       mFdLock;        // held by the reader while in the driver
+            int         mFd;
+            int         mFdCtl;
+    volatile int32_t    mState;
+            bool        mMic;
+            bool        mBluetooth;
+            int         mRate;
+            int         mChannels;
+            uint32_t    mGeneration;
+            bool        mReading;
+            Client *    mClients[MAX_CLIENTS];
+            int         mNumClients;
+            int16_t *   mPeriodBuf;
+            size_t      mPeriodBytes;
+            AudioCaptureClock mClock;
+#ifdef USE_PROPRIETARY_AUDIO_EXTENSIONS
+            AudioPostProcessor *mPostProcessor;
+#endif
+
+            // statistics
+            uint32_t    mReads;
+            uint32_t    mErrors;
+            uint32_t    mOverruns;
+};
+
+}; // namespace android_audio_legacy
+
+#endif // ANDROID_AUDIO_CAPTURE_SPLITTER_H
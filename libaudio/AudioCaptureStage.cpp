@@ -0,0 +1,150 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "AudioCaptureStage"
+#include <utils/Log.h>
+
+#include <string.h>
+
+#include "AudioCaptureStage.h"
+#include "AudioDsp.h"
+
+namespace android_audio_legacy {
+
+using android::NO_ERROR;
+using android::BAD_VALUE;
+using android::NO_MEMORY;
+
+AudioCaptureStage::AudioCaptureStage() :
+    mStarted(false), mMono(false), mInRate(0), mInChannels(1), mOutRate(0), mOutChannels(1),
+    mBuf(NULL), mCapacity(0), mCount(0), mPeriod(1)
+{
+}
+
+AudioCaptureStage::~AudioCaptureStage()
+{
+    delete[] mBuf;
+}
+
+status_t AudioCaptureStage::reserve(size_t samples)
+{
+    if (samples <= mCapacity) {
+        return NO_ERROR;
+    }
+    int16_t *buf = new int16_t[samples];
+    if (buf == NULL) {
+        return NO_MEMORY;
+    }
+    if (mCount) {
+        memcpy(buf, mBuf, mCount * (mMono ? 1 : mInChannels) * sizeof(int16_t));
+    }
+    delete[] mBuf;
+    mBuf = buf;
+    mCapacity = samples;
+    return NO_ERROR;
+}
+
+status_t AudioCaptureStage::start(int inRate, int inChannels, int outRate, int outChannels,
+                                  int quality, int periodMs)
+{
+    mStarted = false;
+    if (inChannels < 1 || inChannels > 2 || outChannels < 1 || outChannels > 2) {
+        return BAD_VALUE;
+    }
+    if (inRate != outRate) {
+        status_t status = mSrc.init(inRate, outRate, quality);
+        if (status != NO_ERROR) {
+            ALOGE("Failed to initialize sample rate converter %d -> %d.", inRate, outRate);
+            return status;
+        }
+    }
+    mMono = inRate != outRate || inChannels != outChannels;
+    mInRate = inRate;
+    mInChannels = inChannels;
+    mOutRate = outRate;
+    mOutChannels = outChannels;
+    // The driver wants multiples of 8 bytes
+    mPeriod = ((inRate * periodMs / 1000) + 3) & ~3;
+    mCount = 0;
+    mStarted = true;
+    return NO_ERROR;
+}
+
+size_t AudioCaptureStage::convert(int16_t *out, size_t outFrames)
+{
+    size_t inFrames = mCount;
+    if (mInRate != mOutRate) {
+        mSrc.convert(mBuf, &inFrames, out, &outFrames);
+    } else {
+        if (inFrames > outFrames) {
+            inFrames = outFrames;
+        }
+        outFrames = inFrames;
+        memcpy(out, mBuf, inFrames * (mMono ? 1 : mInChannels) * sizeof(int16_t));
+    }
+    if (mMono && mOutChannels == 2) {
+        AudioDsp::upmixMonoToStereo(out, out, outFrames);
+    }
+
+    int channels = mMono ? 1 : mInChannels;
+    mCount -= inFrames;
+    if (mCount) {
+        memmove(mBuf, mBuf + inFrames * channels, mCount * channels * sizeof(int16_t));
+    }
+    return outFrames;
+}
+
+size_t AudioCaptureStage::inputNeeded(size_t outFrames) const
+{
+    if (outFrames == 0) {
+        return 0;
+    }
+    // At least one period: convert() has already taken what was pending.
+    size_t needed = mInRate != mOutRate ? mSrc.inputCountFor(outFrames) : outFrames;
+    needed = needed > mCount ? needed - mCount : 1;
+    return (needed + mPeriod - 1) / mPeriod * mPeriod;
+}
+
+int16_t *AudioCaptureStage::inputBuffer(size_t frames)
+{
+    // Room for the new frames before they are mixed down
+    size_t samples = mCount * (mMono ? 1 : mInChannels) + frames * mInChannels;
+    if (samples > mCapacity) {
+        ALOGD("%s: growing to %u samples", __FUNCTION__, (unsigned)samples);
+        if (reserve(samples) != NO_ERROR) {
+            return NULL;
+        }
+    }
+    return mBuf + mCount * (mMono ? 1 : mInChannels);
+}
+
+size_t AudioCaptureStage::pending() const
+{
+    return mCount + (mInRate != mOutRate ? mSrc.delayCount() : 0);
+}
+
+void AudioCaptureStage::inputDone(size_t frames)
+{
+    if (mMono && mInChannels == 2) {
+        int16_t *in = mBuf + mCount;
+        AudioDsp::downmixStereoToMono(in, in, frames);
+    }
+    mCount += frames;
+}
+
+}; // namespace android_audio_legacy
@@ -0,0 +1,89 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+
+#ifndef ANDROID_AUDIO_CAPTURE_STAGE_H
+#define ANDROID_AUDIO_CAPTURE_STAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <utils/Errors.h>
+
+#include "AudioPolyphaseSrc.h"
+
+namespace android_audio_legacy {
+    using android::status_t;
+
+// Capture conversion from the driver format to the client format, for any client
+// read size.
+//
+// The driver is read in whole periods into a pending buffer, and the conversion takes
+// from it what each read needs; the frames left over and the converter phase carry
+// over to the next read, so that every read returns exactly the frames asked for with
+// no drift. The pending buffer is allocated up front for the usual read size and only
+// grows when a client reads more than it holds.
+//
+// The rate converter is mono: when the rates or the channel counts differ, the driver
+// frames are mixed down to mono as they come in and copied to both channels on the
+// way out for a stereo client. Otherwise the frames are passed through.
+class AudioCaptureStage
+{
+public:
+                        AudioCaptureStage();
+                        ~AudioCaptureStage();
+
+            // Makes room for samples pending driver samples.
+            status_t    reserve(size_t samples);
+
+            // Starts converting from the driver format to the client format, drops the
+            // pending frames. The driver is read in periods of periodMs.
+            status_t    start(int inRate, int inChannels, int outRate, int outChannels,
+                              int quality, int periodMs);
+            void        stop() { mStarted = false; }
+            bool        started() const { return mStarted; }
+            int         inRate() const { return mInRate; }
+            int         inChannels() const { return mInChannels; }
+
+            // Converts pending frames into at most outFrames frames at out, returns
+            // the number produced.
+            size_t      convert(int16_t *out, size_t outFrames);
+            // Driver frames to read, in whole periods, to produce outFrames more frames.
+            size_t      inputNeeded(size_t outFrames) const;
+            // Room for frames more driver frames, NULL if it cannot be allocated.
+            int16_t *   inputBuffer(size_t frames);
+            // frames driver frames were written at inputBuffer().
+            void        inputDone(size_t frames);
+            // Driver frames taken in but not converted yet, the converter delay included.
+            size_t      pending() const;
+
+private:
+            AudioPolyphaseSrc mSrc;
+            bool        mStarted;
+            bool        mMono;          // pending frames are mixed down to mono
+            int         mInRate;
+            int         mInChannels;
+            int         mOutRate;
+            int         mOutChannels;
+            int16_t *   mBuf;           // driver frames not yet converted
+            size_t      mCapacity;      // in samples
+            size_t      mCount;         // in frames
+            size_t      mPeriod;        // driver period, in frames
+};
+
+}; // namespace android_audio_legacy
+
+#endif // ANDROID_AUDIO_CAPTURE_STAGE_H
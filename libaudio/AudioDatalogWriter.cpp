@@ -0,0 +1,369 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "AudioDatalogWriter"
+#include <utils/Log.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <cutils/atomic.h>
+
+#include "AudioDatalogWriter.h"
+
+namespace android_audio_legacy {
+
+using android::NO_ERROR;
+using android::BAD_VALUE;
+using android::NO_MEMORY;
+using android::UNKNOWN_ERROR;
+
+static const char kPrefix[] = "log-0x";
+static const char kSuffix[] = ".ecl";
+
+AudioDatalogWriter::AudioDatalogWriter(const char *dir) :
+    Thread(false),
+    mDir(dir), mNumPoints(0), mRate(0), mDelta(false), mFileLimit(MAX_FILE_BYTES),
+    mFileHead(0), mFileCount(0), mTotalBytes(0), mOutBytes(0),
+    mSamples(0), mEncodedBytes(0), mFilesRemoved(0), mErrors(0), mDropped(0)
+{
+    for (int i = 0; i < MAX_POINTS; i++) {
+        mPoints[i].ring = NULL;
+        mPoints[i].id = 0;
+        mPoints[i].fd = -1;
+        mPoints[i].fileIndex = 0;
+        mPoints[i].fileBytes = 0;
+    }
+}
+
+AudioDatalogWriter::~AudioDatalogWriter()
+{
+    stop();
+}
+
+status_t AudioDatalogWriter::start(int numPoints, int rate, bool delta)
+{
+    if (numPoints <= 0 || numPoints > MAX_POINTS) {
+        return BAD_VALUE;
+    }
+    stop();
+
+    for (int i = 0; i < numPoints; i++) {
+        Point& p = mPoints[i];
+        p.ring = new AudioRingBuffer();
+        if (p.ring == NULL || p.ring->init(RING_BYTES) != NO_ERROR) {
+            ALOGE("%s: cannot allocate the ring of log point %d", __FUNCTION__, i);
+            mNumPoints = i + 1;
+            stop();
+            return NO_MEMORY;
+        }
+        p.id = 0;
+        p.fd = -1;
+        p.fileIndex = 0;
+        p.fileBytes = 0;
+    }
+
+    mkdir(mDir, 00770);
+    removeStale();
+    mNumPoints = numPoints;
+    mRate = rate;
+    mDelta = delta;
+    // Leave room for every point to have an open file and a few closed ones
+    mFileLimit = TOTAL_BYTES / (numPoints * 4);
+    if (mFileLimit < MIN_FILE_BYTES) {
+        mFileLimit = MIN_FILE_BYTES;
+    } else if (mFileLimit > MAX_FILE_BYTES) {
+        mFileLimit = MAX_FILE_BYTES;
+    }
+    mFileHead = 0;
+    mFileCount = 0;
+    mTotalBytes = 0;
+    mOutBytes = 0;
+    mSamples = 0;
+    mEncodedBytes = 0;
+    mFilesRemoved = 0;
+    mErrors = 0;
+    android_atomic_release_store(0, &mDropped);
+
+    ALOGD("%s: %d points at %d Hz to %s, %u byte files%s", __FUNCTION__, numPoints, rate,
+          mDir, (unsigned)mFileLimit, delta ? ", delta encoded" : "");
+    if (run("AudioDatalogWriter", ANDROID_PRIORITY_BACKGROUND) != NO_ERROR) {
+        ALOGE("%s: cannot start the writer", __FUNCTION__);
+        stop();
+        return UNKNOWN_ERROR;
+    }
+    return NO_ERROR;
+}
+
+void AudioDatalogWriter::stop()
+{
+    if (mNumPoints == 0) {
+        return;
+    }
+    requestExit();
+    {
+        Mutex::Autolock lock(mLock);
+        mCond.signal();
+    }
+    requestExitAndWait();
+
+    for (int i = 0; i < mNumPoints; i++) {
+        closeFile(i);
+        delete mPoints[i].ring;
+        mPoints[i].ring = NULL;
+    }
+    ALOGD("%s: %llu samples in %llu bytes, %d frames dropped", __FUNCTION__,
+          mSamples, mEncodedBytes, android_atomic_acquire_load(&mDropped));
+    mNumPoints = 0;
+}
+
+void AudioDatalogWriter::write(int index, uint16_t point, const void *data, size_t bytes)
+{
+    if (index < 0 || index >= mNumPoints) {
+        return;
+    }
+    Point& p = mPoints[index];
+    // The ring write publishes the id along with the data
+    p.id = point;
+    if (p.ring->availableToWrite() < bytes) {
+        android_atomic_inc(&mDropped);
+        return;
+    }
+    p.ring->write(data, bytes);
+}
+
+bool AudioDatalogWriter::threadLoop()
+{
+    // Everything queued before the exit request is written
+    bool exiting = exitPending();
+    for (int i = 0; i < mNumPoints; i++) {
+        drain(i);
+    }
+    if (exiting) {
+        return false;
+    }
+    Mutex::Autolock lock(mLock);
+    mCond.waitRelative(mLock, milliseconds(DRAIN_MS));
+    return true;
+}
+
+void AudioDatalogWriter::drain(int i)
+{
+    Point& p = mPoints[i];
+    int16_t pcm[BLOCK_SAMPLES];
+
+    size_t avail;
+    while ((avail = p.ring->availableToRead()) >= sizeof(int16_t)) {
+        size_t samples = avail / sizeof(int16_t);
+        if (samples > BLOCK_SAMPLES) {
+            samples = BLOCK_SAMPLES;
+        }
+        p.ring->read(pcm, samples * sizeof(int16_t));
+        if (p.fd < 0 && openFile(i) != NO_ERROR) {
+            continue;
+        }
+        if (mOutBytes + BLOCK_BYTES > OUT_BYTES) {
+            flushOut(i);
+        }
+        mOutBytes += encode(pcm, samples, mOut + mOutBytes);
+        mSamples += samples;
+        if (p.fileBytes + mOutBytes >= mFileLimit) {
+            closeFile(i);
+        }
+    }
+    flushOut(i);
+}
+
+void AudioDatalogWriter::flushOut(int i)
+{
+    Point& p = mPoints[i];
+    if (mOutBytes == 0 || p.fd < 0) {
+        mOutBytes = 0;
+        return;
+    }
+    ssize_t ret = ::write(p.fd, mOut, mOutBytes);
+    if (ret != (ssize_t)mOutBytes) {
+        ALOGW("%s: write of %u bytes returned %d: %s", __FUNCTION__, (unsigned)mOutBytes,
+              (int)ret, ret < 0 ? strerror(errno) : "short");
+        mErrors++;
+    }
+    if (ret > 0) {
+        p.fileBytes += ret;
+        mTotalBytes += ret;
+        mEncodedBytes += ret;
+    }
+    mOutBytes = 0;
+}
+
+status_t AudioDatalogWriter::openFile(int i)
+{
+    Point& p = mPoints[i];
+    uint16_t id = (uint16_t)android_atomic_acquire_load(&p.id);
+
+    // An open file may grow up to mFileLimit
+    trim(TOTAL_BYTES - mFileLimit);
+    if (mTotalBytes + mFileLimit > TOTAL_BYTES) {
+        android_atomic_inc(&mDropped);
+        return NO_MEMORY;
+    }
+
+    char name[PATH_MAX];
+    fileName(name, sizeof(name), id, p.fileIndex);
+    p.fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0660);
+    if (p.fd < 0) {
+        ALOGE("%s: cannot open %s: %s", __FUNCTION__, name, strerror(errno));
+        mErrors++;
+        android_atomic_inc(&mDropped);
+        return UNKNOWN_ERROR;
+    }
+
+    uint8_t header[16];
+    uint16_t version = VERSION;
+    uint32_t rate = mRate;
+    uint16_t flags = mDelta ? FLAG_DELTA : 0;
+    memcpy(header, "ECLG", 4);
+    memcpy(header + 4, &version, 2);
+    memcpy(header + 6, &id, 2);
+    memcpy(header + 8, &rate, 4);
+    memcpy(header + 12, &flags, 2);
+    memset(header + 14, 0, 2);
+    memcpy(mOut + mOutBytes, header, sizeof(header));
+    mOutBytes += sizeof(header);
+    ALOGV("%s: %s", __FUNCTION__, name);
+    return NO_ERROR;
+}
+
+void AudioDatalogWriter::closeFile(int i)
+{
+    Point& p = mPoints[i];
+    if (p.fd < 0) {
+        return;
+    }
+    flushOut(i);
+    ::close(p.fd);
+    p.fd = -1;
+
+    if (mFileCount == MAX_FILES) {
+        removeOldest();
+    }
+    File& f = mFiles[(mFileHead + mFileCount) % MAX_FILES];
+    f.id = (uint16_t)p.id;
+    f.index = p.fileIndex;
+    f.bytes = p.fileBytes;
+    mFileCount++;
+    p.fileIndex++;
+    p.fileBytes = 0;
+}
+
+void AudioDatalogWriter::trim(size_t limit)
+{
+    while (mTotalBytes > limit && mFileCount > 0) {
+        removeOldest();
+    }
+}
+
+void AudioDatalogWriter::removeOldest()
+{
+    File& f = mFiles[mFileHead];
+    char name[PATH_MAX];
+    fileName(name, sizeof(name), f.id, f.index);
+    if (unlink(name) != 0) {
+        ALOGW("%s: cannot remove %s: %s", __FUNCTION__, name, strerror(errno));
+    }
+    mTotalBytes -= f.bytes;
+    mFileHead = (mFileHead + 1) % MAX_FILES;
+    mFileCount--;
+    mFilesRemoved++;
+}
+
+// The logs of a session replace the logs of the previous one.
+void AudioDatalogWriter::removeStale()
+{
+    DIR *dir = opendir(mDir);
+    if (dir == NULL) {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        size_t len = strlen(entry->d_name);
+        if (len > sizeof(kSuffix) - 1 &&
+                !strncmp(entry->d_name, kPrefix, sizeof(kPrefix) - 1) &&
+                !strcmp(entry->d_name + len - (sizeof(kSuffix) - 1), kSuffix)) {
+            char name[PATH_MAX];
+            snprintf(name, sizeof(name), "%s/%s", mDir, entry->d_name);
+            unlink(name);
+        }
+    }
+    closedir(dir);
+}
+
+void AudioDatalogWriter::fileName(char *name, size_t size, uint16_t id, uint32_t index)
+{
+    snprintf(name, size, "%s/%s%04X-%03u%s", mDir, kPrefix, id, index, kSuffix);
+}
+
+// Blocks are delta encoded when the differences of all their samples fit in 8 bits,
+// which is most blocks of the low level and low pass signals logged by EC/NS.
+size_t AudioDatalogWriter::encode(const int16_t *in, size_t samples, uint8_t *out)
+{
+    bool delta = mDelta && samples > 1;
+    for (size_t i = 1; delta && i < samples; i++) {
+        int32_t d = (int32_t)in[i] - in[i - 1];
+        if (d < -128 || d > 127) {
+            delta = false;
+        }
+    }
+
+    uint16_t count = samples;
+    memcpy(out, &count, 2);
+    out[2] = delta ? ENCODING_DELTA : ENCODING_PCM;
+    out[3] = 0;
+    if (!delta) {
+        memcpy(out + 4, in, samples * sizeof(int16_t));
+        return 4 + samples * sizeof(int16_t);
+    }
+    memcpy(out + 4, in, sizeof(int16_t));
+    for (size_t i = 1; i < samples; i++) {
+        out[5 + i] = (uint8_t)(int8_t)(in[i] - in[i - 1]);
+    }
+    return 4 + sizeof(int16_t) + samples - 1;
+}
+
+void AudioDatalogWriter::dump(String8& result)
+{
+    const size_t SIZE = 256;
+    char buffer[SIZE];
+
+    if (mNumPoints == 0) {
+        result.append("\tdatalog: stopped\n");
+        return;
+    }
+    snprintf(buffer, SIZE, "\tdatalog: %d points at %d Hz%s, %u byte files\n", mNumPoints,
+             mRate, mDelta ? ", delta encoded" : "", (unsigned)mFileLimit);
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\t  %llu samples in %llu bytes, %u files removed, "
+             "%d frames dropped, %u errors\n", mSamples, mEncodedBytes, mFilesRemoved,
+             android_atomic_acquire_load(&mDropped), mErrors);
+    result.append(buffer);
+}
+
+}; // namespace android_audio_legacy
@@ -0,0 +1,131 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_AUDIO_DATALOG_WRITER_H
+#define ANDROID_AUDIO_DATALOG_WRITER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <utils/threads.h>
+#include <utils/String8.h>
+
+#include "AudioRingBuffer.h"
+
+namespace android_audio_legacy {
+    using android::Mutex;
+    using android::Condition;
+    using android::Thread;
+    using android::String8;
+    using android::status_t;
+
+// Streams 16 bit datalog points, such as the EC/NS internal signals, to files.
+//
+// Each point has a bounded ring filled by the audio thread without blocking and
+// drained by a background priority thread into one file per point. Files are
+// rotated and the oldest ones are removed to keep the session under TOTAL_BYTES.
+// When the writer falls behind, the frames that do not fit are dropped and counted.
+//
+// File layout, in native (little endian) byte order:
+//   header  "ECLG", uint16 version, uint16 log point, uint32 rate, uint16 flags, uint16 0
+//   blocks  uint16 samples, uint8 encoding, uint8 0, then
+//           ENCODING_PCM:   samples int16
+//           ENCODING_DELTA: the first sample as int16, then samples - 1 int8 differences
+class AudioDatalogWriter : public Thread
+{
+public:
+    enum { MAX_POINTS = 15 };
+    enum { VERSION = 1 };
+    enum { FLAG_DELTA = 0x1 };
+    enum { ENCODING_PCM = 0, ENCODING_DELTA = 1 };
+
+                        AudioDatalogWriter(const char *dir);
+    virtual             ~AudioDatalogWriter();
+
+            // Removes the files of the previous session, allocates a ring per point
+            // and starts the writer. delta enables the delta encoded blocks.
+            status_t    start(int numPoints, int rate, bool delta);
+            // Writes what is queued, closes the files and frees the rings.
+            void        stop();
+            bool        started() const { return mNumPoints != 0; }
+            int         numPoints() const { return mNumPoints; }
+
+            // Audio thread side, never blocks: queues a frame of log point index.
+            void        write(int index, uint16_t point, const void *data, size_t bytes);
+
+            void        dump(String8& result);
+
+private:
+    enum { RING_BYTES = 64 * 1024 };            // 2 s per point at 16 kHz
+    enum { BLOCK_SAMPLES = 160 };
+    enum { BLOCK_BYTES = 4 + BLOCK_SAMPLES * 2 };
+    enum { OUT_BYTES = 8 * 1024 };
+    enum { DRAIN_MS = 200 };
+    enum { MIN_FILE_BYTES = 64 * 1024 };
+    enum { MAX_FILE_BYTES = 2 * 1024 * 1024 };
+    enum { TOTAL_BYTES = 16 * 1024 * 1024 };
+    enum { MAX_FILES = 64 };
+
+    struct Point {
+        AudioRingBuffer *ring;
+        volatile int32_t id;        // set by the audio thread before queueing
+            int         fd;
+            uint32_t    fileIndex;
+            size_t      fileBytes;
+    };
+    // Closed files, oldest first
+    struct File {
+            uint16_t    id;
+            uint32_t    index;
+            size_t      bytes;
+    };
+
+    virtual bool        threadLoop();
+            void        drain(int i);
+            status_t    openFile(int i);
+            void        closeFile(int i);
+            void        flushOut(int i);
+            void        trim(size_t limit);
+            void        removeOldest();
+            void        removeStale();
+            void        fileName(char *name, size_t size, uint16_t id, uint32_t index);
+            size_t      encode(const int16_t *in, size_t samples, uint8_t *out);
+
+            const char *mDir;
+            Mutex       mLock;
+            Condition   mCond;
+            Point       mPoints[MAX_POINTS];
+            int         mNumPoints;
+            int         mRate;
+            bool        mDelta;
+            size_t      mFileLimit;     // rotation size, TOTAL_BYTES shared by the points
+            File        mFiles[MAX_FILES];
+            int         mFileHead;
+            int         mFileCount;
+            size_t      mTotalBytes;    // in the closed and the open files
+            uint8_t     mOut[OUT_BYTES];
+            size_t      mOutBytes;
+
+            // statistics
+            uint64_t    mSamples;
+            uint64_t    mEncodedBytes;
+            uint32_t    mFilesRemoved;
+            uint32_t    mErrors;
+    volatile int32_t    mDropped;
+};
+
+}; // namespace android_audio_legacy
+
+#endif // ANDROID_AUDIO_DATALOG_WRITER_H
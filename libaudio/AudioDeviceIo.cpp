@@ -0,0 +1,60 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <sys/ioctl.h>
+
+#include "AudioDeviceIo.h"
+
+namespace android_audio_legacy {
+
+static AudioDeviceIo gKernelDeviceIo;
+
+AudioDeviceIo *AudioDeviceIo::sInstance = &gKernelDeviceIo;
+
+void AudioDeviceIo::setInstance(AudioDeviceIo *io)
+{
+    sInstance = io != NULL ? io : &gKernelDeviceIo;
+}
+
+int AudioDeviceIo::open(const char *path, int flags)
+{
+    return ::open(path, flags);
+}
+
+int AudioDeviceIo::close(int fd)
+{
+    return ::close(fd);
+}
+
+ssize_t AudioDeviceIo::read(int fd, void *buffer, size_t bytes)
+{
+    return ::read(fd, buffer, bytes);
+}
+
+ssize_t AudioDeviceIo::write(int fd, const void *buffer, size_t bytes)
+{
+    return ::write(fd, buffer, bytes);
+}
+
+int AudioDeviceIo::ioctl(int fd, int request, void *arg)
+{
+    return ::ioctl(fd, request, arg);
+}
+
+}; // namespace android_audio_legacy
@@ -0,0 +1,54 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_AUDIO_DEVICE_IO_H
+#define ANDROID_AUDIO_DEVICE_IO_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+namespace android_audio_legacy {
+
+// Access to the CPCAP and Tegra audio driver nodes. All driver I/O of the HAL goes
+// through instance(), which is the kernel drivers unless a simulation was installed
+// with setInstance() (see bench/AudioSimDeviceIo.h). Calls follow the conventions of
+// the system calls they replace: -1 and errno on error.
+class AudioDeviceIo
+{
+public:
+    virtual             ~AudioDeviceIo() {}
+
+    virtual int         open(const char *path, int flags);
+    virtual int         close(int fd);
+    virtual ssize_t     read(int fd, void *buffer, size_t bytes);
+    virtual ssize_t     write(int fd, const void *buffer, size_t bytes);
+    virtual int         ioctl(int fd, int request, void *arg);
+            // ioctls taking no argument or an integer by value
+            int         ioctl(int fd, int request) { return ioctl(fd, request, (void *)0); }
+            int         ioctl(int fd, int request, int arg) {
+                            return ioctl(fd, request, (void *)(intptr_t)arg); }
+
+    static  AudioDeviceIo *instance() { return sInstance; }
+            // Must be called before the HAL is opened; NULL restores the kernel drivers.
+    static  void        setInstance(AudioDeviceIo *io);
+
+private:
+    static  AudioDeviceIo *sInstance;
+};
+
+}; // namespace android_audio_legacy
+
+#endif // ANDROID_AUDIO_DEVICE_IO_H
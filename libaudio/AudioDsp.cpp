@@ -0,0 +1,542 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include "AudioDsp.h"
+
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace android_audio_legacy {
+
+static inline int16_t clamp16(int32_t sample)
+{
+    if ((sample >> 15) ^ (sample >> 31))
+        sample = 0x7FFF ^ (sample >> 31);
+    return sample;
+}
+
+#if defined(__SSE2__) && !defined(__ARM_NEON__)
+// Sign-extend the left (even) and right (odd) samples of 4 interleaved frames to 32 bits.
+static inline __m128i sseLeft(__m128i frames)
+{
+    return _mm_srai_epi32(_mm_slli_epi32(frames, 16), 16);
+}
+static inline __m128i sseRight(__m128i frames)
+{
+    return _mm_srai_epi32(frames, 16);
+}
+#endif
+
+void AudioDsp::downmixStereoToMono(int16_t *out, const int16_t *in, size_t frames)
+{
+    // Forward walk: out[i] is written after in[2i] and in[2i+1] have been read.
+#if defined(__ARM_NEON__)
+    for (; frames >= 8; frames -= 8, in += 16, out += 8) {
+        int16x8x2_t s = vld2q_s16(in);
+        vst1q_s16(out, vaddq_s16(vshrq_n_s16(s.val[0], 1), vshrq_n_s16(s.val[1], 1)));
+    }
+#elif defined(__SSE2__)
+    for (; frames >= 8; frames -= 8, in += 16, out += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i *)in);
+        __m128i b = _mm_loadu_si128((const __m128i *)(in + 8));
+        __m128i ma = _mm_add_epi32(_mm_srai_epi32(sseLeft(a), 1), _mm_srai_epi32(sseRight(a), 1));
+        __m128i mb = _mm_add_epi32(_mm_srai_epi32(sseLeft(b), 1), _mm_srai_epi32(sseRight(b), 1));
+        _mm_storeu_si128((__m128i *)out, _mm_packs_epi32(ma, mb));
+    }
+#endif
+    for (; frames > 0; frames--, in += 2) {
+        *out++ = (in[0] >> 1) + (in[1] >> 1);
+    }
+}
+
+void AudioDsp::upmixMonoToStereo(int16_t *out, const int16_t *in, size_t frames)
+{
+    // Backward walk so that the output may overwrite the input in place:
+    // the tail that does not fill a vector is handled first.
+    size_t i = frames;
+#if defined(__ARM_NEON__) || defined(__SSE2__)
+    for (; i & 7; ) {
+        i--;
+        int16_t s = in[i];
+        out[2*i] = s;
+        out[2*i+1] = s;
+    }
+    while (i > 0) {
+        i -= 8;
+#if defined(__ARM_NEON__)
+        int16x8x2_t s;
+        s.val[0] = vld1q_s16(in + i);
+        s.val[1] = s.val[0];
+        vst2q_s16(out + 2*i, s);
+#else
+        __m128i m = _mm_loadu_si128((const __m128i *)(in + i));
+        __m128i lo = _mm_unpacklo_epi16(m, m);
+        __m128i hi = _mm_unpackhi_epi16(m, m);
+        _mm_storeu_si128((__m128i *)(out + 2*i), lo);
+        _mm_storeu_si128((__m128i *)(out + 2*i + 8), hi);
+#endif
+    }
+#else
+    while (i > 0) {
+        i--;
+        int16_t s = in[i];
+        out[2*i] = s;
+        out[2*i+1] = s;
+    }
+#endif
+}
+
+void AudioDsp::deinterleave(int16_t *left, int16_t *right, const int16_t *in, size_t frames)
+{
+#if defined(__ARM_NEON__)
+    for (; frames >= 8; frames -= 8, in += 16, left += 8, right += 8) {
+        int16x8x2_t s = vld2q_s16(in);
+        vst1q_s16(left, s.val[0]);
+        vst1q_s16(right, s.val[1]);
+    }
+#elif defined(__SSE2__)
+    for (; frames >= 8; frames -= 8, in += 16, left += 8, right += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i *)in);
+        __m128i b = _mm_loadu_si128((const __m128i *)(in + 8));
+        _mm_storeu_si128((__m128i *)left, _mm_packs_epi32(sseLeft(a), sseLeft(b)));
+        _mm_storeu_si128((__m128i *)right, _mm_packs_epi32(sseRight(a), sseRight(b)));
+    }
+#endif
+    for (; frames > 0; frames--, in += 2) {
+        *left++ = in[0];
+        *right++ = in[1];
+    }
+}
+
+void AudioDsp::interleave(int16_t *out, const int16_t *left, const int16_t *right,
+                          size_t frames)
+{
+#if defined(__ARM_NEON__)
+    for (; frames >= 8; frames -= 8, out += 16, left += 8, right += 8) {
+        int16x8x2_t s;
+        s.val[0] = vld1q_s16(left);
+        s.val[1] = vld1q_s16(right);
+        vst2q_s16(out, s);
+    }
+#elif defined(__SSE2__)
+    for (; frames >= 8; frames -= 8, out += 16, left += 8, right += 8) {
+        __m128i l = _mm_loadu_si128((const __m128i *)left);
+        __m128i r = _mm_loadu_si128((const __m128i *)right);
+        _mm_storeu_si128((__m128i *)out, _mm_unpacklo_epi16(l, r));
+        _mm_storeu_si128((__m128i *)(out + 8), _mm_unpackhi_epi16(l, r));
+    }
+#endif
+    for (; frames > 0; frames--, out += 2) {
+        out[0] = *left++;
+        out[1] = *right++;
+    }
+}
+
+void AudioDsp::applyGain(int16_t *out, const int16_t *in, size_t samples, int16_t gain)
+{
+#if defined(__ARM_NEON__)
+    int16x4_t g = vdup_n_s16(gain);
+    for (; samples >= 8; samples -= 8, in += 8, out += 8) {
+        int16x8_t x = vld1q_s16(in);
+        int32x4_t lo = vmull_s16(vget_low_s16(x), g);
+        int32x4_t hi = vmull_s16(vget_high_s16(x), g);
+        vst1q_s16(out, vcombine_s16(vqrshrn_n_s32(lo, 12), vqrshrn_n_s32(hi, 12)));
+    }
+#elif defined(__SSE2__)
+    __m128i g = _mm_set1_epi16(gain);
+    __m128i round = _mm_set1_epi32(1 << 11);
+    for (; samples >= 8; samples -= 8, in += 8, out += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *)in);
+        __m128i mlo = _mm_mullo_epi16(x, g);
+        __m128i mhi = _mm_mulhi_epi16(x, g);
+        __m128i p0 = _mm_srai_epi32(_mm_add_epi32(_mm_unpacklo_epi16(mlo, mhi), round), 12);
+        __m128i p1 = _mm_srai_epi32(_mm_add_epi32(_mm_unpackhi_epi16(mlo, mhi), round), 12);
+        _mm_storeu_si128((__m128i *)out, _mm_packs_epi32(p0, p1));
+    }
+#endif
+    for (; samples > 0; samples--) {
+        *out++ = clamp16(((int32_t)*in++ * gain + (1 << 11)) >> 12);
+    }
+}
+
+void AudioDsp::mixStereo(int16_t *out, const int16_t *in, size_t frames,
+                         int16_t left, int16_t right)
+{
+#if defined(__ARM_NEON__)
+    const int16_t lr[4] = { left, right, left, right };
+    int16x4_t g = vld1_s16(lr);
+    for (; frames >= 4; frames -= 4, in += 8, out += 8) {
+        int16x8_t x = vld1q_s16(in);
+        int32x4_t lo = vmull_s16(vget_low_s16(x), g);
+        int32x4_t hi = vmull_s16(vget_high_s16(x), g);
+        int16x8_t y = vcombine_s16(vqrshrn_n_s32(lo, 12), vqrshrn_n_s32(hi, 12));
+        vst1q_s16(out, vqaddq_s16(vld1q_s16(out), y));
+    }
+#elif defined(__SSE2__)
+    __m128i g = _mm_set_epi16(right, left, right, left, right, left, right, left);
+    __m128i round = _mm_set1_epi32(1 << 11);
+    for (; frames >= 4; frames -= 4, in += 8, out += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *)in);
+        __m128i mlo = _mm_mullo_epi16(x, g);
+        __m128i mhi = _mm_mulhi_epi16(x, g);
+        __m128i p0 = _mm_srai_epi32(_mm_add_epi32(_mm_unpacklo_epi16(mlo, mhi), round), 12);
+        __m128i p1 = _mm_srai_epi32(_mm_add_epi32(_mm_unpackhi_epi16(mlo, mhi), round), 12);
+        __m128i y = _mm_packs_epi32(p0, p1);
+        _mm_storeu_si128((__m128i *)out,
+                         _mm_adds_epi16(_mm_loadu_si128((const __m128i *)out), y));
+    }
+#endif
+    for (; frames > 0; frames--, in += 2, out += 2) {
+        out[0] = clamp16(out[0] + clamp16(((int32_t)in[0] * left + (1 << 11)) >> 12));
+        out[1] = clamp16(out[1] + clamp16(((int32_t)in[1] * right + (1 << 11)) >> 12));
+    }
+}
+
+static inline int32_t clamp32(int64_t sample)
+{
+    if (sample > 0x7FFFFFFFLL)
+        return 0x7FFFFFFF;
+    if (sample < -0x80000000LL)
+        return (int32_t)0x80000000;
+    return (int32_t)sample;
+}
+
+static inline uint32_t xorshift32(uint32_t x)
+{
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
+void AudioDsp::expandToQ31(int32_t *out, const int16_t *in, size_t samples)
+{
+#if defined(__ARM_NEON__)
+    for (; samples >= 8; samples -= 8, in += 8, out += 8) {
+        int16x8_t x = vld1q_s16(in);
+        vst1q_s32(out, vshll_n_s16(vget_low_s16(x), 16));
+        vst1q_s32(out + 4, vshll_n_s16(vget_high_s16(x), 16));
+    }
+#elif defined(__SSE2__)
+    __m128i zero = _mm_setzero_si128();
+    for (; samples >= 8; samples -= 8, in += 8, out += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *)in);
+        _mm_storeu_si128((__m128i *)out, _mm_unpacklo_epi16(zero, x));
+        _mm_storeu_si128((__m128i *)(out + 4), _mm_unpackhi_epi16(zero, x));
+    }
+#endif
+    for (; samples > 0; samples--) {
+        *out++ = (int32_t)*in++ << 16;
+    }
+}
+
+void AudioDsp::q824ToQ31(int32_t *out, const int32_t *in, size_t samples)
+{
+#if defined(__ARM_NEON__)
+    for (; samples >= 4; samples -= 4, in += 4, out += 4) {
+        vst1q_s32(out, vqshlq_n_s32(vld1q_s32(in), 8));
+    }
+#elif defined(__SSE2__)
+    __m128i maxIn = _mm_set1_epi32(0x7FFFFF);
+    __m128i minIn = _mm_set1_epi32(-0x800000);
+    __m128i maxOut = _mm_set1_epi32(0x7FFFFFFF);
+    for (; samples >= 4; samples -= 4, in += 4, out += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i *)in);
+        __m128i over = _mm_cmpgt_epi32(x, maxIn);
+        __m128i under = _mm_cmplt_epi32(x, minIn);
+        __m128i y = _mm_andnot_si128(_mm_or_si128(over, under), _mm_slli_epi32(x, 8));
+        // 0x7FFFFFFF when over, 0x80000000 when under
+        y = _mm_or_si128(y, _mm_and_si128(over, maxOut));
+        y = _mm_or_si128(y, _mm_and_si128(under, _mm_slli_epi32(under, 31)));
+        _mm_storeu_si128((__m128i *)out, y);
+    }
+#endif
+    for (; samples > 0; samples--) {
+        *out++ = clamp32((int64_t)*in++ << 8);
+    }
+}
+
+void AudioDsp::downmixStereoToMonoQ31(int32_t *out, const int32_t *in, size_t frames)
+{
+    // Forward walk: out[i] is written after in[2i] and in[2i+1] have been read.
+#if defined(__ARM_NEON__)
+    for (; frames >= 4; frames -= 4, in += 8, out += 4) {
+        int32x4x2_t s = vld2q_s32(in);
+        vst1q_s32(out, vhaddq_s32(s.val[0], s.val[1]));
+    }
+#elif defined(__SSE2__)
+    __m128i one = _mm_set1_epi32(1);
+    for (; frames >= 4; frames -= 4, in += 8, out += 4) {
+        // LLRR order in each half, then the lefts and the rights together
+        __m128i a = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)in),
+                                      _MM_SHUFFLE(3, 1, 2, 0));
+        __m128i b = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)(in + 4)),
+                                      _MM_SHUFFLE(3, 1, 2, 0));
+        __m128i l = _mm_unpacklo_epi64(a, b);
+        __m128i r = _mm_unpackhi_epi64(a, b);
+        __m128i m = _mm_add_epi32(_mm_srai_epi32(l, 1), _mm_srai_epi32(r, 1));
+        m = _mm_add_epi32(m, _mm_and_si128(_mm_and_si128(l, r), one));
+        _mm_storeu_si128((__m128i *)out, m);
+    }
+#endif
+    for (; frames > 0; frames--, in += 2) {
+        *out++ = (int32_t)(((int64_t)in[0] + in[1]) >> 1);
+    }
+}
+
+void AudioDsp::upmixMonoToStereoQ31(int32_t *out, const int32_t *in, size_t frames)
+{
+    // Backward walk so that the output may overwrite the input in place.
+    size_t i = frames;
+#if defined(__ARM_NEON__) || defined(__SSE2__)
+    for (; i & 3; ) {
+        i--;
+        int32_t s = in[i];
+        out[2*i] = s;
+        out[2*i+1] = s;
+    }
+    while (i > 0) {
+        i -= 4;
+#if defined(__ARM_NEON__)
+        int32x4x2_t s;
+        s.val[0] = vld1q_s32(in + i);
+        s.val[1] = s.val[0];
+        vst2q_s32(out + 2*i, s);
+#else
+        __m128i m = _mm_loadu_si128((const __m128i *)(in + i));
+        _mm_storeu_si128((__m128i *)(out + 2*i), _mm_unpacklo_epi32(m, m));
+        _mm_storeu_si128((__m128i *)(out + 2*i + 4), _mm_unpackhi_epi32(m, m));
+#endif
+    }
+#else
+    while (i > 0) {
+        i--;
+        int32_t s = in[i];
+        out[2*i] = s;
+        out[2*i+1] = s;
+    }
+#endif
+}
+
+void AudioDsp::deinterleaveQ31(int32_t *left, int32_t *right, const int32_t *in,
+                               size_t frames)
+{
+#if defined(__ARM_NEON__)
+    for (; frames >= 4; frames -= 4, in += 8, left += 4, right += 4) {
+        int32x4x2_t s = vld2q_s32(in);
+        vst1q_s32(left, s.val[0]);
+        vst1q_s32(right, s.val[1]);
+    }
+#elif defined(__SSE2__)
+    for (; frames >= 4; frames -= 4, in += 8, left += 4, right += 4) {
+        __m128i a = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)in),
+                                      _MM_SHUFFLE(3, 1, 2, 0));
+        __m128i b = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)(in + 4)),
+                                      _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storeu_si128((__m128i *)left, _mm_unpacklo_epi64(a, b));
+        _mm_storeu_si128((__m128i *)right, _mm_unpackhi_epi64(a, b));
+    }
+#endif
+    for (; frames > 0; frames--, in += 2) {
+        *left++ = in[0];
+        *right++ = in[1];
+    }
+}
+
+void AudioDsp::interleaveQ31(int32_t *out, const int32_t *left, const int32_t *right,
+                             size_t frames)
+{
+#if defined(__ARM_NEON__)
+    for (; frames >= 4; frames -= 4, out += 8, left += 4, right += 4) {
+        int32x4x2_t s;
+        s.val[0] = vld1q_s32(left);
+        s.val[1] = vld1q_s32(right);
+        vst2q_s32(out, s);
+    }
+#elif defined(__SSE2__)
+    for (; frames >= 4; frames -= 4, out += 8, left += 4, right += 4) {
+        __m128i l = _mm_loadu_si128((const __m128i *)left);
+        __m128i r = _mm_loadu_si128((const __m128i *)right);
+        _mm_storeu_si128((__m128i *)out, _mm_unpacklo_epi32(l, r));
+        _mm_storeu_si128((__m128i *)(out + 4), _mm_unpackhi_epi32(l, r));
+    }
+#endif
+    for (; frames > 0; frames--, out += 2) {
+        out[0] = *left++;
+        out[1] = *right++;
+    }
+}
+
+void AudioDsp::mixStereoQ31(int32_t *out, const int32_t *in, size_t frames,
+                            int16_t left, int16_t right)
+{
+#if defined(__ARM_NEON__)
+    const int32_t lr[2] = { left, right };
+    int32x2_t g = vld1_s32(lr);
+    for (; frames >= 2; frames -= 2, in += 4, out += 4) {
+        int32x4_t x = vld1q_s32(in);
+        int64x2_t lo = vmull_s32(vget_low_s32(x), g);
+        int64x2_t hi = vmull_s32(vget_high_s32(x), g);
+        int32x4_t y = vcombine_s32(vqrshrn_n_s64(lo, 12), vqrshrn_n_s64(hi, 12));
+        vst1q_s32(out, vqaddq_s32(vld1q_s32(out), y));
+    }
+#endif
+    for (; frames > 0; frames--, in += 2, out += 2) {
+        out[0] = clamp32((int64_t)out[0] +
+                         clamp32(((int64_t)in[0] * left + (1 << 11)) >> 12));
+        out[1] = clamp32((int64_t)out[1] +
+                         clamp32(((int64_t)in[1] * right + (1 << 11)) >> 12));
+    }
+}
+
+void AudioDsp::accumulateLevels(Levels *levels, const int16_t *in, size_t samples)
+{
+    int32_t peak = levels->peak;
+    uint64_t energy = 0;
+    uint32_t clips = 0;
+    levels->samples += samples;
+#if defined(__ARM_NEON__)
+    if (samples >= 8) {
+        int16x8_t vpeak = vdupq_n_s16(0);
+        int64x2_t venergy = vdupq_n_s64(0);
+        uint32x4_t vclips = vdupq_n_u32(0);
+        int16x8_t full = vdupq_n_s16(32767);
+        for (; samples >= 8; samples -= 8, in += 8) {
+            int16x8_t x = vld1q_s16(in);
+            int16x8_t a = vqabsq_s16(x);
+            vpeak = vmaxq_s16(vpeak, a);
+            vclips = vpadalq_u16(vclips, vshrq_n_u16(vceqq_s16(a, full), 15));
+            venergy = vpadalq_s32(venergy, vmull_s16(vget_low_s16(x), vget_low_s16(x)));
+            venergy = vpadalq_s32(venergy, vmull_s16(vget_high_s16(x), vget_high_s16(x)));
+        }
+        int16_t p[8];
+        uint32_t c[4];
+        vst1q_s16(p, vpeak);
+        vst1q_u32(c, vclips);
+        for (int i = 0; i < 8; i++) {
+            if (p[i] > peak) peak = p[i];
+        }
+        clips = c[0] + c[1] + c[2] + c[3];
+        energy = (uint64_t)(vgetq_lane_s64(venergy, 0) + vgetq_lane_s64(venergy, 1));
+    }
+#elif defined(__SSE2__)
+    if (samples >= 8) {
+        __m128i zero = _mm_setzero_si128();
+        __m128i one = _mm_set1_epi16(1);
+        __m128i full = _mm_set1_epi16(32767);
+        __m128i vpeak = zero;
+        __m128i venergy = zero;     // 2 x 64 bits
+        __m128i vclips = zero;      // 4 x 32 bits
+        for (; samples >= 8; samples -= 8, in += 8) {
+            __m128i x = _mm_loadu_si128((const __m128i *)in);
+            __m128i a = _mm_max_epi16(x, _mm_subs_epi16(zero, x));
+            vpeak = _mm_max_epi16(vpeak, a);
+            vclips = _mm_add_epi32(vclips,
+                    _mm_madd_epi16(_mm_and_si128(_mm_cmpeq_epi16(a, full), one), one));
+            // A pair of squares is at most 2^31: unsigned, zero extended to 64 bits
+            __m128i sq = _mm_madd_epi16(x, x);
+            venergy = _mm_add_epi64(venergy, _mm_unpacklo_epi32(sq, zero));
+            venergy = _mm_add_epi64(venergy, _mm_unpackhi_epi32(sq, zero));
+        }
+        int16_t p[8];
+        uint32_t c[4];
+        uint64_t e[2];
+        _mm_storeu_si128((__m128i *)p, vpeak);
+        _mm_storeu_si128((__m128i *)c, vclips);
+        _mm_storeu_si128((__m128i *)e, venergy);
+        for (int i = 0; i < 8; i++) {
+            if (p[i] > peak) peak = p[i];
+        }
+        clips = c[0] + c[1] + c[2] + c[3];
+        energy = e[0] + e[1];
+    }
+#endif
+    for (; samples > 0; samples--) {
+        int32_t x = *in++;
+        int32_t a = x < 0 ? -x : x;
+        if (a > 32767) a = 32767;
+        if (a > peak) peak = a;
+        if (a == 32767) clips++;
+        energy += (uint32_t)(x * x);
+    }
+    levels->peak = peak;
+    levels->energy += energy;
+    levels->clips += clips;
+}
+
+// The sum is split at bit 16 so that it cannot overflow: the high half is shifted
+// down exactly, the low half plus dither and rounding gives a carry of -1 to 2.
+void AudioDsp::ditherToPcm16(int16_t *out, const int32_t *in, size_t samples,
+                             uint32_t *state)
+{
+#if defined(__ARM_NEON__)
+    uint32x4_t x = vld1q_u32(state);
+    uint32x4_t mask = vdupq_n_u32(0xFFFF);
+    int32x4_t round = vdupq_n_s32(0x8000);
+    for (; samples >= 4; samples -= 4, in += 4, out += 4) {
+        x = veorq_u32(x, vshlq_n_u32(x, 13));
+        x = veorq_u32(x, vshrq_n_u32(x, 17));
+        x = veorq_u32(x, vshlq_n_u32(x, 5));
+        int32x4_t d = vsubq_s32(vreinterpretq_s32_u32(vandq_u32(x, mask)),
+                                vreinterpretq_s32_u32(vshrq_n_u32(x, 16)));
+        int32x4_t s = vld1q_s32(in);
+        int32x4_t lo = vreinterpretq_s32_u32(vandq_u32(vreinterpretq_u32_s32(s), mask));
+        int32x4_t carry = vshrq_n_s32(vaddq_s32(vaddq_s32(lo, d), round), 16);
+        vst1_s16(out, vqmovn_s32(vaddq_s32(vshrq_n_s32(s, 16), carry)));
+    }
+    vst1q_u32(state, x);
+#elif defined(__SSE2__)
+    __m128i x = _mm_loadu_si128((const __m128i *)state);
+    __m128i mask = _mm_set1_epi32(0xFFFF);
+    __m128i round = _mm_set1_epi32(0x8000);
+    for (; samples >= 4; samples -= 4, in += 4, out += 4) {
+        x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+        x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+        x = _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+        __m128i d = _mm_sub_epi32(_mm_and_si128(x, mask), _mm_srli_epi32(x, 16));
+        __m128i s = _mm_loadu_si128((const __m128i *)in);
+        __m128i lo = _mm_and_si128(s, mask);
+        __m128i carry = _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(lo, d), round), 16);
+        __m128i y = _mm_add_epi32(_mm_srai_epi32(s, 16), carry);
+        _mm_storel_epi64((__m128i *)out, _mm_packs_epi32(y, y));
+    }
+    _mm_storeu_si128((__m128i *)state, x);
+#endif
+    // Whole vectors have been done: the next sample is again on lane 0.
+    for (size_t i = 0; i < samples; i++) {
+        uint32_t r = xorshift32(state[i & (DITHER_LANES - 1)]);
+        state[i & (DITHER_LANES - 1)] = r;
+        int32_t d = (int32_t)(r & 0xFFFF) - (int32_t)(r >> 16);
+        int32_t s = in[i];
+        out[i] = clamp16((s >> 16) + (((s & 0xFFFF) + d + 0x8000) >> 16));
+    }
+}
+
+const char *AudioDsp::implementation()
+{
+#if defined(__ARM_NEON__)
+    return "neon";
+#elif defined(__SSE2__)
+    return "sse2";
+#else
+    return "c";
+#endif
+}
+
+}; // namespace android_audio_legacy
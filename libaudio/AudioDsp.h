@@ -0,0 +1,98 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_AUDIO_DSP_H
+#define ANDROID_AUDIO_DSP_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+namespace android_audio_legacy {
+
+// Channel conversion and gain kernels used on the HAL write and EC/NS paths.
+// Kernels work on native-endian 16-bit PCM, or on Q31 samples for the *Q31 ones.
+// A NEON version is used on ARM, an SSE2 version on x86 hosts and a portable C
+// version everywhere else; all three produce bit-identical results.
+class AudioDsp
+{
+public:
+    // Unity gain for applyGain(), gains are Q3.12
+    enum { UNITY_GAIN = 1 << 12 };
+
+    // Running level of a signal, see accumulateLevels().
+    struct Levels {
+        uint64_t energy;        // sum of the squared samples
+        uint32_t samples;
+        uint32_t clips;         // samples at full scale
+        int32_t  peak;          // largest magnitude, 32768 counts as 32767
+    };
+
+    // mono[i] = (stereo[2i] >> 1) + (stereo[2i+1] >> 1). out may alias in.
+    static void downmixStereoToMono(int16_t *out, const int16_t *in, size_t frames);
+    // stereo[2i] = stereo[2i+1] = mono[i]. out may alias in.
+    static void upmixMonoToStereo(int16_t *out, const int16_t *in, size_t frames);
+    // Split an interleaved stereo buffer into two planar buffers.
+    static void deinterleave(int16_t *left, int16_t *right, const int16_t *in, size_t frames);
+    // Merge two planar buffers into an interleaved stereo buffer.
+    static void interleave(int16_t *out, const int16_t *left, const int16_t *right,
+                           size_t frames);
+    // out[i] = sat16(round(in[i] * gain / UNITY_GAIN)). out may alias in.
+    static void applyGain(int16_t *out, const int16_t *in, size_t samples, int16_t gain);
+    // Stereo accumulate: out[2i] = sat16(out[2i] + sat16(round(in[2i] * left / UNITY_GAIN))),
+    // and the same with right for out[2i+1].
+    static void mixStereo(int16_t *out, const int16_t *in, size_t frames,
+                          int16_t left, int16_t right);
+    // Adds the samples to levels: peak = max(peak, min(|in[i]|, 32767)), energy += in[i]^2,
+    // clips counts the samples of magnitude 32767 or more. Nothing is written to in.
+    static void accumulateLevels(Levels *levels, const int16_t *in, size_t samples);
+
+    // Q31 kernels, for the stages that must not lose precision before the final
+    // conversion to 16 bits. Full scale is 1 << 31. SSE2 has no 32-bit signed
+    // multiply, so the x86 build uses the C version of mixStereoQ31().
+
+    // Number of dither generators, see ditherToPcm16().
+    enum { DITHER_LANES = 4 };
+
+    // out[i] = in[i] << 16.
+    static void expandToQ31(int32_t *out, const int16_t *in, size_t samples);
+    // out[i] = sat32(in[i] << 8), from 8.24 fixed point. out may alias in.
+    static void q824ToQ31(int32_t *out, const int32_t *in, size_t samples);
+    // mono[i] = floor((stereo[2i] + stereo[2i+1]) / 2). out may alias in.
+    static void downmixStereoToMonoQ31(int32_t *out, const int32_t *in, size_t frames);
+    // stereo[2i] = stereo[2i+1] = mono[i]. out may alias in.
+    static void upmixMonoToStereoQ31(int32_t *out, const int32_t *in, size_t frames);
+    static void deinterleaveQ31(int32_t *left, int32_t *right, const int32_t *in,
+                                size_t frames);
+    static void interleaveQ31(int32_t *out, const int32_t *left, const int32_t *right,
+                              size_t frames);
+    // Stereo accumulate: out[2i] = sat32(out[2i] + sat32(round(in[2i] * left / UNITY_GAIN))),
+    // and the same with right for out[2i+1].
+    static void mixStereoQ31(int32_t *out, const int32_t *in, size_t frames,
+                             int16_t left, int16_t right);
+    // Conversion to 16 bits with TPDF dither of +/- 1 LSB:
+    // out[i] = sat16(floor((in[i] + d + 0x8000) / 0x10000)), where d is the difference of
+    // the two 16-bit halves of the next xorshift32 value of generator i % DITHER_LANES.
+    // state holds the DITHER_LANES generators, which must not be 0.
+    static void ditherToPcm16(int16_t *out, const int32_t *in, size_t samples,
+                              uint32_t *state);
+
+    // Name of the implementation compiled in ("neon", "sse2" or "c").
+    static const char *implementation();
+};
+
+}; // namespace android_audio_legacy
+
+#endif // ANDROID_AUDIO_DSP_H
@@ -0,0 +1,287 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "AudioEqualizer"
+#include <utils/Log.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "AudioEqualizer.h"
+
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+namespace android_audio_legacy {
+
+enum {
+    BAND_HIGHPASS = 0,
+    BAND_LOWSHELF,
+    BAND_PEAKING,
+    BAND_HIGHSHELF
+};
+
+// The bands of each preset. The preset gain keeps the largest boost below full scale.
+static const struct {
+    const char *name;
+    double      gainDb;
+    int         numBands;
+    struct {
+        int     type;
+        double  freq;
+        double  gainDb;         // unused by the high pass
+        double  q;
+    } bands[AudioEqualizer::MAX_BIQUADS];
+} kPresets[AudioEqualizer::PRESET_NUM] = {
+    { "none", 0.0, 0, {} },
+    // The speakers roll off below 250 Hz: cut what they cannot play, lift what is
+    // just above, and bring the presence region forward.
+    { "speaker", -6.0, 4, {
+        { BAND_HIGHPASS,   180.0,  0.0, 0.707 },
+        { BAND_LOWSHELF,   320.0,  6.0, 0.707 },
+        { BAND_PEAKING,   1000.0, -3.0, 1.0 },
+        { BAND_HIGHSHELF, 6000.0,  4.0, 0.707 } } },
+    { "headset", -3.0, 2, {
+        { BAND_LOWSHELF,   100.0,  3.0, 0.707 },
+        { BAND_HIGHSHELF, 10000.0, 2.0, 0.707 } } },
+    { "dock", -4.0, 3, {
+        { BAND_HIGHPASS,    60.0,  0.0, 0.707 },
+        { BAND_LOWSHELF,   120.0,  4.0, 0.707 },
+        { BAND_PEAKING,   3000.0, -2.0, 1.4 } } },
+    { "spdif", 0.0, 1, {
+        { BAND_HIGHPASS,    10.0,  0.0, 0.707 } } },
+};
+
+static inline int32_t clamp32(int64_t sample)
+{
+    if (sample > 0x7FFFFFFFLL)
+        return 0x7FFFFFFF;
+    if (sample < -0x80000000LL)
+        return -0x7FFFFFFF - 1;
+    return (int32_t)sample;
+}
+
+static int32_t toQ30(double coef)
+{
+    return clamp32((int64_t)floor(coef * (1 << 30) + 0.5));
+}
+
+AudioEqualizer::AudioEqualizer() :
+    mPreset(PRESET_NONE), mSampleRate(44100), mNumBiquads(0)
+{
+    memset(mState, 0, sizeof(mState));
+}
+
+const char *AudioEqualizer::presetName(int preset)
+{
+    if (preset < 0 || preset >= PRESET_NUM) {
+        return "invalid";
+    }
+    return kPresets[preset].name;
+}
+
+void AudioEqualizer::setPreset(int preset)
+{
+    if (preset < 0 || preset >= PRESET_NUM) {
+        preset = PRESET_NONE;
+    }
+    if (preset != mPreset) {
+        ALOGV("%s: %s -> %s", __FUNCTION__, presetName(mPreset), presetName(preset));
+        mPreset = preset;
+        design();
+    }
+}
+
+void AudioEqualizer::setSampleRate(int rate)
+{
+    if (rate > 0 && rate != mSampleRate) {
+        mSampleRate = rate;
+        design();
+    }
+}
+
+// Biquads of the Audio EQ Cookbook (R. Bristow-Johnson)
+void AudioEqualizer::design()
+{
+    mNumBiquads = 0;
+    memset(mState, 0, sizeof(mState));
+
+    double gain = pow(10.0, kPresets[mPreset].gainDb / 20.0);
+    for (int i = 0; i < kPresets[mPreset].numBands; i++) {
+        int type = kPresets[mPreset].bands[i].type;
+        double freq = kPresets[mPreset].bands[i].freq;
+        if (freq >= mSampleRate * 0.45) {
+            ALOGW("%s: %s band at %d Hz skipped at %d Hz", __FUNCTION__,
+                  presetName(mPreset), (int)freq, mSampleRate);
+            continue;
+        }
+        double A = pow(10.0, kPresets[mPreset].bands[i].gainDb / 40.0);
+        double w0 = 2.0 * M_PI * freq / mSampleRate;
+        double cosw = cos(w0);
+        double alpha = sin(w0) / (2.0 * kPresets[mPreset].bands[i].q);
+        double sq = 2.0 * sqrt(A) * alpha;
+        double b0, b1, b2, a0, a1, a2;
+        switch (type) {
+        case BAND_HIGHPASS:
+            b0 = (1.0 + cosw) / 2.0;
+            b1 = -(1.0 + cosw);
+            b2 = (1.0 + cosw) / 2.0;
+            a0 = 1.0 + alpha;
+            a1 = -2.0 * cosw;
+            a2 = 1.0 - alpha;
+            break;
+        case BAND_LOWSHELF:
+            b0 = A * ((A + 1.0) - (A - 1.0) * cosw + sq);
+            b1 = 2.0 * A * ((A - 1.0) - (A + 1.0) * cosw);
+            b2 = A * ((A + 1.0) - (A - 1.0) * cosw - sq);
+            a0 = (A + 1.0) + (A - 1.0) * cosw + sq;
+            a1 = -2.0 * ((A - 1.0) + (A + 1.0) * cosw);
+            a2 = (A + 1.0) + (A - 1.0) * cosw - sq;
+            break;
+        case BAND_PEAKING:
+            b0 = 1.0 + alpha * A;
+            b1 = -2.0 * cosw;
+            b2 = 1.0 - alpha * A;
+            a0 = 1.0 + alpha / A;
+            a1 = -2.0 * cosw;
+            a2 = 1.0 - alpha / A;
+            break;
+        case BAND_HIGHSHELF:
+        default:
+            b0 = A * ((A + 1.0) + (A - 1.0) * cosw + sq);
+            b1 = -2.0 * A * ((A - 1.0) + (A + 1.0) * cosw);
+            b2 = A * ((A + 1.0) + (A - 1.0) * cosw - sq);
+            a0 = (A + 1.0) - (A - 1.0) * cosw + sq;
+            a1 = 2.0 * ((A - 1.0) - (A + 1.0) * cosw);
+            a2 = (A + 1.0) - (A - 1.0) * cosw - sq;
+            break;
+        }
+        // The preset gain goes into the first biquad, before any boost
+        double g = mNumBiquads == 0 ? gain : 1.0;
+        Biquad& q = mBiquads[mNumBiquads++];
+        q.b0 = toQ30(g * b0 / a0);
+        q.b1 = toQ30(g * b1 / a0);
+        q.b2 = toQ30(g * b2 / a0);
+        q.a1 = toQ30(a1 / a0);
+        q.a2 = toQ30(a2 / a0);
+    }
+    ALOGV("%s: %s, %d biquads at %d Hz", __FUNCTION__, presetName(mPreset), mNumBiquads,
+          mSampleRate);
+}
+
+// With the samples HEADROOM_BITS down, a product is below 2^58 and the five terms
+// cannot overflow the accumulator.
+void AudioEqualizer::runBiquad(const Biquad& q, State *s, int32_t *frames, size_t count)
+{
+#if defined(__ARM_NEON__)
+    // Left and right in the two lanes
+    int32x2_t b0 = vdup_n_s32(q.b0);
+    int32x2_t b1 = vdup_n_s32(q.b1);
+    int32x2_t b2 = vdup_n_s32(q.b2);
+    int32x2_t a1 = vdup_n_s32(q.a1);
+    int32x2_t a2 = vdup_n_s32(q.a2);
+    int32x2_t x1 = vld1_s32(s->x1);
+    int32x2_t x2 = vld1_s32(s->x2);
+    int32x2_t y1 = vld1_s32(s->y1);
+    int32x2_t y2 = vld1_s32(s->y2);
+    for (; count > 0; count--, frames += 2) {
+        int32x2_t x = vld1_s32(frames);
+        int64x2_t acc = vmull_s32(x, b0);
+        acc = vmlal_s32(acc, x1, b1);
+        acc = vmlal_s32(acc, x2, b2);
+        acc = vmlsl_s32(acc, y1, a1);
+        acc = vmlsl_s32(acc, y2, a2);
+        int32x2_t y = vqrshrn_n_s64(acc, 30);
+        x2 = x1;
+        x1 = x;
+        y2 = y1;
+        y1 = y;
+        vst1_s32(frames, y);
+    }
+    vst1_s32(s->x1, x1);
+    vst1_s32(s->x2, x2);
+    vst1_s32(s->y1, y1);
+    vst1_s32(s->y2, y2);
+#else
+    for (int c = 0; c < 2; c++) {
+        int32_t x1 = s->x1[c], x2 = s->x2[c], y1 = s->y1[c], y2 = s->y2[c];
+        int32_t *p = frames + c;
+        for (size_t i = 0; i < count; i++, p += 2) {
+            int32_t x = *p;
+            int64_t acc = (int64_t)x * q.b0 + (int64_t)x1 * q.b1 + (int64_t)x2 * q.b2 -
+                          (int64_t)y1 * q.a1 - (int64_t)y2 * q.a2;
+            int32_t y = clamp32((acc + (1 << 29)) >> 30);
+            x2 = x1;
+            x1 = x;
+            y2 = y1;
+            y1 = y;
+            *p = y;
+        }
+        s->x1[c] = x1;
+        s->x2[c] = x2;
+        s->y1[c] = y1;
+        s->y2[c] = y2;
+    }
+#endif
+}
+
+// Block processing: each biquad runs over the whole buffer with its coefficients and
+// history in registers.
+void AudioEqualizer::process(int32_t *frames, size_t count)
+{
+    if (mNumBiquads == 0) {
+        return;
+    }
+    size_t samples = count * 2;
+    size_t i = 0;
+#if defined(__ARM_NEON__)
+    for (; i + 4 <= samples; i += 4) {
+        vst1q_s32(frames + i, vshrq_n_s32(vld1q_s32(frames + i), HEADROOM_BITS));
+    }
+#endif
+    for (; i < samples; i++) {
+        frames[i] >>= HEADROOM_BITS;
+    }
+
+    for (int b = 0; b < mNumBiquads; b++) {
+        runBiquad(mBiquads[b], &mState[b], frames, count);
+    }
+
+    i = 0;
+#if defined(__ARM_NEON__)
+    for (; i + 4 <= samples; i += 4) {
+        vst1q_s32(frames + i, vqshlq_n_s32(vld1q_s32(frames + i), HEADROOM_BITS));
+    }
+#endif
+    for (; i < samples; i++) {
+        frames[i] = clamp32((int64_t)frames[i] << HEADROOM_BITS);
+    }
+}
+
+void AudioEqualizer::dump(String8& result) const
+{
+    const size_t SIZE = 256;
+    char buffer[SIZE];
+
+    snprintf(buffer, SIZE, "\tequalizer: %s, %d biquads at %d Hz\n", presetName(mPreset),
+             mNumBiquads, mSampleRate);
+    result.append(buffer);
+}
+
+}; // namespace android_audio_legacy
@@ -0,0 +1,85 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_AUDIO_EQUALIZER_H
+#define ANDROID_AUDIO_EQUALIZER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <utils/String8.h>
+
+namespace android_audio_legacy {
+    using android::String8;
+
+// Device equalizer of the output path: a cascade of biquads designed for the
+// accessory, for the builds without the proprietary multimedia processing.
+//
+// Processes interleaved stereo Q31 in place. The samples run through the cascade
+// HEADROOM_BITS below full scale, so that the boosts of the bands do not clip before
+// the preset gain; the coefficients are Q2.30 and each biquad accumulates in 64 bits.
+// The NEON and C versions give identical results. Not thread safe: the owner
+// serializes setPreset() and setSampleRate() with process().
+class AudioEqualizer
+{
+public:
+    enum {
+        PRESET_NONE = 0,    // flat, process() does nothing
+        PRESET_SPEAKER,     // loudness contour for the built-in speakers
+        PRESET_HEADSET,
+        PRESET_DOCK,        // analog dock line out
+        PRESET_SPDIF,       // HDMI: subsonic filter only
+        PRESET_NUM
+    };
+    enum { MAX_BIQUADS = 5 };
+    enum { HEADROOM_BITS = 4 };
+
+                        AudioEqualizer();
+
+            // Both redesign the filters and clear their history when they change.
+            void        setPreset(int preset);
+            void        setSampleRate(int rate);
+            int         preset() const { return mPreset; }
+            bool        enabled() const { return mNumBiquads != 0; }
+
+            void        process(int32_t *frames, size_t count);
+
+            static const char *presetName(int preset);
+            void        dump(String8& result) const;
+
+private:
+            // y = b0 x + b1 x[-1] + b2 x[-2] - a1 y[-1] - a2 y[-2], Q2.30
+            struct Biquad {
+                int32_t b0, b1, b2, a1, a2;
+            };
+            // per channel history, left then right
+            struct State {
+                int32_t x1[2], x2[2], y1[2], y2[2];
+            };
+
+            void        design();
+            static void runBiquad(const Biquad& q, State *s, int32_t *frames, size_t count);
+
+            int         mPreset;
+            int         mSampleRate;
+            int         mNumBiquads;
+            Biquad      mBiquads[MAX_BIQUADS];
+            State       mState[MAX_BIQUADS];
+};
+
+}; // namespace android_audio_legacy
+
+#endif // ANDROID_AUDIO_EQUALIZER_H
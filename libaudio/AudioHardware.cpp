@@ -23,6 +23,7 @@
 
 #include <stdio.h>
 #include <unistd.h>
+#include <time.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -30,10 +31,15 @@
 #include <fcntl.h>
 
 #include "AudioHardware.h"
+#include "AudioDsp.h"
+#include "AudioDeviceIo.h"
 #include <audio_effects/effect_aec.h>
 #include <audio_effects/effect_ns.h>
 
 namespace android_audio_legacy {
+
+// Driver access, see AudioDeviceIo.h
+static inline AudioDeviceIo *devIo() { return AudioDeviceIo::instance(); }
 const uint32_t AudioHardware::inputSamplingRates[] = {
     8000, 11025, 12000, 16000, 22050, 32000, 44100, 48000
 };
@@ -41,11 +47,34 @@ const uint32_t AudioHardware::inputSamplingRates[] = {
 // number of times to attempt init() before giving up
 const uint32_t MAX_INIT_TRIES = 10;
 
-// When another thread wants to acquire the Mutex on the input or output stream, a short sleep
-// period is forced in the read or write function to release the processor before acquiring the
-// Mutex. Otherwise, as the read/write thread sleeps most of the time waiting for DMA buffers with
-// the Mutex locked, the other thread could wait quite long before being able to acquire the Mutex.
-#define FORCED_SLEEP_TIME_US  10000
+// The read/write thread sleeps most of the time waiting for DMA buffers with the stream lock
+// held, and takes it again as soon as it releases it between two buffers. The stream lock is
+// a FIFO AudioStreamLock so that another thread asking for it, doRouting_l() in particular,
+// gets it at the next buffer boundary.
+
+#ifndef USE_PROPRIETARY_AUDIO_EXTENSIONS
+// Device EQ preset for the outputs the multimedia processing would have tuned
+static int eqPresetFor(uint32_t outDevice, bool bluetooth, bool spdif)
+{
+    if (bluetooth) {
+        return AudioEqualizer::PRESET_NONE;
+    }
+    if (spdif) {
+        return AudioEqualizer::PRESET_SPDIF;
+    }
+    switch (outDevice) {
+    case CPCAP_AUDIO_OUT_SPEAKER:
+    case CPCAP_AUDIO_OUT_HEADSET_AND_SPEAKER:
+        return AudioEqualizer::PRESET_SPEAKER;
+    case CPCAP_AUDIO_OUT_HEADSET:
+        return AudioEqualizer::PRESET_HEADSET;
+    case CPCAP_AUDIO_OUT_ANLG_DOCK_HEADSET:
+        return AudioEqualizer::PRESET_DOCK;
+    default:
+        return AudioEqualizer::PRESET_NONE;
+    }
+}
+#endif
 
 // ----------------------------------------------------------------------------
 
@@ -54,10 +83,16 @@ AudioHardware::AudioHardware() :
     mInit(false), mMicMute(false), mBluetoothNrec(true), mBluetoothId(0),
     mOutput(0), /*mCurOut/InDevice*/ mCpcapCtlFd(-1), mHwOutRate(0), mHwInRate(0),
     mMasterVol(1.0), mVoiceVol(1.0),
-    /*mCpcapGain*/
-    mSpkrVolume(-1), mMicVolume(-1), mEcnsEnabled(0), mEcnsRequested(0), mBtScoOn(false)
+    mSpkrVolume(-1), mMicVolume(-1), mEcnsEnabled(0), mEcnsRequested(0)
 {
     ALOGV("AudioHardware constructor");
+    mCaptureSplitter = new AudioCaptureSplitter();
+    mTuning = new AudioTuningStore(AUDIO_TUNING_DIR);
+    mMixer = new AudioOutputMixer();
+#ifdef USE_PROPRIETARY_AUDIO_EXTENSIONS
+    mCaptureSplitter->setPostProcessor(&mAudioPP);
+    mAudioPP.setTuningStore(mTuning.get());
+#endif
 }
 
 // designed to be called multiple times for retries
@@ -67,26 +102,26 @@ status_t AudioHardware::init() {
         return NO_ERROR;
     }
 
-    mCpcapCtlFd = ::open("/dev/audio_ctl", O_RDWR);
+    mCpcapCtlFd = devIo()->open("/dev/audio_ctl", O_RDWR);
     if (mCpcapCtlFd < 0) {
         ALOGE("open /dev/audio_ctl failed: %s", strerror(errno));
         goto error;
     }
 
-    if (::ioctl(mCpcapCtlFd, CPCAP_AUDIO_OUT_GET_OUTPUT, &mCurOutDevice) < 0) {
+    if (devIo()->ioctl(mCpcapCtlFd, CPCAP_AUDIO_OUT_GET_OUTPUT, &mCurOutDevice) < 0) {
         ALOGE("could not get output device: %s", strerror(errno));
         goto error;
     }
-    if (::ioctl(mCpcapCtlFd, CPCAP_AUDIO_IN_GET_INPUT, &mCurInDevice) < 0) {
+    if (devIo()->ioctl(mCpcapCtlFd, CPCAP_AUDIO_IN_GET_INPUT, &mCurInDevice) < 0) {
         ALOGE("could not get input device: %s", strerror(errno));
         goto error;
     }
     // For bookkeeping only
-    if (::ioctl(mCpcapCtlFd, CPCAP_AUDIO_OUT_GET_RATE, &mHwOutRate) < 0) {
+    if (devIo()->ioctl(mCpcapCtlFd, CPCAP_AUDIO_OUT_GET_RATE, &mHwOutRate) < 0) {
         ALOGE("could not get output rate: %s", strerror(errno));
         goto error;
     }
-    if (::ioctl(mCpcapCtlFd, CPCAP_AUDIO_IN_GET_RATE, &mHwInRate) < 0) {
+    if (devIo()->ioctl(mCpcapCtlFd, CPCAP_AUDIO_IN_GET_RATE, &mHwInRate) < 0) {
         ALOGE("could not get input rate: %s", strerror(errno));
         goto error;
     }
@@ -94,16 +129,19 @@ status_t AudioHardware::init() {
 #ifdef USE_PROPRIETARY_AUDIO_EXTENSIONS
     // Init the MM Audio Post Processing
     mAudioPP.setAudioDev(&mCurOutDevice, &mCurInDevice, false, false, false);
+#else
+    mEqualizer.setPreset(eqPresetFor(mCurOutDevice.id, false, false));
 #endif
 
-    readHwGainFile();
+    mTuning->init();
+    mOutputProfiles.load(AUDIO_OUTPUT_PROFILES_FILE);
 
     mInit = true;
     return NO_ERROR;
 
 error:
     if (mCpcapCtlFd >= 0) {
-        (void) ::close(mCpcapCtlFd);
+        (void) devIo()->close(mCpcapCtlFd);
         mCpcapCtlFd = -1;
     }
     return NO_INIT;
@@ -116,44 +154,18 @@ AudioHardware::~AudioHardware()
         closeInputStream((AudioStreamIn*)mInputs[index]);
     }
     mInputs.clear();
+    while (mMixedOutputs.size()) {
+        closeOutputStream((AudioStreamOut*)mMixedOutputs[0]);
+    }
     closeOutputStream((AudioStreamOut*)mOutput);
+    mMixer->stop();
+    mTuning->stop();
     if (mCpcapCtlFd >= 0) {
-        (void) ::close(mCpcapCtlFd);
+        (void) devIo()->close(mCpcapCtlFd);
         mCpcapCtlFd = -1;
     }
 }
 
-void AudioHardware::readHwGainFile()
-{
-    int fd;
-    int rc=0;
-    int i;
-    uint32_t format, version, barker;
-    fd = open("/system/etc/cpcap_gain.bin", O_RDONLY);
-    if (fd>=0) {
-        ::read(fd, &format, sizeof(uint32_t));
-        ::read(fd, &version, sizeof(uint32_t));
-        ::read(fd, &barker, sizeof(uint32_t));
-        rc = ::read(fd, mCpcapGain, sizeof(mCpcapGain));
-        ALOGD("Read gain file, format %X version %X", format, version);
-        ::close(fd);
-    }
-    if (rc != sizeof(mCpcapGain) || format != 0x30303032) {
-        int gain;
-        ALOGE("CPCAP gain file not valid. Using defaults.");
-        for (int i=0; i<AUDIO_HW_GAIN_NUM_DIRECTIONS; i++) {
-            if (i==AUDIO_HW_GAIN_SPKR_GAIN)
-                gain = 11;
-            else
-                gain = 31;
-            for (int j=0; j<AUDIO_HW_GAIN_NUM_USECASES; j++)
-                for (int k=0; k<AUDIO_HW_GAIN_NUM_PATHS; k++)
-                    mCpcapGain[i][j][k]=gain;
-        }
-    }
-    return;
-}
-
 status_t AudioHardware::initCheck()
 {
     return mInit ? NO_ERROR : NO_INIT;
@@ -165,12 +177,19 @@ AudioStreamOut* AudioHardware::openOutputStream(
     { // scope for the lock
         Mutex::Autolock lock(mLock);
 
-        // only one output stream allowed
+        // The drivers belong to the first output stream, the next ones are mixed into it
         if (mOutput) {
+            AudioStreamOutMixed* out = new AudioStreamOutMixed();
+            status_t lStatus = out->set(this, devices, format, channels, sampleRate);
             if (status) {
-                *status = INVALID_OPERATION;
+                *status = lStatus;
+            }
+            if (lStatus != NO_ERROR) {
+                delete out;
+                return 0;
             }
-            return 0;
+            mMixedOutputs.add(out);
+            return out;
         }
 
         // create new output stream
@@ -193,6 +212,8 @@ AudioStreamOut* AudioHardware::openOutputStream(
         }
         if (lStatus == NO_ERROR) {
             mOutput = out;
+            mRouting.invalidateStreams();
+            mMixer->setSink(out, out->bufferSize() / out->frameSize(), out->sampleRate());
         } else {
             mLock.unlock();
             delete out;
@@ -205,15 +226,28 @@ AudioStreamOut* AudioHardware::openOutputStream(
 
 void AudioHardware::closeOutputStream(AudioStreamOut* out) {
     Mutex::Autolock lock(mLock);
-    if (mOutput == 0 || mOutput != out) {
+    ssize_t index = mMixedOutputs.indexOf((AudioStreamOutMixed *)out);
+    if (index >= 0) {
+        mMixedOutputs.removeAt(index);
+        mLock.unlock();
+        delete out;
+        mLock.lock();
+    } else if (mOutput == 0 || mOutput != out) {
         ALOGW("Attempt to close invalid output stream");
     }
     else {
         // AudioStreamOutTegra destructor calls standby which locks
         mOutput = 0;
+        mRouting.invalidateStreams();
         mLock.unlock();
+        mMixer->setSink(NULL, 0, 0);
         delete out;
         mLock.lock();
+        // What the mixed streams queued is lost, their writes are dropped until a
+        // primary output is opened again.
+        for (size_t i = 0; i < mMixedOutputs.size(); i++) {
+            mMixedOutputs[i]->standby();
+        }
     }
 }
 
@@ -255,6 +289,7 @@ void AudioHardware::closeInputStream(AudioStreamIn* in)
         ALOGW("Attempt to close invalid input stream");
     } else {
         mInputs.removeAt(index);
+        mRouting.invalidateStreams();
         mLock.unlock();
         delete in;
         mLock.lock();
@@ -309,13 +344,13 @@ status_t AudioHardware::doStandby(int stop_fd, bool output, bool enable)
                 mOutput->flush();
         }
 
-        if (::ioctl(mCpcapCtlFd, CPCAP_AUDIO_OUT_SET_OUTPUT, &standby) < 0) {
+        if (devIo()->ioctl(mCpcapCtlFd, CPCAP_AUDIO_OUT_SET_OUTPUT, &standby) < 0) {
             ALOGE("could not turn off current output device: %s",
                  strerror(errno));
             status = errno;
         }
 
-        if (::ioctl(mCpcapCtlFd, CPCAP_AUDIO_OUT_GET_OUTPUT, &mCurOutDevice) < 0) {
+        if (devIo()->ioctl(mCpcapCtlFd, CPCAP_AUDIO_OUT_GET_OUTPUT, &mCurOutDevice) < 0) {
             ALOGE("could not get current output device after standby: %s",
                  strerror(errno));
         }
@@ -332,18 +367,18 @@ status_t AudioHardware::doStandby(int stop_fd, bool output, bool enable)
              * will block until recording is resumed.
              */
             ALOGV("%s: stop recording", __FUNCTION__);
-            if (::ioctl(stop_fd, TEGRA_AUDIO_IN_STOP) < 0) {
+            if (devIo()->ioctl(stop_fd, TEGRA_AUDIO_IN_STOP) < 0) {
                 ALOGE("could not stop recording: %s",
                      strerror(errno));
             }
         }
 
-        if (::ioctl(mCpcapCtlFd, CPCAP_AUDIO_IN_SET_INPUT, &standby) < 0) {
+        if (devIo()->ioctl(mCpcapCtlFd, CPCAP_AUDIO_IN_SET_INPUT, &standby) < 0) {
             ALOGE("could not turn off current input device: %s",
                  strerror(errno));
             status = errno;
         }
-        ::ioctl(mCpcapCtlFd, CPCAP_AUDIO_IN_GET_INPUT, &mCurInDevice);
+        devIo()->ioctl(mCpcapCtlFd, CPCAP_AUDIO_IN_GET_INPUT, &mCurInDevice);
         ALOGV("%s: after standby %s, input device %d is %s", __FUNCTION__,
              enable ? "enable" : "disable", mCurInDevice.id,
              mCurInDevice.on ? "on" : "off");
@@ -417,6 +452,22 @@ status_t AudioHardware::setParameters(const String8& keyValuePairs)
             doRouting();
         }
     }
+#ifdef USE_PROPRIETARY_AUDIO_EXTENSIONS
+    // Uplink EC/NS frame duration in ms, applied when EC/NS next starts
+    key = String8("ecns_frame_ms");
+    int frameMs;
+    if (param.getInt(key, frameMs) == NO_ERROR) {
+        if (mAudioPP.setEcnsFrameMs(frameMs) != NO_ERROR) {
+            ALOGW("Unsupported EC/NS frame duration %d ms", frameMs);
+            return BAD_VALUE;
+        }
+    }
+    // Delta encoding of the EC/NS datalog files, applied when logging next starts
+    key = String8("ecns_log_delta");
+    if (param.get(key, value) == NO_ERROR) {
+        mAudioPP.setEcnsLogDelta(value == "on");
+    }
+#endif
     return NO_ERROR;
 }
 
@@ -519,7 +570,7 @@ status_t AudioHardware::setVolume_l(float v, int usecase)
     spkr = ceil(v * spkr);
     if (mSpkrVolume != spkr) {
         ALOGV("Set tx volume to %d", spkr);
-        int ret = ::ioctl(mCpcapCtlFd, CPCAP_AUDIO_OUT_SET_VOLUME, spkr);
+        int ret = devIo()->ioctl(mCpcapCtlFd, CPCAP_AUDIO_OUT_SET_VOLUME, spkr);
         if (ret < 0) {
             ALOGE("could not set spkr volume: %s", strerror(errno));
             return ret;
@@ -528,7 +579,7 @@ status_t AudioHardware::setVolume_l(float v, int usecase)
     }
     if (mMicVolume != mic) {
         ALOGV("Set rx volume to %d", mic);
-        int ret = ::ioctl(mCpcapCtlFd, CPCAP_AUDIO_IN_SET_VOLUME, mic);
+        int ret = devIo()->ioctl(mCpcapCtlFd, CPCAP_AUDIO_IN_SET_VOLUME, mic);
         if (ret < 0) {
             ALOGE("could not set mic volume: %s", strerror(errno));
             return ret;
@@ -548,7 +599,7 @@ uint8_t AudioHardware::getGain(int direction, int usecase)
        ALOGE("No output device.");
        return 0;
     }
-    uint32_t outDev = mOutput->devices();
+    uint32_t outDev = outputDevices_l();
 
 // In case of an actual phone, with an actual earpiece, uncomment.
 //    if (outDev & AudioSystem::DEVICE_OUT_EARPIECE)
@@ -563,16 +614,22 @@ uint8_t AudioHardware::getGain(int direction, int usecase)
     else
        path = AUDIO_HW_GAIN_SPEAKERPHONE;
 
-    ALOGV("Picked gain[%d][%d][%d] which is %d.",direction, usecase, path,
-          mCpcapGain[direction][usecase][path]);
+    uint8_t gain = mTuning->gain(direction, usecase, path);
+    ALOGV("Picked gain[%d][%d][%d] which is %d.",direction, usecase, path, gain);
 
-    return mCpcapGain[direction][usecase][path];
+    return gain;
 }
 
+// The capture is shared: run it at the highest rate asked for by the active inputs.
 int AudioHardware::getActiveInputRate()
 {
-    AudioStreamInTegra *input = getActiveInput_l();
-    return (input != NULL) ? input->sampleRate() : 0;
+    int rate = 0;
+    for (size_t i = 0; i < mInputs.size(); i++) {
+        if (!mInputs[i]->getStandby() && (int)mInputs[i]->sampleRate() > rate) {
+            rate = mInputs[i]->sampleRate();
+        }
+    }
+    return rate;
 }
 
 status_t AudioHardware::doRouting()
@@ -581,13 +638,31 @@ status_t AudioHardware::doRouting()
     return doRouting_l();
 }
 
+// Call this with mLock held.
+// The policy only routes the outputs that play: an idle output keeps the device it
+// had, which is not where the others play.
+uint32_t AudioHardware::outputDevices_l()
+{
+    uint32_t devices = 0;
+    for (size_t i = 0; i < mMixedOutputs.size(); i++) {
+        if (mMixedOutputs[i]->playing()) {
+            devices |= mMixedOutputs[i]->devices();
+        }
+    }
+    if (devices == 0 || !mOutput->clientStandby()) {
+        devices |= mOutput->devices();
+    }
+    return devices;
+}
+
 // Call this with mLock held.
 status_t AudioHardware::doRouting_l()
 {
     if (!mOutput) {
         return NO_ERROR;
     }
-    uint32_t outputDevices = mOutput->devices();
+    nsecs_t start = systemTime();
+    uint32_t outputDevices = outputDevices_l();
     AudioStreamInTegra *input = getActiveInput_l();
     uint32_t inputDevice = (input == NULL) ? 0 : input->devices();
     uint32_t btScoOutDevices = outputDevices & (
@@ -652,7 +727,7 @@ status_t AudioHardware::doRouting_l()
         else
             mCurInDevice.id = sndInDevice;
 
-        if (::ioctl(mCpcapCtlFd, CPCAP_AUDIO_IN_SET_INPUT,
+        if (devIo()->ioctl(mCpcapCtlFd, CPCAP_AUDIO_IN_SET_INPUT,
                   &mCurInDevice) < 0)
             ALOGE("could not set input (%d, on %d): %s",
                  mCurInDevice.id, mCurInDevice.on, strerror(errno));
@@ -671,7 +746,7 @@ status_t AudioHardware::doRouting_l()
         else
             mCurOutDevice.id = sndOutDevice;
 
-        if (::ioctl(mCpcapCtlFd, CPCAP_AUDIO_OUT_SET_OUTPUT,
+        if (devIo()->ioctl(mCpcapCtlFd, CPCAP_AUDIO_OUT_SET_OUTPUT,
                   &mCurOutDevice) < 0)
             ALOGE("could not set output (%d, on %d): %s",
                  mCurOutDevice.id, mCurOutDevice.on,
@@ -718,77 +793,109 @@ status_t AudioHardware::doRouting_l()
         ALOGD("Bluetooth SCO active, rate forced to 8K");
     }
 
-    if (input) {
-        // acquire mutex if not already locked by read()
-        if (!input->isLocked()) {
-            input->lock();
+    AudioRoute route;
+    route.output = mOutput;
+    route.input = input;
+    route.outDevice = mCurOutDevice.id;
+    route.inDevice = mCurInDevice.id;
+    route.speaker = speakerOutDevices != 0;
+    route.spdif = spdifOutDevices != 0;
+    route.btSco = btScoOn;
+    route.mic = micInDevice != 0;
+    route.btNrec = mBluetoothNrec;
+    route.ecns = mEcnsEnabled;
+    route.hwOutRate = mHwOutRate;
+    route.hwInRate = mHwInRate;
+    // Only redo what changed: resetting the post processor restarts EC/NS, and the
+    // stream locks are only available at the next buffer boundary.
+    uint32_t changes = mRouting.diff(route);
+
+    if (changes & AudioRoutingState::CHANGE_STREAMS) {
+        if (input) {
+            // acquire mutex if not already locked by read()
+            if (!input->isLocked()) {
+                input->lock();
+            }
+        }
+        // acquire mutex if not already locked by write()
+        if (!mOutput->isLocked()) {
+            mOutput->lock();
         }
-    }
-    // acquire mutex if not already locked by write()
-    if (!mOutput->isLocked()) {
-        mOutput->lock();
-    }
 #ifdef USE_PROPRIETARY_AUDIO_EXTENSIONS
-    mAudioPP.setAudioDev(&mCurOutDevice, &mCurInDevice,
-                         btScoOn, mBluetoothNrec,
-                         spdifOutDevices?true:false);
-    mAudioPP.enableEcns(mEcnsEnabled);
+        if (changes & AudioRoutingState::CHANGE_PP_DEVICE) {
+            mAudioPP.setAudioDev(&mCurOutDevice, &mCurInDevice,
+                                 btScoOn, mBluetoothNrec,
+                                 spdifOutDevices?true:false);
+        }
+        if (changes & AudioRoutingState::CHANGE_ECNS) {
+            mAudioPP.enableEcns(mEcnsEnabled);
+        }
+#else
+        if (changes & AudioRoutingState::CHANGE_PP_DEVICE) {
+            mEqualizer.setPreset(eqPresetFor(mCurOutDevice.id, btScoOn,
+                                             spdifOutDevices?true:false));
+        }
 #endif
 
-    mOutput->setDriver_l(speakerOutDevices?true:false,
-                       btScoOn,
-                       spdifOutDevices?true:false, mHwOutRate);
+        if (changes & AudioRoutingState::CHANGE_OUT_DRIVER) {
+            mOutput->setDriver_l(speakerOutDevices?true:false,
+                               btScoOn,
+                               spdifOutDevices?true:false, mHwOutRate);
+        }
 
-    if (input) {
-        input->setDriver_l(micInDevice?true:false,
-                btScoOn, mHwInRate);
-    }
+        if (input && (changes & AudioRoutingState::CHANGE_IN_DRIVER)) {
+            input->setDriver_l(micInDevice?true:false,
+                    btScoOn, mHwInRate);
+        }
 
-    // Changing I2S to port connection when bluetooth starts or stopS must be done simultaneously
-    // for input and output while both DMAs are stopped
-    if (btScoOn != mBtScoOn) {
-        if (input) {
+        // Changing I2S to port connection when bluetooth starts or stopS must be done
+        // simultaneously for input and output while both DMAs are stopped
+        if (changes & AudioRoutingState::CHANGE_BT_SCO) {
+            if (input) {
 #ifdef USE_PROPRIETARY_AUDIO_EXTENSIONS
-            if (mEcnsEnabled) {
-                mAudioPP.enableEcns(0);
-                mAudioPP.enableEcns(mEcnsEnabled);
-            }
+                if (mEcnsEnabled) {
+                    mAudioPP.enableEcns(0);
+                    mAudioPP.enableEcns(mEcnsEnabled);
+                }
 #endif
-            input->lockFd();
-            input->stop_l();
-        }
-        mOutput->lockFd();
-        mOutput->flush_l();
+                input->lockFd();
+                input->stop_l();
+            }
+            mOutput->lockFd();
+            mOutput->flush_l();
+
+            int bit_format = TEGRA_AUDIO_BIT_FORMAT_DEFAULT;
+            bool is_bt_bypass = false;
+            if (btScoOn) {
+                bit_format = TEGRA_AUDIO_BIT_FORMAT_DSP;
+                is_bt_bypass = true;
+            }
+            ALOGV("%s: bluetooth state changed. is_bt_bypass %d bit_format %d",
+                 __FUNCTION__, is_bt_bypass, bit_format);
+            // Setup the I2S2-> DAP2/4 capture/playback path.
+            if (devIo()->ioctl(mOutput->mBtFdIoCtl, TEGRA_AUDIO_SET_BIT_FORMAT,
+                               &bit_format) < 0) {
+                ALOGE("could not set bit format %s", strerror(errno));
+            }
+            if (devIo()->ioctl(mCpcapCtlFd, CPCAP_AUDIO_SET_BLUETOOTH_BYPASS,
+                               is_bt_bypass) < 0) {
+                ALOGE("could not set bluetooth bypass %s", strerror(errno));
+            }
 
-        int bit_format = TEGRA_AUDIO_BIT_FORMAT_DEFAULT;
-        bool is_bt_bypass = false;
-        if (btScoOn) {
-            bit_format = TEGRA_AUDIO_BIT_FORMAT_DSP;
-            is_bt_bypass = true;
-        }
-        ALOGV("%s: bluetooth state changed. is_bt_bypass %d bit_format %d",
-             __FUNCTION__, is_bt_bypass, bit_format);
-        // Setup the I2S2-> DAP2/4 capture/playback path.
-        if (::ioctl(mOutput->mBtFdIoCtl, TEGRA_AUDIO_SET_BIT_FORMAT, &bit_format) < 0) {
-            ALOGE("could not set bit format %s", strerror(errno));
-        }
-        if (::ioctl(mCpcapCtlFd, CPCAP_AUDIO_SET_BLUETOOTH_BYPASS, is_bt_bypass) < 0) {
-            ALOGE("could not set bluetooth bypass %s", strerror(errno));
+            mOutput->unlockFd();
+            if (input) {
+                input->unlockFd();
+            }
         }
 
-        mBtScoOn = btScoOn;
-        mOutput->unlockFd();
-        if (input) {
-            input->unlockFd();
+        if (!mOutput->isLocked()) {
+            mOutput->unlock();
+        }
+        if (input && !input->isLocked()) {
+            input->unlock();
         }
     }
-
-    if (!mOutput->isLocked()) {
-        mOutput->unlock();
-    }
-    if (input && !input->isLocked()) {
-        input->unlock();
-    }
+    mRouting.applied(route, changes, start);
 
     // Since HW path may have changed, set the hardware gains.
     int useCase = AUDIO_HW_GAIN_USECASE_MM;
@@ -816,6 +923,13 @@ status_t AudioHardware::dumpInternals(int fd, const Vector<String16>& args)
     result.append(buffer);
     snprintf(buffer, SIZE, "\tmBluetoothId: %d\n", mBluetoothId);
     result.append(buffer);
+    mRouting.dump(result);
+    mCaptureSplitter->dump(result);
+    mTuning->dump(result);
+    mMixer->dump(result);
+#ifndef USE_PROPRIETARY_AUDIO_EXTENSIONS
+    mEqualizer.dump(result);
+#endif
     ::write(fd, result.string(), result.size());
     return NO_ERROR;
 }
@@ -830,6 +944,9 @@ status_t AudioHardware::dump(int fd, const Vector<String16>& args)
     if (mOutput) {
         mOutput->dump(fd, args);
     }
+#ifdef USE_PROPRIETARY_AUDIO_EXTENSIONS
+    mAudioPP.dump(fd);
+#endif
     return NO_ERROR;
 }
 
@@ -851,8 +968,8 @@ uint32_t AudioHardware::getInputSampleRate(uint32_t sampleRate)
 AudioHardware::AudioStreamInTegra *AudioHardware::getActiveInput_l()
 {
     for (size_t i = 0; i < mInputs.size(); i++) {
-        // return first input found not being in standby mode
-        // as only one input can be in this state
+        // return first input found not being in standby mode: the
+        // capture path is routed for it, the others share its capture
         if (!mInputs[i]->getStandby()) {
             return mInputs[i];
         }
@@ -861,53 +978,36 @@ AudioHardware::AudioStreamInTegra *AudioHardware::getActiveInput_l()
     return NULL;
 }
 
-void AudioHardware::setEcnsRequested_l(int ecns, bool enabled)
+void AudioHardware::updateEcnsRequested_l()
 {
-    if (enabled) {
-        mEcnsRequested |= ecns;
-    } else {
-        mEcnsRequested &= ~ecns;
+    mEcnsRequested = 0;
+    for (size_t i = 0; i < mInputs.size(); i++) {
+        if (!mInputs[i]->getStandby()) {
+            mEcnsRequested |= mInputs[i]->ecnsRequested();
+        }
     }
 }
 
 // ----------------------------------------------------------------------------
 // Sample Rate Converter wrapper
 //
-#ifdef USE_PROPRIETARY_AUDIO_EXTENSIONS
 AudioHardware::AudioStreamSrc::AudioStreamSrc() :
-        mSrcBuffer(NULL), mSrcInitted(false)
+        mSrcInitted(false)
 {
 }
 AudioHardware::AudioStreamSrc::~AudioStreamSrc()
 {
-    if (mSrcBuffer != NULL) {
-        delete[] mSrcBuffer;
-    }
 }
 
-void AudioHardware::AudioStreamSrc::init(int inRate, int outRate)
+void AudioHardware::AudioStreamSrc::init(int inRate, int outRate, int quality)
 {
-    if (mSrcBuffer == NULL) {
-        mSrcBuffer = new char[src_memory_required_stereo(MAX_FRAME_LEN, MAX_CONVERT_RATIO)];
-    }
-    if (mSrcBuffer == NULL) {
-        ALOGE("Failed to allocate memory for sample rate converter.");
+    mSrcInitted = false;
+    if (mSrc.init(inRate, outRate, quality) != NO_ERROR) {
+        ALOGE("Failed to initialize sample rate converter %d -> %d.", inRate, outRate);
         return;
     }
-    mSrcInit.memory = (SRC16*)(mSrcBuffer);
-    mSrcInit.input_rate = inRate;
-    mSrcInit.output_rate = outRate;
-    mSrcInit.frame_length = MAX_FRAME_LEN;
-    mSrcInit.stereo_flag = SRC_OFF;
-    mSrcInit.input_interleaved = SRC_OFF;
-    mSrcInit.output_interleaved = SRC_OFF;
-    rate_convert_init(&mSrcInit, &mSrcObj);
-
     mSrcInitted = true;
-    mSrcInRate = inRate;
-    mSrcOutRate = outRate;
 }
-#endif
 
 // ----------------------------------------------------------------------------
 
@@ -919,11 +1019,20 @@ AudioHardware::AudioStreamOutTegra::AudioStreamOutTegra() :
     mStartCount(0), mRetryCount(0), mDevices(0),
     mIsSpkrEnabled(false), mIsBtEnabled(false), mIsSpdifEnabled(false),
     mIsSpkrEnabledReq(false), mIsBtEnabledReq(false), mIsSpdifEnabledReq(false),
-    mSpareSample(0), mHaveSpareSample(false),
-    mState(AUDIO_STREAM_IDLE), /*mSrc*/ mLocked(false), mDriverRate(AUDIO_HW_OUT_SAMPLERATE),
-    mInit(false)
+    mState(AUDIO_STREAM_IDLE), /*mSrc*/ mPosition(AUDIO_HW_OUT_SAMPLERATE), mNumBufs(0),
+    mProfile(&AudioOutputProfiles::sBuiltIn),
+    mLocked(false), mDriverRate(AUDIO_HW_OUT_SAMPLERATE), mSpeakerRate(0), mInit(false),
+    mSilence(NULL), mSilenceSize(0),
+    mIdleTimeoutMs(AUDIO_HW_OUT_IDLE_STANDBY_MS), mSilentSince(0), mIdlePending(false),
+    mIdle(false), mIdleNext(0), mIdleEntries(0), mClientStandby(true)
 {
     ALOGV("AudioStreamOutTegra constructor");
+    // Any non-zero seeds, different per generator
+    for (int i = 0; i < AudioDsp::DITHER_LANES; i++) {
+        mDither[i] = 0x9E3779B9 * (i + 1);
+    }
+    mSpkrWriter = new AudioSinkWriter("AudioOutSpeaker");
+    mSpdifWriter = new AudioSinkWriter("AudioOutSpdif");
 }
 
 // designed to be called multiple times for retries
@@ -933,9 +1042,9 @@ status_t AudioHardware::AudioStreamOutTegra::init()
         return NO_ERROR;
     }
 
-#define OPEN_FD(fd, dev)    fd = ::open(dev, O_RDWR);                              \
-                            if (fd < 0) {                                          \
-                                ALOGE("open " dev " failed: %s", strerror(errno));   \
+#define OPEN_FD(fd, dev)    fd = devIo()->open(dev, O_RDWR);                        \
+                            if (fd < 0) {                                           \
+                                ALOGE("open " dev " failed: %s", strerror(errno));  \
                                 goto error;                                         \
                             }
     OPEN_FD(mFd, "/dev/audio0_out")
@@ -948,15 +1057,13 @@ status_t AudioHardware::AudioStreamOutTegra::init()
     OPEN_FD(mSpdifFdCtl, "/dev/spdif_out_ctl")
 #undef OPEN_FD
 
-    setNumBufs(AUDIO_HW_NUM_OUT_BUF_LONG);
-
     mInit = true;
     return NO_ERROR;
 
 error:
-#define CLOSE_FD(fd)    if (fd >= 0) {          \
-                            (void) ::close(fd); \
-                            fd = -1;            \
+#define CLOSE_FD(fd)    if (fd >= 0) {                  \
+                            (void) devIo()->close(fd);  \
+                            fd = -1;                    \
                         }
     CLOSE_FD(mFd)
     CLOSE_FD(mFdCtl)
@@ -1022,12 +1129,38 @@ status_t AudioHardware::AudioStreamOutTegra::set(
 
 #ifdef USE_PROPRIETARY_AUDIO_EXTENSIONS
     mHardware->mAudioPP.setPlayAudioRate(lRate);
+#else
+    mHardware->mEqualizer.setSampleRate(lRate);
 #endif
 
     if (pFormat) *pFormat = lFormat;
     if (pChannels) *pChannels = lChannels;
     if (pRate) *pRate = lRate;
 
+    // Sized for the largest profile so that setParameters() can switch without reallocating
+    mProfile = mHardware->mOutputProfiles.getDefault();
+    resetBufferTuner();
+    setNumBufs(mProfile->numBufs);
+    if (mSinkPool.init(AudioSinkWriter::MAX_BACKLOG + 2,
+                       mHardware->mOutputProfiles.maxBufferSize()) != NO_ERROR) {
+        ALOGW("no buffers for parallel writes, secondary outputs will be written in line");
+    }
+    if (mArena.reserve(mHardware->mOutputProfiles.maxBufferSize() *
+                       AUDIO_HW_OUT_MAX_EXPANSION * AUDIO_HW_OUT_WIDE_EXPANSION) != NO_ERROR) {
+        return NO_MEMORY;
+    }
+    // Also holds the EC/NS preload at the highest driver rate writeFrames() accepts
+    mSilenceSize = lRate * AUDIO_HW_OUT_MAX_EXPANSION * 2 /* stereo */ * sizeof(int16_t) *
+                   AUDIO_HW_OUT_ECNS_PRELOAD_MS / 1000;
+    if (mSilenceSize < mHardware->mOutputProfiles.maxBufferSize()) {
+        mSilenceSize = mHardware->mOutputProfiles.maxBufferSize();
+    }
+    mSilence = calloc(1, mSilenceSize);
+    if (mSilence == NULL) {
+        return NO_MEMORY;
+    }
+    mHardware->mMixer->setIdleTimeout(mIdleTimeoutMs);
+
     mDevices = devices;
     if (mFd >= 0 && mFdCtl >= 0 &&
                 mBtFd >= 0 &&
@@ -1044,21 +1177,137 @@ status_t AudioHardware::AudioStreamOutTegra::set(
 
 AudioHardware::AudioStreamOutTegra::~AudioStreamOutTegra()
 {
-    standby();
+    standbyNow();
+    free(mSilence);
+    // The writer threads must be gone before their fds are closed.
+    mSpkrWriter->stop();
+    mSpdifWriter->stop();
     // Prevent someone from flushing the fd during a close.
     Mutex::Autolock lock(mFdLock);
-    if (mFd >= 0)         { ::close(mFd);         mFd = -1;         }
-    if (mFdCtl >= 0)      { ::close(mFdCtl);      mFdCtl = -1;      }
-    if (mBtFd >= 0)       { ::close(mBtFd);       mBtFd = -1;       }
-    if (mBtFdCtl >= 0)    { ::close(mBtFdCtl);    mBtFdCtl = -1;    }
-    if (mBtFdIoCtl >= 0)  { ::close(mBtFdIoCtl);  mBtFdIoCtl = -1;  }
-    if (mSpdifFd >= 0)    { ::close(mSpdifFd);    mSpdifFd = -1;    }
-    if (mSpdifFdCtl >= 0) { ::close(mSpdifFdCtl); mSpdifFdCtl = -1; }
+    if (mFd >= 0)         { devIo()->close(mFd);         mFd = -1;         }
+    if (mFdCtl >= 0)      { devIo()->close(mFdCtl);      mFdCtl = -1;      }
+    if (mBtFd >= 0)       { devIo()->close(mBtFd);       mBtFd = -1;       }
+    if (mBtFdCtl >= 0)    { devIo()->close(mBtFdCtl);    mBtFdCtl = -1;    }
+    if (mBtFdIoCtl >= 0)  { devIo()->close(mBtFdIoCtl);  mBtFdIoCtl = -1;  }
+    if (mSpdifFd >= 0)    { devIo()->close(mSpdifFd);    mSpdifFd = -1;    }
+    if (mSpdifFdCtl >= 0) { devIo()->close(mSpdifFdCtl); mSpdifFdCtl = -1; }
 }
 
 ssize_t AudioHardware::AudioStreamOutTegra::write(const void* buffer, size_t bytes)
+{
+    return writeFrames(buffer, bytes, true);
+}
+
+// The mixer thread keeps the drivers running for the mixed streams while the client is idle.
+ssize_t AudioHardware::AudioStreamOutTegra::writeMix(size_t frames)
+{
+    size_t bytes = frames * frameSize();
+    if (bytes > bufferSize()) {
+        bytes = bufferSize();
+    }
+    return writeFrames(mSilence, bytes, false);
+}
+
+void AudioHardware::AudioStreamOutTegra::standbyMix()
+{
+    standbyNow();
+}
+
+// True if the buffer only holds digital silence
+static bool isSilence(const void *buffer, size_t bytes)
+{
+    const uint32_t *p = (const uint32_t *)buffer;
+    size_t count = bytes / sizeof(uint32_t);
+    uint32_t acc = 0;
+    // Stop at the first block with a sample, which is where music usually is
+    for (size_t i = 0; i < count; i += 16) {
+        size_t end = i + 16 < count ? i + 16 : count;
+        for (size_t j = i; j < end; j++) {
+            acc |= p[j];
+        }
+        if (acc != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The idle standby only turns CPCAP and its DMA off. It is not used with the other
+// sinks, while EC/NS needs the downlink or while mixed streams are played.
+bool AudioHardware::AudioStreamOutTegra::idleAllowed() const
+{
+    return mIdleTimeoutMs != 0 && mState == AUDIO_STREAM_CONFIGURED &&
+            mIsSpkrEnabled && !mIsBtEnabled && !mIsSpdifEnabled &&
+            !mHardware->mEcnsEnabled && !mHardware->mMixer->hasActiveTracks();
+}
+
+// The client wrote silence for mIdleTimeoutMs: put the output hardware to standby but
+// keep the stream configured, so that resumeIdle_l() only has to turn CPCAP back on.
+void AudioHardware::AudioStreamOutTegra::enterIdle()
+{
+    Mutex::Autolock lock(mHardware->mLock);
+    AudioStreamLock::Autolock lock2(mLock);
+
+    mIdlePending = false;
+    if (mIdle || !idleAllowed()) {
+        return;
+    }
+    ALOGV("output %p idle after %u ms of silence", this, mIdleTimeoutMs);
+    nsecs_t start = systemTime();
+    // Only silence is queued in the driver: flush_l() leaves the position alone while
+    // idle and the idle writes keep it running.
+    mIdle = true;
+    mHardware->doStandby(mFdCtl, true, true); // output, standby
+    mIdleNext = systemTime();
+    mIdleEntries++;
+    mStats.lap(AudioStageStats::STAGE_IDLE_ENTER, start);
+}
+
+// Called with mLock and mHardware->mLock held, with the stream still configured: the
+// routing, the rate and the number of buffers of the driver are still valid and the
+// driver was flushed by enterIdle(), so unlike online_l() nothing is flushed or set up.
+status_t AudioHardware::AudioStreamOutTegra::resumeIdle_l()
+{
+    ALOGV("output %p resuming from idle", this);
+    nsecs_t start = systemTime();
+    status_t status = mHardware->doStandby(mFdCtl, true, false); // output, online
+    mIdle = false;
+    mSilentSince = 0;
+    // Clear the errors counted while nothing was written
+    getUnderruns();
+    mStats.lap(AudioStageStats::STAGE_IDLE_RESUME, start);
+    return status;
+}
+
+// Silence written while idle is dropped. The write takes as long as playing it would,
+// for the client to keep its pace, and the position advances as if it were played.
+ssize_t AudioHardware::AudioStreamOutTegra::writeIdle(size_t bytes, nsecs_t start)
+{
+    size_t frames = bytes / frameSize();
+    nsecs_t wake;
+    {
+        AudioStreamLock::Autolock lock(mLock);
+        mHardware->mMixer->onClientWrite(start);
+        mPosition.onWrite(AudioPositionTracker::SINK_SPEAKER, frames, start);
+        if (mIdleNext < start) {
+            mIdleNext = start;
+        }
+        // Return when the previous buffer would be played, one buffer ahead as the driver
+        wake = mIdleNext;
+        mIdleNext += (nsecs_t)frames * 1000000000LL / sampleRate();
+    }
+    nsecs_t now = systemTime();
+    if (wake > now) {
+        usleep(ns2us(wake - now));
+    }
+    return bytes;
+}
+
+ssize_t AudioHardware::AudioStreamOutTegra::writeFrames(const void* buffer, size_t bytes,
+                                                        bool client)
 {
     status_t status;
+    nsecs_t start = systemTime();
     if (!mHardware) {
         ALOGE("%s: mHardware is null", __FUNCTION__);
         return NO_INIT;
@@ -1066,16 +1315,25 @@ ssize_t AudioHardware::AudioStreamOutTegra::write(const void* buffer, size_t byt
     // ALOGD("AudioStreamOutTegra::write(%p, %u) TID %d", buffer, bytes, gettid());
     // Protect output state during the write process.
 
-    if (mSleepReq) {
-        // sleep a few milliseconds so that the processor can be given to the thread attempting to
-        // lock mLock before we sleep with mLock held while writing below
-        usleep(FORCED_SLEEP_TIME_US);
+    if (client && mClientStandby) {
+        // While the client was in standby the hardware followed the mixed streams only
+        mClientStandby = false;
+        mHardware->doRouting();
+    }
+
+    // Silence from the client lets the hardware idle; any other write resumes it.
+    bool silent = client && idleAllowed() && isSilence(buffer, bytes);
+    if (silent && mIdlePending) {
+        enterIdle();
+    }
+    if (silent && mIdle) {
+        return writeIdle(bytes, start);
     }
 
     bool needsOnline = false;
-    if (mState < AUDIO_STREAM_CONFIGURED) {
+    if (mState < AUDIO_STREAM_CONFIGURED || mIdle) {
         mHardware->mLock.lock();
-        if (mState < AUDIO_STREAM_CONFIGURED) {
+        if (mState < AUDIO_STREAM_CONFIGURED || mIdle) {
             needsOnline = true;
         } else {
             mHardware->mLock.unlock();
@@ -1083,17 +1341,37 @@ ssize_t AudioHardware::AudioStreamOutTegra::write(const void* buffer, size_t byt
     }
 
     { // scope for the lock
-        Mutex::Autolock lock(mLock);
+        AudioStreamLock::Autolock lock(mLock);
 
         ssize_t written = 0;
-        const uint8_t* p = static_cast<const uint8_t*>(buffer);
-        size_t outsize = bytes;
+        const void *data = buffer;      // output of the last processing stage
+        const void *sinkData;
+        void *dst;
+        size_t outsize;                 // size of data as 16-bit samples
+        size_t maxBytes;
+        // The mix and the device EQ need Q31 samples. Once widened for them, the downmix
+        // and the SRC carry on in Q31, and the samples are dithered back to 16 bits
+        // once, before the driver or the first stage that only takes 16-bit samples.
+        // A write that needs neither the mix nor the EQ stays 16-bit: widening it for
+        // the SRC alone would double the cost of the path.
+        bool wide = false;              // data holds Q31 samples
         int outFd = mFd;
         bool stereo;
+        bool ecEnabled = false;
+        bool spkrSecondary;
+        bool spdifSecondary;
         ssize_t writtenToSpdif = 0;
+        nsecs_t now;
+        uint32_t underruns;
 
         if (needsOnline) {
-            status = online_l();
+            if (mIdle && mState == AUDIO_STREAM_CONFIGURED) {
+                status = resumeIdle_l();
+            } else {
+                now = systemTime();
+                status = online_l();
+                mStats.lap(AudioStageStats::STAGE_ONLINE, now);
+            }
             mHardware->mLock.unlock();
             if (status < 0) {
                 goto error;
@@ -1101,29 +1379,97 @@ ssize_t AudioHardware::AudioStreamOutTegra::write(const void* buffer, size_t byt
         }
         stereo = mIsBtEnabled ? false : (channels() == AudioSystem::CHANNEL_OUT_STEREO);
 
+        // Every stage must fit in the arena: take what does and report a short write.
+        maxBytes = mArena.capacity() / (AUDIO_HW_OUT_MAX_EXPANSION * AUDIO_HW_OUT_WIDE_EXPANSION);
+        if (bytes > maxBytes) {
+            ALOGW("%s: %u bytes do not fit in the scratch arena", __FUNCTION__, bytes);
+            bytes = maxBytes & ~(frameSize() - 1);
+        }
+        outsize = bytes;
+
+        if (client) {
+            mHardware->mMixer->onClientWrite(start);
+        }
+        if (mHardware->mMixer->hasActiveTracks()) {
+            // The mixed streams go through the same processing as the client buffer
+            now = systemTime();
+            data = widen(data, bytes);
+            wide = true;
+            mHardware->mMixer->mix((int32_t *)data, bytes / frameSize(), client);
+            mStats.lap(AudioStageStats::STAGE_MIX, now);
+        }
+
 #ifdef USE_PROPRIETARY_AUDIO_EXTENSIONS
         // Do Multimedia processing if appropriate for device and usecase.
-        mHardware->mAudioPP.doMmProcessing((void *)buffer, bytes / frameSize());
+        // The library only takes 16-bit samples.
+        if (wide) {
+            data = narrow(data, bytes);
+            wide = false;
+        }
+        now = systemTime();
+        dst = mArena.other(data);
+        memcpy(dst, data, bytes);
+        mHardware->mAudioPP.doMmProcessing(dst, bytes / frameSize());
+        data = dst;
+        mStats.lap(AudioStageStats::STAGE_MM_PROCESSING, now);
+#else
+        // The device EQ takes the place of the multimedia processing, in Q31
+        if (mHardware->mEqualizer.enabled()) {
+            now = systemTime();
+            if (!wide) {
+                data = widen(data, bytes);
+                wide = true;
+            }
+            // data is in the arena, after widen()
+            mHardware->mEqualizer.process((int32_t *)data, bytes / frameSize());
+            mStats.lap(AudioStageStats::STAGE_MM_PROCESSING, now);
+        }
 #endif
 
-        if (mIsSpkrEnabled && mIsBtEnabled) {
-            // When dual routing to CPCAP and Bluetooth, piggyback CPCAP audio now,
-            // and then down convert for the BT.
-            // CPCAP is always 44.1 in this case.
-            // This also works in the three-way routing case.
+        // When dual routing to CPCAP and Bluetooth, piggyback CPCAP audio now,
+        // and then down convert for the BT.
+        // CPCAP is always 44.1 in this case.
+        // This also works in the three-way routing case.
+        spkrSecondary = mIsSpkrEnabled && mIsBtEnabled;
+        // When dual routing to Speaker and HDMI, piggyback HDMI now, since it
+        // has no mic we'll leave the rest of the acoustic processing for the
+        // CPCAP hardware path.
+        // This also works in the three-way routing case, except the acoustic
+        // tuning will be done on Bluetooth, since it has the exclusive mic amd
+        // it also needs the sample rate conversion
+        spdifSecondary = mIsSpdifEnabled && mSpdifFd >= 0 && (mIsSpkrEnabled || mIsBtEnabled);
+        sinkData = data;
+        if (wide && (spkrSecondary || spdifSecondary || mIsSpdifEnabled)) {
+            // These sinks take their own 16-bit copy, the main sink carries on in Q31
+            sinkData = narrow(data, outsize);
+        }
+        if (spkrSecondary || spdifSecondary) {
+            // The piggybacked sinks are written by their own thread from a copy of the
+            // unprocessed buffer, while this thread processes and writes the main sink.
             Mutex::Autolock lock2(mFdLock);
-            ::write(outFd, buffer, outsize);
-        }
-        if (mIsSpdifEnabled) {
-            // When dual routing to Speaker and HDMI, piggyback HDMI now, since it
-            // has no mic we'll leave the rest of the acoustic processing for the
-            // CPCAP hardware path.
-            // This also works in the three-way routing case, except the acoustic
-            // tuning will be done on Bluetooth, since it has the exclusive mic amd
-            // it also needs the sample rate conversion
+            AudioSinkBuffer *sinkBuf = mSinkPool.obtain(sinkData, outsize);
+            if (sinkBuf != NULL) {
+                if (spkrSecondary) {
+                    mSpkrWriter->queue(mFd, sinkBuf);
+                }
+                if (spdifSecondary) {
+                    mSpdifWriter->queue(mSpdifFd, sinkBuf);
+                }
+                sinkBuf->release();
+            } else {
+                if (spkrSecondary) {
+                    devIo()->write(mFd, sinkData, outsize);
+                }
+                if (spdifSecondary) {
+                    devIo()->write(mSpdifFd, sinkData, outsize);
+                }
+            }
+        }
+        if (mIsSpdifEnabled && !spdifSecondary) {
+            // HDMI only: this is the main sink, there is nothing to overlap with.
             Mutex::Autolock lock2(mFdLock);
             if (mSpdifFd >= 0) {
-                writtenToSpdif = ::write(mSpdifFd, buffer, outsize);
+                writtenToSpdif = devIo()->write(mSpdifFd, sinkData, outsize);
                 ALOGV("%s: written %d bytes to SPDIF", __FUNCTION__, (int)writtenToSpdif);
             } else {
                 ALOGW("s/pdif enabled but unavailable");
@@ -1135,69 +1481,81 @@ ssize_t AudioHardware::AudioStreamOutTegra::write(const void* buffer, size_t byt
             outFd = -1;
         }
 
-#ifdef USE_PROPRIETARY_AUDIO_EXTENSIONS
         // Check if sample rate conversion or ECNS are required.
-        // Caution: Upconversion (from 44.1 to 48) would require a new output buffer larger than the
-        // original one.
         if (mDriverRate != (int)sampleRate()) {
             if (!mSrc.initted() ||
                  mSrc.inRate() != (int)sampleRate() ||
                  mSrc.outRate() != mDriverRate) {
-                ALOGD("%s: downconvert started from %d to %d",__FUNCTION__,
+                ALOGD("%s: conversion started from %d to %d",__FUNCTION__,
                      sampleRate(), mDriverRate);
-                mSrc.init(sampleRate(), mDriverRate);
+                if (mDriverRate > (int)sampleRate() * AUDIO_HW_OUT_MAX_EXPANSION) {
+                    ALOGE("%s: cannot convert up to %d", __FUNCTION__, mDriverRate);
+                    status = BAD_VALUE;
+                    goto error;
+                }
+                mSrc.init(sampleRate(), mDriverRate, AUDIO_HW_OUT_SRC_QUALITY);
                 if (!mSrc.initted()) {
                     status = -1;
                     goto error;
                 }
-                // Workaround to give multiple of 4 bytes to driver: Keep one sample
-                // buffered in case SRC returns an odd number of samples.
-                mHaveSpareSample = false;
+                // Give multiples of 4 bytes to the driver: an odd mono sample stays
+                // in the converter history until the next write.
+                mSrc.setOutputAlign(2);
+                mPosition.setPipelineDelay(mSrc.delayNs());
             }
-        } else {
+        } else if (mSrc.initted()) {
             mSrc.deinit();
+            mPosition.setPipelineDelay(0);
         }
+#ifdef USE_PROPRIETARY_AUDIO_EXTENSIONS
+        ecEnabled = mHardware->mAudioPP.isEcEnabled();
+#endif
 
-        if (mHardware->mAudioPP.isEcEnabled() || mSrc.initted())
+        if (ecEnabled || mSrc.initted())
         {
             // cut audio down to Mono for SRC or ECNS
             if (channels() == AudioSystem::CHANNEL_OUT_STEREO)
             {
-                // Do stereo-to-mono downmix before SRC, in-place
-                int16_t *destBuf = (int16_t *) buffer;
-                for (int i = 0; i < (int)bytes/2; i++) {
-                     destBuf[i] = (destBuf[i*2]>>1) + (destBuf[i*2+1]>>1);
+                // Do stereo-to-mono downmix before SRC
+                now = systemTime();
+                dst = mArena.other(data);
+                if (wide) {
+                    AudioDsp::downmixStereoToMonoQ31((int32_t *)dst, (const int32_t *)data,
+                                                     outsize / frameSize());
+                } else {
+                    AudioDsp::downmixStereoToMono((int16_t *)dst, (const int16_t *)data,
+                                                  outsize / frameSize());
                 }
+                data = dst;
+                mStats.lap(AudioStageStats::STAGE_DOWNMIX, now);
                 outsize >>= 1;
             }
         }
 
         if (mSrc.initted()) {
-            // Apply the sample rate conversion.
-            mSrc.mIoData.in_buf_ch1 = (SRC16 *) (buffer);
-            mSrc.mIoData.in_buf_ch2 = 0;
-            mSrc.mIoData.input_count = outsize / sizeof(SRC16);
-            mSrc.mIoData.out_buf_ch1 = (SRC16 *) (buffer);
-            mSrc.mIoData.out_buf_ch2 = 0;
-            mSrc.mIoData.output_count = outsize / sizeof(SRC16);
-            if (mHaveSpareSample) {
-                // Leave room for placing the spare.
-                mSrc.mIoData.out_buf_ch1++;
-                mSrc.mIoData.output_count--;
+            // Apply the sample rate conversion, leaving room to go back up to stereo.
+            dst = mArena.other(data);
+            mSrc.mIoData.inBuf = (const int16_t *)data;
+            mSrc.mIoData.inCount = outsize / sizeof(int16_t);
+            mSrc.mIoData.outBuf = (int16_t *)dst;
+            mSrc.mIoData.outCount = mArena.capacity() / (2 * sizeof(int16_t));
+            now = systemTime();
+            if (wide) {
+                mSrc.mIoData.outCount = mArena.capacity() / (2 * sizeof(int32_t));
+                mSrc.srcConvertQ31((const int32_t *)data, &mSrc.mIoData.inCount,
+                                   (int32_t *)dst, &mSrc.mIoData.outCount);
+            } else {
+                mSrc.srcConvert();
             }
-            mSrc.srcConvert();
+            data = dst;
+            mStats.lap(AudioStageStats::STAGE_SRC, now);
             ALOGV("Converted %d bytes at %d to %d bytes at %d",
-                 outsize, sampleRate(), mSrc.mIoData.output_count*2, mDriverRate);
-            if (mHaveSpareSample) {
-                int16_t *bufp = (int16_t*)buffer;
-                bufp[0]=mSpareSample;
-                mSrc.mIoData.output_count++;
-                mHaveSpareSample = false;
-            }
-            outsize = mSrc.mIoData.output_count*2;
+                 outsize, sampleRate(), mSrc.mIoData.outCount*2, mDriverRate);
+            outsize = mSrc.mIoData.outCount*2;
             ALOGV("Outsize is now %d", outsize);
         }
-        if (mHardware->mAudioPP.isEcEnabled()) {
+#ifdef USE_PROPRIETARY_AUDIO_EXTENSIONS
+        if (ecEnabled) {
             // EC/NS is a blocking interface, to synchronise with read.
             // It also consumes data when EC/NS is running.
             // It expects MONO data.
@@ -1207,39 +1565,48 @@ ssize_t AudioHardware::AudioStreamOutTegra::write(const void* buffer, size_t byt
             // Indicate that it is safe to call setDriver_l() without locking mLock: if the input
             // stream is started, doRouting_l() will not block when setDriver_l() is called.
             mLocked = true;
+            if (wide) {
+                data = narrow(data, outsize);
+                wide = false;
+            }
             ALOGV("writeDownlinkEcns size %d", outsize);
-            written = mHardware->mAudioPP.writeDownlinkEcns(outFd,(void *)buffer,
+            now = systemTime();
+            written = mHardware->mAudioPP.writeDownlinkEcns(outFd,(void *)data,
                                                             stereo, outsize, &mFdLock);
+            mStats.lap(AudioStageStats::STAGE_ECNS, now);
             mLocked = false;
         }
-        if (mHardware->mAudioPP.isEcEnabled() || mSrc.initted()) {
+#endif
+        if (ecEnabled || mSrc.initted()) {
             // Move audio back up to Stereo, if the EC/NS wasn't in fact running and we're
             // writing to a stereo device.
             if (stereo &&
                 written != (ssize_t)outsize) {
-                // Back up to stereo, in place.
-                int16_t *destBuf = (int16_t *) buffer;
-                for (int i = outsize/2-1; i >= 0; i--) {
-                    destBuf[i*2] = destBuf[i];
-                    destBuf[i*2+1] = destBuf[i];
+                // Back up to stereo.
+                dst = mArena.other(data);
+                if (wide) {
+                    AudioDsp::upmixMonoToStereoQ31((int32_t *)dst, (const int32_t *)data,
+                                                   outsize / sizeof(int16_t));
+                } else {
+                    AudioDsp::upmixMonoToStereo((int16_t *)dst, (const int16_t *)data,
+                                                outsize / sizeof(int16_t));
                 }
+                data = dst;
                 outsize <<= 1;
             }
         }
-#endif
 
+        if (wide) {
+            data = narrow(data, outsize);
+            wide = false;
+        }
+        mLevelMeter.add((const int16_t *)data, outsize / sizeof(int16_t));
         if (written != (ssize_t)outsize) {
-            // The sample rate conversion modifies the output size.
-            if (outsize&0x3) {
-                int16_t* bufp = (int16_t *)buffer;
-//                ALOGV("Keep the spare sample away from the driver.");
-                mHaveSpareSample = true;
-                mSpareSample = bufp[outsize/2 - 1];
-            }
-
             if (outFd >= 0) {
                 Mutex::Autolock lock2(mFdLock);
-                written = ::write(outFd, buffer, outsize&(~0x3));
+                now = systemTime();
+                written = devIo()->write(outFd, data, outsize&(~0x3));
+                mStats.lap(AudioStageStats::STAGE_DRIVER, now);
                 if (written != ((ssize_t)outsize&(~0x3))) {
                     status = written;
                     goto error;
@@ -1253,6 +1620,37 @@ ssize_t AudioHardware::AudioStreamOutTegra::write(const void* buffer, size_t byt
             status = written;
             goto error;
         }
+        now = mStats.lap(AudioStageStats::STAGE_TOTAL, start);
+        if (needsOnline) {
+            // Until the client buffer is queued behind the preload, if any
+            mStats.lap(AudioStageStats::STAGE_FIRST_WRITE, start);
+        }
+        // Only the frames of the client count in its position
+        if (client) {
+            mPosition.onWrite(mIsBtEnabled ? AudioPositionTracker::SINK_BLUETOOTH :
+                              (mIsSpkrEnabled ? AudioPositionTracker::SINK_SPEAKER :
+                                                AudioPositionTracker::SINK_SPDIF),
+                              bytes / frameSize(), now);
+            if (!silent) {
+                mSilentSince = 0;
+                mIdlePending = false;
+            } else if (mSilentSince == 0) {
+                mSilentSince = start;
+            } else if (now - mSilentSince >= milliseconds(mIdleTimeoutMs)) {
+                mIdlePending = true;
+            }
+        }
+        // The number of buffers only applies to the speaker driver. During EC/NS it is
+        // fixed by the profile to bound the echo path delay.
+        underruns = mIsSpkrEnabled ? getUnderruns() : 0;
+        mStats.addUnderruns(underruns);
+        if (mIsSpkrEnabled && !mHardware->mEcnsEnabled &&
+                mBufferTuner.onWrite(now, underruns) &&
+                mState == AUDIO_STREAM_CONFIGURED) {
+            // The driver only takes a new number of buffers when empty: have online_l()
+            // flush it and apply the new count at next write.
+            mState = AUDIO_STREAM_NEW_RATE_REQ;
+        }
 
         // Sample rate converter may be stashing a couple of bytes here or there,
         // so just report that all bytes were consumed. (it would be a bug not to.)
@@ -1262,12 +1660,36 @@ ssize_t AudioHardware::AudioStreamOutTegra::write(const void* buffer, size_t byt
     }
 error:
     ALOGE("write(): error, return %d", status);
-    standby();
+    standbyNow();
     usleep(bytes * 1000 / frameSize() / sampleRate() * 1000);
 
     return status;
 }
 
+void *AudioHardware::AudioStreamOutTegra::widen(const void *data, size_t bytes)
+{
+    void *dst = mArena.other(data);
+    AudioDsp::expandToQ31((int32_t *)dst, (const int16_t *)data, bytes / sizeof(int16_t));
+    return dst;
+}
+
+void *AudioHardware::AudioStreamOutTegra::narrow(const void *data, size_t bytes)
+{
+    nsecs_t start = systemTime();
+    void *dst = mArena.other(data);
+    AudioDsp::ditherToPcm16((int16_t *)dst, (const int32_t *)data, bytes / sizeof(int16_t),
+                            mDither);
+    mStats.lap(AudioStageStats::STAGE_DITHER, start);
+    return dst;
+}
+
+void AudioHardware::AudioStreamOutTegra::lock()
+{
+    nsecs_t start = systemTime();
+    mLock.lock();
+    mStats.lap(AudioStageStats::STAGE_ROUTING_LOCK, start);
+}
+
 void AudioHardware::AudioStreamOutTegra::flush()
 {
     // Prevent someone from writing the fd while we flush
@@ -1278,33 +1700,75 @@ void AudioHardware::AudioStreamOutTegra::flush()
 void AudioHardware::AudioStreamOutTegra::flush_l()
 {
     ALOGV("AudioStreamOutTegra::flush()");
-    if (::ioctl(mFdCtl, TEGRA_AUDIO_OUT_FLUSH) < 0)
+    // Drop the data not yet given to the drivers and wait for the writes in progress.
+    mSpkrWriter->flush();
+    mSpdifWriter->flush();
+    if (!mIdle) {
+        mPosition.onFlush(systemTime());
+    }
+    if (devIo()->ioctl(mFdCtl, TEGRA_AUDIO_OUT_FLUSH) < 0)
        ALOGE("could not flush playback: %s", strerror(errno));
-    if (::ioctl(mBtFdCtl, TEGRA_AUDIO_OUT_FLUSH) < 0)
+    if (devIo()->ioctl(mBtFdCtl, TEGRA_AUDIO_OUT_FLUSH) < 0)
        ALOGE("could not flush bluetooth: %s", strerror(errno));
-    if (mSpdifFdCtl >= 0 && ::ioctl(mSpdifFdCtl, TEGRA_AUDIO_OUT_FLUSH) < 0)
+    if (mSpdifFdCtl >= 0 && devIo()->ioctl(mSpdifFdCtl, TEGRA_AUDIO_OUT_FLUSH) < 0)
        ALOGE("could not flush spdif: %s", strerror(errno));
     ALOGV("AudioStreamOutTegra::flush() returns");
 }
 
+// Called with mLock held
+void AudioHardware::AudioStreamOutTegra::resetBufferTuner()
+{
+    int minBufs = mProfile->numBufs < AUDIO_HW_MIN_OUT_BUF ? mProfile->numBufs :
+                                                             AUDIO_HW_MIN_OUT_BUF;
+    mBufferTuner.reset(minBufs, mProfile->numBufs,
+            (nsecs_t)(bufferSize() / frameSize()) * 1000000000LL / sampleRate());
+}
+
+// Underruns of the speaker driver since the last call
+uint32_t AudioHardware::AudioStreamOutTegra::getUnderruns()
+{
+#ifdef TEGRA_AUDIO_OUT_GET_ERROR_COUNT
+    struct tegra_audio_error_counts errors;
+    if (devIo()->ioctl(mFdCtl, TEGRA_AUDIO_OUT_GET_ERROR_COUNT, &errors) < 0) {
+        return 0;
+    }
+    return errors.late_dma + errors.full_empty;
+#else
+    return 0;
+#endif
+}
+
 // FIXME: this is a workaround for issue 3387419 with impact on latency
 // to be removed when root cause is fixed
 void AudioHardware::AudioStreamOutTegra::setNumBufs(int numBufs)
 {
     Mutex::Autolock lock(mFdLock);
     ALOGV("AudioStreamOutTegra::setNumBufs(%d)", numBufs);
-    if (::ioctl(mFdCtl, TEGRA_AUDIO_OUT_SET_NUM_BUFS, &numBufs) < 0)
-       ALOGE("could not set number of output buffers: %s", strerror(errno));
+    // The driver keeps its number of buffers across standby
+    if (numBufs != mNumBufs) {
+        if (devIo()->ioctl(mFdCtl, TEGRA_AUDIO_OUT_SET_NUM_BUFS, &numBufs) < 0) {
+            ALOGE("could not set number of output buffers: %s", strerror(errno));
+        }
+    }
+    mNumBufs = numBufs;
+    // Same assumption as latency(): one driver buffer holds bufferSize() bytes.
+    mPosition.setQueueCapacity(
+            (nsecs_t)numBufs * (bufferSize() / frameSize()) * 1000000000LL / sampleRate());
 }
 
-// Called with mLock and mHardware->mLock held
+// Called with mLock and mHardware->mLock held.
+// The steps that would leave the hardware as it is are skipped: this is on the path of
+// the first write after standby, usually a short UI sound.
 status_t AudioHardware::AudioStreamOutTegra::online_l()
 {
     status_t status = NO_ERROR;
+    bool flushed = false;       // no data left in the drivers
 
     if (mState < AUDIO_STREAM_NEW_RATE_REQ) {
         if (mState == AUDIO_STREAM_IDLE) {
             ALOGV("output %p going online", this);
+            // standbyNow() flushed the drivers, and nothing was written since
+            flushed = true;
             mState = AUDIO_STREAM_CONFIG_REQ;
             // update EC state if necessary
             if (mHardware->getActiveInput_l() && mHardware->isEcRequested()) {
@@ -1317,9 +1781,12 @@ status_t AudioHardware::AudioStreamOutTegra::online_l()
 
         // If there's no hardware speaker, leave the HW alone. (i.e. SCO/SPDIF is on)
         if (mIsSpkrEnabledReq) {
-            status = mHardware->doStandby(mFdCtl, true, false); // output, online
-        } else {
+            if (!mHardware->mCurOutDevice.on) {
+                status = mHardware->doStandby(mFdCtl, true, false); // output, online
+            }
+        } else if (mHardware->mCurOutDevice.on) {
             status = mHardware->doStandby(mFdCtl, true, true); // output, standby
+            flushed = true;
         }
         mIsSpkrEnabled = mIsSpkrEnabledReq;
 
@@ -1329,21 +1796,32 @@ status_t AudioHardware::AudioStreamOutTegra::online_l()
     }
 
     // Flush old data (wrong rate) from I2S driver before changing rate.
-    flush();
+    if (!flushed) {
+        flush();
+    }
     if (mHardware->mEcnsEnabled) {
-        setNumBufs(AUDIO_HW_NUM_OUT_BUF);
+        setNumBufs(mProfile->numBufsEcns);
     } else {
-        setNumBufs(AUDIO_HW_NUM_OUT_BUF_LONG);
+        setNumBufs(mBufferTuner.numBufs());
     }
+    // Clear the errors counted while the driver was drained by standby or by the flush
+    getUnderruns();
+    mIdle = false;
+    mSilentSince = 0;
     int speaker_rate = mHardware->mHwOutRate;
     if (mIsBtEnabled) {
         speaker_rate = AUDIO_HW_OUT_SAMPLERATE;
     }
     // Now the DMA is empty, change the rate.
-    if (::ioctl(mHardware->mCpcapCtlFd, CPCAP_AUDIO_OUT_SET_RATE,
-              speaker_rate) < 0)
-        ALOGE("could not set output rate(%d): %s",
-              speaker_rate, strerror(errno));
+    if (speaker_rate != mSpeakerRate) {
+        mSpeakerRate = speaker_rate;
+        if (devIo()->ioctl(mHardware->mCpcapCtlFd, CPCAP_AUDIO_OUT_SET_RATE,
+                  speaker_rate) < 0) {
+            ALOGE("could not set output rate(%d): %s",
+                  speaker_rate, strerror(errno));
+            mSpeakerRate = 0;
+        }
+    }
 
     mDriverRate = mHardware->mHwOutRate;
 
@@ -1356,11 +1834,13 @@ status_t AudioHardware::AudioStreamOutTegra::online_l()
             fd = mFd;
         }
         if (fd >= 0) {
-            size_t bufSize = (mDriverRate * 2 /* stereo */ * sizeof(int16_t))/ 50;
-            char buf[bufSize];
-            memset(buf, 0, bufSize);
+            size_t bufSize = mDriverRate * 2 /* stereo */ * sizeof(int16_t) *
+                             AUDIO_HW_OUT_ECNS_PRELOAD_MS / 1000;
+            if (bufSize > mSilenceSize) {
+                bufSize = mSilenceSize;
+            }
             Mutex::Autolock lock2(mFdLock);
-            ::write(fd, buf, bufSize);
+            devIo()->write(fd, mSilence, bufSize & ~0x3);
         }
     }
 
@@ -1370,6 +1850,20 @@ status_t AudioHardware::AudioStreamOutTegra::online_l()
 }
 
 status_t AudioHardware::AudioStreamOutTegra::standby()
+{
+    if (!mHardware) {
+        return NO_INIT;
+    }
+    mClientStandby = true;
+    // The mixer thread is still writing the mixed streams, it calls standbyMix() when done
+    if (mHardware->mMixer->playing()) {
+        ALOGV("output %p standby deferred to the mixer", this);
+        return NO_ERROR;
+    }
+    return standbyNow();
+}
+
+status_t AudioHardware::AudioStreamOutTegra::standbyNow()
 {
     if (!mHardware) {
         return NO_INIT;
@@ -1377,11 +1871,16 @@ status_t AudioHardware::AudioStreamOutTegra::standby()
 
     status_t status = NO_ERROR;
     Mutex::Autolock lock(mHardware->mLock);
-    Mutex::Autolock lock2(mLock);
+    AudioStreamLock::Autolock lock2(mLock);
 
     if (mState != AUDIO_STREAM_IDLE) {
         ALOGV("output %p going into standby", this);
         mState = AUDIO_STREAM_IDLE;
+        mIdle = false;
+        mIdlePending = false;
+        mSilentSince = 0;
+        mPosition.onStandby(systemTime());
+        mBufferTuner.onStandby();
 
         // update EC state if necessary
         if (mHardware->getActiveInput_l() && mHardware->isEcRequested()) {
@@ -1421,6 +1920,8 @@ status_t AudioHardware::AudioStreamOutTegra::dump(int fd, const Vector<String16>
     result.append(buffer);
     snprintf(buffer, SIZE, "\tformat: %d\n", format());
     result.append(buffer);
+    snprintf(buffer, SIZE, "\toutput profile: %s, %d buffers\n", mProfile->name, mNumBufs);
+    result.append(buffer);
     snprintf(buffer, SIZE, "\tmHardware: %p\n", mHardware);
     result.append(buffer);
     snprintf(buffer, SIZE, "\tmFd: %d\n", mFd);
@@ -1436,7 +1937,15 @@ status_t AudioHardware::AudioStreamOutTegra::dump(int fd, const Vector<String16>
         snprintf(buffer, SIZE, "\tmStandby: unknown\n");
 
     result.append(buffer);
+    snprintf(buffer, SIZE, "\tidle standby: %s, after %u ms of silence, %u times\n",
+             mIdle ? "on" : "off", mIdleTimeoutMs, mIdleEntries);
+    result.append(buffer);
+    mPosition.dump(result);
+    mBufferTuner.dump(result);
+    mStats.dump(result);
     ::write(fd, result.string(), result.size());
+    mSpkrWriter->dump(fd);
+    mSpdifWriter->dump(fd);
     return NO_ERROR;
 }
 
@@ -1462,12 +1971,109 @@ status_t AudioHardware::AudioStreamOutTegra::setParameters(const String8& keyVal
         param.remove(key);
     }
 
+    // AudioFlinger reads bufferSize() back only after a frame count change: a profile
+    // of another buffer size is only taken together with its frame count, and the
+    // frame count alone must be the one of the active profile.
+    const char OUTPUT_PROFILE_KEY[] = "output_profile";
+    String8 value;
+    int frameCount = 0;
+    bool hasFrameCount = param.getInt(String8(AudioParameter::keyFrameCount),
+                                      frameCount) == NO_ERROR;
+    param.remove(String8(AudioParameter::keyFrameCount));
+    key = String8(OUTPUT_PROFILE_KEY);
+    if (param.get(key, value) == NO_ERROR) {
+        status_t profileStatus = setProfile(value.string(), hasFrameCount ? frameCount : 0);
+        if (profileStatus != NO_ERROR) {
+            status = profileStatus;
+        }
+        param.remove(key);
+    } else if (hasFrameCount && frameCount != (int)(bufferSize() / frameSize())) {
+        status = BAD_VALUE;
+    }
+
+    // Silence, or no write, for this long puts the output hardware to standby. 0 disables it.
+    const char IDLE_STANDBY_KEY[] = "idle_standby_ms";
+    int idleMs;
+    key = String8(IDLE_STANDBY_KEY);
+    if (param.getInt(key, idleMs) == NO_ERROR) {
+        if (idleMs >= 0) {
+            setIdleTimeout(idleMs);
+        } else {
+            status = BAD_VALUE;
+        }
+        param.remove(key);
+    }
+
+    // Level meter of what is played, read back with getParameters()
+    const char LEVELS_KEY[] = "levels";
+    int levels;
+    key = String8(LEVELS_KEY);
+    if (param.getInt(key, levels) == NO_ERROR) {
+        mLevelMeter.setEnabled(levels != 0);
+        param.remove(key);
+    }
+
     if (param.size()) {
         status = BAD_VALUE;
     }
     return status;
 }
 
+status_t AudioHardware::AudioStreamOutTegra::setProfile(const char *name, int frameCount)
+{
+    const AudioOutputProfile *profile = mHardware->mOutputProfiles.get(name);
+    if (profile == NULL) {
+        ALOGW("unknown output profile %s", name);
+        return BAD_VALUE;
+    }
+    int profileFrames = profile->bufferSize / frameSize();
+    if (frameCount != 0 && frameCount != profileFrames) {
+        return BAD_VALUE;
+    }
+
+    bool resized;
+    {
+        Mutex::Autolock lock(mHardware->mLock);
+        AudioStreamLock::Autolock lock2(mLock);
+        if (profile == mProfile) {
+            return NO_ERROR;
+        }
+        resized = profile->bufferSize != mProfile->bufferSize;
+        if (resized && frameCount == 0) {
+            ALOGW("output profile %s needs frame_count=%d", name, profileFrames);
+            return BAD_VALUE;
+        }
+        ALOGV("output profile %s -> %s", mProfile->name, profile->name);
+        mProfile = profile;
+        resetBufferTuner();
+        if (mState == AUDIO_STREAM_CONFIGURED) {
+            // online_l() flushes the driver and applies the new number of buffers and
+            // queue capacity at next write()
+            mState = AUDIO_STREAM_NEW_RATE_REQ;
+        } else {
+            setNumBufs(mHardware->mEcnsEnabled ? mProfile->numBufsEcns : mBufferTuner.numBufs());
+        }
+    }
+    if (resized) {
+        // Not under the locks: the mixer thread may be in writeMix()
+        mHardware->mMixer->setSink(this, bufferSize() / frameSize(), sampleRate());
+    }
+    return NO_ERROR;
+}
+
+void AudioHardware::AudioStreamOutTegra::setIdleTimeout(uint32_t ms)
+{
+    {
+        AudioStreamLock::Autolock lock(mLock);
+        ALOGV("output idle standby after %u ms", ms);
+        mIdleTimeoutMs = ms;
+        mSilentSince = 0;
+        mIdlePending = false;
+    }
+    // A disabled timeout leaves the current idle standby, if any, at next write
+    mHardware->mMixer->setIdleTimeout(ms);
+}
+
 String8 AudioHardware::AudioStreamOutTegra::getParameters(const String8& keys)
 {
     AudioParameter param = AudioParameter(keys);
@@ -1479,27 +2085,336 @@ String8 AudioHardware::AudioStreamOutTegra::getParameters(const String8& keys)
         param.addInt(key, (int)mDevices);
     }
 
+    const char OUTPUT_PROFILE_KEY[] = "output_profile";
+    key = String8(OUTPUT_PROFILE_KEY);
+    if (param.get(key, value) == NO_ERROR) {
+        param.add(key, String8(mProfile->name));
+    }
+
+    const char IDLE_STANDBY_KEY[] = "idle_standby_ms";
+    key = String8(IDLE_STANDBY_KEY);
+    if (param.get(key, value) == NO_ERROR) {
+        param.addInt(key, (int)mIdleTimeoutMs);
+    }
+
+    // "<peak dBFS>,<rms dBFS>,<clipped samples>" since the last query, if enabled
+    const char LEVELS_KEY[] = "levels";
+    key = String8(LEVELS_KEY);
+    if (param.get(key, value) == NO_ERROR) {
+        if (mLevelMeter.enabled()) {
+            param.add(key, mLevelMeter.read());
+        } else {
+            param.remove(key);
+        }
+    }
+
+    // "<frames>,<seconds>.<nanoseconds>" of CLOCK_MONOTONIC, see getPresentationPosition()
+    const char PRESENTATION_POSITION_KEY[] = "presentation_position";
+    key = String8(PRESENTATION_POSITION_KEY);
+    if (param.get(key, value) == NO_ERROR) {
+        uint64_t frames;
+        struct timespec ts;
+        if (getPresentationPosition(&frames, &ts) == NO_ERROR) {
+            char buf[64];
+            snprintf(buf, sizeof(buf), "%llu,%ld.%09ld",
+                     (unsigned long long)frames, (long)ts.tv_sec, (long)ts.tv_nsec);
+            param.add(key, String8(buf));
+        } else {
+            param.remove(key);
+        }
+    }
+
     ALOGV("AudioStreamOutTegra::getParameters() %s", param.toString().string());
     return param.toString();
 }
 
 status_t AudioHardware::AudioStreamOutTegra::getRenderPosition(uint32_t *dspFrames)
 {
-    //TODO: enable when supported by driver
-    return INVALID_OPERATION;
+    if (dspFrames == NULL) {
+        return BAD_VALUE;
+    }
+    *dspFrames = mPosition.renderPosition(systemTime());
+    return NO_ERROR;
+}
+
+status_t AudioHardware::AudioStreamOutTegra::getPresentationPosition(uint64_t *frames,
+                                                                    struct timespec *timestamp)
+{
+    if (frames == NULL || timestamp == NULL) {
+        return BAD_VALUE;
+    }
+    clock_gettime(CLOCK_MONOTONIC, timestamp);
+    nsecs_t now = (nsecs_t)timestamp->tv_sec * 1000000000LL + timestamp->tv_nsec;
+    return mPosition.presentationPosition(now, frames);
+}
+
+// ----------------------------------------------------------------------------
+
+AudioHardware::AudioStreamOutMixed::AudioStreamOutMixed() :
+    mHardware(0), mFormat(AudioSystem::PCM_16_BIT), mSampleRate(AUDIO_HW_OUT_SAMPLERATE),
+    mChannels(AudioSystem::CHANNEL_OUT_STEREO), mFrameSize(0), mBufferSize(0), mDevices(0),
+    mAdded(false), mRenderBase(0)
+{
+}
+
+status_t AudioHardware::AudioStreamOutMixed::set(
+        AudioHardware* hw, uint32_t devices, int *pFormat, uint32_t *pChannels, uint32_t *pRate)
+{
+    int lFormat = pFormat ? *pFormat : 0;
+    uint32_t lChannels = pChannels ? *pChannels : 0;
+    uint32_t lRate = pRate ? *pRate : 0;
+
+    mHardware = hw;
+
+    // fix up defaults
+    if (lFormat == 0) lFormat = format();
+    if (lChannels == 0) lChannels = AudioSystem::CHANNEL_OUT_STEREO;
+    if (lRate == 0) lRate = AUDIO_HW_OUT_SAMPLERATE;
+
+    // check values. The framework opens the mixed outputs of audio_policy.conf in 16-bit,
+    // the wider formats are for the clients that open the HAL themselves.
+    if ((lFormat != AudioSystem::PCM_16_BIT &&
+         lFormat != AUDIO_FORMAT_PCM_32_BIT &&
+         lFormat != AUDIO_FORMAT_PCM_8_24_BIT) ||
+        (lChannels != AudioSystem::CHANNEL_OUT_STEREO &&
+         lChannels != AudioSystem::CHANNEL_OUT_MONO) ||
+        (lRate < AUDIO_HW_MIXED_MIN_RATE) || (lRate > AUDIO_HW_MIXED_MAX_RATE)) {
+        if (pFormat) *pFormat = AudioSystem::PCM_16_BIT;
+        if (pChannels) *pChannels = AudioSystem::CHANNEL_OUT_STEREO;
+        if (pRate) *pRate = AUDIO_HW_OUT_SAMPLERATE;
+        return BAD_VALUE;
+    }
+
+    mFormat = lFormat;
+    mFrameSize = AudioSystem::popCount(lChannels) *
+                 (lFormat == AudioSystem::PCM_16_BIT ? sizeof(int16_t) : sizeof(int32_t));
+    mSampleRate = lRate;
+    mChannels = lChannels;
+    mDevices = devices;
+    if (lRate != AUDIO_HW_OUT_SAMPLERATE) {
+        if (mSrcLeft.init(lRate, AUDIO_HW_OUT_SAMPLERATE, AUDIO_HW_OUT_SRC_QUALITY) != NO_ERROR ||
+                (lChannels == AudioSystem::CHANNEL_OUT_STEREO &&
+                 mSrcRight.init(lRate, AUDIO_HW_OUT_SAMPLERATE,
+                                AUDIO_HW_OUT_SRC_QUALITY) != NO_ERROR)) {
+            if (pRate) *pRate = AUDIO_HW_OUT_SAMPLERATE;
+            return BAD_VALUE;
+        }
+    }
+    mBufferSize = (lRate * AUDIO_HW_MIXED_BUFFER_MS / 1000) * mFrameSize;
+
+    // The track can hold the queue of the largest sink period; the mixer only fills it
+    // up to the queue of the current one, so that the stream is not further ahead.
+    size_t queueFrames = AudioOutputMixer::QUEUE_PERIODS *
+                         mHardware->mOutputProfiles.maxBufferSize() / (2 * sizeof(int16_t));
+    if (mTrack.init(queueFrames * AudioOutputMixer::FRAME_SIZE) != NO_ERROR) {
+        return NO_MEMORY;
+    }
+    if (mHardware->mMixer->addTrack(&mTrack) != NO_ERROR) {
+        ALOGW("no room for another mixed output stream");
+        return INVALID_OPERATION;
+    }
+    mAdded = true;
+
+    if (pFormat) *pFormat = lFormat;
+    if (pChannels) *pChannels = lChannels;
+    if (pRate) *pRate = lRate;
+    ALOGV("mixed output %p: format %d, %d Hz, %d channels", this, lFormat, lRate,
+          AudioSystem::popCount(lChannels));
+    return NO_ERROR;
+}
+
+AudioHardware::AudioStreamOutMixed::~AudioStreamOutMixed()
+{
+    if (mAdded) {
+        standby();
+        mHardware->mMixer->removeTrack(&mTrack);
+    }
+}
+
+uint32_t AudioHardware::AudioStreamOutMixed::latency() const
+{
+    // The primary output is only deleted with the hardware lock released
+    Mutex::Autolock lock(mHardware->mLock);
+    AudioStreamOutTegra *output = mHardware->mOutput;
+    uint32_t queueMs = mHardware->mMixer->queueFrames() * 1000 / AUDIO_HW_OUT_SAMPLERATE;
+    return queueMs + (output ? output->latency() : 0);
+}
+
+status_t AudioHardware::AudioStreamOutMixed::setVolume(float left, float right)
+{
+    const float maxGain = 32767.0f / AudioDsp::UNITY_GAIN;
+    if (left < 0.0f || right < 0.0f || left > maxGain || right > maxGain) {
+        return BAD_VALUE;
+    }
+    mTrack.setVolume((int16_t)(left * AudioDsp::UNITY_GAIN + 0.5f),
+                     (int16_t)(right * AudioDsp::UNITY_GAIN + 0.5f));
+    return NO_ERROR;
+}
+
+// Converts to stereo Q31 at the sink rate and queues to the track; blocks while the
+// track is full, so that the stream is paced by the primary output.
+ssize_t AudioHardware::AudioStreamOutMixed::write(const void* buffer, size_t bytes)
+{
+    bool started;
+    { // scope for the lock
+        Mutex::Autolock lock(mLock);
+        started = !playing();
+        write_l(buffer, bytes);
+    }
+    if (started) {
+        // The hardware may not be routed to this stream's devices yet: the policy does
+        // not route an output again when it restarts on the same devices.
+        mHardware->doRouting();
+    }
+    return bytes;
+}
+
+void AudioHardware::AudioStreamOutMixed::write_l(const void* buffer, size_t bytes)
+{
+    const uint8_t *in = (const uint8_t *)buffer;
+    size_t frames = bytes / mFrameSize;
+    bool stereo = mChannels == AudioSystem::CHANNEL_OUT_STEREO;
+    size_t channelCount = stereo ? 2 : 1;
+
+    if (!mHardware->mMixer->hasSink()) {
+        // The primary output is closed: drop the audio at the rate it would play
+        usleep(frames * 1000000LL / mSampleRate);
+        return;
+    }
+    while (frames != 0) {
+        size_t inCount = frames < CHUNK_FRAMES ? frames : CHUNK_FRAMES;
+        size_t outCount = MAX_CHUNK_OUT;
+        const int32_t *wide = mIn;
+        const int32_t *out = mOut;
+        if (mFormat == AudioSystem::PCM_16_BIT) {
+            AudioDsp::expandToQ31(mIn, (const int16_t *)in, inCount * channelCount);
+        } else if (mFormat == AUDIO_FORMAT_PCM_8_24_BIT) {
+            AudioDsp::q824ToQ31(mIn, (const int32_t *)in, inCount * channelCount);
+        } else {
+            wide = (const int32_t *)in;
+        }
+        if (!mSrcLeft.initted()) {
+            if (stereo) {
+                out = wide;
+            } else {
+                AudioDsp::upmixMonoToStereoQ31(mOut, wide, inCount);
+            }
+            outCount = inCount;
+        } else if (stereo) {
+            size_t inRight = inCount;
+            size_t outRight = MAX_CHUNK_OUT;
+            AudioDsp::deinterleaveQ31(mLeft, mRight, wide, inCount);
+            mSrcLeft.convert(mLeft, &inCount, mOutLeft, &outCount);
+            mSrcRight.convert(mRight, &inRight, mOutRight, &outRight);
+            AudioDsp::interleaveQ31(mOut, mOutLeft, mOutRight, outCount);
+        } else {
+            mSrcLeft.convert(wide, &inCount, mOutLeft, &outCount);
+            AudioDsp::upmixMonoToStereoQ31(mOut, mOutLeft, outCount);
+        }
+        if (inCount == 0) {
+            ALOGE("%s: converter stalled", __FUNCTION__);
+            break;
+        }
+        if (mHardware->mMixer->write(&mTrack, out, outCount) == 0 && outCount != 0 &&
+                !mHardware->mMixer->hasSink()) {
+            usleep(frames * 1000000LL / mSampleRate);
+            break;
+        }
+        in += inCount * mFrameSize;
+        frames -= inCount;
+    }
+}
+
+status_t AudioHardware::AudioStreamOutMixed::standby()
+{
+    Mutex::Autolock lock(mLock);
+    mHardware->mMixer->standby(&mTrack);
+    mRenderBase = mHardware->mMixer->framesMixed(&mTrack);
+    if (mSrcLeft.initted()) {
+        mSrcLeft.reset();
+        mSrcRight.reset();
+    }
+    return NO_ERROR;
+}
+
+status_t AudioHardware::AudioStreamOutMixed::dump(int fd, const Vector<String16>& args)
+{
+    const size_t SIZE = 256;
+    char buffer[SIZE];
+    String8 result;
+    result.append("AudioStreamOutMixed::dump\n");
+    snprintf(buffer, SIZE, "\tsample rate: %d\n", sampleRate());
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tformat: %d\n", format());
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tbuffer size: %d\n", bufferSize());
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tchannels: %d\n", channels());
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\ttrack: %p, %u frames queued of %u\n", &mTrack,
+             (unsigned)mTrack.framesQueued(), (unsigned)mHardware->mMixer->queueFrames());
+    result.append(buffer);
+    ::write(fd, result.string(), result.size());
+    return NO_ERROR;
+}
+
+// The hardware plays on the devices of all the outputs playing, see outputDevices_l().
+status_t AudioHardware::AudioStreamOutMixed::setParameters(const String8& keyValuePairs)
+{
+    AudioParameter param = AudioParameter(keyValuePairs);
+    String8 key = String8(AudioParameter::keyRouting);
+    int device;
+    ALOGV("AudioStreamOutMixed::setParameters() %s", keyValuePairs.string());
+
+    if (param.getInt(key, device) == NO_ERROR) {
+        if (device != 0) {
+            mDevices = device;
+            // The primary output is not routed while it does not play
+            mHardware->doRouting();
+        }
+        param.remove(key);
+    }
+    if (param.size()) {
+        return BAD_VALUE;
+    }
+    return NO_ERROR;
+}
+
+String8 AudioHardware::AudioStreamOutMixed::getParameters(const String8& keys)
+{
+    AudioParameter param = AudioParameter(keys);
+    String8 value;
+    String8 key = String8(AudioParameter::keyRouting);
+
+    if (param.get(key, value) == NO_ERROR) {
+        param.addInt(key, (int)mDevices);
+    }
+    ALOGV("AudioStreamOutMixed::getParameters() %s", param.toString().string());
+    return param.toString();
+}
+
+// Frames mixed since the last standby, at the stream rate
+status_t AudioHardware::AudioStreamOutMixed::getRenderPosition(uint32_t *dspFrames)
+{
+    if (dspFrames == NULL) {
+        return BAD_VALUE;
+    }
+    Mutex::Autolock lock(mLock);
+    uint64_t frames = mHardware->mMixer->framesMixed(&mTrack) - mRenderBase;
+    *dspFrames = (uint32_t)(frames * mSampleRate / AUDIO_HW_OUT_SAMPLERATE);
+    return NO_ERROR;
 }
 
 // ----------------------------------------------------------------------------
 
 // always succeeds, must call set() immediately after
 AudioHardware::AudioStreamInTegra::AudioStreamInTegra() :
-    mHardware(0), mFd(-1), mFdCtl(-1), mState(AUDIO_STREAM_IDLE), mRetryCount(0),
+    mHardware(0), mState(AUDIO_STREAM_IDLE), mRetryCount(0),
     mFormat(AUDIO_HW_IN_FORMAT), mChannels(AUDIO_HW_IN_CHANNELS),
     mSampleRate(AUDIO_HW_IN_SAMPLERATE), mBufferSize(AUDIO_HW_IN_BUFFERSIZE),
     mAcoustics((AudioSystem::audio_in_acoustics)0), mDevices(0),
-    mIsMicEnabled(0), mIsBtEnabled(0),
-    mSource(AUDIO_SOURCE_DEFAULT), mLocked(false), mTotalBuffersRead(0),
-    mDriverRate(AUDIO_HW_IN_SAMPLERATE), mEcnsRequested(0)
+    mSource(AUDIO_SOURCE_DEFAULT), mLocked(false), mEcnsRequested(0),
+    mFramesRead(0), mCaptureNs(0)
 {
     ALOGV("AudioStreamInTegra constructor");
 }
@@ -1509,7 +2424,7 @@ status_t AudioHardware::AudioStreamInTegra::set(
         AudioHardware* hw, uint32_t devices, int *pFormat, uint32_t *pChannels, uint32_t *pRate,
         AudioSystem::audio_in_acoustics acoustic_flags)
 {
-    Mutex::Autolock lock(mLock);
+    AudioStreamLock::Autolock lock(mLock);
     status_t status = BAD_VALUE;
     mHardware = hw;
     if (pFormat == 0)
@@ -1548,6 +2463,16 @@ status_t AudioHardware::AudioStreamInTegra::set(
     mSampleRate = *pRate;
     mBufferSize = mHardware->getInputBufferSize(mSampleRate, AudioSystem::PCM_16_BIT,
                                                 AudioSystem::popCount(mChannels));
+    // Room for a client buffer and the driver periods around it at any driver rate.
+    // Larger reads grow it.
+    if (mCapture.reserve(mBufferSize / sizeof(int16_t) +
+                         2 * AUDIO_HW_IN_MAX_RATE * AUDIO_HW_IN_PERIOD_MS / 1000) != NO_ERROR) {
+        return NO_MEMORY;
+    }
+    // This input's share of the capture
+    if (mClient.init(AUDIO_HW_IN_RING_BYTES) != NO_ERROR) {
+        return NO_MEMORY;
+    }
     return NO_ERROR;
 }
 
@@ -1564,22 +2489,14 @@ void AudioHardware::AudioStreamInTegra::setDriver_l(bool mic, bool bluetooth, in
 {
     ALOGV("In setDriver_l() Analog mic? %s. Bluetooth? %s.", mic?"yes":"no", bluetooth?"yes":"no");
 
-    // force some reconfiguration at next read()
-    // Note: mState always == AUDIO_STREAM_CONFIGURED when setDriver_l() is called on an input
-    if (mic != mIsMicEnabled || bluetooth != mIsBtEnabled) {
-        mState = AUDIO_STREAM_CONFIG_REQ;
-    } else if (sampleRate != mDriverRate) {
-        mState = AUDIO_STREAM_NEW_RATE_REQ;
-    }
-
-    mIsMicEnabled = mic;
-    mIsBtEnabled = bluetooth;
-
+    // force some reconfiguration of the shared capture at next read()
+    mHardware->mCaptureSplitter->setPath(mic, bluetooth, sampleRate);
 }
 
 ssize_t AudioHardware::AudioStreamInTegra::read(void* buffer, ssize_t bytes)
 {
     status_t status;
+    nsecs_t start = systemTime();
     if (!mHardware) {
         ALOGE("%s: mHardware is null", __FUNCTION__);
         return NO_INIT;
@@ -1587,16 +2504,13 @@ ssize_t AudioHardware::AudioStreamInTegra::read(void* buffer, ssize_t bytes)
     //
     ALOGV("AudioStreamInTegra::read(%p, %ld) TID %d", buffer, bytes, gettid());
 
-    if (mSleepReq) {
-        // sleep a few milliseconds so that the processor can be given to the thread attempting to
-        // lock mLock before we sleep with mLock held while reading below
-        usleep(FORCED_SLEEP_TIME_US);
-    }
-
+    AudioCaptureSplitter *splitter = mHardware->mCaptureSplitter.get();
     bool needsOnline = false;
-    if (mState < AUDIO_STREAM_CONFIGURED) {
+    if (mState < AUDIO_STREAM_CONFIGURED ||
+            splitter->state() < AudioCaptureSplitter::STATE_CONFIGURED) {
         mHardware->mLock.lock();
-        if (mState < AUDIO_STREAM_CONFIGURED) {
+        if (mState < AUDIO_STREAM_CONFIGURED ||
+                splitter->state() < AudioCaptureSplitter::STATE_CONFIGURED) {
             needsOnline = true;
         } else {
             mHardware->mLock.unlock();
@@ -1604,12 +2518,9 @@ ssize_t AudioHardware::AudioStreamInTegra::read(void* buffer, ssize_t bytes)
     }
 
     {   // scope for mLock
-        Mutex::Autolock lock(mLock);
+        AudioStreamLock::Autolock lock(mLock);
 
-        ssize_t ret;
-        bool srcReqd;
-        int  hwReadBytes;
-        int16_t * inbuf;
+        ssize_t ret = 0;
 
         if (needsOnline) {
             status = online_l();
@@ -1620,66 +2531,63 @@ ssize_t AudioHardware::AudioStreamInTegra::read(void* buffer, ssize_t bytes)
             }
         }
 
-        srcReqd = (mDriverRate != (int)mSampleRate);
-
-#ifdef USE_PROPRIETARY_AUDIO_EXTENSIONS
-        if (srcReqd) {
-            hwReadBytes = ( bytes*mDriverRate/mSampleRate ) & (~0x7);
-            ALOGV("Running capture SRC.  HW=%d bytes at %d, Flinger=%d bytes at %d",
-                  hwReadBytes, mDriverRate, (int)bytes, mSampleRate);
-            inbuf = mInScratch;
-            if ((size_t)bytes > sizeof(mInScratch)) {
-                ALOGE("read: buf size problem. %d>%d",(int)bytes,sizeof(mInScratch));
-                status = BAD_VALUE;
-                goto error;
-            }
-            // Check if we need to init the rate converter
-            if (!mSrc.initted() ||
-                 mSrc.inRate() != mDriverRate ||
-                 mSrc.outRate() != (int)mSampleRate) {
-                ALOGD ("%s: Upconvert started from %d to %d", __FUNCTION__,
-                       mDriverRate, mSampleRate);
-                mSrc.init(mDriverRate, mSampleRate);
-                if (!mSrc.initted()) {
+        // Fill the client buffer exactly: convert what is pending, then read whole
+        // capture periods for the rest. What is left over goes to the next read.
+        size_t channelCount = AudioSystem::popCount(mChannels);
+        size_t outFrames = bytes / frameSize();
+        size_t produced = 0;
+        while (produced < outFrames) {
+            if (!mCapture.started()) {
+                int rate, channels;
+                splitter->sync(&mClient, &rate, &channels);
+                ALOGD("%s: capture conversion started from %d Hz %d ch to %d Hz %d ch",
+                      __FUNCTION__, rate, channels, mSampleRate, (int)channelCount);
+                if (mCapture.start(rate, channels, mSampleRate, channelCount,
+                                   AUDIO_HW_IN_SRC_QUALITY, AUDIO_HW_IN_PERIOD_MS) != NO_ERROR) {
                     status = NO_INIT;
                     goto error;
                 }
             }
-        } else {
-            hwReadBytes = bytes;
-            inbuf = (int16_t *)buffer;
-            mSrc.deinit();
-        }
-        // Read from driver, or ECNS thread, as appropriate.
-        {
-            Mutex::Autolock dfl(mFdLock);
-            ret = mHardware->mAudioPP.read(mFd, inbuf, hwReadBytes, mDriverRate);
-        }
-        if (ret>0 && srcReqd) {
-            mSrc.mIoData.in_buf_ch1 = (SRC16 *) (inbuf);
-            mSrc.mIoData.in_buf_ch2 = 0;
-            mSrc.mIoData.input_count = hwReadBytes / sizeof(SRC16);
-            mSrc.mIoData.out_buf_ch1 = (SRC16 *) (buffer);
-            mSrc.mIoData.out_buf_ch2 = 0;
-            mSrc.mIoData.output_count = bytes/sizeof(SRC16);
-            mSrc.srcConvert();
-            ret = mSrc.mIoData.output_count*sizeof(SRC16);
-            if (ret > bytes) {
-                ALOGE("read: buffer overrun");
+            nsecs_t now = systemTime();
+            produced += mCapture.convert((int16_t *)buffer + produced * channelCount,
+                                         outFrames - produced);
+            mStats.lap(AudioStageStats::STAGE_SRC, now);
+            if (produced == outFrames) {
+                break;
+            }
+            size_t count = mCapture.inputNeeded(outFrames - produced);
+            int16_t *inbuf = mCapture.inputBuffer(count);
+            if (inbuf == NULL) {
+                status = NO_MEMORY;
+                goto error;
             }
+            size_t inFrameSize = mCapture.inChannels() * sizeof(int16_t);
+            ret = readDriver_l(inbuf, count * inFrameSize);
+            if (ret == WOULD_BLOCK) {
+                // The capture was reconfigured: convert from its new format
+                mCapture.stop();
+                ret = 0;
+                continue;
+            }
+            if (ret <= 0) {
+                break;
+            }
+            mCapture.inputDone(ret / inFrameSize);
         }
-#else
-        if (srcReqd) {
-            ALOGE("%s: sample rate mismatch HAL %d, driver %d",
-                 __FUNCTION__, mSampleRate, mDriverRate);
-            status = INVALID_OPERATION;
-            goto error;
+        if (ret >= 0) {
+            ret = produced * frameSize();
         }
-        {
-            Mutex::Autolock dfl(mFdLock);
-            ret = ::read(mFd, buffer, bytes);
+        if (produced) {
+            // The last frame returned is behind the next one in the ring by what the
+            // conversion still holds.
+            nsecs_t captureNs;
+            if (splitter->captureTime(&mClient, mCapture.pending() + 1, &captureNs) != NO_ERROR) {
+                captureNs = 0;
+            }
+            Mutex::Autolock _pl(mPositionLock);
+            mFramesRead += produced;
+            mCaptureNs = captureNs;
         }
-#endif
 
         // It is not optimal to mute after all the above processing but it is necessary to
         // keep the clock sync from input device. It also avoids glitches on output streams due
@@ -1690,6 +2598,9 @@ ssize_t AudioHardware::AudioStreamInTegra::read(void* buffer, ssize_t bytes)
             ALOGV("%s muted",__FUNCTION__);
             memset(buffer, 0, bytes);
         }
+        if (ret > 0) {
+            mLevelMeter.add((const int16_t *)buffer, ret / sizeof(int16_t));
+        }
 
         ALOGV("%s returns %d.",__FUNCTION__, (int)ret);
         if (ret < 0) {
@@ -1697,10 +2608,7 @@ ssize_t AudioHardware::AudioStreamInTegra::read(void* buffer, ssize_t bytes)
             goto error;
         }
 
-        {
-            Mutex::Autolock _fl(mFramesLock);
-            mTotalBuffersRead++;
-        }
+        mStats.lap(AudioStageStats::STAGE_TOTAL, start);
         return ret;
     }
 
@@ -1711,6 +2619,24 @@ error:
     return status;
 }
 
+// Reads this input's share of the capture. Called with mLock held.
+ssize_t AudioHardware::AudioStreamInTegra::readDriver_l(void *buffer, size_t bytes)
+{
+    AudioCaptureSplitter *splitter = mHardware->mCaptureSplitter.get();
+    nsecs_t now = systemTime();
+    ssize_t ret = splitter->read(&mClient, buffer, bytes);
+    mStats.lap(AudioStageStats::STAGE_DRIVER, now);
+    mStats.addOverruns(splitter->takeOverruns(&mClient));
+    return ret;
+}
+
+void AudioHardware::AudioStreamInTegra::lock()
+{
+    nsecs_t start = systemTime();
+    mLock.lock();
+    mStats.lap(AudioStageStats::STAGE_ROUTING_LOCK, start);
+}
+
 bool AudioHardware::AudioStreamInTegra::getStandby() const
 {
     return mState == AUDIO_STREAM_IDLE;
@@ -1723,30 +2649,33 @@ status_t AudioHardware::AudioStreamInTegra::standby()
     }
 
     Mutex::Autolock lock(mHardware->mLock);
-    Mutex::Autolock lock2(mLock);
+    AudioStreamLock::Autolock lock2(mLock);
+    AudioCaptureSplitter *splitter = mHardware->mCaptureSplitter.get();
     status_t status = NO_ERROR;
     if (mState != AUDIO_STREAM_IDLE) {
         ALOGV("input %p going into standby", this);
         mState = AUDIO_STREAM_IDLE;
-        // stopping capture now so that the input stream state (AUDIO_STREAM_IDLE)
-        // is consistent with the driver state when doRouting_l() is executed.
-        // Not doing so makes that I2S reconfiguration fails  when switching from
-        // BT SCO to built-in mic.
-        stop_l();
-        // reset global pre processing state before disabling the input
-        mHardware->setEcnsRequested_l(PREPROC_AEC|PREPROC_NS, false);
+        // restart the capture converter from a clean history on the next read
+        mCapture.stop();
+        splitter->detach(&mClient);
+        bool last = !splitter->hasClients();
+        if (last) {
+            // stopping capture now so that the input stream state (AUDIO_STREAM_IDLE)
+            // is consistent with the driver state when doRouting_l() is executed.
+            // Not doing so makes that I2S reconfiguration fails  when switching from
+            // BT SCO to built-in mic.
+            splitter->stopReader();
+            stop_l();
+        }
+        // drop the pre processing requested by this input
+        mHardware->updateEcnsRequested_l();
         // setDriver_l() will not try to lock mLock when called by doRouting_l()
         mLocked = true;
         mHardware->doRouting_l();
         mLocked = false;
-        status = mHardware->doStandby(mFdCtl, false, true); // input, standby
-        if (mFd >= 0) {
-            ::close(mFd);
-            mFd = -1;
-        }
-        if (mFdCtl >= 0) {
-            ::close(mFdCtl);
-            mFdCtl = -1;
+        if (last) {
+            status = mHardware->doStandby(splitter->fdCtl(), false, true); // input, standby
+            splitter->close();
         }
     }
 
@@ -1756,111 +2685,111 @@ status_t AudioHardware::AudioStreamInTegra::standby()
 // Called with mLock and mHardware->mLock held
 status_t AudioHardware::AudioStreamInTegra::online_l()
 {
+    AudioCaptureSplitter *splitter = mHardware->mCaptureSplitter.get();
     status_t status = NO_ERROR;
 
-    reopenReconfigDriver();
-
-    if (mState < AUDIO_STREAM_NEW_RATE_REQ) {
-
-        // Use standby to flush the driver.  mHardware->mLock should already be held
-
-        mHardware->doStandby(mFdCtl, false, true);
-        if (mDevices & ~AudioSystem::DEVICE_IN_BLUETOOTH_SCO_HEADSET) {
-            status = mHardware->doStandby(mFdCtl, false, false);
+    // The first input opens the capture driver. The others join the running capture
+    // and only restart it if the routing they ask for changes the path or the rate.
+    bool restart = splitter->state() == AudioCaptureSplitter::STATE_IDLE;
+    if (restart) {
+        status = reopenReconfigDriver();
+        if (status != NO_ERROR) {
+            return status;
         }
+    }
 
-        if (mState == AUDIO_STREAM_IDLE) {
-            mState = AUDIO_STREAM_CONFIG_REQ;
-            ALOGV("input %p going online", this);
-            // apply pre processing requested for this input
-            mHardware->setEcnsRequested_l(mEcnsRequested, true);
-            // setDriver_l() will not try to lock mLock when called by doRouting_l()
-            mLocked = true;
-            mHardware->doRouting_l();
-            mLocked = false;
-            {
-                Mutex::Autolock _fl(mFramesLock);
-                mTotalBuffersRead = 0;
-                mStartTimeNs = systemTime();
-            }
+    if (mState == AUDIO_STREAM_IDLE) {
+        status = splitter->attach(&mClient);
+        if (status != NO_ERROR) {
+            return status;
+        }
+        mState = AUDIO_STREAM_CONFIG_REQ;
+        ALOGV("input %p going online", this);
+        {
+            Mutex::Autolock _pl(mPositionLock);
+            mFramesRead = 0;
+            mCaptureNs = 0;
         }
+        // apply pre processing requested for this input
+        mHardware->updateEcnsRequested_l();
+        // setDriver_l() will not try to lock mLock when called by doRouting_l()
+        mLocked = true;
+        mHardware->doRouting_l();
+        mLocked = false;
+    }
 
-        // configuration
-        struct tegra_audio_in_config config;
-        status = ::ioctl(mFdCtl, TEGRA_AUDIO_IN_GET_CONFIG, &config);
-        if (status < 0) {
-            ALOGE("cannot read input config: %s", strerror(errno));
+    if (!restart && splitter->state() < AudioCaptureSplitter::STATE_NEW_RATE_REQ) {
+        restart = true;
+        status = reopenReconfigDriver();
+        if (status != NO_ERROR) {
             return status;
         }
-        config.stereo = AudioSystem::popCount(mChannels) == 2;
-        config.rate = mHardware->mHwInRate;
-        status = ::ioctl(mFdCtl, TEGRA_AUDIO_IN_SET_CONFIG, &config);
+    }
 
-        if (status < 0) {
-            ALOGE("cannot set input config: %s", strerror(errno));
-            if (::ioctl(mFdCtl, TEGRA_AUDIO_IN_GET_CONFIG, &config) == 0) {
-                if (config.stereo) {
-                    mChannels = AudioSystem::CHANNEL_IN_STEREO;
-                } else {
-                    mChannels = AudioSystem::CHANNEL_IN_MONO;
-                }
+    if (restart || splitter->state() != AudioCaptureSplitter::STATE_CONFIGURED) {
+        int channels = splitter->channels();
+        splitter->stopReader();
+        if (restart) {
+            // configuration
+            struct tegra_audio_in_config config;
+            status = devIo()->ioctl(splitter->fdCtl(), TEGRA_AUDIO_IN_GET_CONFIG, &config);
+            if (status < 0) {
+                ALOGE("cannot read input config: %s", strerror(errno));
+                return status;
+            }
+            config.stereo = AudioSystem::popCount(mChannels) == 2;
+            config.rate = mHardware->mHwInRate;
+            status = devIo()->ioctl(splitter->fdCtl(), TEGRA_AUDIO_IN_SET_CONFIG, &config);
+
+            if (status < 0) {
+                ALOGE("cannot set input config: %s", strerror(errno));
+                devIo()->ioctl(splitter->fdCtl(), TEGRA_AUDIO_IN_GET_CONFIG, &config);
             }
+            channels = config.stereo ? 2 : 1;
         }
 
+        if (devIo()->ioctl(mHardware->mCpcapCtlFd, CPCAP_AUDIO_IN_SET_RATE,
+                    mHardware->mHwInRate) < 0)
+            ALOGE("could not set input rate(%d): %s", mHardware->mHwInRate, strerror(errno));
 
+        splitter->setConfigured(mHardware->mHwInRate, channels);
+        status = splitter->startReader();
     }
 
-    mDriverRate = mHardware->mHwInRate;
-
-    if (::ioctl(mHardware->mCpcapCtlFd, CPCAP_AUDIO_IN_SET_RATE,
-                mDriverRate) < 0)
-        ALOGE("could not set input rate(%d): %s", mDriverRate, strerror(errno));
-
-    mState = AUDIO_STREAM_CONFIGURED;
+    if (status == NO_ERROR) {
+        mState = AUDIO_STREAM_CONFIGURED;
+    }
 
     return status;
 }
 
 // serves a similar purpose as the init() method of other classes
-void AudioHardware::AudioStreamInTegra::reopenReconfigDriver()
+// Called with mLock and mHardware->mLock held
+status_t AudioHardware::AudioStreamInTegra::reopenReconfigDriver()
 {
+    AudioCaptureSplitter *splitter = mHardware->mCaptureSplitter.get();
+
+    splitter->stopReader();
 #ifdef USE_PROPRIETARY_AUDIO_EXTENSIONS
     if (mHardware->mEcnsEnabled) {
         mHardware->mAudioPP.enableEcns(0);
         mHardware->mAudioPP.enableEcns(mHardware->mEcnsEnabled);
     }
 #endif
-    // Need to "restart" the driver when changing the buffer configuration.
-    if (mFdCtl >= 0 && ::ioctl(mFdCtl, TEGRA_AUDIO_IN_STOP) < 0) {
-        ALOGE("%s: could not stop recording: %s", __FUNCTION__, strerror(errno));
-    }
-    if (mFd >= 0) {
-        ::close(mFd);
-        mFd = -1;
-    }
-    if (mFdCtl >= 0) {
-        ::close(mFdCtl);
-        mFdCtl = -1;
-    }
-
     // This does not have a retry loop to avoid blocking if another record session already in progress
-    mFd = ::open("/dev/audio1_in", O_RDWR);
-    if (mFd < 0) {
-        ALOGE("open /dev/audio1_in failed: %s", strerror(errno));
+    status_t status = splitter->open();
+    if (status != NO_ERROR) {
+        return status;
     }
-    mFdCtl = ::open("/dev/audio1_in_ctl", O_RDWR);
-    if (mFdCtl < 0) {
-        ALOGE("open /dev/audio1_in_ctl failed: %s", strerror(errno));
-        if (mFd >= 0) {
-            ::close(mFd);
-            mFd = -1;
-        }
-    } else {
-        // here we would set mInit = true;
+
+    // Use standby to flush the driver.  mHardware->mLock should already be held
+    mHardware->doStandby(splitter->fdCtl(), false, true);
+    if (mDevices & ~AudioSystem::DEVICE_IN_BLUETOOTH_SCO_HEADSET) {
+        status = mHardware->doStandby(splitter->fdCtl(), false, false);
     }
+    return status;
 }
 
-
 status_t AudioHardware::AudioStreamInTegra::dump(int fd, const Vector<String16>& args)
 {
     const size_t SIZE = 256;
@@ -1877,12 +2806,11 @@ status_t AudioHardware::AudioStreamInTegra::dump(int fd, const Vector<String16>&
     result.append(buffer);
     snprintf(buffer, SIZE, "\tmHardware: %p\n", mHardware);
     result.append(buffer);
-    snprintf(buffer, SIZE, "\tmFd count: %d\n", mFd);
-    result.append(buffer);
     snprintf(buffer, SIZE, "\tmState: %d\n", mState);
     result.append(buffer);
     snprintf(buffer, SIZE, "\tmRetryCount: %d\n", mRetryCount);
     result.append(buffer);
+    mStats.dump(result);
     ::write(fd, result.string(), result.size());
     return NO_ERROR;
 }
@@ -1915,6 +2843,15 @@ status_t AudioHardware::AudioStreamInTegra::setParameters(const String8& keyValu
         param.remove(key);
     }
 
+    // Level meter of what is captured, read back with getParameters()
+    const char LEVELS_KEY[] = "levels";
+    int levels;
+    key = String8(LEVELS_KEY);
+    if (param.getInt(key, levels) == NO_ERROR) {
+        mLevelMeter.setEnabled(levels != 0);
+        param.remove(key);
+    }
+
     if (param.size()) {
         status = BAD_VALUE;
     }
@@ -1932,39 +2869,73 @@ String8 AudioHardware::AudioStreamInTegra::getParameters(const String8& keys)
         param.addInt(key, (int)mDevices);
     }
 
+    // "<peak dBFS>,<rms dBFS>,<clipped samples>" since the last query, if enabled
+    const char LEVELS_KEY[] = "levels";
+    key = String8(LEVELS_KEY);
+    if (param.get(key, value) == NO_ERROR) {
+        if (mLevelMeter.enabled()) {
+            param.add(key, mLevelMeter.read());
+        } else {
+            param.remove(key);
+        }
+    }
+
+    // "<frames>,<seconds>.<nanoseconds>" of CLOCK_MONOTONIC, see getCapturePosition()
+    const char CAPTURE_POSITION_KEY[] = "capture_position";
+    key = String8(CAPTURE_POSITION_KEY);
+    if (param.get(key, value) == NO_ERROR) {
+        uint64_t frames;
+        struct timespec ts;
+        if (getCapturePosition(&frames, &ts) == NO_ERROR) {
+            char buf[64];
+            snprintf(buf, sizeof(buf), "%llu,%ld.%09ld",
+                     (unsigned long long)frames, (long)ts.tv_sec, (long)ts.tv_nsec);
+            param.add(key, String8(buf));
+        } else {
+            param.remove(key);
+        }
+    }
+
     ALOGV("AudioStreamInTegra::getParameters() %s", param.toString().string());
     return param.toString();
 }
 
-unsigned int  AudioHardware::AudioStreamInTegra::getInputFramesLost() const
+status_t AudioHardware::AudioStreamInTegra::getCapturePosition(uint64_t *frames,
+                                                               struct timespec *timestamp)
 {
-    Mutex::Autolock _l(mFramesLock);
-    unsigned int lostFrames = 0;
-    if (!getStandby()) {
-        unsigned int framesPerBuffer = bufferSize() / frameSize();
-        uint64_t expectedFrames = ((systemTime() - mStartTimeNs) * mSampleRate) / 1000000000;
-        expectedFrames = (expectedFrames / framesPerBuffer) * framesPerBuffer;
-        uint64_t actualFrames = (uint64_t)mTotalBuffersRead * framesPerBuffer;
-        if (expectedFrames > actualFrames) {
-            lostFrames = (unsigned int)(expectedFrames - actualFrames);
-            ALOGW("getInputFramesLost() expected %d actual %d lost %d",
-                 (unsigned int)expectedFrames, (unsigned int)actualFrames, lostFrames);
-        }
+    if (frames == NULL || timestamp == NULL) {
+        return BAD_VALUE;
     }
+    Mutex::Autolock _pl(mPositionLock);
+    if (mCaptureNs == 0) {
+        return INVALID_OPERATION;
+    }
+    *frames = mFramesRead;
+    timestamp->tv_sec = mCaptureNs / 1000000000LL;
+    timestamp->tv_nsec = mCaptureNs % 1000000000LL;
+    return NO_ERROR;
+}
 
-    mTotalBuffersRead = 0;
-    mStartTimeNs = systemTime();
-
+unsigned int  AudioHardware::AudioStreamInTegra::getInputFramesLost() const
+{
+    // Frames the driver dropped and frames dropped from the ring of this input, counted
+    // exactly at the driver rate
+    AudioCaptureSplitter *splitter = mHardware->mCaptureSplitter.get();
+    uint32_t lost = splitter->takeLostFrames(&mClient);
+    int rate = splitter->rate();
+    if (lost == 0 || rate == 0) {
+        return 0;
+    }
+    unsigned int lostFrames = (unsigned int)((uint64_t)lost * mSampleRate / rate);
+    ALOGW("getInputFramesLost() lost %d", lostFrames);
     return lostFrames;
 }
 
-// must be called with mLock and mFdLock held
+// must be called with mLock and the capture fd lock held
 void AudioHardware::AudioStreamInTegra::stop_l()
 {
     ALOGV("AudioStreamInTegra::stop_l() starts");
-    if (::ioctl(mFdCtl, TEGRA_AUDIO_IN_STOP) < 0) {
-        ALOGE("could not stop recording: %d %s", errno, strerror(errno));
-    }
+    mHardware->mCaptureSplitter->stopDma();
     ALOGV("AudioStreamInTegra::stop_l() returns");
 }
 
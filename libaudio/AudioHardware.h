@@ -25,58 +25,64 @@
 
 #include <hardware_legacy/AudioHardwareBase.h>
 #include "AudioPostProcessor.h"
-#ifdef USE_PROPRIETARY_AUDIO_EXTENSIONS
-extern "C" {
-#include "rate_conv.h"
-}
-#endif
+#include "AudioPolyphaseSrc.h"
+#include "AudioSinkWriter.h"
+#include "AudioPositionTracker.h"
+#include "AudioOutputProfiles.h"
+#include "AudioBufferTuner.h"
+#include "AudioStats.h"
+#include "AudioScratchArena.h"
+#include "AudioStreamLock.h"
+#include "AudioRoutingState.h"
+#include "AudioCaptureStage.h"
+#include "AudioCaptureSplitter.h"
+#include "AudioTuningStore.h"
+#include "AudioOutputMixer.h"
+#include "AudioDsp.h"
+#include "AudioEqualizer.h"
 
 namespace android_audio_legacy {
     using android::AutoMutex;
     using android::Mutex;
     using android::SortedVector;
+    using android::sp;
 
 #include <linux/cpcap_audio.h>
 #include <linux/tegra_audio.h>
 
 #define AUDIO_HW_OUT_SAMPLERATE 44100
-#define AUDIO_HW_NUM_OUT_BUF 2
 #define AUDIO_HW_OUT_LATENCY_MS 0
-
-// FIXME: this is a workaround for issue 3387419 with impact on latency
-// to be removed when root cause is fixed
-#define AUDIO_HW_NUM_OUT_BUF_LONG 4
+// Output buffering is set by the active profile, see AudioOutputProfiles.h. Outside of
+// EC/NS the number of buffers is lowered down to this while no underrun is seen.
+#define AUDIO_HW_MIN_OUT_BUF 2
+// Silence queued when the output goes online with EC/NS, to limit underruns
+#define AUDIO_HW_OUT_ECNS_PRELOAD_MS 20
+// Largest growth of a client buffer through the write path (upsampling to the driver
+// rate); the scratch arena of the output stream is sized for it.
+#define AUDIO_HW_OUT_MAX_EXPANSION 2
+// Digital silence written for this long puts the output hardware to standby, while the
+// stream stays configured; see AudioStreamOutTegra::enterIdle(). 0 disables it.
+#define AUDIO_HW_OUT_IDLE_STANDBY_MS 2000
+// The write path widens to Q31 for the mix and the device EQ, the downmix and the SRC
+// that follow them stay in Q31.
+#define AUDIO_HW_OUT_WIDE_EXPANSION (sizeof(int32_t) / sizeof(int16_t))
 
 #define AUDIO_HW_IN_SAMPLERATE 11025                  // Default audio input sample rate
 #define AUDIO_HW_IN_CHANNELS (AudioSystem::CHANNEL_IN_MONO) // Default audio input channel mask
 #define AUDIO_HW_IN_BUFFERSIZE (4096)               // Default audio input buffer size
 #define AUDIO_HW_IN_FORMAT (AudioSystem::PCM_16_BIT)  // Default audio input sample format
+#define AUDIO_HW_IN_PERIOD_MS 20                    // Driver reads are whole periods
+#define AUDIO_HW_IN_MAX_RATE 48000
+#define AUDIO_HW_IN_RING_BYTES (32 * 1024)          // Per input share of the capture, power of 2
 
-enum {
-    AUDIO_HW_GAIN_SPKR_GAIN = 0,
-    AUDIO_HW_GAIN_MIC_GAIN,
-    AUDIO_HW_GAIN_NUM_DIRECTIONS
-};
-enum {
-    AUDIO_HW_GAIN_USECASE_VOICE= 0,
-    AUDIO_HW_GAIN_USECASE_MM,
-    AUDIO_HW_GAIN_USECASE_VOICE_REC,
-    AUDIO_HW_GAIN_NUM_USECASES
-};
-enum {
-    AUDIO_HW_GAIN_EARPIECE = 0,
-    AUDIO_HW_GAIN_SPEAKERPHONE,
-    AUDIO_HW_GAIN_HEADSET_W_MIC,
-    AUDIO_HW_GAIN_MONO_HEADSET,
-    AUDIO_HW_GAIN_HEADSET_NO_MIC,
-    AUDIO_HW_GAIN_EMU_DEVICE,
-    AUDIO_HW_GAIN_RSVD1,
-    AUDIO_HW_GAIN_RSVD2,
-    AUDIO_HW_GAIN_RSVD3,
-    AUDIO_HW_GAIN_RSVD4,
-    AUDIO_HW_GAIN_RSVD5,
-    AUDIO_HW_GAIN_NUM_PATHS
-};
+// Output streams opened while the primary one is open are mixed into it
+#define AUDIO_HW_MIXED_MIN_RATE 8000
+#define AUDIO_HW_MIXED_MAX_RATE 48000
+#define AUDIO_HW_MIXED_BUFFER_MS 20                 // Default write size of a mixed stream
+
+// Sample rate converter quality for playback (down to BT SCO) and capture
+#define AUDIO_HW_OUT_SRC_QUALITY (AudioPolyphaseSrc::QUALITY_MEDIUM)
+#define AUDIO_HW_IN_SRC_QUALITY (AudioPolyphaseSrc::QUALITY_HIGH)
 
 enum input_state {
     AUDIO_STREAM_IDLE,
@@ -88,6 +94,7 @@ enum input_state {
 class AudioHardware : public  AudioHardwareBase
 {
     class AudioStreamOutTegra;
+    class AudioStreamOutMixed;
     class AudioStreamInTegra;
     class AudioStreamSrc;
 
@@ -147,7 +154,9 @@ public:
 #endif
                };
 
-               void        setEcnsRequested_l(int ecns, bool enabled);
+               // EC/NS runs on the shared capture: it is requested while an active input
+               // asks for it.
+               void        updateEcnsRequested_l();
                bool        isEcRequested() { return !!(mEcnsRequested & PREPROC_AEC); }
 protected:
     // AudioHardwareBase provides default implementation
@@ -168,36 +177,47 @@ private:
     status_t    doStandby(int stop_fd, bool output, bool enable);
     status_t    doRouting_l();
     status_t    doRouting();
+    // Devices of the outputs playing, those of the primary output if none is
+    uint32_t    outputDevices_l();
     status_t    setVolume_l(float v, int usecase);
     uint8_t     getGain(int direction, int usecase);
-    void        readHwGainFile();
 
     AudioStreamInTegra*   getActiveInput_l();
     status_t    setMicMute_l(bool state);
 
-#ifdef USE_PROPRIETARY_AUDIO_EXTENSIONS
+    struct SrcIo {
+                const int16_t * inBuf;
+                size_t      inCount;    // in: samples available, out: samples consumed
+                int16_t *   outBuf;
+                size_t      outCount;   // in: room at outBuf, out: samples produced
+    };
+
     class AudioStreamSrc {
     public:
                             AudioStreamSrc();
                             ~AudioStreamSrc();
-    inline      int         inRate() {return mSrcInRate;};
-    inline      int         outRate() {return mSrcOutRate;};
+    inline      int         inRate() {return mSrc.inRate();};
+    inline      int         outRate() {return mSrc.outRate();};
     inline      bool        initted() {return mSrcInitted;};
-                void        init(int inRate, int outRate);
+                void        init(int inRate, int outRate, int quality);
     inline      void        deinit() {mSrcInitted = false;};
-                SRC_IO_T    mIoData;
-    inline      void        srcConvert() { rate_convert(&mIoData, &mSrcObj, 0x0800); };
+    inline      void        setOutputAlign(size_t align) { mSrc.setOutputAlign(align); };
+    inline      size_t      inputCountFor(size_t outCount) { return mSrc.inputCountFor(outCount); };
+                // filter group delay
+    inline      nsecs_t     delayNs() { return (nsecs_t)mSrc.taps() * 500000000LL / mSrc.inRate(); };
+                SrcIo       mIoData;
+    inline      void        srcConvert() { mSrc.convert(mIoData.inBuf, &mIoData.inCount,
+                                                        mIoData.outBuf, &mIoData.outCount); };
+                // Q31 samples, the counts are as in mIoData
+    inline      void        srcConvertQ31(const int32_t *in, size_t *inCount,
+                                          int32_t *out, size_t *outCount) {
+                                mSrc.convert(in, inCount, out, outCount); };
     private:
-                SRC_OBJ_T   mSrcObj;
-                char *      mSrcBuffer;
-                SRC_INIT_T  mSrcInit;
-                int         mSrcInRate;
-                int         mSrcOutRate;
+                AudioPolyphaseSrc mSrc;
                 bool        mSrcInitted;
     };
-#endif
 
-    class AudioStreamOutTegra : public AudioStreamOut {
+    class AudioStreamOutTegra : public AudioStreamOut, public AudioMixerSink {
     public:
                             AudioStreamOutTegra();
         virtual             ~AudioStreamOutTegra();
@@ -211,34 +231,63 @@ private:
                                 uint32_t *pRate);
         virtual uint32_t    sampleRate() const { return AUDIO_HW_OUT_SAMPLERATE; }
         // must be 32-bit aligned - driver only seems to like 4800
-        virtual size_t      bufferSize() const { return 4096; }
+        virtual size_t      bufferSize() const { return mProfile->bufferSize; }
         virtual uint32_t    channels() const { return AudioSystem::CHANNEL_OUT_STEREO; }
         virtual int         format() const { return AudioSystem::PCM_16_BIT; }
-        virtual uint32_t    latency() const { return (1000*AUDIO_HW_NUM_OUT_BUF_LONG*(bufferSize()/frameSize()))/sampleRate()+AUDIO_HW_OUT_LATENCY_MS; }
+        virtual uint32_t    latency() const { return (1000*(mNumBufs ? mNumBufs : mProfile->numBufs)*(bufferSize()/frameSize()))/sampleRate()+AUDIO_HW_OUT_LATENCY_MS; }
         virtual status_t    setVolume(float left, float right) { return INVALID_OPERATION; }
         virtual ssize_t     write(const void* buffer, size_t bytes);
                 void        flush();
                 void        flush_l();
+                // Ignored while the mixer plays secondary streams, see standbyMix()
         virtual status_t    standby();
                 status_t    online_l();
+                // AudioMixerSink
+        virtual ssize_t     writeMix(size_t frames);
+        virtual void        standbyMix();
         virtual status_t    dump(int fd, const Vector<String16>& args);
                 bool        getStandby();
+                // The client called standby() and has not written since
+                bool        clientStandby() const { return mClientStandby; }
         virtual status_t    setParameters(const String8& keyValuePairs);
         virtual String8     getParameters(const String8& keys);
                 uint32_t    devices() { return mDevices; }
         virtual status_t    getRenderPosition(uint32_t *dspFrames);
-                void        lock() { mSleepReq = true; mLock.lock();  mSleepReq = false; }
+                // Frames presented since the stream was opened, and the CLOCK_MONOTONIC
+                // time at which the last of them was presented.
+                status_t    getPresentationPosition(uint64_t *frames, struct timespec *timestamp);
+                // Used by doRouting_l(), the wait is recorded in the stream stats.
+                void        lock();
                 void        unlock() { mLock.unlock(); }
                 bool        isLocked() { return mLocked; }
                 void        setNumBufs(int numBufs);
+                void        resetBufferTuner();
+                uint32_t    getUnderruns();
+                // Selects a profile of mHardware->mOutputProfiles, BAD_VALUE if unknown.
+                // A profile of another buffer size needs its frameCount, 0 if none given.
+                status_t    setProfile(const char *name, int frameCount);
                 void        lockFd() { mFdLock.lock(); }
                 void        unlockFd() { mFdLock.unlock(); }
 
                 int         mBtFdIoCtl;
 
     private:
+                // client is false for the writes of the mixer thread
+                ssize_t     writeFrames(const void* buffer, size_t bytes, bool client);
+                status_t    standbyNow();
+                // Move the samples of the write path to Q31 and back to 16 bits, into
+                // the other arena buffer. bytes is the size of the 16-bit samples.
+                void *      widen(const void *data, size_t bytes);
+                void *      narrow(const void *data, size_t bytes);
+                // Idle standby: the hardware is off while the client writes silence
+                bool        idleAllowed() const;
+                void        enterIdle();
+                status_t    resumeIdle_l();
+                ssize_t     writeIdle(size_t bytes, nsecs_t start);
+                void        setIdleTimeout(uint32_t ms);
+
                 AudioHardware* mHardware;
-                Mutex       mLock;
+                AudioStreamLock mLock;
                 int         mFd;
                 int         mFdCtl;
                 int         mBtFd;
@@ -255,16 +304,88 @@ private:
                 bool        mIsSpkrEnabledReq;
                 bool        mIsBtEnabledReq;
                 bool        mIsSpdifEnabledReq;
-                int16_t     mSpareSample;
-                bool        mHaveSpareSample;
                 int         mState;
-#ifdef USE_PROPRIETARY_AUDIO_EXTENSIONS
                 AudioStreamSrc mSrc;
-#endif
+                // Working buffers of the write path, the client buffer is read only.
+                AudioScratchArena mArena;
+                // Speaker (when bluetooth is the main sink) and S/PDIF are written in parallel
+                // with the main sink from copies of the client buffer.
+                AudioSinkBufferPool mSinkPool;
+                sp<AudioSinkWriter> mSpkrWriter;
+                sp<AudioSinkWriter> mSpdifWriter;
+                AudioPositionTracker mPosition;
+                int         mNumBufs;
+                const AudioOutputProfile *mProfile;
+                AudioBufferTuner mBufferTuner;
+                AudioStageStats mStats;
+                AudioLevelMeter mLevelMeter;
                 bool        mLocked;        // setDriver() doesn't have to lock if true
                 int         mDriverRate;
+                int         mSpeakerRate;   // last rate set on CPCAP, 0 if unknown
                 bool        mInit;
-                bool        mSleepReq;
+                void *      mSilence;       // source of the mixer thread writes and preload
+                size_t      mSilenceSize;
+                uint32_t    mDither[AudioDsp::DITHER_LANES];
+                uint32_t    mIdleTimeoutMs;
+                nsecs_t     mSilentSince;   // first silent write, 0 if the last was not
+                bool        mIdlePending;   // silent for the timeout: idle at next write
+                bool        mIdle;          // hardware in standby, writes are not played
+                nsecs_t     mIdleNext;      // end of the last idle write, in real time
+                uint32_t    mIdleEntries;
+                bool        mClientStandby;
+    };
+
+    // Output stream at any rate, mono or stereo, mixed into the primary output by mMixer.
+    class AudioStreamOutMixed : public AudioStreamOut {
+    public:
+                            AudioStreamOutMixed();
+        virtual             ~AudioStreamOutMixed();
+                status_t    set(AudioHardware* mHardware,
+                                uint32_t devices,
+                                int *pFormat,
+                                uint32_t *pChannels,
+                                uint32_t *pRate);
+        virtual uint32_t    sampleRate() const { return mSampleRate; }
+        virtual size_t      bufferSize() const { return mBufferSize; }
+        virtual uint32_t    channels() const { return mChannels; }
+        virtual int         format() const { return mFormat; }
+        virtual uint32_t    latency() const;
+        virtual status_t    setVolume(float left, float right);
+        virtual ssize_t     write(const void* buffer, size_t bytes);
+        virtual status_t    standby();
+        virtual status_t    dump(int fd, const Vector<String16>& args);
+        virtual status_t    setParameters(const String8& keyValuePairs);
+        virtual String8     getParameters(const String8& keys);
+        virtual status_t    getRenderPosition(uint32_t *dspFrames);
+                uint32_t    devices() { return mDevices; }
+                // Written to and neither in standby nor drained
+                bool        playing() { return mHardware->mMixer->isActive(&mTrack); }
+
+    private:
+                void        write_l(const void* buffer, size_t bytes);
+        // Client frames converted per pass, and the most output frames they give
+        enum { CHUNK_FRAMES = 256 };
+        enum { MAX_CHUNK_OUT = CHUNK_FRAMES * AUDIO_HW_OUT_SAMPLERATE / AUDIO_HW_MIXED_MIN_RATE + 8 };
+
+                AudioHardware* mHardware;
+                Mutex       mLock;
+                int         mFormat;            // 16-bit, Q31 or 8.24 samples
+                uint32_t    mSampleRate;
+                uint32_t    mChannels;
+                size_t      mFrameSize;
+                size_t      mBufferSize;
+                uint32_t    mDevices;
+                AudioPolyphaseSrc mSrcLeft;
+                AudioPolyphaseSrc mSrcRight;    // stereo streams only
+                AudioOutputMixer::Track mTrack;
+                bool        mAdded;
+                uint64_t    mRenderBase;        // track frames mixed at the last standby
+                int32_t     mIn[CHUNK_FRAMES * 2];      // client samples in Q31
+                int32_t     mLeft[CHUNK_FRAMES];
+                int32_t     mRight[CHUNK_FRAMES];
+                int32_t     mOutLeft[MAX_CHUNK_OUT];
+                int32_t     mOutRight[MAX_CHUNK_OUT];
+                int32_t     mOut[MAX_CHUNK_OUT * 2];
     };
 
     class AudioStreamInTegra : public AudioStreamIn {
@@ -290,27 +411,31 @@ private:
         virtual status_t    setParameters(const String8& keyValuePairs);
         virtual String8     getParameters(const String8& keys);
         virtual unsigned int  getInputFramesLost() const;
+                // Frames read since the stream went online, and the CLOCK_MONOTONIC
+                // time the last of them was captured.
+                status_t    getCapturePosition(uint64_t *frames, struct timespec *timestamp);
         virtual status_t    addAudioEffect(effect_handle_t effect);
         virtual status_t    removeAudioEffect(effect_handle_t effect);
 
                 uint32_t    devices() { return mDevices; }
                 void        setDriver_l(bool mic, bool bluetooth, int sampleRate);
                 int         source() const { return mSource; }
-                void        lock() { mSleepReq = true; mLock.lock(); mSleepReq = false; }
+                // Used by doRouting_l(), the wait is recorded in the stream stats.
+                void        lock();
                 void        unlock() { mLock.unlock(); }
                 bool        isLocked() { return mLocked; }
                 void        stop_l();
-                void        lockFd() { mFdLock.lock(); }
-                void        unlockFd() { mFdLock.unlock(); }
+                void        lockFd() { mHardware->mCaptureSplitter->lockFd(); }
+                void        unlockFd() { mHardware->mCaptureSplitter->unlockFd(); }
+                int         ecnsRequested() const { return mEcnsRequested; }
 
     private:
-                void        reopenReconfigDriver();
+                status_t    reopenReconfigDriver();
+                ssize_t     readDriver_l(void *buffer, size_t bytes);
                 void        updateEcnsRequested(effect_handle_t effect, bool enabled);
 
                 AudioHardware* mHardware;
-                Mutex       mLock;
-                int         mFd;
-                int         mFdCtl;
+                AudioStreamLock mLock;
                 int         mState;
                 int         mRetryCount;
                 int         mFormat;
@@ -319,22 +444,16 @@ private:
                 size_t      mBufferSize;
                 AudioSystem::audio_in_acoustics mAcoustics;
                 uint32_t    mDevices;
-                bool        mIsMicEnabled;
-                bool        mIsBtEnabled;
                 int         mSource;
-                // 20 millisecond scratch buffer
-                int16_t     mInScratch[48000/50];
-#ifdef USE_PROPRIETARY_AUDIO_EXTENSIONS
-                AudioStreamSrc mSrc;
-#endif
+        mutable AudioCaptureSplitter::Client mClient;
+                AudioCaptureStage mCapture;
+                AudioStageStats mStats;
+                AudioLevelMeter mLevelMeter;
                 bool        mLocked;        // setDriver() doesn't have to lock if true
-        mutable uint32_t    mTotalBuffersRead;
-        mutable nsecs_t     mStartTimeNs;
-                int         mDriverRate;
-        mutable Mutex       mFramesLock;
-                Mutex       mFdLock;
-                bool        mSleepReq;
                 int         mEcnsRequested;   // bit field indicating if AEC and/or NS are requested
+                Mutex       mPositionLock;
+                uint64_t    mFramesRead;
+                nsecs_t     mCaptureNs;     // capture time of the last frame read, 0 if unknown
     };
 
             static const uint32_t inputSamplingRates[];
@@ -343,6 +462,7 @@ private:
             bool        mBluetoothNrec;
             uint32_t    mBluetoothId;
             AudioStreamOutTegra*  mOutput;
+            SortedVector <AudioStreamOutMixed*>  mMixedOutputs;
             SortedVector <AudioStreamInTegra*>   mInputs;
 
             struct cpcap_audio_stream mCurOutDevice;
@@ -356,18 +476,22 @@ private:
             int mHwInRate;
             float mMasterVol;
             float mVoiceVol;
-            uint8_t mCpcapGain[AUDIO_HW_GAIN_NUM_DIRECTIONS]
-                              [AUDIO_HW_GAIN_NUM_USECASES]
-                              [AUDIO_HW_GAIN_NUM_PATHS];
+            sp<AudioTuningStore> mTuning;
+            AudioOutputProfiles mOutputProfiles;
 #ifdef USE_PROPRIETARY_AUDIO_EXTENSIONS
             AudioPostProcessor mAudioPP;
+#else
+            // Device EQ of the output, used under the output stream lock
+            AudioEqualizer mEqualizer;
 #endif
             int mSpkrVolume;
             int mMicVolume;
 
             int mEcnsEnabled;   // bit field indicating if AEC and/or NS are enabled
             int mEcnsRequested; // bit field indicating if AEC and/or NS are requested
-            bool mBtScoOn;
+            AudioRoutingState mRouting;
+            sp<AudioCaptureSplitter> mCaptureSplitter;
+            sp<AudioOutputMixer> mMixer;
 };
 
 // ----------------------------------------------------------------------------
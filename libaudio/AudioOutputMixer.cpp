@@ -0,0 +1,423 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "AudioOutputMixer"
+#include <utils/Log.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <cutils/atomic.h>
+
+#include "AudioDsp.h"
+#include "AudioOutputMixer.h"
+
+namespace android_audio_legacy {
+
+using android::NO_ERROR;
+using android::BAD_VALUE;
+using android::NO_MEMORY;
+
+AudioOutputMixer::Track::Track() :
+    mVolume((AudioDsp::UNITY_GAIN << 16) | AudioDsp::UNITY_GAIN), mFramesMixed(0),
+    mActive(false), mUnderruns(0), mStalls(0)
+{
+}
+
+status_t AudioOutputMixer::Track::init(size_t bytes)
+{
+    return mRing.init(bytes);
+}
+
+void AudioOutputMixer::Track::setVolume(int16_t left, int16_t right)
+{
+    android_atomic_release_store(((int32_t)right << 16) | (uint16_t)left, &mVolume);
+}
+
+// ----------------------------------------------------------------------------
+
+AudioOutputMixer::AudioOutputMixer() :
+    Thread(false),
+    mNumTracks(0), mNumActive(0), mSink(NULL), mPeriodFrames(0), mPeriodNs(0),
+    mLastClientMs(0), mLastTrackData(0), mDriving(false), mInSink(false), mStarted(false),
+    mIdleTimeoutMs(0), mIdleClientMs(0),
+    mMixWrites(0), mSinkErrors(0), mIdleStandbys(0)
+{
+    for (int i = 0; i < MAX_TRACKS; i++) {
+        mTracks[i] = NULL;
+    }
+}
+
+AudioOutputMixer::~AudioOutputMixer()
+{
+}
+
+void AudioOutputMixer::setSink(AudioMixerSink *sink, size_t periodFrames, uint32_t rate)
+{
+    Mutex::Autolock lock(mLock);
+
+    // The sink is about to go away: wait until the thread is out of it
+    while (mInSink) {
+        mCond.wait(mLock);
+    }
+    mSink = sink;
+    mPeriodFrames = periodFrames;
+    mPeriodNs = rate ? (nsecs_t)periodFrames * 1000000000LL / rate : 0;
+    mDriving = false;
+    // Nothing to put to standby until the new sink is written
+    mIdleClientMs = android_atomic_acquire_load(&mLastClientMs);
+    mCond.broadcast();
+}
+
+void AudioOutputMixer::setIdleTimeout(uint32_t ms)
+{
+    Mutex::Autolock lock(mLock);
+    mIdleTimeoutMs = ms;
+    if (ms != 0) {
+        start_l();
+    }
+    mCond.broadcast();
+}
+
+void AudioOutputMixer::start_l()
+{
+    if (!mStarted) {
+        run("AudioOutputMixer", ANDROID_PRIORITY_URGENT_AUDIO);
+        mStarted = true;
+    }
+}
+
+void AudioOutputMixer::stop()
+{
+    requestExit();
+    {
+        Mutex::Autolock lock(mLock);
+        mCond.broadcast();
+    }
+    requestExitAndWait();
+}
+
+status_t AudioOutputMixer::addTrack(Track *track)
+{
+    Mutex::Autolock lock(mLock);
+
+    if (!track->mRing.initted()) {
+        return NO_MEMORY;
+    }
+    for (int i = 0; i < MAX_TRACKS; i++) {
+        if (mTracks[i] == NULL) {
+            mTracks[i] = track;
+            track->mFramesMixed = 0;
+            android_atomic_inc(&mNumTracks);
+            start_l();
+            return NO_ERROR;
+        }
+    }
+    return BAD_VALUE;
+}
+
+void AudioOutputMixer::removeTrack(Track *track)
+{
+    Mutex::Autolock lock(mLock);
+
+    for (int i = 0; i < MAX_TRACKS; i++) {
+        if (mTracks[i] == track) {
+            setActive_l(track, false);
+            mTracks[i] = NULL;
+            android_atomic_dec(&mNumTracks);
+        }
+    }
+    // A write() of the track may be waiting
+    mCond.broadcast();
+}
+
+bool AudioOutputMixer::isActive(Track *track)
+{
+    Mutex::Autolock lock(mLock);
+    return track->mActive;
+}
+
+size_t AudioOutputMixer::queueFrames()
+{
+    Mutex::Autolock lock(mLock);
+    return QUEUE_PERIODS * mPeriodFrames;
+}
+
+bool AudioOutputMixer::hasSink()
+{
+    Mutex::Autolock lock(mLock);
+    return mSink != NULL;
+}
+
+bool AudioOutputMixer::playing()
+{
+    Mutex::Autolock lock(mLock);
+    return mDriving;
+}
+
+size_t AudioOutputMixer::write(Track *track, const int32_t *frames, size_t count)
+{
+    Mutex::Autolock lock(mLock);
+    size_t done = 0;
+
+    if (mSink == NULL) {
+        // Nothing would play the track: do not wait for the timeout
+        track->mRing.flush();
+        return 0;
+    }
+    setActive_l(track, true);
+    while (done < count) {
+        // The ring is sized for the largest period, only QUEUE_PERIODS are queued
+        size_t queued = track->framesQueued();
+        size_t room = queued < QUEUE_PERIODS * mPeriodFrames ?
+                      QUEUE_PERIODS * mPeriodFrames - queued : 0;
+        if (room > count - done) {
+            room = count - done;
+        }
+        size_t n = track->mRing.write(frames + done * 2, room * FRAME_SIZE) / FRAME_SIZE;
+        done += n;
+        if (n != 0) {
+            // Wake the thread up if it has to play the track
+            mCond.broadcast();
+        }
+        if (done < count &&
+                mCond.waitRelative(mLock, milliseconds(WRITE_TIMEOUT_MS)) != NO_ERROR) {
+            ALOGW("%s: sink is stalled, dropping %u frames", __FUNCTION__,
+                  (unsigned)(count - done));
+            track->mStalls++;
+            break;
+        }
+        if (mSink == NULL) {
+            // The sink was closed while waiting
+            setActive_l(track, false);
+            track->mRing.flush();
+            break;
+        }
+    }
+    return done;
+}
+
+void AudioOutputMixer::standby(Track *track)
+{
+    Mutex::Autolock lock(mLock);
+    setActive_l(track, false);
+    track->mRing.flush();
+    mCond.broadcast();
+}
+
+uint64_t AudioOutputMixer::framesMixed(Track *track)
+{
+    Mutex::Autolock lock(mLock);
+    return track->mFramesMixed;
+}
+
+void AudioOutputMixer::onClientWrite(nsecs_t now)
+{
+    int32_t ms = (int32_t)ns2ms(now);
+    android_atomic_release_store(ms, &mLastClientMs);
+    if (mIdleTimeoutMs != 0 && ms == mIdleClientMs) {
+        // Not likely, but it would look like the idle standby was already done
+        android_atomic_release_store(ms + 1, &mLastClientMs);
+    }
+}
+
+void AudioOutputMixer::mix(int32_t *out, size_t frames, bool client)
+{
+    Mutex::Autolock lock(mLock);
+    bool mixed = false;
+
+    for (int i = 0; i < MAX_TRACKS; i++) {
+        Track *track = mTracks[i];
+        if (track == NULL) {
+            continue;
+        }
+        size_t avail = track->framesQueued();
+        if (avail == 0) {
+            // Drained for a whole period: the stream paused or stopped
+            setActive_l(track, false);
+            continue;
+        }
+        if (avail < frames) {
+            track->mUnderruns++;
+        }
+        int32_t volume = android_atomic_acquire_load(&track->mVolume);
+        size_t done = 0;
+        while (done < frames && avail != 0) {
+            size_t n = frames - done;
+            if (n > MIX_FRAMES) {
+                n = MIX_FRAMES;
+            }
+            if (n > avail) {
+                n = avail;
+            }
+            track->mRing.read(mMixBuf, n * FRAME_SIZE);
+            AudioDsp::mixStereoQ31(out + done * 2, mMixBuf, n,
+                                   (int16_t)(volume & 0xFFFF), (int16_t)(volume >> 16));
+            done += n;
+            avail -= n;
+        }
+        track->mFramesMixed += done;
+        mixed = mixed || done != 0;
+    }
+    if (mixed && !client) {
+        mLastTrackData = systemTime();
+    }
+    // Room in the tracks
+    mCond.broadcast();
+}
+
+void AudioOutputMixer::setActive_l(Track *track, bool active)
+{
+    if (track->mActive != active) {
+        track->mActive = active;
+        if (active) {
+            android_atomic_inc(&mNumActive);
+        } else {
+            android_atomic_dec(&mNumActive);
+        }
+    }
+}
+
+bool AudioOutputMixer::tracksReady_l() const
+{
+    for (int i = 0; i < MAX_TRACKS; i++) {
+        if (mTracks[i] != NULL && mTracks[i]->framesQueued() != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// The client writes a period at a time: it is active while it is less than two
+// periods late for the next one.
+bool AudioOutputMixer::clientActive(nsecs_t now) const
+{
+    int32_t last = android_atomic_acquire_load(&mLastClientMs);
+    return (int32_t)ns2ms(now) - last < (int32_t)ns2ms(2 * mPeriodNs);
+}
+
+nsecs_t AudioOutputMixer::idleStandbyIn_l(nsecs_t now) const
+{
+    int32_t last = android_atomic_acquire_load(&mLastClientMs);
+    if (mSink == NULL || mIdleTimeoutMs == 0 || mDriving || last == mIdleClientMs) {
+        return -1;
+    }
+    int32_t left = last + (int32_t)mIdleTimeoutMs - (int32_t)ns2ms(now);
+    return left > 0 ? milliseconds(left) : 0;
+}
+
+// Called with mLock held, returns with it held; the sink may not be changed meanwhile.
+void AudioOutputMixer::standbySink_l()
+{
+    AudioMixerSink *sink = mSink;
+    mInSink = true;
+    mLock.unlock();
+    sink->standbyMix();
+    mLock.lock();
+    mInSink = false;
+    mCond.broadcast();
+}
+
+bool AudioOutputMixer::threadLoop()
+{
+    Mutex::Autolock lock(mLock);
+
+    if (exitPending()) {
+        return false;
+    }
+    nsecs_t now = systemTime();
+    if (mSink == NULL || clientActive(now) || !tracksReady_l()) {
+        if (mDriving && mSink != NULL && !clientActive(now) &&
+                now - mLastTrackData < milliseconds(IDLE_STANDBY_MS)) {
+            // Between writes of a track: keep the sink running for a while
+            mCond.waitRelative(mLock, mPeriodNs);
+            return true;
+        }
+        if (mDriving) {
+            mDriving = false;
+            if (mSink != NULL && !clientActive(now)) {
+                standbySink_l();
+                mIdleClientMs = android_atomic_acquire_load(&mLastClientMs);
+            }
+        }
+        nsecs_t idleIn = idleStandbyIn_l(now);
+        if (idleIn == 0) {
+            // The client has stopped writing without going to standby
+            ALOGV("%s: no writes for %u ms, sink to standby", __FUNCTION__, mIdleTimeoutMs);
+            mIdleClientMs = android_atomic_acquire_load(&mLastClientMs);
+            mIdleStandbys++;
+            standbySink_l();
+            return true;
+        }
+        if (mSink != NULL && clientActive(now) && tracksReady_l()) {
+            mCond.waitRelative(mLock, mPeriodNs);
+        } else if (idleIn > 0) {
+            mCond.waitRelative(mLock, idleIn);
+        } else {
+            mCond.wait(mLock);
+        }
+        return true;
+    }
+
+    if (!mDriving) {
+        ALOGV("%s: playing the tracks, the sink client is idle", __FUNCTION__);
+        mDriving = true;
+        mLastTrackData = now;
+    }
+    AudioMixerSink *sink = mSink;
+    size_t frames = mPeriodFrames;
+    mInSink = true;
+    mLock.unlock();
+    ssize_t ret = sink->writeMix(frames);
+    mLock.lock();
+    mInSink = false;
+    mMixWrites++;
+    if (ret < 0) {
+        mSinkErrors++;
+        mCond.waitRelative(mLock, mPeriodNs);
+    }
+    mCond.broadcast();
+    return true;
+}
+
+void AudioOutputMixer::dump(String8& result)
+{
+    const size_t SIZE = 256;
+    char buffer[SIZE];
+    Mutex::Autolock lock(mLock);
+
+    snprintf(buffer, SIZE, "\tmixer: %d tracks, %d active, %u frame period%s, %u sink writes, "
+             "%u errors\n", mNumTracks, mNumActive, (unsigned)mPeriodFrames,
+             mDriving ? ", playing the tracks" : "", mMixWrites, mSinkErrors);
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tmixer: idle standby after %u ms without writes, %u done\n",
+             mIdleTimeoutMs, mIdleStandbys);
+    result.append(buffer);
+    for (int i = 0; i < MAX_TRACKS; i++) {
+        Track *track = mTracks[i];
+        if (track == NULL) {
+            continue;
+        }
+        int32_t volume = android_atomic_acquire_load(&track->mVolume);
+        snprintf(buffer, SIZE, "\t  track %p: %u frames queued, %llu mixed, gain %d/%d, "
+                 "%u underruns, %u stalls\n", track, (unsigned)track->framesQueued(),
+                 track->mFramesMixed, (int16_t)(volume & 0xFFFF), (int16_t)(volume >> 16),
+                 track->mUnderruns, track->mStalls);
+        result.append(buffer);
+    }
+}
+
+}; // namespace android_audio_legacy
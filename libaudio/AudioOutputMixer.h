@@ -0,0 +1,162 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_AUDIO_OUTPUT_MIXER_H
+#define ANDROID_AUDIO_OUTPUT_MIXER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <utils/threads.h>
+#include <utils/String8.h>
+
+#include "AudioRingBuffer.h"
+
+namespace android_audio_legacy {
+    using android::Mutex;
+    using android::Condition;
+    using android::Thread;
+    using android::String8;
+    using android::status_t;
+
+// The output stream that owns the drivers. The mixer calls it to play the tracks
+// while its own client is not writing.
+class AudioMixerSink
+{
+public:
+    virtual             ~AudioMixerSink() {}
+            // Plays frames of silence with the tracks mixed in. Blocks like write().
+    virtual ssize_t     writeMix(size_t frames) = 0;
+            // The tracks went idle after writeMix() calls, or the client of the sink
+            // stopped writing without going to standby.
+    virtual void        standbyMix() = 0;
+};
+
+// Mixes secondary output streams into the primary one.
+//
+// Each secondary stream owns a Track, which it fills with audio already converted to
+// stereo Q31 samples at the sink rate. The primary stream calls mix() on every write,
+// which adds the queued audio of the tracks to its Q31 buffer with saturation.
+// When the primary client is idle and a track has audio, the mixer thread keeps the
+// sink running with writeMix(), so that the tracks are not stalled by it. When neither
+// writes for the idle timeout, the thread puts the sink to standby.
+class AudioOutputMixer : public Thread
+{
+public:
+    enum { MAX_TRACKS = 4 };
+
+    class Track {
+    public:
+                        Track();
+            // Audio queued by the stream, rounded up to a power of 2
+            status_t    init(size_t bytes);
+            // Q3.12 gains, see AudioDsp::mixStereoQ31()
+            void        setVolume(int16_t left, int16_t right);
+            size_t      framesQueued() const { return mRing.availableToRead() / FRAME_SIZE; }
+
+    private:
+        friend class AudioOutputMixer;
+            AudioRingBuffer mRing;
+    volatile int32_t    mVolume;        // left gain in the low half, right in the high half
+            uint64_t    mFramesMixed;
+            bool        mActive;        // written to since the last standby or drain
+            uint32_t    mUnderruns;
+            uint32_t    mStalls;
+    };
+
+    enum { FRAME_SIZE = 2 * sizeof(int32_t) };
+    // Sink periods a track queues ahead of the sink
+    enum { QUEUE_PERIODS = 2 };
+
+                        AudioOutputMixer();
+    virtual             ~AudioOutputMixer();
+
+            // The sink, NULL when the primary stream is closed.
+            void        setSink(AudioMixerSink *sink, size_t periodFrames, uint32_t rate);
+            // Stops the thread, the tracks must be removed.
+            void        stop();
+            // Time without writes after which the sink is put to standby, 0 for never
+            void        setIdleTimeout(uint32_t ms);
+
+            status_t    addTrack(Track *track);
+            void        removeTrack(Track *track);
+            bool        hasTracks() const { return mNumTracks != 0; }
+            // A track was written to and has not gone to standby or drained. The
+            // tracks of the streams opened but not playing leave the sink alone.
+            bool        hasActiveTracks() const { return mNumActive != 0; }
+            bool        isActive(Track *track);
+            // Frames a track queues at most, with the current sink period
+            size_t      queueFrames();
+            bool        hasSink();
+            // The thread is playing the tracks for the idle sink client
+            bool        playing();
+
+            // Stream side: queues frames, waits while the track holds queueFrames().
+            // Returns the number of frames queued, short if the sink stalled, 0 without
+            // a sink.
+            size_t      write(Track *track, const int32_t *frames, size_t count);
+            // The stream went to standby: what it queued is dropped.
+            void        standby(Track *track);
+            // Frames of the track mixed since it was added
+            uint64_t    framesMixed(Track *track);
+
+            // Sink side: the sink client wrote, the thread leaves the sink to it.
+            void        onClientWrite(nsecs_t now);
+            // Sink side: adds the frames queued by the tracks to out, at most frames.
+            // client is false when called from writeMix().
+            void        mix(int32_t *out, size_t frames, bool client);
+
+            void        dump(String8& result);
+
+private:
+    enum { MIX_FRAMES = 512 };
+    enum { WRITE_TIMEOUT_MS = 1000 };
+    enum { IDLE_STANDBY_MS = 3000 };
+
+    virtual bool        threadLoop();
+            void        start_l();
+            void        setActive_l(Track *track, bool active);
+            bool        tracksReady_l() const;
+            bool        clientActive(nsecs_t now) const;
+            // Time left before the idle standby of the sink, -1 if none is due
+            nsecs_t     idleStandbyIn_l(nsecs_t now) const;
+            void        standbySink_l();
+
+            Mutex       mLock;
+            Condition   mCond;              // room in a track, a track has data, exit
+            Track *     mTracks[MAX_TRACKS];
+    volatile int32_t    mNumTracks;
+    volatile int32_t    mNumActive;
+            AudioMixerSink *mSink;
+            size_t      mPeriodFrames;
+            nsecs_t     mPeriodNs;
+    volatile int32_t    mLastClientMs;      // last client write, ns2ms(systemTime())
+            nsecs_t     mLastTrackData;     // last writeMix() that had track audio
+            bool        mDriving;           // the thread is playing the tracks
+            bool        mInSink;            // in writeMix() or standbyMix()
+            bool        mStarted;
+            uint32_t    mIdleTimeoutMs;
+            int32_t     mIdleClientMs;      // last client write before the idle standby
+            int32_t     mMixBuf[MIX_FRAMES * 2];
+
+            // statistics
+            uint32_t    mMixWrites;
+            uint32_t    mSinkErrors;
+            uint32_t    mIdleStandbys;
+};
+
+}; // namespace android_audio_legacy
+
+#endif // ANDROID_AUDIO_OUTPUT_MIXER_H
@@ -0,0 +1,165 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "AudioOutputProfiles"
+#include <utils/Log.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cutils/config_utils.h>
+#include <cutils/misc.h>
+
+#include "AudioOutputProfiles.h"
+
+namespace android_audio_legacy {
+
+// The driver only takes multiples of 32 bytes (see bufferSize())
+#define PROFILE_BUFFER_ALIGN 32
+#define PROFILE_MIN_BUFFER_SIZE 512
+#define PROFILE_MAX_BUFFER_SIZE 32768
+#define PROFILE_MAX_NUM_BUFS 8
+
+// FIXME: 4 buffers instead of 2 is a workaround for issue 3387419 with impact on latency
+// to be removed when root cause is fixed
+const AudioOutputProfile AudioOutputProfiles::sBuiltIn = { "default", 4096, 4, 2 };
+
+static const AudioOutputProfile kBuiltInProfiles[] = {
+    AudioOutputProfiles::sBuiltIn,
+    // games and UI sounds: ~17 ms
+    { "low_latency", 1024, 3, 2 },
+    // screen off music, fewer wakeups: ~370 ms
+    { "deep_buffer", 16384, 4, 2 },
+};
+
+AudioOutputProfiles::AudioOutputProfiles() :
+    mNumProfiles(0), mDefault(0)
+{
+    for (size_t i = 0; i < sizeof(kBuiltInProfiles) / sizeof(kBuiltInProfiles[0]); i++) {
+        mProfiles[mNumProfiles++] = kBuiltInProfiles[i];
+    }
+}
+
+AudioOutputProfile *AudioOutputProfiles::find(const char *name)
+{
+    for (int i = 0; i < mNumProfiles; i++) {
+        if (strcmp(mProfiles[i].name, name) == 0) {
+            return &mProfiles[i];
+        }
+    }
+    return NULL;
+}
+
+const AudioOutputProfile *AudioOutputProfiles::get(const char *name) const
+{
+    return const_cast<AudioOutputProfiles *>(this)->find(name);
+}
+
+size_t AudioOutputProfiles::maxBufferSize() const
+{
+    size_t size = 0;
+    for (int i = 0; i < mNumProfiles; i++) {
+        if (mProfiles[i].bufferSize > size) {
+            size = mProfiles[i].bufferSize;
+        }
+    }
+    return size;
+}
+
+// File format, in the syntax of audio_policy.conf:
+//
+// default_profile <name>
+// profiles {
+//   <name> {
+//     buffer_size <bytes>
+//     num_bufs <count>
+//     num_bufs_ecns <count>
+//   }
+// }
+void AudioOutputProfiles::load(const char *path)
+{
+    unsigned size;
+    char *data = (char *)load_file(path, &size);
+    if (data == NULL) {
+        ALOGV("%s: no %s, using built-in profiles", __FUNCTION__, path);
+        return;
+    }
+    cnode *root = config_node("", "");
+    config_load(root, data);
+
+    cnode *profiles = config_find(root, "profiles");
+    for (cnode *node = profiles ? profiles->first_child : NULL; node != NULL; node = node->next) {
+        AudioOutputProfile *profile = find(node->name);
+        if (profile == NULL) {
+            if (mNumProfiles == MAX_PROFILES || strlen(node->name) >= sizeof(profile->name)) {
+                ALOGW("%s: ignoring profile %s", __FUNCTION__, node->name);
+                continue;
+            }
+            profile = &mProfiles[mNumProfiles];
+            *profile = sBuiltIn;
+            strcpy(profile->name, node->name);
+            mNumProfiles++;
+        }
+        size_t bufferSize = atoi(config_str(node, "buffer_size", "0"));
+        int numBufs = atoi(config_str(node, "num_bufs", "0"));
+        int numBufsEcns = atoi(config_str(node, "num_bufs_ecns", "0"));
+        if (bufferSize != 0) {
+            if (bufferSize % PROFILE_BUFFER_ALIGN || bufferSize < PROFILE_MIN_BUFFER_SIZE ||
+                    bufferSize > PROFILE_MAX_BUFFER_SIZE) {
+                ALOGW("%s: %s: invalid buffer_size %d", __FUNCTION__, node->name, (int)bufferSize);
+            } else {
+                profile->bufferSize = bufferSize;
+            }
+        }
+        if (numBufs > 0 && numBufs <= PROFILE_MAX_NUM_BUFS) {
+            profile->numBufs = numBufs;
+        }
+        if (numBufsEcns > 0 && numBufsEcns <= PROFILE_MAX_NUM_BUFS) {
+            profile->numBufsEcns = numBufsEcns;
+        }
+        ALOGV("%s: profile %s buffer size %d, %d buffers, %d with EC/NS", __FUNCTION__,
+              profile->name, (int)profile->bufferSize, profile->numBufs, profile->numBufsEcns);
+    }
+
+    const char *name = config_str(root, "default_profile", NULL);
+    if (name != NULL) {
+        AudioOutputProfile *profile = find(name);
+        if (profile != NULL) {
+            mDefault = profile - mProfiles;
+        } else {
+            ALOGW("%s: unknown default profile %s", __FUNCTION__, name);
+        }
+    }
+
+    config_free(root);
+    free(root);
+    free(data);
+}
+
+void AudioOutputProfiles::dump(String8& result) const
+{
+    const size_t SIZE = 256;
+    char buffer[SIZE];
+    for (int i = 0; i < mNumProfiles; i++) {
+        snprintf(buffer, SIZE, "\t%c%s: buffer size %d, %d buffers, %d with EC/NS\n",
+                 i == mDefault ? '*' : ' ', mProfiles[i].name, (int)mProfiles[i].bufferSize,
+                 mProfiles[i].numBufs, mProfiles[i].numBufsEcns);
+        result.append(buffer);
+    }
+}
+
+}; // namespace android_audio_legacy
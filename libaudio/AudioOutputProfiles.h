@@ -0,0 +1,69 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_AUDIO_OUTPUT_PROFILES_H
+#define ANDROID_AUDIO_OUTPUT_PROFILES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/String8.h>
+
+namespace android_audio_legacy {
+    using android::String8;
+
+#define AUDIO_OUTPUT_PROFILES_FILE "/system/etc/audio_output_profiles.conf"
+
+// Buffering of the primary output: size of the writes and number of driver buffers.
+struct AudioOutputProfile {
+    char        name[32];
+    size_t      bufferSize;     // bytes per write(), 16 bit stereo
+    int         numBufs;        // driver buffers
+    int         numBufsEcns;    // driver buffers while EC/NS is running
+};
+
+// Named output profiles. A built-in set ("default", "low_latency", "deep_buffer") can be
+// overridden or extended by AUDIO_OUTPUT_PROFILES_FILE. The table does not change once
+// loaded, so profile pointers stay valid for the life of the object.
+class AudioOutputProfiles
+{
+public:
+    enum { MAX_PROFILES = 8 };
+
+                        AudioOutputProfiles();
+
+            void        load(const char *path);
+            // NULL if there is no profile of that name
+            const AudioOutputProfile *get(const char *name) const;
+            const AudioOutputProfile *getDefault() const { return &mProfiles[mDefault]; }
+            size_t      maxBufferSize() const;
+            void        dump(String8& result) const;
+
+    // Used before the table of the hardware is available
+    static const AudioOutputProfile sBuiltIn;
+
+private:
+            AudioOutputProfile *find(const char *name);
+
+            AudioOutputProfile mProfiles[MAX_PROFILES];
+            int         mNumProfiles;
+            int         mDefault;
+};
+
+}; // namespace android_audio_legacy
+
+#endif // ANDROID_AUDIO_OUTPUT_PROFILES_H
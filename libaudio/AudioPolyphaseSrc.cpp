@@ -0,0 +1,379 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "AudioPolyphaseSrc"
+#include <utils/Log.h>
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "AudioPolyphaseSrc.h"
+
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace android_audio_legacy {
+
+using android::NO_ERROR;
+using android::BAD_VALUE;
+using android::NO_MEMORY;
+
+// Filter length (per phase, at unity ratio), Kaiser beta and passband edge
+// (fraction of the output Nyquist frequency) for each quality level.
+static const struct {
+    int     taps;
+    double  beta;
+    double  rolloff;
+} kQuality[AudioPolyphaseSrc::QUALITY_NUM] = {
+    {  8, 5.0, 0.85 },
+    { 16, 7.0, 0.90 },
+    { 32, 9.0, 0.94 },
+};
+
+// Extra room in the history buffer for the input that is buffered but held
+// back by output alignment.
+static const size_t kBufSlack = 64;
+
+static int gcd(int a, int b)
+{
+    while (b != 0) {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// Zeroth order modified Bessel function of the first kind.
+static double besselI0(double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+    double halfx = x / 2.0;
+    for (int k = 1; k < 50; k++) {
+        term *= (halfx / k) * (halfx / k);
+        sum += term;
+        if (term < sum * 1e-12)
+            break;
+    }
+    return sum;
+}
+
+static inline int16_t clamp16(int32_t sample)
+{
+    if ((sample >> 15) ^ (sample >> 31))
+        sample = 0x7FFF ^ (sample >> 31);
+    return sample;
+}
+
+static inline int32_t clamp32(int64_t sample)
+{
+    if (sample > 0x7FFFFFFFLL)
+        return 0x7FFFFFFF;
+    if (sample < -0x80000000LL)
+        return (int32_t)0x80000000;
+    return (int32_t)sample;
+}
+
+AudioPolyphaseSrc::AudioPolyphaseSrc() :
+    mInRate(0), mOutRate(0), mL(1), mM(1), mTaps(0), mCoefs(NULL), mBuf(NULL),
+    mBuf32(NULL),
+    mBufCount(0), mPos(0), mPhase(0), mOutAlign(1)
+{
+}
+
+AudioPolyphaseSrc::~AudioPolyphaseSrc()
+{
+    release();
+}
+
+void AudioPolyphaseSrc::release()
+{
+    delete[] mCoefs;
+    mCoefs = NULL;
+    delete[] mBuf;
+    mBuf = NULL;
+    delete[] mBuf32;
+    mBuf32 = NULL;
+}
+
+status_t AudioPolyphaseSrc::init(int inRate, int outRate, int quality)
+{
+    release();
+
+    if (inRate <= 0 || outRate <= 0) {
+        return BAD_VALUE;
+    }
+    if (quality < 0 || quality >= QUALITY_NUM) {
+        quality = QUALITY_MEDIUM;
+    }
+    int g = gcd(inRate, outRate);
+    int L = outRate / g;
+    int M = inRate / g;
+    if (L > MAX_PHASES) {
+        ALOGE("%s: cannot convert %d to %d, %d phases needed", __FUNCTION__, inRate, outRate, L);
+        return BAD_VALUE;
+    }
+
+    // When decimating, the cutoff moves down to the output Nyquist frequency and
+    // the filter must be proportionally longer in input samples.
+    int taps = kQuality[quality].taps;
+    if (M > L) {
+        taps = (taps * M + L - 1) / L;
+    }
+    taps = (taps + 7) & ~7;
+
+    mCoefs = new int16_t[L * taps];
+    mBuf = new int16_t[taps + CHUNK + kBufSlack];
+    mBuf32 = new int32_t[taps + CHUNK + kBufSlack];
+    if (mCoefs == NULL || mBuf == NULL || mBuf32 == NULL) {
+        release();
+        return NO_MEMORY;
+    }
+
+    // Cutoff in cycles per input sample
+    double fc = 0.5 * kQuality[quality].rolloff * (L < M ? (double)L / M : 1.0);
+    double beta = kQuality[quality].beta;
+    double i0beta = besselI0(beta);
+    int N = taps * L;
+    double center = (N - 1) / 2.0;
+    double *h = new double[taps];
+    for (int p = 0; p < L; p++) {
+        double sum = 0;
+        for (int i = 0; i < taps; i++) {
+            int n = p + i * L;
+            double t = (n - center) / L;    // in input samples
+            double x = 2.0 * fc * t;
+            double sinc = (fabs(x) < 1e-9) ? 1.0 : sin(M_PI * x) / (M_PI * x);
+            double r = 2.0 * n / (N - 1) - 1.0;
+            double w = besselI0(beta * sqrt(r * r < 1.0 ? 1.0 - r * r : 0.0)) / i0beta;
+            h[i] = 2.0 * fc * sinc * w;
+            sum += h[i];
+        }
+        // Normalize every phase to unity DC gain so that the phases do not
+        // modulate a constant signal, and put the rounding error in the peak tap.
+        int16_t *c = &mCoefs[p * taps];
+        int32_t isum = 0;
+        int peak = taps - 1;
+        for (int i = 0; i < taps; i++) {
+            // coefficients are stored reversed, oldest input sample first
+            int16_t q = clamp16((int32_t)floor(h[i] / sum * (1 << 14) + 0.5));
+            c[taps - 1 - i] = q;
+            isum += q;
+            if (abs(q) > abs(c[peak])) {
+                peak = taps - 1 - i;
+            }
+        }
+        c[peak] = clamp16(c[peak] + (1 << 14) - isum);
+    }
+    delete[] h;
+
+    mInRate = inRate;
+    mOutRate = outRate;
+    mL = L;
+    mM = M;
+    mTaps = taps;
+    reset();
+
+    ALOGV("%s: %d -> %d, L %d M %d, %d taps/phase", __FUNCTION__, inRate, outRate, L, M, taps);
+    return NO_ERROR;
+}
+
+void AudioPolyphaseSrc::reset()
+{
+    if (mBuf == NULL) {
+        return;
+    }
+    // Start with a history of silence: the first output uses the first input sample.
+    memset(mBuf, 0, (mTaps - 1) * sizeof(int16_t));
+    memset(mBuf32, 0, (mTaps - 1) * sizeof(int32_t));
+    mBufCount = mTaps - 1;
+    mPos = mTaps - 1;
+    mPhase = 0;
+}
+
+size_t AudioPolyphaseSrc::maxOutputCount(size_t inCount) const
+{
+    if (!initted()) {
+        return 0;
+    }
+    uint64_t start = (uint64_t)mPos * mL + mPhase;
+    uint64_t end = (uint64_t)(mBufCount + inCount) * mL;
+    return start < end ? (size_t)((end - start + mM - 1) / mM) : 0;
+}
+
+size_t AudioPolyphaseSrc::inputCountFor(size_t outCount) const
+{
+    if (!initted() || outCount == 0) {
+        return 0;
+    }
+    uint64_t last = ((uint64_t)mPos * mL + mPhase + (uint64_t)(outCount - 1) * mM) / mL;
+    return last + 1 > mBufCount ? (size_t)(last + 1 - mBufCount) : 0;
+}
+
+size_t AudioPolyphaseSrc::delayCount() const
+{
+    if (!initted()) {
+        return 0;
+    }
+    return (mBufCount > mPos ? mBufCount - mPos : 0) + (mTaps - 1) / 2;
+}
+
+inline int16_t AudioPolyphaseSrc::filter(const int16_t *x, const int16_t *coefs) const
+{
+    int32_t acc;
+#if defined(__ARM_NEON__)
+    int32x4_t sum = vdupq_n_s32(0);
+    for (int i = 0; i < mTaps; i += 8) {
+        int16x8_t s = vld1q_s16(x + i);
+        int16x8_t c = vld1q_s16(coefs + i);
+        sum = vmlal_s16(sum, vget_low_s16(s), vget_low_s16(c));
+        sum = vmlal_s16(sum, vget_high_s16(s), vget_high_s16(c));
+    }
+    int32x2_t pair = vadd_s32(vget_low_s32(sum), vget_high_s32(sum));
+    acc = vget_lane_s32(vpadd_s32(pair, pair), 0);
+#elif defined(__SSE2__)
+    __m128i sum = _mm_setzero_si128();
+    for (int i = 0; i < mTaps; i += 8) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(x + i));
+        __m128i c = _mm_loadu_si128((const __m128i *)(coefs + i));
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(s, c));
+    }
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    acc = _mm_cvtsi128_si32(sum);
+#else
+    acc = 0;
+    for (int i = 0; i < mTaps; i++) {
+        acc += (int32_t)x[i] * coefs[i];
+    }
+#endif
+    return clamp16((acc + (1 << 13)) >> 14);
+}
+
+// Bit-exact on all targets: the products are summed in 64 bits. SSE2 has no
+// 32-bit signed multiply, so the x86 build runs the C loop.
+inline int32_t AudioPolyphaseSrc::filter(const int32_t *x, const int16_t *coefs) const
+{
+    int64_t acc;
+#if defined(__ARM_NEON__)
+    int64x2_t sum = vdupq_n_s64(0);
+    for (int i = 0; i < mTaps; i += 8) {
+        int16x8_t c = vld1q_s16(coefs + i);
+        int32x4_t c0 = vmovl_s16(vget_low_s16(c));
+        int32x4_t c1 = vmovl_s16(vget_high_s16(c));
+        int32x4_t s0 = vld1q_s32(x + i);
+        int32x4_t s1 = vld1q_s32(x + i + 4);
+        sum = vmlal_s32(sum, vget_low_s32(s0), vget_low_s32(c0));
+        sum = vmlal_s32(sum, vget_high_s32(s0), vget_high_s32(c0));
+        sum = vmlal_s32(sum, vget_low_s32(s1), vget_low_s32(c1));
+        sum = vmlal_s32(sum, vget_high_s32(s1), vget_high_s32(c1));
+    }
+    acc = vgetq_lane_s64(sum, 0) + vgetq_lane_s64(sum, 1);
+#else
+    acc = 0;
+    for (int i = 0; i < mTaps; i++) {
+        acc += (int64_t)x[i] * coefs[i];
+    }
+#endif
+    return clamp32((acc + (1 << 13)) >> 14);
+}
+
+void AudioPolyphaseSrc::convert(const int16_t *in, size_t *inCount,
+                                int16_t *out, size_t *outCount)
+{
+    convertSamples(mBuf, in, inCount, out, outCount);
+}
+
+void AudioPolyphaseSrc::convert(const int32_t *in, size_t *inCount,
+                                int32_t *out, size_t *outCount)
+{
+    convertSamples(mBuf32, in, inCount, out, outCount);
+}
+
+template <typename T>
+void AudioPolyphaseSrc::convertSamples(T *buf, const T *in, size_t *inCount,
+                                       T *out, size_t *outCount)
+{
+    if (!initted()) {
+        *inCount = 0;
+        *outCount = 0;
+        return;
+    }
+
+    size_t inAvail = *inCount;
+    size_t outCap = *outCount - (*outCount % mOutAlign);
+    size_t avail = maxOutputCount(inAvail);
+    bool outputLimited = avail > outCap;
+    size_t target = outputLimited ? outCap : avail - (avail % mOutAlign);
+
+    // Input to take: everything, unless the output buffer is the limit, in which case
+    // only what the last output needs is consumed and the rest is left to the caller.
+    size_t take = outputLimited ? inputCountFor(target) : inAvail;
+
+    size_t consumed = 0;
+    size_t produced = 0;
+    const size_t capacity = mTaps + CHUNK + kBufSlack;
+    while (produced < target || consumed < take) {
+        // Input is always appended before the outputs that need it are computed,
+        // so that outputs never overtake unread input when out aliases in.
+        if (consumed < take) {
+            size_t discard = mPos + 1 - mTaps;
+            if (discard > mBufCount) {
+                discard = mBufCount;
+            }
+            if (discard) {
+                memmove(buf, buf + discard, (mBufCount - discard) * sizeof(T));
+                mBufCount -= discard;
+                mPos -= discard;
+            }
+            size_t n = take - consumed;
+            if (n > CHUNK) {
+                n = CHUNK;
+            }
+            if (n > capacity - mBufCount) {
+                n = capacity - mBufCount;
+            }
+            if (n == 0 && mPos >= mBufCount) {
+                ALOGE("%s: history buffer full", __FUNCTION__);
+                break;
+            }
+            memcpy(buf + mBufCount, in + consumed, n * sizeof(T));
+            mBufCount += n;
+            consumed += n;
+        }
+        size_t before = produced;
+        while (produced < target && mPos < mBufCount) {
+            out[produced++] = filter(&buf[mPos + 1 - mTaps], &mCoefs[mPhase * mTaps]);
+            mPhase += mM;
+            mPos += mPhase / mL;
+            mPhase %= mL;
+        }
+        if (produced == before && consumed == take) {
+            break;
+        }
+    }
+
+    *inCount = consumed;
+    *outCount = produced;
+}
+
+}; // namespace android_audio_legacy
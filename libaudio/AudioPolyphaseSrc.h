@@ -0,0 +1,109 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_AUDIO_POLYPHASE_SRC_H
+#define ANDROID_AUDIO_POLYPHASE_SRC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <utils/Errors.h>
+
+namespace android_audio_legacy {
+    using android::status_t;
+
+// Streaming mono polyphase FIR sample rate converter.
+//
+// The conversion ratio is reduced to L/M (L = outRate/gcd, M = inRate/gcd) and
+// a Kaiser windowed sinc prototype is split into L phases of mTaps Q14
+// coefficients. Filter history and the fractional phase are kept between
+// calls to convert(), so any input block size can be fed. Between two resets, a
+// converter must be fed either 16-bit or Q31 samples only.
+class AudioPolyphaseSrc
+{
+public:
+    enum {
+        QUALITY_LOW = 0,    // short filter, for the real time playback path
+        QUALITY_MEDIUM,
+        QUALITY_HIGH,       // long filter, for capture and voice recognition
+        QUALITY_NUM
+    };
+
+                        AudioPolyphaseSrc();
+                        ~AudioPolyphaseSrc();
+
+            // Builds the filter bank and clears the history.
+            // Returns BAD_VALUE if the ratio needs more than MAX_PHASES phases.
+            status_t    init(int inRate, int outRate, int quality);
+            // Clears the history and phase, keeps the filter bank.
+            void        reset();
+            bool        initted() const { return mCoefs != NULL; }
+
+            // The number of output samples produced by a call to convert() is
+            // rounded down to a multiple of align; the remainder is carried over.
+            void        setOutputAlign(size_t align) { mOutAlign = align ? align : 1; }
+
+            // Converts up to *inCount samples from in into at most *outCount samples
+            // at out. On return, *inCount and *outCount hold the number of samples
+            // consumed and produced. out may alias in when downsampling.
+            void        convert(const int16_t *in, size_t *inCount,
+                                int16_t *out, size_t *outCount);
+            // The same with Q31 samples, accumulated in 64 bits.
+            void        convert(const int32_t *in, size_t *inCount,
+                                int32_t *out, size_t *outCount);
+
+            // Upper bound of the number of samples produced from inCount input samples.
+            size_t      maxOutputCount(size_t inCount) const;
+            // Number of input samples still needed to produce outCount output samples.
+            size_t      inputCountFor(size_t outCount) const;
+            // Input samples between the newest input and the center of the next
+            // output: the input not reached yet plus the filter group delay.
+            size_t      delayCount() const;
+
+            int         inRate() const { return mInRate; }
+            int         outRate() const { return mOutRate; }
+            int         taps() const { return mTaps; }
+
+    enum { MAX_PHASES = 512 };
+
+private:
+    // number of input samples copied into the history buffer per pass
+    enum { CHUNK = 256 };
+
+            template <typename T>
+            void        convertSamples(T *buf, const T *in, size_t *inCount,
+                                       T *out, size_t *outCount);
+            int16_t     filter(const int16_t *x, const int16_t *coefs) const;
+            int32_t     filter(const int32_t *x, const int16_t *coefs) const;
+            void        release();
+
+            int         mInRate;
+            int         mOutRate;
+            int         mL;             // interpolation factor, number of phases
+            int         mM;             // decimation factor
+            int         mTaps;          // coefficients per phase, multiple of 8
+            int16_t *   mCoefs;         // mL phases of mTaps reversed Q14 coefficients
+            int16_t *   mBuf;           // history followed by fresh input
+            int32_t *   mBuf32;         // the same for Q31 input
+            size_t      mBufCount;      // valid samples in mBuf
+            size_t      mPos;           // newest input sample of the next output
+            int         mPhase;         // phase of the next output
+            size_t      mOutAlign;
+};
+
+}; // namespace android_audio_legacy
+
+#endif // ANDROID_AUDIO_POLYPHASE_SRC_H
@@ -0,0 +1,149 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "AudioPositionTracker"
+#include <utils/Log.h>
+
+#include <stdio.h>
+
+#include "AudioPositionTracker.h"
+
+namespace android_audio_legacy {
+
+using android::NO_ERROR;
+using android::INVALID_OPERATION;
+
+AudioPositionTracker::AudioPositionTracker(uint32_t sampleRate) :
+    mSampleRate(sampleRate), mCapacityNs(0), mDelayNs(0), mFramesWritten(0),
+    mQueuedNs(0), mLastWriteNs(0), mLastPresented(0), mRenderBase(0),
+    mStandby(true), mStarted(false), mFlushes(0)
+{
+    for (int i = 0; i < SINK_NUM; i++) {
+        mSinkFrames[i] = 0;
+    }
+}
+
+void AudioPositionTracker::setQueueCapacity(nsecs_t capacityNs)
+{
+    Mutex::Autolock lock(mLock);
+    mCapacityNs = capacityNs;
+}
+
+void AudioPositionTracker::setPipelineDelay(nsecs_t delayNs)
+{
+    Mutex::Autolock lock(mLock);
+    mDelayNs = delayNs;
+}
+
+nsecs_t AudioPositionTracker::queuedNs_l(nsecs_t now) const
+{
+    nsecs_t queued = mQueuedNs - (now - mLastWriteNs);
+    return queued > 0 ? queued : 0;
+}
+
+uint64_t AudioPositionTracker::presented_l(nsecs_t now)
+{
+    uint64_t pending = (uint64_t)(queuedNs_l(now) + mDelayNs) * mSampleRate / 1000000000LL;
+    uint64_t presented = mFramesWritten > pending ? mFramesWritten - pending : 0;
+    if (presented < mLastPresented) {
+        presented = mLastPresented;
+    }
+    mLastPresented = presented;
+    return presented;
+}
+
+void AudioPositionTracker::onWrite(int sink, size_t frames, nsecs_t now)
+{
+    Mutex::Autolock lock(mLock);
+
+    if (mStandby) {
+        mRenderBase = presented_l(now);
+        mStandby = false;
+    }
+    nsecs_t queued = queuedNs_l(now) + (nsecs_t)frames * 1000000000LL / mSampleRate;
+    if (mCapacityNs > 0 && queued > mCapacityNs) {
+        queued = mCapacityNs;
+    }
+    mQueuedNs = queued;
+    mLastWriteNs = now;
+    mFramesWritten += frames;
+    if (sink >= 0 && sink < SINK_NUM) {
+        mSinkFrames[sink] += frames;
+    }
+    mStarted = true;
+}
+
+void AudioPositionTracker::onFlush(nsecs_t now)
+{
+    Mutex::Autolock lock(mLock);
+
+    // Whatever was still queued is gone: present it as never written. The pipeline
+    // delay stays in the count, presented_l() keeps subtracting it.
+    uint64_t queued = (uint64_t)queuedNs_l(now) * mSampleRate / 1000000000LL;
+    mFramesWritten = mFramesWritten > queued ? mFramesWritten - queued : 0;
+    mQueuedNs = 0;
+    mLastWriteNs = now;
+    mFlushes++;
+}
+
+void AudioPositionTracker::onStandby(nsecs_t now)
+{
+    Mutex::Autolock lock(mLock);
+    mStandby = true;
+}
+
+uint32_t AudioPositionTracker::renderPosition(nsecs_t now)
+{
+    Mutex::Autolock lock(mLock);
+
+    if (mStandby) {
+        return 0;
+    }
+    return (uint32_t)(presented_l(now) - mRenderBase);
+}
+
+status_t AudioPositionTracker::presentationPosition(nsecs_t now, uint64_t *frames)
+{
+    Mutex::Autolock lock(mLock);
+
+    if (!mStarted) {
+        return INVALID_OPERATION;
+    }
+    *frames = presented_l(now);
+    return NO_ERROR;
+}
+
+void AudioPositionTracker::dump(String8& result)
+{
+    const size_t SIZE = 256;
+    char buffer[SIZE];
+    Mutex::Autolock lock(mLock);
+
+    snprintf(buffer, SIZE, "\tframes written: %llu (speaker %llu, bluetooth %llu, spdif %llu)\n",
+             (unsigned long long)mFramesWritten,
+             (unsigned long long)mSinkFrames[SINK_SPEAKER],
+             (unsigned long long)mSinkFrames[SINK_BLUETOOTH],
+             (unsigned long long)mSinkFrames[SINK_SPDIF]);
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tframes presented: %llu\n", (unsigned long long)mLastPresented);
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tqueue capacity: %d us, pipeline delay: %d us, flushes: %u\n",
+             (int)(mCapacityNs / 1000), (int)(mDelayNs / 1000), mFlushes);
+    result.append(buffer);
+}
+
+}; // namespace android_audio_legacy
@@ -0,0 +1,92 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_AUDIO_POSITION_TRACKER_H
+#define ANDROID_AUDIO_POSITION_TRACKER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/threads.h>
+#include <utils/String8.h>
+
+namespace android_audio_legacy {
+    using android::Mutex;
+    using android::String8;
+    using android::status_t;
+
+// Estimates the number of frames presented by an output stream.
+//
+// The Tegra driver cannot report how much audio is still queued for the DMA, so the
+// queue is modelled as a leaky bucket: every write() adds the duration of the frames
+// the driver accepted, the queue drains in real time and cannot hold more than its
+// capacity (a write that blocks leaves the queue full). Frames are counted at the
+// client sample rate, so sample rate conversion does not change the count; the delay
+// of the converter filter is accounted as a fixed pipeline delay.
+class AudioPositionTracker
+{
+public:
+    enum {
+        SINK_SPEAKER = 0,
+        SINK_BLUETOOTH,
+        SINK_SPDIF,
+        SINK_NUM
+    };
+
+                        AudioPositionTracker(uint32_t sampleRate);
+
+            // Audio the driver can hold before write() blocks.
+            void        setQueueCapacity(nsecs_t capacityNs);
+            // Fixed delay between the client buffer and the driver (e.g. SRC filter delay).
+            void        setPipelineDelay(nsecs_t delayNs);
+
+            // frames were accepted by the driver of sink, at time now.
+            void        onWrite(int sink, size_t frames, nsecs_t now);
+            // The driver queue was flushed: the audio still queued will never be played.
+            void        onFlush(nsecs_t now);
+            // The stream went to standby: getRenderPosition() restarts from 0.
+            void        onStandby(nsecs_t now);
+
+            // Frames presented since the stream last exited standby.
+            uint32_t    renderPosition(nsecs_t now);
+            // Frames presented since the stream was opened, at time now.
+            // Returns INVALID_OPERATION until something was written.
+            status_t    presentationPosition(nsecs_t now, uint64_t *frames);
+
+            void        dump(String8& result);
+
+private:
+            nsecs_t     queuedNs_l(nsecs_t now) const;
+            uint64_t    presented_l(nsecs_t now);
+
+            Mutex       mLock;
+            uint32_t    mSampleRate;
+            nsecs_t     mCapacityNs;
+            nsecs_t     mDelayNs;
+            uint64_t    mFramesWritten;     // accepted by the driver and not flushed
+            uint64_t    mSinkFrames[SINK_NUM];
+            nsecs_t     mQueuedNs;          // audio in the driver queue at mLastWriteNs
+            nsecs_t     mLastWriteNs;
+            uint64_t    mLastPresented;     // keeps the position monotonic
+            uint64_t    mRenderBase;        // position when the stream exited standby
+            bool        mStandby;
+            bool        mStarted;
+            uint32_t    mFlushes;
+};
+
+}; // namespace android_audio_legacy
+
+#endif // ANDROID_AUDIO_POSITION_TRACKER_H
@@ -17,9 +17,12 @@
 //#define LOG_NDEBUG 0
 #define LOG_TAG "AudioPostProcessor"
 #include <fcntl.h>
+#include <cutils/atomic.h>
 #include <utils/Log.h>
 #include "AudioHardware.h"
 #include "AudioPostProcessor.h"
+#include "AudioDsp.h"
+#include "AudioDeviceIo.h"
 #include <sys/stat.h>
 #include "mot_acoustics.h"
 // hardware specific functions
@@ -33,6 +36,14 @@ extern uint16_t HC_CTO_AUDIO_MM_PARAMETER_TABLE[];
 #define MOT_LOG_DELIMITER_END    0xF00D
 #define BASIC_DOCK_PROP_VALUE    0
 
+// Size of the downlink ring: 256 ms of wideband speech
+#define ECNS_DL_RING_BYTES 8192
+// The write thread stays at most this many uplink frames ahead of the read thread
+#define ECNS_DL_MAX_FRAMES 3
+#define ECNS_DL_POLL_US 2000
+// Default uplink frame duration
+#define ECNS_FRAME_MS 20
+
 #define ECNSLOGPATH "/data/ecns"
 #define DOCK_PROP_PATH "/sys/class/switch/dock/dock_prop"
 
@@ -51,21 +62,33 @@ struct timeval mtv1, mtv2, mtv3, mtv4, mtv5, mtv6, mtv7, mtv8;
 namespace android_audio_legacy {
 
 AudioPostProcessor::AudioPostProcessor() :
-    mEcnsScratchBuf(0), mLogNumPoints(0),  mEcnsDlBuf(0), mEcnsDlBufSize(0), mEcnsThread(0)
+    mMmActive(0), mMmInUse(-1), mMmSwaps(0),
+    mEcnsFrameBytes(0), mEcnsFrameMs(ECNS_FRAME_MS),
+    mEcnsDlOverflows(0), mEcnsDlUnderflows(0), mEcnsOutFd(-1),
+    mEcnsLogDelta(false), mEcnsLogFailed(false), mEcnsDlBuf(0), mEcnsDlBufSize(0),
+    mTuning(NULL), mParamGeneration(0), mEcnsThread(0)
 {
     ALOGD("%s",__FUNCTION__);
 
-    // One-time CTO Audio configuration
-    mAudioMmEnvVar.cto_audio_mm_param_block_ptr              = HC_CTO_AUDIO_MM_PARAMETER_TABLE;
-    mAudioMmEnvVar.cto_audio_mm_pcmlogging_buffer_block_ptr  = mPcmLoggingBuf;
-    mAudioMmEnvVar.pcmlogging_buffer_block_size              = ARRAY_SIZE(mPcmLoggingBuf);
-    mAudioMmEnvVar.cto_audio_mm_runtime_param_mem_ptr        = mRuntimeParam;
-    mAudioMmEnvVar.cto_audio_mm_static_memory_block_ptr      = mStaticMem;
-    mAudioMmEnvVar.cto_audio_mm_scratch_memory_block_ptr     = mScratchMem;
-    mAudioMmEnvVar.accy = CTO_AUDIO_MM_ACCY_INVALID;
-    mAudioMmEnvVar.sample_rate = CTO_AUDIO_MM_SAMPL_44100;
-
-    mEcnsThread = new EcnsThread();
+    if (mEcnsDlRing.init(ECNS_DL_RING_BYTES) != NO_ERROR) {
+        ALOGE("%s: cannot allocate the EC/NS downlink ring", __FUNCTION__);
+    }
+
+    // One-time CTO Audio configuration, each block has its own memory
+    for (int i = 0; i < 2; i++) {
+        MmState *state = &mMmStates[i];
+        state->env.cto_audio_mm_param_block_ptr              = HC_CTO_AUDIO_MM_PARAMETER_TABLE;
+        state->env.cto_audio_mm_pcmlogging_buffer_block_ptr  = state->pcmLoggingBuf;
+        state->env.pcmlogging_buffer_block_size              = ARRAY_SIZE(state->pcmLoggingBuf);
+        state->env.cto_audio_mm_runtime_param_mem_ptr        = state->runtimeParam;
+        state->env.cto_audio_mm_static_memory_block_ptr      = state->staticMem;
+        state->env.cto_audio_mm_scratch_memory_block_ptr     = state->scratchMem;
+        state->env.accy = CTO_AUDIO_MM_ACCY_INVALID;
+        state->env.sample_rate = CTO_AUDIO_MM_SAMPL_44100;
+    }
+
+    mEcnsThread = new EcnsThread(this);
+    mEcnsLog = new AudioDatalogWriter(ECNSLOGPATH);
     // Initial conditions for EC/NS
     stopEcns();
 }
@@ -78,6 +101,13 @@ AudioPostProcessor::~AudioPostProcessor()
     }
 }
 
+void AudioPostProcessor::setTuningStore(AudioTuningStore *tuning)
+{
+    mTuning = tuning;
+    // initEcns() copies the whole parameter table
+    mTuning->setMinSize(AudioTuningStore::TABLE_ECNS, sizeof(mParamTable));
+}
+
 uint32_t AudioPostProcessor::convOutDevToCTO(uint32_t outDev)
 {
     int32_t dock_prop = 0;
@@ -124,31 +154,58 @@ uint32_t AudioPostProcessor::convRateToCto(uint32_t rate)
     }
 }
 
-void AudioPostProcessor::configMmAudio()
+// Called with mMmLock held, never from the playback thread.
+// The playback thread does not wait for a reconfiguration: it keeps processing with the
+// published block while the other one is built, and takes the new one at its next buffer.
+void AudioPostProcessor::configMmAudio(uint32_t accy, uint32_t rate)
 {
-    if (mAudioMmEnvVar.accy != CTO_AUDIO_MM_ACCY_INVALID) {
+    int32_t target = 1 - mMmActive;
+
+    // doMmProcessing() may still be running the block published before the current one.
+    // Pairs with the barrier in doMmProcessing(): if it is not seen using target here,
+    // it will see the current block published and use that one.
+    android_memory_barrier();
+    while (android_atomic_acquire_load(&mMmInUse) == target) {
+        usleep(1000);
+    }
+
+    MmState *state = &mMmStates[target];
+    state->env.accy = accy;
+    state->env.sample_rate = rate;
+    if (accy != CTO_AUDIO_MM_ACCY_INVALID) {
         ALOGD("Configure CTO Audio MM processing");
         // fetch the corresponding runtime audio parameter
-        api_cto_audio_mm_param_parser(&(mAudioMmEnvVar), (int16_t *)0, (int16_t *)0);
+        api_cto_audio_mm_param_parser(&(state->env), (int16_t *)0, (int16_t *)0);
         // Initialize algorithm static memory
-        api_cto_audio_mm_init(&(mAudioMmEnvVar), (int16_t *)0, (int16_t *)0);
+        api_cto_audio_mm_init(&(state->env), (int16_t *)0, (int16_t *)0);
     } else {
         ALOGD("CTO Audio MM processing is disabled.");
     }
+    android_atomic_release_store(target, &mMmActive);
+    mMmSwaps++;
 }
 
 void AudioPostProcessor::enableEcns(int value)
 {
     if (mEcnsEnabled!=value) {
         ALOGD("enableEcns() new %08x old %08x)", value, mEcnsEnabled);
-        mEcnsThread->broadcastReadCond();
-        mEcnsThread->requestExitAndWait();
+        mEcnsThread->stop();
         stopEcns();
         cleanupEcns();
         mEcnsEnabled = value;
     }
 }
 
+status_t AudioPostProcessor::setEcnsFrameMs(int ms)
+{
+    if (ms != 10 && ms != 20) {
+        return BAD_VALUE;
+    }
+    ALOGD("%s: %d ms", __FUNCTION__, ms);
+    mEcnsFrameMs = ms;
+    return NO_ERROR;
+}
+
 void AudioPostProcessor::setAudioDev(struct cpcap_audio_stream *outDev,
                                      struct cpcap_audio_stream *inDev,
                                      bool is_bt, bool is_bt_ec, bool is_spdif)
@@ -186,9 +243,9 @@ void AudioPostProcessor::setAudioDev(struct cpcap_audio_stream *outDev,
     }
 
     ALOGV("setAudioDev %d", outDev->id);
-    if (mm_accy != mAudioMmEnvVar.accy) {
-        mAudioMmEnvVar.accy = mm_accy;
-        configMmAudio();
+    const CTO_AUDIO_MM_ENV_VAR *env = &mMmStates[mMmActive].env;
+    if (mm_accy != env->accy) {
+        configMmAudio(mm_accy, env->sample_rate);
     }
 }
 
@@ -199,22 +256,34 @@ void AudioPostProcessor::setPlayAudioRate(int sampRate)
     Mutex::Autolock lock(mMmLock);
 
     ALOGD("AudioPostProcessor::setPlayAudioRate %d", sampRate);
-    if (rate != mAudioMmEnvVar.sample_rate) {
-        mAudioMmEnvVar.sample_rate = rate;
-        configMmAudio();
+    const CTO_AUDIO_MM_ENV_VAR *env = &mMmStates[mMmActive].env;
+    if (rate != env->sample_rate) {
+        configMmAudio(env->accy, rate);
     }
 }
 
+// Only called from the playback thread. Takes no lock: see configMmAudio().
 void AudioPostProcessor::doMmProcessing(void * buffer, int numSamples)
 {
-    Mutex::Autolock lock(mMmLock);
+    int32_t active = android_atomic_acquire_load(&mMmActive);
+    for (;;) {
+        android_atomic_release_store(active, &mMmInUse);
+        android_memory_barrier();
+        int32_t published = android_atomic_acquire_load(&mMmActive);
+        if (published == active) {
+            break;
+        }
+        active = published;
+    }
 
-    if (mAudioMmEnvVar.accy != CTO_AUDIO_MM_ACCY_INVALID &&
+    CTO_AUDIO_MM_ENV_VAR *env = &mMmStates[active].env;
+    if (env->accy != CTO_AUDIO_MM_ACCY_INVALID &&
         !mEcnsEnabled) {
         // Apply the CTO audio effects in-place.
-        mAudioMmEnvVar.frame_size = numSamples;
-        api_cto_audio_mm_main(&mAudioMmEnvVar, (int16_t *)buffer, (int16_t *)buffer);
+        env->frame_size = numSamples;
+        api_cto_audio_mm_main(env, (int16_t *)buffer, (int16_t *)buffer);
     }
+    android_atomic_release_store(-1, &mMmInUse);
 }
 
 int AudioPostProcessor::getEcnsRate (void)
@@ -250,28 +319,32 @@ void AudioPostProcessor::initEcns(int rate, int bytes)
     mMemBlocks.mot_datalog = mMotDatalog;
     mMemBlocks.gainTableMemory = mParamTable;
 
-    FILE * fp = fopen("/system/etc/voip_aud_params.bin", "r");
-    if (fp) {
-        if (fread(mParamTable, sizeof(mParamTable), 1, fp) < 1) {
-            ALOGE("Cannot read VOIP parameter file.  Disabling EC/NS.");
-            fclose(fp);
+    // The EC/NS module works on its own copy, refreshed only when the tuning changed.
+    if (mTuning == NULL ||
+            mTuning->copyEcnsTable(mParamTable, sizeof(mParamTable), &mParamGeneration) != NO_ERROR) {
+        ALOGE("No valid VOIP parameter file.  Disabling EC/NS.");
+        mEcnsEnabled = 0;
+        mEcnsRunning = 0;
+        return;
+    }
+
+    // Room for a stereo frame, the downlink is converted up in place before it is played.
+    if (mEcnsDlBufSize < bytes * 2) {
+        int16_t *buf = (int16_t *)realloc(mEcnsDlBuf, bytes * 2);
+        if (!buf) {
+            ALOGE("Cannot allocate EC/NS downlink buffer.  Disabling EC/NS.");
             mEcnsEnabled = 0;
             mEcnsRunning = 0;
             return;
         }
-        fclose(fp);
-    }
-    else {
-        ALOGE("Cannot open VOIP parameter file.  Disabling EC/NS.");
-        mEcnsEnabled = 0;
-        mEcnsRunning = 0;
-        return;
+        mEcnsDlBuf = buf;
+        mEcnsDlBufSize = bytes * 2;
     }
+    mEcnsFrameBytes = bytes;
+    // Do not start with downlink audio that was buffered for a previous session.
+    mEcnsDlRing.flush();
 
     mEcnsRunning = 1;
-    mEcnsOutBuf = 0;
-    mEcnsOutBufSize = 0;
-    mEcnsOutBufReadOffset = 0;
 
     // Send setup parameters to the EC/NS module, init the module.
     API_MOT_SETUP(&mEcnsCtrl, &mMemBlocks);
@@ -291,11 +364,6 @@ void AudioPostProcessor::cleanupEcns(void)
 {
     AutoMutex lock(mEcnsBufLock);
     mEcnsRate = 0;
-    if (mEcnsScratchBuf) {
-        free(mEcnsScratchBuf);
-        mEcnsScratchBuf = 0;
-    }
-    mEcnsScratchBufSize = 0;
     mEcnsOutFd = -1;
 
     if (mEcnsDlBuf) {
@@ -303,10 +371,8 @@ void AudioPostProcessor::cleanupEcns(void)
        mEcnsDlBuf = 0;
     }
     mEcnsDlBufSize = 0;
-    // In case write() is blocked, set it free.
-    mEcnsBufCond.signal();
 
-    ecnsLogToFile();
+    ecnsLogClose();
 }
 
 
@@ -320,7 +386,7 @@ int AudioPostProcessor::writeDownlinkEcns(int fd, void * buffer, bool stereo,
     if (!(mEcnsEnabled & AEC)) {
         if (fd >= 0) {
             fdLock->lock();
-            ::write(fd, buffer, bytes);
+            AudioDeviceIo::instance()->write(fd, buffer, bytes);
             fdLock->unlock();
         }
         return bytes;
@@ -336,23 +402,36 @@ int AudioPostProcessor::writeDownlinkEcns(int fd, void * buffer, bool stereo,
         mEcnsBufLock.lock();
         written = bytes;  // Pretend all data was consumed even if ecns isn't running
     }
-    if (mEcnsRunning) {
+    bool running = mEcnsRunning;
+    int limit = mEcnsFrameBytes * ECNS_DL_MAX_FRAMES;
+    int rate = mEcnsRate;
+    if (running) {
         // Only run through here after initEcns has been done by read thread.
         mEcnsOutFd = fd;
-        mEcnsOutBuf = buffer;
-        mEcnsOutBufSize = bytes;
-        mEcnsOutBufReadOffset = 0;
         mEcnsOutFdLockp = fdLock;
         mEcnsOutStereo = stereo;
-        if (mEcnsBufCond.waitRelative(mEcnsBufLock, seconds(1)) != NO_ERROR) {
-            ALOGE("%s: Capture thread is stalled.", __FUNCTION__);
-        }
-        if (mEcnsOutBufSize != 0)
-            ALOGD("%s: Buffer not consumed", __FUNCTION__);
-        else
-            written = bytes;  // All data consumed
     }
     mEcnsBufLock.unlock();
+
+    if (running) {
+        // The read thread plays the downlink speech at the capture pace. Wait for it to
+        // drain the ring down to a few frames, but never longer than the duration of this
+        // buffer: if capture stalls, the ring overflows rather than stalling playback.
+        nsecs_t budget = (nsecs_t)bytes * 1000000000LL / (rate * sizeof(int16_t));
+        nsecs_t start = systemTime();
+        while ((int)(mEcnsDlRing.capacity() - mEcnsDlRing.availableToWrite()) + bytes > limit) {
+            nsecs_t left = budget - (systemTime() - start);
+            if (left <= 0) {
+                break;
+            }
+            usleep(left > ECNS_DL_POLL_US * 1000LL ? ECNS_DL_POLL_US : (useconds_t)ns2us(left));
+        }
+        if ((int)mEcnsDlRing.write(buffer, bytes) != bytes) {
+            android_atomic_inc(&mEcnsDlOverflows);
+            ALOGV("%s: Capture thread is stalled, downlink data dropped.", __FUNCTION__);
+        }
+        written = bytes;  // All data consumed
+    }
     return written;
 }
 
@@ -360,25 +439,50 @@ int AudioPostProcessor::writeDownlinkEcns(int fd, void * buffer, bool stereo,
 int AudioPostProcessor::read(int fd, void * buffer, int bytes, int rate)
 {
     if (mEcnsEnabled) {
-        return mEcnsThread->readData(fd, buffer, bytes, rate, this);
+        int done = 0;
+        while (done < bytes) {
+            int avail;
+            const int16_t *frame = acquireUplink(fd, rate, &avail);
+            if (frame == NULL) {
+                return done ? done : -1;
+            }
+            int n = avail < bytes - done ? avail : bytes - done;
+            memcpy((char *)buffer + done, frame, n);
+            releaseUplink(n);
+            done += n;
+        }
+        return done;
     }
     ssize_t ret;
-    ret = ::read(fd, buffer, bytes);
+    ret = AudioDeviceIo::instance()->read(fd, buffer, bytes);
     if (ret < 0)
         ALOGE("Error reading from audio in: %s", strerror(errno));
     return (int)ret;
 }
 
+const int16_t *AudioPostProcessor::acquireUplink(int fd, int rate, int *bytes)
+{
+    if (!mEcnsEnabled) {
+        return NULL;
+    }
+    mEcnsThread->start(fd, rate, mEcnsFrameMs);
+    return mEcnsThread->acquire(bytes);
+}
+
+void AudioPostProcessor::releaseUplink(int bytes)
+{
+    mEcnsThread->release(bytes);
+}
+
 // Returns: Bytes processed.
 int AudioPostProcessor::applyUplinkEcns(void * buffer, int bytes, int rate)
 {
-    static int16 ul_gbuff2[160];
     int16_t *dl_buf;
     int16_t *ul_buf = (int16_t *)buffer;
     int dl_buf_bytes=0;
-    // The write thread could have left us with one frame of data in the
-    // driver when we started reading.
-    static bool onetime;
+    int outFd = -1;
+    Mutex *outFdLockp = NULL;
+    bool outStereo = false;
 
     if (!mEcnsEnabled)
         return 0;
@@ -386,107 +490,39 @@ int AudioPostProcessor::applyUplinkEcns(void * buffer, int bytes, int rate)
     ALOGV("%s %d bytes at %d Hz",__FUNCTION__, bytes, rate);
     if (mEcnsEnabled && !mEcnsRunning) {
         initEcns(rate, bytes);
-        onetime=true;
     }
 
-    // In case the rate switched..
-    if (mEcnsEnabled && rate != mEcnsRate) {
+    // In case the rate or the frame size switched..
+    if (mEcnsEnabled && (rate != mEcnsRate || bytes != mEcnsFrameBytes)) {
         stopEcns();
         initEcns(rate, bytes);
-        onetime=true;
     }
 
     if (!mEcnsRunning) {
         ALOGE("EC/NS failed to init, read returns.");
-        if (mEcnsEnabled & AEC) {
-            mEcnsBufCond.signal();
-        }
+        return -1;
+    }
+
+    dl_buf = mEcnsDlBuf;
+    if (!dl_buf || mEcnsDlBufSize < bytes * 2) {
         return -1;
     }
 
     // do not get downlink audio if only NS is enabled
     if (mEcnsEnabled & AEC) {
         mEcnsBufLock.lock();
-        // Need a contiguous stereo playback buffer in the end.
-        if (bytes*2 != mEcnsDlBufSize || !mEcnsDlBuf) {
-            if (mEcnsDlBuf)
-                free(mEcnsDlBuf);
-            mEcnsDlBuf = (int16_t*)malloc(bytes*2);
-            if (mEcnsDlBuf)
-                mEcnsDlBufSize = bytes*2;
-        }
-        dl_buf = mEcnsDlBuf;
-        if (!dl_buf) {
-            mEcnsBufLock.unlock();
-            return -1;
-        }
-
-        // Need to gather appropriate amount of downlink speech.
-        // Take oldest scratch data first.  The scratch buffer holds fractions of buffers
-        // that were too small for processing.
-        if (mEcnsScratchBuf && mEcnsScratchBufSize) {
-            dl_buf_bytes = mEcnsScratchBufSize > bytes ? bytes:mEcnsScratchBufSize;
-            memcpy(dl_buf, mEcnsScratchBuf, dl_buf_bytes);
-            //ALOGD("Took %d bytes from mEcnsScratchBuf", dl_buf_bytes);
-            mEcnsScratchBufSize -= dl_buf_bytes;
-            if (mEcnsScratchBufSize==0) {
-                // This should always be true.
-                free(mEcnsScratchBuf);
-                mEcnsScratchBuf = 0;
-                mEcnsScratchBufSize = 0;
-            }
-        }
-        // Take fresh data from write thread second.
-        if (dl_buf_bytes < bytes) {
-            int bytes_to_copy = mEcnsOutBufSize - mEcnsOutBufReadOffset;
-            bytes_to_copy = bytes_to_copy + dl_buf_bytes > bytes?
-                          bytes-dl_buf_bytes:bytes_to_copy;
-            if (bytes_to_copy) {
-                memcpy((void *)((unsigned int)dl_buf+dl_buf_bytes),
-                       (void *)((unsigned int)mEcnsOutBuf+mEcnsOutBufReadOffset),
-                       bytes_to_copy);
-                dl_buf_bytes += bytes_to_copy;
-            }
-            //ALOGD("Took %d bytes from mEcnsOutBuf.  Need %d more.", bytes_to_copy,
-            //      bytes-dl_buf_bytes);
-            mEcnsOutBufReadOffset += bytes_to_copy;
-            if (mEcnsOutBufSize - mEcnsOutBufReadOffset < bytes) {
-                // We've depleted the output buffer, it's smaller than one uplink "frame".
-                // First take any unused data into scratch, then free the write thread.
-                if (mEcnsScratchBuf) {
-                    ALOGE("Memleak - coding error");
-                    free(mEcnsScratchBuf);
-                }
-                if (mEcnsOutBufSize - mEcnsOutBufReadOffset > 0) {
-                    if ((mEcnsScratchBuf=malloc(mEcnsOutBufSize - mEcnsOutBufReadOffset)) == 0) {
-                        ALOGE("%s: Alloc failed, scratch data lost.",__FUNCTION__);
-                    } else {
-                        mEcnsScratchBufSize = mEcnsOutBufSize - mEcnsOutBufReadOffset;
-                        //ALOGD("....store %d bytes into scratch buf %p",
-                        //     mEcnsScratchBufSize, mEcnsScratchBuf);
-                        memcpy(mEcnsScratchBuf,
-                               (void *)((unsigned int)mEcnsOutBuf+mEcnsOutBufReadOffset),
-                               mEcnsScratchBufSize);
-                    }
-                }
-                mEcnsOutBuf = 0;
-                mEcnsOutBufSize = 0;
-                mEcnsOutBufReadOffset = 0;
-                //ALOGD("Signal write thread - need data.");
-                mEcnsBufCond.signal();
-            }
-        }
-
-        ALOGV_IF(dl_buf_bytes < bytes, "%s:EC/NS Starved for downlink data. have %d need %d.",
-             __FUNCTION__,dl_buf_bytes, bytes);
-
+        outFd = mEcnsOutFd;
+        outFdLockp = mEcnsOutFdLockp;
+        outStereo = mEcnsOutStereo;
         mEcnsBufLock.unlock();
-    } else {
-        if (mEcnsDlBufSize < bytes * 2) {
-           mEcnsDlBufSize = bytes * 2;
-           mEcnsDlBuf = (int16_t *)realloc(mEcnsDlBuf, mEcnsDlBufSize);
+
+        // Take the downlink speech queued by the write thread.
+        dl_buf_bytes = mEcnsDlRing.read(dl_buf, bytes);
+        if (dl_buf_bytes < bytes && outFd != -1) {
+            android_atomic_inc(&mEcnsDlUnderflows);
+            ALOGV("%s:EC/NS Starved for downlink data. have %d need %d.",
+                 __FUNCTION__,dl_buf_bytes, bytes);
         }
-        dl_buf = mEcnsDlBuf;
     }
 
     // Pad downlink with zeroes as last resort.  We have to process the UL speech.
@@ -500,104 +536,105 @@ int AudioPostProcessor::applyUplinkEcns(void * buffer, int bytes, int rate)
     GETTIMEOFDAY(&mtv4, NULL);
     API_MOT_LOG_RESET(&mEcnsCtrl, &mMemBlocks);
     if (mEcnsEnabled & AEC) {
-        API_MOT_DOWNLINK(&mEcnsCtrl, &mMemBlocks, (int16*)dl_buf, (int16*)ul_buf, &(ul_gbuff2[0]));
+        API_MOT_DOWNLINK(&mEcnsCtrl, &mMemBlocks, (int16*)dl_buf, (int16*)ul_buf, mEcnsGainBuf);
     }
-    API_MOT_UPLINK(&mEcnsCtrl, &mMemBlocks, (int16*)dl_buf, (int16*)ul_buf, &(ul_gbuff2[0]));
+    API_MOT_UPLINK(&mEcnsCtrl, &mMemBlocks, (int16*)dl_buf, (int16*)ul_buf, mEcnsGainBuf);
 
     // Playback the echo-cancelled speech to driver.
     // Include zero padding.  Our echo canceller needs a consistent path.
     if (mEcnsEnabled & AEC) {
-        if (mEcnsOutStereo) {
+        if (outStereo) {
             // Convert up to stereo, in place.
-            for (int i = bytes/2-1; i >= 0; i--) {
-                dl_buf[i*2] = dl_buf[i];
-                dl_buf[i*2+1] = dl_buf[i];
-            }
+            AudioDsp::upmixMonoToStereo(dl_buf, dl_buf, bytes / sizeof(int16_t));
             dl_buf_bytes *= 2;
         }
         GETTIMEOFDAY(&mtv5, NULL);
-        if (mEcnsOutFd != -1) {
-            mEcnsOutFdLockp->lock();
-            ::write(mEcnsOutFd, &dl_buf[0],
-                    bytes*(mEcnsOutStereo?2:1));
-            mEcnsOutFdLockp->unlock();
+        if (outFd != -1) {
+            outFdLockp->lock();
+            AudioDeviceIo::instance()->write(outFd, &dl_buf[0],
+                    bytes*(outStereo?2:1));
+            outFdLockp->unlock();
         }
     }
     // Do the CTO SuperAPI internal logging.
     // (Do this after writing output to avoid adding latency.)
     GETTIMEOFDAY(&mtv6, NULL);
-    ecnsLogToRam(bytes);
+    ecnsLog();
     return bytes;
 }
-void AudioPostProcessor::ecnsLogToRam (int bytes)
+
+status_t AudioPostProcessor::dump(int fd)
+{
+    const size_t SIZE = 256;
+    char buffer[SIZE];
+    String8 result;
+    result.append("AudioPostProcessor::dump\n");
+    snprintf(buffer, SIZE, "\tMM processing: accy %u, rate %u, %u reconfigurations\n",
+             mMmStates[mMmActive].env.accy, mMmStates[mMmActive].env.sample_rate, mMmSwaps);
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tmEcnsEnabled: %d\n", mEcnsEnabled);
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tmEcnsRunning: %s\n", mEcnsRunning ? "true" : "false");
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tmEcnsRate: %d\n", mEcnsRate);
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tdownlink ring: %u of %u bytes\n",
+             mEcnsDlRing.capacity() - mEcnsDlRing.availableToWrite(), mEcnsDlRing.capacity());
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tdownlink overflows: %d\n", android_atomic_acquire_load(&mEcnsDlOverflows));
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tdownlink underflows: %d\n",
+             android_atomic_acquire_load(&mEcnsDlUnderflows));
+    result.append(buffer);
+    mEcnsThread->dump(result);
+    mEcnsLog->dump(result);
+    ::write(fd, result.string(), result.size());
+    return NO_ERROR;
+}
+
+void AudioPostProcessor::setEcnsLogDelta(bool delta)
+{
+    mEcnsLogDelta = delta;
+}
+
+// Queues the CTO SuperAPI log points of the last frame to the datalog writer,
+// which streams them to ECNSLOGPATH.
+void AudioPostProcessor::ecnsLog(void)
 {
-    uint16_t *logp;
     int mode = mEcnsMode + (mEcnsRate==16000?CTO_AUDIO_USECASE_WB_HANDSET:0);
     uint16_t *audioProfile = &mParamTable[AUDIO_PROFILE_PARAMETER_BLOCK_WORD16_SIZE*mode];
 
-    if (audioProfile[ECNS_LOG_ENABLE_OFFSET] & ECNS_LOGGING_BITS) {
-        if (!mLogBuf[0]) {
-            mLogNumPoints = 0;
-            mLogOffset = 0;
-            ALOGE("EC/NS AUDIO LOGGER CONFIGURATION:");
-            ALOGE("log enable %04X",
-                audioProfile[ECNS_LOG_ENABLE_OFFSET]);
-            mkdir(ECNSLOGPATH, 00770);
-            for (uint16_t i=1; i>0; i<<=1) {
-                if (i&ECNS_LOGGING_BITS&audioProfile[ECNS_LOG_ENABLE_OFFSET]) {
-                   mLogNumPoints++;
-                }
-            }
-            ALOGE("Number of log points is %d.", mLogNumPoints);
-            logp = mMotDatalog;
-            mLogSize = 10*60*50*bytes;
-            for (int i=0; i<mLogNumPoints; i++) {
-                // Allocate 10 minutes of logging per point
-                mLogBuf[i]=(char *)malloc(mLogSize);
-                if (!mLogBuf[i]) {
-                    ALOGE("%s: Memory allocation failed.", __FUNCTION__);
-                    for (int j=0; j<i; j++) {
-                        free(mLogBuf[j]);
-                        mLogBuf[j]=0;
-                    }
-                    return;
-                }
+    if (!(audioProfile[ECNS_LOG_ENABLE_OFFSET] & ECNS_LOGGING_BITS) || mEcnsLogFailed) {
+        return;
+    }
+    if (!mEcnsLog->started()) {
+        int numPoints = 0;
+        ALOGE("EC/NS AUDIO LOGGER CONFIGURATION:");
+        ALOGE("log enable %04X",
+            audioProfile[ECNS_LOG_ENABLE_OFFSET]);
+        for (uint16_t i=1; i>0; i<<=1) {
+            if (i&ECNS_LOGGING_BITS&audioProfile[ECNS_LOG_ENABLE_OFFSET]) {
+               numPoints++;
             }
         }
-        if (mLogOffset+bytes > mLogSize)
+        ALOGE("Number of log points is %d.", numPoints);
+        if (mEcnsLog->start(numPoints, mEcnsRate, mEcnsLogDelta) != NO_ERROR) {
+            // Do not retry every frame
+            mEcnsLogFailed = true;
             return;
-        logp = mMotDatalog;
-        for (int i=0; i<mLogNumPoints; i++) {
-            if (mLogBuf[i]) {
-                mLogPoint[i] = logp[1];
-                memcpy(&mLogBuf[i][mLogOffset], &logp[4], logp[2]*sizeof(uint16_t));
-                logp += 4+logp[2];
-            } else {
-                ALOGE("EC/NS logging enabled, but memory not allocated");
-            }
         }
-        mLogOffset += bytes;
+    }
+    uint16_t *logp = mMotDatalog;
+    for (int i=0; i<mEcnsLog->numPoints(); i++) {
+        mEcnsLog->write(i, logp[1], &logp[4], logp[2]*sizeof(uint16_t));
+        logp += 4+logp[2];
     }
 }
 
-void AudioPostProcessor::ecnsLogToFile()
+void AudioPostProcessor::ecnsLogClose()
 {
-    if (mLogNumPoints && mLogOffset > 16000*2) {
-        for (int i=0; i<mLogNumPoints; i++) {
-            FILE * fp;
-            char fname[80];
-            sprintf(fname, ECNSLOGPATH"/log-0x%04X.pcm", mLogPoint[i]);
-            fp = fopen((const char *)fname, "w");
-            if (fp) {
-                ALOGE("Writing %d bytes to %s", mLogOffset, fname);
-                fwrite(mLogBuf[i], mLogOffset, 1, fp);
-                fclose(fp);
-            } else {
-                ALOGE("Problem writing to %s", fname);
-            }
-        }
-    }
-    mLogOffset = 0;
+    mEcnsLog->stop();
+    mEcnsLogFailed = false;
 }
 
 int AudioPostProcessor::read_dock_prop(char const *path)
@@ -643,8 +680,10 @@ int AudioPostProcessor::read_dock_prop(char const *path)
 // Echo Canceller thread
 // Needed to isolate the EC/NS module from scheduling jitter of it's clients.
 //
-AudioPostProcessor::EcnsThread::EcnsThread() :
-    mReadBuf(0), mIsRunning(0)
+AudioPostProcessor::EcnsThread::EcnsThread(AudioPostProcessor * pp) :
+    mProcessor(pp), mFrameBytes(0), mFd(-1), mRate(0), mPublishSeq(0), mTakeSeq(0),
+    mTakeOffset(0), mHeld(false), mIsRunning(false),
+    mFramesDone(0), mOverflows(0), mStalls(0), mErrors(0)
 {
 }
 
@@ -652,146 +691,165 @@ AudioPostProcessor::EcnsThread::~EcnsThread()
 {
 }
 
-int AudioPostProcessor::EcnsThread::readData(int fd, void * buffer, int bytes, int rate,
-                                             AudioPostProcessor * pp)
+void AudioPostProcessor::EcnsThread::start(int fd, int rate, int frameMs)
 {
-    ALOGV("%s: read %d bytes at %d rate", __FUNCTION__, bytes, rate);
-    Mutex::Autolock lock(mEcnsReadLock);
-    mProcessor = pp;
-    mFd = fd;
-    mClientBuf = buffer;
-    mReadSize = bytes;
-    mRate = rate;
-    if (!mIsRunning) {
-        ALOGD("Create (run) the ECNS thread");
-        run("AudioPostProcessor::EcnsThread", ANDROID_PRIORITY_HIGHEST);
+    Mutex::Autolock control(mControlLock);
+    {
+        Mutex::Autolock lock(mLock);
+        if (mIsRunning) {
+            return;
+        }
+        // EC/NS works on mono frames
+        int bytes = rate * frameMs / 1000 * sizeof(int16_t);
+        if (bytes > ECNS_MAX_FRAME_SAMPLES * (int)sizeof(int16_t)) {
+            bytes = ECNS_MAX_FRAME_SAMPLES * sizeof(int16_t);
+        }
+        mFd = fd;
+        mRate = rate;
+        mFrameBytes = bytes;
+        mPublishSeq = 0;
+        mTakeSeq = 0;
+        mTakeOffset = 0;
+        mHeld = false;
         mIsRunning = true;
     }
-    mEcnsReadCond.signal();
-    if (mEcnsReadCond.waitRelative(mEcnsReadLock, seconds(1)) != NO_ERROR) {
-        ALOGE("%s: ECNS thread is stalled.", __FUNCTION__);
-        mClientBuf = 0;
-        return -1;
+    ALOGD("Create (run) the ECNS thread, %d bytes at %d Hz", mFrameBytes, mRate);
+    if (run("AudioPostProcessor::EcnsThread", ANDROID_PRIORITY_HIGHEST) != NO_ERROR) {
+        Mutex::Autolock lock(mLock);
+        mIsRunning = false;
     }
-    return bytes;
 }
 
-bool AudioPostProcessor::EcnsThread::threadLoop()
+void AudioPostProcessor::EcnsThread::stop()
 {
-#ifdef DEBUG_TIMING
-    int count = 0;
-    int small_jitter = 0;
-    int medium_jitter = 0;
-    int large_jitter = 0;
-#endif
-    ssize_t ret1 = 0, ret2;
-    struct timeval tv1, tv2;
-    int  usecs;
-    bool half_done = false;
-    int ecnsStatus = 0;
-
-    ALOGD("%s: Enter thread loop size %d rate %d", __FUNCTION__,
-                                          mReadSize, mRate);
-
-    mReadBuf = (int16_t *) malloc(mReadSize);
-    if (!mReadBuf)
-        goto error;
-
-    while (!exitPending() && ecnsStatus != -1) {
-        GETTIMEOFDAY(&mtv1, NULL);
-        if (!half_done)
-            ret1 = ::read(mFd, mReadBuf, mReadSize/2);
-        if(exitPending())
-            goto error;
-        GETTIMEOFDAY(&mtv2, NULL);
-        ret2 = ::read(mFd, (char *)mReadBuf+mReadSize/2, mReadSize/2);
-        if(exitPending())
-            goto error;
-        if (ret1 <= 0 || ret2 <= 0) {
-            ALOGE("%s: Problem reading.", __FUNCTION__);
-            goto error;
-        }
-        GETTIMEOFDAY(&mtv3, NULL);
-        mEcnsReadLock.lock();
-        ecnsStatus = mProcessor->applyUplinkEcns(mReadBuf, mReadSize, mRate);
-
-        // wait for client buffer if not ready
-        if (!mClientBuf) {
-            if(exitPending()) {
-                mEcnsReadLock.unlock();
-                goto error;
-            }
-            if (mEcnsReadCond.waitRelative(mEcnsReadLock, seconds(1)) != NO_ERROR) {
-                ALOGE("%s: client stalled.", __FUNCTION__);
-            }
-        }
-        if (mClientBuf && mReadSize) {
-            // Give the buffer to the client.
-            memcpy(mClientBuf, mReadBuf, mReadSize);
-            // Avoid read overflow by reading before signaling the similar-priority read thread.
-            ret1 = ::read(mFd, mReadBuf, mReadSize/2);
-            half_done = true;
-            GETTIMEOFDAY(&mtv7, NULL);
-            mClientBuf = 0;
-            mEcnsReadCond.signal();
-        } else {
-            half_done = false;
-            ALOGV("%s: Read overflow (ECNS sanity preserved)", __FUNCTION__);
-        }
-        mEcnsReadLock.unlock();
-        GETTIMEOFDAY(&mtv8, NULL);
+    Mutex::Autolock control(mControlLock);
+    requestExit();
+    {
+        Mutex::Autolock lock(mLock);
+        mReadyCond.broadcast();
+    }
+    requestExitAndWait();
+}
 
-#ifdef DEBUG_TIMING
-	count++;
-        tv1.tv_sec = mtv1.tv_sec;
-        tv1.tv_usec = mtv1.tv_usec;
-        tv2.tv_sec = mtv8.tv_sec;
-        tv2.tv_usec = mtv8.tv_usec;
-        // Compare first and last timestamps
-        tv2.tv_sec -= tv1.tv_sec;
-        if(tv2.tv_usec < tv1.tv_usec) {
-            tv2.tv_sec--;
-            tv2.tv_usec = 1000000 + tv2.tv_usec - tv1.tv_usec;
-        } else {
-            tv2.tv_usec = tv2.tv_usec - tv1.tv_usec;
+const int16_t *AudioPostProcessor::EcnsThread::acquire(int *bytes)
+{
+    Mutex::Autolock lock(mLock);
+
+    while (mTakeSeq == mPublishSeq) {
+        if (!mIsRunning) {
+            return NULL;
         }
-        usecs = tv2.tv_usec + tv2.tv_sec*1000000;
-        if (usecs > 25000) {
-            if (usecs > 30000)
-                large_jitter++;
-            else
-                medium_jitter++;
-            ALOGD("jitter: usecs = %d should be 20000", usecs);
-            ALOGD("Point 1 (      start): %03d.%06d:", (int)mtv1.tv_sec, (int)mtv1.tv_usec);
-            ALOGD("Point 2 (after read1): %03d.%06d:", (int)mtv2.tv_sec, (int)mtv2.tv_usec);
-            ALOGD("Point 3 (after read2): %03d.%06d:", (int)mtv3.tv_sec, (int)mtv3.tv_usec);
-            ALOGD("Point 4 (before ECNS): %03d.%06d:", (int)mtv4.tv_sec, (int)mtv4.tv_usec);
-            ALOGD("Point 5 (after  ECNS): %03d.%06d:", (int)mtv5.tv_sec, (int)mtv5.tv_usec);
-            ALOGD("Point 6 (after write): %03d.%06d:", (int)mtv6.tv_sec, (int)mtv6.tv_usec);
-            ALOGD("Point 7 (before sgnl): %03d.%06d:", (int)mtv7.tv_sec, (int)mtv7.tv_usec);
-            ALOGD("Point 8 (after unlck): %03d.%06d:", (int)mtv8.tv_sec, (int)mtv8.tv_usec);
-        } else if ((usecs > 22000) || (usecs < 18000)) {
-            small_jitter++;
-            ALOGD("jitter: usecs = %d should be 20000", usecs);
+        if (mReadyCond.waitRelative(mLock, seconds(1)) != NO_ERROR) {
+            ALOGE("%s: ECNS thread is stalled.", __FUNCTION__);
+            mStalls++;
+            return NULL;
         }
-        if ((count % 500)== 0) {
-            ALOGD("====================================== Statistics ===========================");
-            ALOGD(" After %d seconds:", count/50);
-            ALOGD(" Small jitters-  %d (%02.5f%%)", small_jitter, ((float)small_jitter)*100/count);
-            ALOGD(" Medium jitters- %d (%02.5f%%)", medium_jitter, ((float)medium_jitter)*100/count);
-            ALOGD(" Large jitters-  %d (%02.5f%%)", large_jitter, ((float)large_jitter)*100/count);
-            ALOGD("=============================================================================");
+    }
+    mHeld = true;
+    *bytes = mFrameBytes - mTakeOffset;
+    return &mFrames[mTakeSeq % ECNS_NUM_FRAMES][mTakeOffset / sizeof(int16_t)];
+}
+
+void AudioPostProcessor::EcnsThread::release(int bytes)
+{
+    Mutex::Autolock lock(mLock);
+
+    if (!mHeld) {
+        return;
+    }
+    mHeld = false;
+    mTakeOffset += bytes;
+    if (mTakeOffset >= mFrameBytes) {
+        mTakeSeq++;
+        mTakeOffset = 0;
+    }
+}
+
+// Read stage: the frame to capture into. When the client has not taken the frames
+// already published, the oldest is dropped, or the newest if the client holds the
+// oldest: the EC/NS cadence never waits for the client.
+int16_t *AudioPostProcessor::EcnsThread::readStage()
+{
+    int16_t *frame;
+    {
+        Mutex::Autolock lock(mLock);
+        if (mPublishSeq - mTakeSeq == ECNS_NUM_FRAMES) {
+            if (mHeld) {
+                mPublishSeq--;
+            } else {
+                mTakeSeq++;
+                mTakeOffset = 0;
+            }
+            mOverflows++;
         }
-#endif
+        frame = mFrames[mPublishSeq % ECNS_NUM_FRAMES];
     }
-error:
+    ssize_t ret = AudioDeviceIo::instance()->read(mFd, frame, mFrameBytes);
+    if (ret != mFrameBytes) {
+        ALOGE("%s: Problem reading: %d", __FUNCTION__, (int)ret);
+        return NULL;
+    }
+    return frame;
+}
+
+// EC/NS stage, in place and without any lock held
+bool AudioPostProcessor::EcnsThread::ecnsStage(int16_t *frame)
+{
+    return mProcessor->applyUplinkEcns(frame, mFrameBytes, mRate) != -1;
+}
+
+// Publish stage: the frame is handed to the client.
+void AudioPostProcessor::EcnsThread::publishStage()
+{
+    Mutex::Autolock lock(mLock);
+    mPublishSeq++;
+    mFramesDone++;
+    mReadyCond.broadcast();
+}
+
+// The pipeline reads a frame into one of ECNS_NUM_FRAMES preallocated buffers, runs
+// EC/NS on it in place and publishes it; the client takes published frames without
+// copy through acquire() and release(). The lock only covers the frame sequence
+// numbers, so neither side ever waits for the other while it works on a frame.
+bool AudioPostProcessor::EcnsThread::threadLoop()
+{
+    int16_t *frame = NULL;
+    bool ok = false;
+
+    if (!exitPending()) {
+        frame = readStage();
+    }
+    if (frame != NULL && !exitPending()) {
+        ok = ecnsStage(frame);
+    }
+    if (ok) {
+        publishStage();
+        return true;
+    }
+
     ALOGD("%s: Exit thread loop, enabled = %d", __FUNCTION__,mProcessor->isEcnsEnabled());
-    if (mReadBuf) {
-        free (mReadBuf);
-        mReadBuf = 0;
+    Mutex::Autolock lock(mLock);
+    if (frame == NULL && !exitPending()) {
+        mErrors++;
     }
     mIsRunning = false;
+    mReadyCond.broadcast();
     return false;
 }
 
+void AudioPostProcessor::EcnsThread::dump(String8& result)
+{
+    const size_t SIZE = 256;
+    char buffer[SIZE];
+    Mutex::Autolock lock(mLock);
+
+    snprintf(buffer, SIZE, "	uplink: %s, %d byte frames, %u ready%s\n",
+             mIsRunning ? "running" : "stopped", mFrameBytes, mPublishSeq - mTakeSeq,
+             mHeld ? ", 1 held" : "");
+    result.append(buffer);
+    snprintf(buffer, SIZE, "	uplink frames: %u, overflows %u, stalls %u, errors %u\n",
+             mFramesDone, mOverflows, mStalls, mErrors);
+    result.append(buffer);
+}
+
 } //namespace android
@@ -19,11 +19,15 @@
 #ifdef USE_PROPRIETARY_AUDIO_EXTENSIONS
 
 #include <utils/threads.h>
+#include <utils/String8.h>
 
 extern "C" {
 #include "cto_audio_mm.h"
 }
 #include "mot_acoustics.h"
+#include "AudioRingBuffer.h"
+#include "AudioDatalogWriter.h"
+#include "AudioTuningStore.h"
 
 namespace android_audio_legacy {
     using android::Mutex;
@@ -31,6 +35,12 @@ namespace android_audio_legacy {
     using android::Condition;
     using android::Thread;
     using android::sp;
+    using android::String8;
+    using android::status_t;
+
+// Uplink frames the EC/NS pipeline holds, and the largest: 20 ms at 16 kHz mono
+#define ECNS_NUM_FRAMES 4
+#define ECNS_MAX_FRAME_SAMPLES 320
 
 class AudioPostProcessor
 {
@@ -38,6 +48,8 @@ public:
                         AudioPostProcessor();
                         ~AudioPostProcessor();
             void        setPlayAudioRate(int rate);
+            // Source of the EC/NS parameter table
+            void        setTuningStore(AudioTuningStore *tuning);
             void        setAudioDev(struct cpcap_audio_stream *outDev,
                                     struct cpcap_audio_stream *inDev,
                                     bool is_bt, bool is_bt_ec, bool is_spdif);
@@ -54,51 +66,68 @@ public:
             bool        isEcnsEnabled(void) { return (mEcnsEnabled != 0); }
             bool        isEcEnabled(void) { return !!(mEcnsEnabled & AEC); }
 
+            // EC/NS frame duration, 10 or 20 ms, applied when EC/NS next starts
+            status_t    setEcnsFrameMs(int ms);
+            // Delta encode the EC/NS datalog, applied when logging next starts
+            void        setEcnsLogDelta(bool delta);
+
             int         writeDownlinkEcns(int fd, void * buffer,
                                           bool stereo, int bytes, Mutex * fdLockp);
             int         read(int fd, void * buffer, int bytes, int rate);
+            // Zero copy uplink: the oldest processed frame captured from fd, NULL if
+            // EC/NS is off or stalled. The frame stays valid until releaseUplink(),
+            // which tells how many of its *bytes were consumed.
+            const int16_t *acquireUplink(int fd, int rate, int *bytes);
+            void        releaseUplink(int bytes);
             int         applyUplinkEcns(void * buffer, int bytes, int rate);
 
+            status_t    dump(int fd);
+
 private:
-            void        configMmAudio(void);
+            void        configMmAudio(uint32_t accy, uint32_t rate);
             uint32_t    convOutDevToCTO(uint32_t outDev);
             uint32_t    convRateToCto(uint32_t rate);
 
             void        initEcns(int rate, int bytes);
             void        stopEcns(void);
             void        cleanupEcns(void);
-            void        ecnsLogToRam(int bytes);
-            void        ecnsLogToFile(void);
+            void        ecnsLog(void);
+            void        ecnsLogClose(void);
             int         read_dock_prop(char const *path);
 
         // CTO Multimedia Audio Processing storage buffers
-            int16_t     mPcmLoggingBuf[((CTO_AUDIO_MM_DATALOGGING_BUFFER_BLOCK_BYTESIZE)/2)];
             uint32_t    mNoiseEst[((CTO_AUDIO_MM_NOISE_EST_BLOCK_BYTESIZE)/4)];
-            uint16_t    mRuntimeParam[((CTO_AUDIO_MM_RUNTIME_PARAM_BYTESIZE)/2)];
-            uint16_t    mStaticMem[((CTO_AUDIO_MM_STATICMEM_BLOCK_BYTESIZE)/2)];
-            uint16_t    mScratchMem[((CTO_AUDIO_MM_SCRATCHMEM_BLOCK_BYTESIZE)/2)];
-            CTO_AUDIO_MM_ENV_VAR mAudioMmEnvVar;
-            Mutex       mMmLock;
+            // A complete configuration of the library. configMmAudio() builds the new
+            // configuration in the block doMmProcessing() does not use, then publishes it.
+            struct MmState {
+                int16_t     pcmLoggingBuf[((CTO_AUDIO_MM_DATALOGGING_BUFFER_BLOCK_BYTESIZE)/2)];
+                uint16_t    runtimeParam[((CTO_AUDIO_MM_RUNTIME_PARAM_BYTESIZE)/2)];
+                uint16_t    staticMem[((CTO_AUDIO_MM_STATICMEM_BLOCK_BYTESIZE)/2)];
+                uint16_t    scratchMem[((CTO_AUDIO_MM_SCRATCHMEM_BLOCK_BYTESIZE)/2)];
+                CTO_AUDIO_MM_ENV_VAR env;
+            };
+            MmState     mMmStates[2];
+    volatile int32_t    mMmActive;      // index of the published block
+    volatile int32_t    mMmInUse;       // index of the block doMmProcessing() runs, or -1
+            Mutex       mMmLock;        // serializes the reconfigurations only
+            uint32_t    mMmSwaps;
 
         // EC/NS configuration etc.
             Mutex       mEcnsBufLock;
-            Condition   mEcnsBufCond;  // Signal to unblock write thread
             int         mEcnsEnabled; // Enabled by libaudio
             bool        mEcnsRunning; // ECNS module init done by read thread
             int         mEcnsRate;
-            void *      mEcnsScratchBuf;  // holding cell for downlink speech "consumed".
-            int         mEcnsScratchBufSize;
-            void *      mEcnsOutBuf;      // buffer from downlink "write()"
-            int         mEcnsOutBufSize;
-            int         mEcnsOutBufReadOffset;
+            int         mEcnsFrameBytes;  // uplink frame size, set by initEcns()
+            int         mEcnsFrameMs;
+            AudioRingBuffer mEcnsDlRing;  // downlink speech from write() to the read thread
+    volatile int32_t    mEcnsDlOverflows;
+    volatile int32_t    mEcnsDlUnderflows;
             int         mEcnsOutFd;       // fd pointing to output driver
             Mutex *     mEcnsOutFdLockp;
             CTO_AUDIO_USECASES_CTRL mEcnsMode;
-            char *      mLogBuf[15];
-            int         mLogOffset;
-            int         mLogSize;
-            int         mLogNumPoints;
-            uint16_t    mLogPoint[15];
+            sp <AudioDatalogWriter> mEcnsLog;
+            bool        mEcnsLogDelta;
+            bool        mEcnsLogFailed;
             int16_t *   mEcnsDlBuf;
             int         mEcnsDlBufSize;
             bool        mEcnsOutStereo;
@@ -106,30 +135,51 @@ private:
         // EC/NS Module memory
             T_MOT_MEM_BLOCKS mMemBlocks;
             T_MOT_CTRL  mEcnsCtrl;
+            int16       mEcnsGainBuf[160];  // written by API_MOT_DOWNLINK/UPLINK, not read
             uint16_t    mStaticMemory_1[API_MOT_STATIC_MEM_WORD16_SIZE];
             uint16_t    mMotDatalog[API_MOT_DATALOGGING_MEM_WORD16_SIZE];
             uint16_t    mParamTable[AUDIO_PROFILE_PARAMETER_BLOCK_WORD16_SIZE*CTO_AUDIO_USECASE_TOTAL_NUMBER];
+            AudioTuningStore *mTuning;
+            uint32_t    mParamGeneration; // of the tuning table copied to mParamTable
 
-        // ECNS Thread
+        // ECNS Thread: the uplink pipeline, see threadLoop()
             class EcnsThread : public Thread {
 public:
-                        EcnsThread();
+                        EcnsThread(AudioPostProcessor * pp);
                         ~EcnsThread();
-            int         readData(int fd, void * buffer, int bytes, int rate,
-                                 AudioPostProcessor * pp);
-            void        broadcastReadCond() { mEcnsReadCond.broadcast(); }
+            // Starts capturing fd at rate in frames of frameMs, unless running.
+            void        start(int fd, int rate, int frameMs);
+            void        stop();
+            const int16_t *acquire(int *bytes);
+            void        release(int bytes);
+            void        dump(String8& result);
 
 private:
             bool        threadLoop();
-            Mutex       mEcnsReadLock;
-            Condition   mEcnsReadCond;  // Signal to unblock read thread
+            int16_t *   readStage();
+            bool        ecnsStage(int16_t *frame);
+            void        publishStage();
+
+            Mutex       mControlLock;   // start() and stop()
+            Mutex       mLock;          // frame sequence numbers
+            Condition   mReadyCond;     // a frame was published, or the thread exited
             AudioPostProcessor * mProcessor;
-            void *      mClientBuf;
-            int         mReadSize;
-            int16_t *   mReadBuf;
+            int16_t     mFrames[ECNS_NUM_FRAMES][ECNS_MAX_FRAME_SAMPLES];
+            int         mFrameBytes;
             int         mFd;
             int         mRate;
+            // Free running frame counts: [mTakeSeq, mPublishSeq) are ready for the
+            // client, the frame at mPublishSeq is being read and processed.
+            uint32_t    mPublishSeq;
+            uint32_t    mTakeSeq;
+            int         mTakeOffset;    // bytes of frame mTakeSeq consumed
+            bool        mHeld;          // frame mTakeSeq is acquired
             bool        mIsRunning;
+            // statistics
+            uint32_t    mFramesDone;
+            uint32_t    mOverflows;     // frames dropped, the client did not take them
+            uint32_t    mStalls;        // client waits that timed out
+            uint32_t    mErrors;        // driver reads that failed
             };
             sp <EcnsThread> mEcnsThread;
 };
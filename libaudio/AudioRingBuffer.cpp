@@ -0,0 +1,132 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cutils/atomic.h>
+
+#include "AudioRingBuffer.h"
+
+namespace android_audio_legacy {
+
+using android::NO_ERROR;
+using android::BAD_VALUE;
+using android::NO_MEMORY;
+
+AudioRingBuffer::AudioRingBuffer() :
+    mData(NULL), mCapacity(0), mRear(0), mFront(0)
+{
+}
+
+AudioRingBuffer::~AudioRingBuffer()
+{
+    free(mData);
+}
+
+status_t AudioRingBuffer::init(size_t capacity)
+{
+    if (capacity == 0 || capacity > (1U << 30)) {
+        return BAD_VALUE;
+    }
+    size_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    free(mData);
+    mData = (uint8_t *)memalign(CACHE_LINE, size);
+    if (mData == NULL) {
+        mCapacity = 0;
+        return NO_MEMORY;
+    }
+    mCapacity = size;
+    mRear = 0;
+    mFront = 0;
+    return NO_ERROR;
+}
+
+size_t AudioRingBuffer::availableToWrite() const
+{
+    // The producer owns mRear, only mFront needs to be synchronized.
+    uint32_t filled = (uint32_t)mRear - (uint32_t)android_atomic_acquire_load(&mFront);
+    return mCapacity - filled;
+}
+
+size_t AudioRingBuffer::availableToRead() const
+{
+    return (uint32_t)android_atomic_acquire_load(&mRear) - (uint32_t)mFront;
+}
+
+size_t AudioRingBuffer::write(const void *buffer, size_t bytes)
+{
+    if (mData == NULL) {
+        return 0;
+    }
+    size_t avail = availableToWrite();
+    if (bytes > avail) {
+        bytes = avail;
+    }
+    uint32_t rear = (uint32_t)mRear;
+    size_t offset = rear & (mCapacity - 1);
+    size_t part = mCapacity - offset;
+    if (part > bytes) {
+        part = bytes;
+    }
+    memcpy(mData + offset, buffer, part);
+    memcpy(mData, (const uint8_t *)buffer + part, bytes - part);
+    // Publish the data before the index.
+    android_atomic_release_store((int32_t)(rear + bytes), &mRear);
+    return bytes;
+}
+
+size_t AudioRingBuffer::read(void *buffer, size_t bytes)
+{
+    if (mData == NULL) {
+        return 0;
+    }
+    size_t avail = availableToRead();
+    if (bytes > avail) {
+        bytes = avail;
+    }
+    uint32_t front = (uint32_t)mFront;
+    size_t offset = front & (mCapacity - 1);
+    size_t part = mCapacity - offset;
+    if (part > bytes) {
+        part = bytes;
+    }
+    memcpy(buffer, mData + offset, part);
+    memcpy((uint8_t *)buffer + part, mData, bytes - part);
+    // Release the space only after the data has been copied out.
+    android_atomic_release_store((int32_t)(front + bytes), &mFront);
+    return bytes;
+}
+
+size_t AudioRingBuffer::discard(size_t bytes)
+{
+    size_t avail = availableToRead();
+    if (bytes > avail) {
+        bytes = avail;
+    }
+    android_atomic_release_store((int32_t)((uint32_t)mFront + bytes), &mFront);
+    return bytes;
+}
+
+void AudioRingBuffer::flush()
+{
+    android_atomic_release_store(android_atomic_acquire_load(&mRear), &mFront);
+}
+
+}; // namespace android_audio_legacy
@@ -0,0 +1,78 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_AUDIO_RING_BUFFER_H
+#define ANDROID_AUDIO_RING_BUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <utils/Errors.h>
+
+namespace android_audio_legacy {
+    using android::status_t;
+
+// Single producer, single consumer byte FIFO.
+//
+// The storage is allocated once by init() and aligned on a cache line. Each side
+// only writes its own index, which sits on its own cache line, and publishes it
+// with a release store: write() and read() never take a lock nor block, and can
+// be called from threads of any priority.
+class AudioRingBuffer
+{
+public:
+    enum { CACHE_LINE = 64 };
+
+                        AudioRingBuffer();
+                        ~AudioRingBuffer();
+
+            // Allocates the storage, capacity is rounded up to a power of 2.
+            // Not thread safe: call before the producer and consumer are started.
+            status_t    init(size_t capacity);
+            bool        initted() const { return mData != NULL; }
+            size_t      capacity() const { return mCapacity; }
+
+            // Producer side. Copies as much of buffer as fits and returns the
+            // number of bytes copied.
+            size_t      write(const void *buffer, size_t bytes);
+            size_t      availableToWrite() const;
+
+            // Consumer side. Copies at most bytes into buffer and returns the
+            // number of bytes copied.
+            size_t      read(void *buffer, size_t bytes);
+            size_t      availableToRead() const;
+            // Drops the oldest bytes, at most bytes, and returns the number dropped.
+            size_t      discard(size_t bytes);
+            // Drops everything written so far.
+            void        flush();
+
+private:
+                        AudioRingBuffer(const AudioRingBuffer &);
+            AudioRingBuffer& operator = (const AudioRingBuffer &);
+
+            uint8_t *   mData;
+            size_t      mCapacity;
+            char        mPad0[CACHE_LINE];
+    // Free running byte counts, the buffer offset is count & (mCapacity - 1)
+    volatile int32_t    mRear;      // written by the producer only
+            char        mPad1[CACHE_LINE - sizeof(int32_t)];
+    volatile int32_t    mFront;     // written by the consumer only
+            char        mPad2[CACHE_LINE - sizeof(int32_t)];
+};
+
+}; // namespace android_audio_legacy
+
+#endif // ANDROID_AUDIO_RING_BUFFER_H
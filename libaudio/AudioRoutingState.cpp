@@ -0,0 +1,110 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "AudioRoutingState"
+#include <utils/Log.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include "AudioRoutingState.h"
+
+namespace android_audio_legacy {
+
+AudioRoutingState::AudioRoutingState() :
+    mNoops(0)
+{
+    // The drivers and the post processor start with bluetooth and EC/NS off, anything
+    // else is programmed by the first routing.
+    memset(&mCurrent, 0, sizeof(mCurrent));
+    mCurrent.outDevice = -1;
+    mCurrent.inDevice = -1;
+}
+
+uint32_t AudioRoutingState::diff(const AudioRoute& target) const
+{
+    uint32_t changes = 0;
+
+    if (target.outDevice != mCurrent.outDevice ||
+            target.inDevice != mCurrent.inDevice ||
+            target.btSco != mCurrent.btSco ||
+            target.btNrec != mCurrent.btNrec ||
+            target.spdif != mCurrent.spdif) {
+        changes |= CHANGE_PP_DEVICE;
+    }
+    if (target.ecns != mCurrent.ecns) {
+        changes |= CHANGE_ECNS;
+    }
+    if (target.output != mCurrent.output ||
+            target.speaker != mCurrent.speaker ||
+            target.btSco != mCurrent.btSco ||
+            target.spdif != mCurrent.spdif ||
+            target.hwOutRate != mCurrent.hwOutRate) {
+        changes |= CHANGE_OUT_DRIVER;
+    }
+    if (target.input != NULL &&
+            (target.input != mCurrent.input ||
+             target.mic != mCurrent.mic ||
+             target.btSco != mCurrent.btSco ||
+             target.hwInRate != mCurrent.hwInRate)) {
+        changes |= CHANGE_IN_DRIVER;
+    }
+    if (target.btSco != mCurrent.btSco) {
+        changes |= CHANGE_BT_SCO;
+    }
+    return changes;
+}
+
+void AudioRoutingState::applied(const AudioRoute& route, uint32_t changes, nsecs_t start)
+{
+    mCurrent = route;
+    if (changes & CHANGE_STREAMS) {
+        mTransitions.add(systemTime() - start);
+    } else {
+        mNoops++;
+    }
+    ALOGV("%s: changes %02x", __FUNCTION__, changes);
+}
+
+void AudioRoutingState::invalidateStreams()
+{
+    mCurrent.output = NULL;
+    mCurrent.input = NULL;
+}
+
+void AudioRoutingState::dump(String8& result) const
+{
+    const size_t SIZE = 256;
+    char buffer[SIZE];
+
+    snprintf(buffer, SIZE, "\trouting: out %d in %d%s%s, ecns %x, rates %d/%d, "
+             "%u transitions, %u no-ops\n",
+             mCurrent.outDevice, mCurrent.inDevice,
+             mCurrent.btSco ? " sco" : "", mCurrent.spdif ? " spdif" : "",
+             mCurrent.ecns, mCurrent.hwOutRate, mCurrent.hwInRate,
+             mTransitions.count(), mNoops);
+    result.append(buffer);
+    if (mTransitions.count()) {
+        snprintf(buffer, SIZE, "\t  %-14s %8s %8s %8s %8s\n", "routing (us)", "count", "p50",
+                 "p99", "max");
+        result.append(buffer);
+        mTransitions.dump(result, "transition");
+    }
+}
+
+}; // namespace android_audio_legacy
@@ -0,0 +1,84 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+
+#ifndef ANDROID_AUDIO_ROUTING_STATE_H
+#define ANDROID_AUDIO_ROUTING_STATE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/Timers.h>
+#include <utils/String8.h>
+
+#include "AudioStats.h"
+
+namespace android_audio_legacy {
+    using android::String8;
+
+// Everything doRouting_l() programs into the drivers and the post processor.
+struct AudioRoute {
+            const void *output;     // streams the driver paths were given to
+            const void *input;      // NULL if no input is active
+            int         outDevice;  // CPCAP_AUDIO_OUT_*
+            int         inDevice;   // CPCAP_AUDIO_IN_*
+            bool        speaker;    // CPCAP output path in use
+            bool        spdif;
+            bool        btSco;
+            bool        mic;        // CPCAP input path in use
+            bool        btNrec;
+            int         ecns;       // AudioHardware::PREPROC_* enabled
+            int         hwOutRate;
+            int         hwInRate;
+};
+
+// The route last applied to the hardware. doRouting_l() builds the target route, and
+// only redoes the steps whose inputs differ from it: most routing requests from the
+// framework change nothing, or only the gains.
+class AudioRoutingState
+{
+public:
+    enum {
+        CHANGE_PP_DEVICE    = 0x01, // post processor use case: devices, SCO, NREC, S/PDIF
+        CHANGE_ECNS         = 0x02, // EC/NS enabled set
+        CHANGE_OUT_DRIVER   = 0x04, // output stream paths or rate
+        CHANGE_IN_DRIVER    = 0x08, // input stream paths or rate
+        CHANGE_BT_SCO       = 0x10, // I2S port switch, both DMAs must be stopped
+        // the changes that need the stream locks
+        CHANGE_STREAMS      = 0x1F,
+    };
+
+                        AudioRoutingState();
+
+            // CHANGE_* bits of the steps needed to go from the current route to target.
+            uint32_t    diff(const AudioRoute& target) const;
+            // Makes route current and records the transition that began at start.
+            void        applied(const AudioRoute& route, uint32_t changes, nsecs_t start);
+            // Forgets the streams, for when one is opened or closed: the next routing
+            // gives them their paths again.
+            void        invalidateStreams();
+            const AudioRoute& current() const { return mCurrent; }
+            void        dump(String8& result) const;
+
+private:
+            AudioRoute  mCurrent;
+            uint32_t    mNoops;         // routings with nothing to change
+            AudioLatencyHistogram mTransitions;
+};
+
+}; // namespace android_audio_legacy
+
+#endif // ANDROID_AUDIO_ROUTING_STATE_H
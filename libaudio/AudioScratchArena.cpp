@@ -0,0 +1,78 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "AudioScratchArena"
+#include <utils/Log.h>
+
+#include <malloc.h>
+#include <stdlib.h>
+
+#include "AudioScratchArena.h"
+
+namespace android_audio_legacy {
+
+using android::NO_ERROR;
+using android::BAD_VALUE;
+using android::NO_MEMORY;
+
+AudioScratchArena::AudioScratchArena() :
+    mCapacity(0)
+{
+    for (int i = 0; i < NUM_BUFFERS; i++) {
+        mBuffers[i] = NULL;
+    }
+}
+
+AudioScratchArena::~AudioScratchArena()
+{
+    release();
+}
+
+void AudioScratchArena::release()
+{
+    for (int i = 0; i < NUM_BUFFERS; i++) {
+        free(mBuffers[i]);
+        mBuffers[i] = NULL;
+    }
+    mCapacity = 0;
+}
+
+status_t AudioScratchArena::reserve(size_t bytes)
+{
+    if (bytes == 0) {
+        return BAD_VALUE;
+    }
+    if (bytes <= mCapacity) {
+        return NO_ERROR;
+    }
+    release();
+    bytes = (bytes + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1);
+    for (int i = 0; i < NUM_BUFFERS; i++) {
+        mBuffers[i] = (uint8_t *)memalign(ALIGNMENT, bytes);
+        if (mBuffers[i] == NULL) {
+            ALOGE("%s: cannot allocate %u bytes", __FUNCTION__, (unsigned)bytes);
+            release();
+            return NO_MEMORY;
+        }
+    }
+    mCapacity = bytes;
+    ALOGV("%s: %d buffers of %u bytes", __FUNCTION__, NUM_BUFFERS, (unsigned)bytes);
+    return NO_ERROR;
+}
+
+}; // namespace android_audio_legacy
@@ -0,0 +1,64 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+
+#ifndef ANDROID_AUDIO_SCRATCH_ARENA_H
+#define ANDROID_AUDIO_SCRATCH_ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <utils/Errors.h>
+
+namespace android_audio_legacy {
+    using android::status_t;
+
+// Working buffers of a stream's processing chain, allocated once outside of the
+// real time path. Each stage reads its source and writes to the other buffer,
+// so that no stage works in place, the client buffer is never written and a
+// stage may produce more data than it consumes.
+class AudioScratchArena
+{
+public:
+    enum {
+        NUM_BUFFERS = 2,
+        ALIGNMENT   = 32,   // cache line, and enough for any vector load
+    };
+
+                        AudioScratchArena();
+                        ~AudioScratchArena();
+
+            // Allocates NUM_BUFFERS buffers of at least bytes each. Keeps the current
+            // buffers if they are large enough.
+            status_t    reserve(size_t bytes);
+            size_t      capacity() const { return mCapacity; }
+
+            // Destination for a stage reading from src: the buffer that src is not in.
+            // src may be the client buffer, or NULL for the first stage.
+            void *      other(const void *src) const {
+                            return src == mBuffers[0] ? mBuffers[1] : mBuffers[0];
+                        }
+
+private:
+            void        release();
+
+            uint8_t *   mBuffers[NUM_BUFFERS];
+            size_t      mCapacity;
+};
+
+}; // namespace android_audio_legacy
+
+#endif // ANDROID_AUDIO_SCRATCH_ARENA_H
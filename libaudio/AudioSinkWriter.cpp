@@ -0,0 +1,257 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "AudioSinkWriter"
+#include <utils/Log.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <cutils/atomic.h>
+#include <utils/String8.h>
+
+#include "AudioDeviceIo.h"
+#include "AudioSinkWriter.h"
+
+namespace android_audio_legacy {
+
+using android::NO_ERROR;
+using android::BAD_VALUE;
+using android::NO_MEMORY;
+using android::String8;
+
+// ----------------------------------------------------------------------------
+
+void AudioSinkBuffer::acquire()
+{
+    android_atomic_inc(&mRefs);
+}
+
+void AudioSinkBuffer::release()
+{
+    if (android_atomic_dec(&mRefs) == 1) {
+        mPool->put(this);
+    }
+}
+
+AudioSinkBufferPool::AudioSinkBufferPool() :
+    mBuffers(NULL), mFree(NULL), mStorage(NULL), mBufferSize(0)
+{
+}
+
+AudioSinkBufferPool::~AudioSinkBufferPool()
+{
+    release();
+}
+
+void AudioSinkBufferPool::release()
+{
+    delete[] mBuffers;
+    mBuffers = NULL;
+    free(mStorage);
+    mStorage = NULL;
+    mFree = NULL;
+}
+
+status_t AudioSinkBufferPool::init(int count, size_t bufferSize)
+{
+    Mutex::Autolock lock(mLock);
+
+    release();
+    if (count <= 0 || bufferSize == 0) {
+        return BAD_VALUE;
+    }
+    mBuffers = new AudioSinkBuffer[count];
+    mStorage = (uint8_t *)malloc(count * bufferSize);
+    if (mBuffers == NULL || mStorage == NULL) {
+        release();
+        return NO_MEMORY;
+    }
+    mBufferSize = bufferSize;
+    for (int i = 0; i < count; i++) {
+        mBuffers[i].mPool = this;
+        mBuffers[i].mData = mStorage + i * bufferSize;
+        mBuffers[i].mSize = 0;
+        mBuffers[i].mRefs = 0;
+        mBuffers[i].mNext = mFree;
+        mFree = &mBuffers[i];
+    }
+    return NO_ERROR;
+}
+
+AudioSinkBuffer *AudioSinkBufferPool::obtain(const void *data, size_t bytes)
+{
+    AudioSinkBuffer *buffer;
+    {
+        Mutex::Autolock lock(mLock);
+        buffer = mFree;
+        if (buffer == NULL || bytes > mBufferSize) {
+            return NULL;
+        }
+        mFree = buffer->mNext;
+    }
+    memcpy(buffer->mData, data, bytes);
+    buffer->mSize = bytes;
+    buffer->mRefs = 1;
+    return buffer;
+}
+
+void AudioSinkBufferPool::put(AudioSinkBuffer *buffer)
+{
+    Mutex::Autolock lock(mLock);
+    buffer->mNext = mFree;
+    mFree = buffer;
+}
+
+// ----------------------------------------------------------------------------
+
+AudioSinkWriter::AudioSinkWriter(const char *name) :
+    Thread(false),
+    mName(name), mHead(0), mCount(0), mWriting(false), mStarted(false),
+    mWrites(0), mLateWrites(0), mDropped(0), mErrors(0), mMaxBacklog(0), mMaxWriteNs(0)
+{
+}
+
+AudioSinkWriter::~AudioSinkWriter()
+{
+}
+
+void AudioSinkWriter::queue(int fd, AudioSinkBuffer *buffer)
+{
+    Mutex::Autolock lock(mLock);
+
+    if (!mStarted) {
+        ALOGV("%s: starting %s writer", __FUNCTION__, mName);
+        run(mName, ANDROID_PRIORITY_URGENT_AUDIO);
+        mStarted = true;
+    }
+    if (mCount == MAX_BACKLOG) {
+        mLateWrites++;
+        while (mCount == MAX_BACKLOG) {
+            if (mDoneCond.waitRelative(mLock, seconds(1)) != NO_ERROR) {
+                ALOGE("%s: %s writer is stalled.", __FUNCTION__, mName);
+                mDropped++;
+                return;
+            }
+        }
+    }
+    buffer->acquire();
+    Entry& entry = mQueue[(mHead + mCount) % MAX_BACKLOG];
+    entry.fd = fd;
+    entry.buffer = buffer;
+    mCount++;
+    if (mCount > mMaxBacklog) {
+        mMaxBacklog = mCount;
+    }
+    mWorkCond.signal();
+}
+
+void AudioSinkWriter::flush()
+{
+    Mutex::Autolock lock(mLock);
+
+    while (mCount > 0) {
+        mQueue[mHead].buffer->release();
+        mHead = (mHead + 1) % MAX_BACKLOG;
+        mCount--;
+        mDropped++;
+    }
+    while (mWriting) {
+        mDoneCond.wait(mLock);
+    }
+}
+
+void AudioSinkWriter::stop()
+{
+    requestExit();
+    {
+        Mutex::Autolock lock(mLock);
+        mWorkCond.signal();
+    }
+    requestExitAndWait();
+    flush();
+}
+
+bool AudioSinkWriter::threadLoop()
+{
+    Mutex::Autolock lock(mLock);
+
+    while (mCount == 0 && !exitPending()) {
+        mWorkCond.wait(mLock);
+    }
+    if (exitPending()) {
+        return false;
+    }
+
+    Entry entry = mQueue[mHead];
+    mHead = (mHead + 1) % MAX_BACKLOG;
+    mCount--;
+    mWriting = true;
+    mDoneCond.broadcast();
+
+    mLock.unlock();
+    size_t size = entry.buffer->size();
+    nsecs_t start = systemTime();
+    ssize_t written = AudioDeviceIo::instance()->write(entry.fd, entry.buffer->data(), size);
+    nsecs_t duration = systemTime() - start;
+    entry.buffer->release();
+    if (written != (ssize_t)size) {
+        ALOGW("%s: %s write of %d bytes returned %d: %s", __FUNCTION__, mName,
+              (int)size, (int)written, written < 0 ? strerror(errno) : "short");
+    }
+    mLock.lock();
+
+    mWriting = false;
+    mWrites++;
+    if (written != (ssize_t)size) {
+        mErrors++;
+    }
+    if (duration > mMaxWriteNs) {
+        mMaxWriteNs = duration;
+    }
+    mDoneCond.broadcast();
+    return true;
+}
+
+status_t AudioSinkWriter::dump(int fd)
+{
+    const size_t SIZE = 256;
+    char buffer[SIZE];
+    String8 result;
+    Mutex::Autolock lock(mLock);
+
+    snprintf(buffer, SIZE, "AudioSinkWriter(%s)::dump\n", mName);
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tbacklog: %d (max %d)\n", mCount, mMaxBacklog);
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\twrites: %u\n", mWrites);
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tlate writes: %u\n", mLateWrites);
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tdropped: %u\n", mDropped);
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\terrors: %u\n", mErrors);
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tlongest write: %d us\n", (int)ns2us(mMaxWriteNs));
+    result.append(buffer);
+    ::write(fd, result.string(), result.size());
+    return NO_ERROR;
+}
+
+}; // namespace android_audio_legacy
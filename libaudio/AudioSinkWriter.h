@@ -0,0 +1,127 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_AUDIO_SINK_WRITER_H
+#define ANDROID_AUDIO_SINK_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/threads.h>
+
+namespace android_audio_legacy {
+    using android::Mutex;
+    using android::Condition;
+    using android::Thread;
+    using android::status_t;
+
+class AudioSinkBufferPool;
+
+// A block of PCM shared by the writers of several sinks. It goes back to its pool
+// when the last reference is released.
+class AudioSinkBuffer
+{
+public:
+            const void *data() const { return mData; }
+            size_t      size() const { return mSize; }
+            void        acquire();
+            void        release();
+
+private:
+    friend class AudioSinkBufferPool;
+
+            AudioSinkBufferPool *mPool;
+            uint8_t *   mData;
+            size_t      mSize;
+    volatile int32_t    mRefs;
+            AudioSinkBuffer *mNext;
+};
+
+// Fixed set of AudioSinkBuffers allocated once, so that the write path does not allocate.
+class AudioSinkBufferPool
+{
+public:
+                        AudioSinkBufferPool();
+                        ~AudioSinkBufferPool();
+            status_t    init(int count, size_t bufferSize);
+            // Returns a buffer holding a copy of data with one reference held by the
+            // caller, or NULL if the pool is empty or bytes is larger than a buffer.
+            AudioSinkBuffer *obtain(const void *data, size_t bytes);
+
+private:
+    friend class AudioSinkBuffer;
+            void        put(AudioSinkBuffer *buffer);
+            void        release();
+
+            Mutex       mLock;
+            AudioSinkBuffer *mBuffers;
+            AudioSinkBuffer *mFree;
+            uint8_t *   mStorage;
+            size_t      mBufferSize;
+};
+
+// Writes the buffers queued for one output sink from its own thread, so that the
+// DMA waits of several sinks overlap instead of adding up in AudioStreamOut::write().
+class AudioSinkWriter : public Thread
+{
+public:
+    // Buffers queued but not being written. A pool shared by all writers fed with the
+    // same buffers needs MAX_BACKLOG + 2 buffers never to run dry.
+    enum { MAX_BACKLOG = 2 };
+
+                        AudioSinkWriter(const char *name);
+        virtual         ~AudioSinkWriter();
+
+            // Queues buffer to be written to fd and takes a reference on it.
+            // Waits while MAX_BACKLOG buffers are already queued.
+            void        queue(int fd, AudioSinkBuffer *buffer);
+            // Drops the queued buffers and waits for the write in progress to complete.
+            void        flush();
+            // Flushes and terminates the thread.
+            void        stop();
+            status_t    dump(int fd);
+
+private:
+        virtual bool    threadLoop();
+
+    struct Entry {
+            int         fd;
+            AudioSinkBuffer *buffer;
+    };
+
+            const char *mName;
+            Mutex       mLock;
+            Condition   mWorkCond;      // Signal to unblock the writer thread
+            Condition   mDoneCond;      // Signal a dequeue or the end of a write
+            Entry       mQueue[MAX_BACKLOG];
+            int         mHead;
+            int         mCount;
+            bool        mWriting;
+            bool        mStarted;
+
+            // statistics
+            uint32_t    mWrites;
+            uint32_t    mLateWrites;    // queue() had to wait for the writer
+            uint32_t    mDropped;       // buffers flushed or given up on
+            uint32_t    mErrors;
+            int         mMaxBacklog;
+            nsecs_t     mMaxWriteNs;
+};
+
+}; // namespace android_audio_legacy
+
+#endif // ANDROID_AUDIO_SINK_WRITER_H
@@ -0,0 +1,209 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <cutils/atomic.h>
+
+#include "AudioStats.h"
+
+namespace android_audio_legacy {
+
+static const char *kStageNames[AudioStageStats::STAGE_NUM] = {
+    "mm processing",
+    "downmix",
+    "src",
+    "ecns",
+    "driver",
+    "total",
+    "routing lock",
+    "mix",
+    "dither",
+    "idle enter",
+    "idle resume",
+    "online",
+    "first write",
+};
+
+// Reported for silence, below the quantization noise of 16 bits
+static const double kLevelFloorDb = -100.0;
+
+AudioLatencyHistogram::AudioLatencyHistogram() :
+    mCount(0), mMaxUs(0)
+{
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        mBuckets[i] = 0;
+    }
+}
+
+void AudioLatencyHistogram::add(nsecs_t ns)
+{
+    uint32_t us = ns > 0 ? (uint32_t)(ns / 1000) : 0;
+    int bucket = us ? 32 - __builtin_clz(us) : 0;
+    if (bucket >= NUM_BUCKETS) {
+        bucket = NUM_BUCKETS - 1;
+    }
+    android_atomic_inc(&mBuckets[bucket]);
+    android_atomic_inc(&mCount);
+
+    int32_t max;
+    do {
+        max = android_atomic_acquire_load(&mMaxUs);
+        if ((uint32_t)max >= us) {
+            break;
+        }
+    } while (android_atomic_cmpxchg(max, (int32_t)us, &mMaxUs) != 0);
+}
+
+uint32_t AudioLatencyHistogram::count() const
+{
+    return (uint32_t)android_atomic_acquire_load(&mCount);
+}
+
+uint32_t AudioLatencyHistogram::maxUs() const
+{
+    return (uint32_t)android_atomic_acquire_load(&mMaxUs);
+}
+
+uint32_t AudioLatencyHistogram::percentileUs(int percent) const
+{
+    // The buckets are read one by one while they may be updated: use their sum rather
+    // than mCount so that the rank is always reached.
+    uint32_t counts[NUM_BUCKETS];
+    uint64_t total = 0;
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        counts[i] = (uint32_t)android_atomic_acquire_load(&mBuckets[i]);
+        total += counts[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t rank = (total * percent + 99) / 100;
+    uint64_t seen = 0;
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        seen += counts[i];
+        if (seen >= rank) {
+            return 1u << i;
+        }
+    }
+    return maxUs();
+}
+
+void AudioLatencyHistogram::dump(String8& result, const char *name) const
+{
+    const size_t SIZE = 256;
+    char buffer[SIZE];
+
+    snprintf(buffer, SIZE, "\t  %-14s %8u %8u %8u %8u\n", name, count(),
+             percentileUs(50), percentileUs(99), maxUs());
+    result.append(buffer);
+}
+
+AudioStageStats::AudioStageStats() :
+    mUnderruns(0), mOverruns(0)
+{
+}
+
+nsecs_t AudioStageStats::lap(int stage, nsecs_t start)
+{
+    nsecs_t now = systemTime();
+    mStages[stage].add(now - start);
+    return now;
+}
+
+void AudioStageStats::addUnderruns(uint32_t count)
+{
+    if (count) {
+        android_atomic_add((int32_t)count, &mUnderruns);
+    }
+}
+
+void AudioStageStats::addOverruns(uint32_t count)
+{
+    if (count) {
+        android_atomic_add((int32_t)count, &mOverruns);
+    }
+}
+
+void AudioStageStats::dump(String8& result) const
+{
+    const size_t SIZE = 256;
+    char buffer[SIZE];
+
+    snprintf(buffer, SIZE, "\t  %-14s %8s %8s %8s %8s\n", "stage (us)", "count", "p50", "p99",
+             "max");
+    result.append(buffer);
+    for (int i = 0; i < STAGE_NUM; i++) {
+        if (mStages[i].count()) {
+            mStages[i].dump(result, kStageNames[i]);
+        }
+    }
+    snprintf(buffer, SIZE, "\tdriver underruns: %d, overruns: %d\n",
+             android_atomic_acquire_load(&mUnderruns), android_atomic_acquire_load(&mOverruns));
+    result.append(buffer);
+}
+
+// ----------------------------------------------------------------------------
+
+AudioLevelMeter::AudioLevelMeter() :
+    mEnabled(0)
+{
+    memset(&mLevels, 0, sizeof(mLevels));
+}
+
+void AudioLevelMeter::setEnabled(bool enabled)
+{
+    Mutex::Autolock lock(mLock);
+    memset(&mLevels, 0, sizeof(mLevels));
+    android_atomic_release_store(enabled ? 1 : 0, &mEnabled);
+}
+
+void AudioLevelMeter::add(const int16_t *samples, size_t count)
+{
+    if (!enabled()) {
+        return;
+    }
+    Mutex::Autolock lock(mLock);
+    AudioDsp::accumulateLevels(&mLevels, samples, count);
+}
+
+String8 AudioLevelMeter::read()
+{
+    AudioDsp::Levels levels;
+    {
+        Mutex::Autolock lock(mLock);
+        levels = mLevels;
+        memset(&mLevels, 0, sizeof(mLevels));
+    }
+    double peakDb = kLevelFloorDb;
+    double rmsDb = kLevelFloorDb;
+    if (levels.peak > 0) {
+        peakDb = 20.0 * log10(levels.peak / 32768.0);
+    }
+    if (levels.energy > 0) {
+        double meanSquare = (double)levels.energy / levels.samples;
+        rmsDb = 10.0 * log10(meanSquare / (32768.0 * 32768.0));
+    }
+    if (peakDb < kLevelFloorDb) peakDb = kLevelFloorDb;
+    if (rmsDb < kLevelFloorDb) rmsDb = kLevelFloorDb;
+
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.1f,%.1f,%u", peakDb, rmsDb, levels.clips);
+    return String8(buf);
+}
+
+}; // namespace android_audio_legacy
@@ -0,0 +1,113 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_AUDIO_STATS_H
+#define ANDROID_AUDIO_STATS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/threads.h>
+#include <utils/Timers.h>
+#include <utils/String8.h>
+
+#include "AudioDsp.h"
+
+namespace android_audio_legacy {
+    using android::Mutex;
+    using android::String8;
+
+// Histogram of durations in power of two microsecond buckets. Updates are lock free and
+// may run concurrently with dump(); percentiles are the upper bound of their bucket.
+class AudioLatencyHistogram
+{
+public:
+    // bucket 0 counts durations below 1 us, bucket i durations in [2^(i-1), 2^i) us
+    enum { NUM_BUCKETS = 24 };
+
+                        AudioLatencyHistogram();
+
+            void        add(nsecs_t ns);
+            uint32_t    count() const;
+            uint32_t    percentileUs(int percent) const;
+            uint32_t    maxUs() const;
+            void        dump(String8& result, const char *name) const;
+
+private:
+            volatile int32_t mBuckets[NUM_BUCKETS];
+            volatile int32_t mCount;
+            volatile int32_t mMaxUs;
+};
+
+// Time spent in each stage of a stream read() or write(), and driver error counts.
+class AudioStageStats
+{
+public:
+    enum {
+        STAGE_MM_PROCESSING = 0,    // multimedia post processing
+        STAGE_DOWNMIX,              // stereo to mono for SRC or EC/NS
+        STAGE_SRC,
+        STAGE_ECNS,                 // handoff to or from the EC/NS thread
+        STAGE_DRIVER,               // blocked in the driver ::write() or ::read()
+        STAGE_TOTAL,                // whole read() or write()
+        STAGE_ROUTING_LOCK,         // doRouting_l() waiting for the stream lock
+        STAGE_MIX,                  // secondary output streams mixed in
+        STAGE_DITHER,               // Q31 to 16 bits
+        STAGE_IDLE_ENTER,           // output hardware to idle standby
+        STAGE_IDLE_RESUME,          // output hardware back from idle standby
+        STAGE_ONLINE,               // output hardware reconfigured by online_l()
+        STAGE_FIRST_WRITE,          // write() bringing the output back, to the driver
+        STAGE_NUM
+    };
+
+                        AudioStageStats();
+
+            // Records the time since start in stage, returns the current time so that
+            // consecutive stages can be chained.
+            nsecs_t     lap(int stage, nsecs_t start);
+            void        addUnderruns(uint32_t count);
+            void        addOverruns(uint32_t count);
+            void        dump(String8& result) const;
+
+private:
+            AudioLatencyHistogram mStages[STAGE_NUM];
+            volatile int32_t mUnderruns;
+            volatile int32_t mOverruns;
+};
+
+// Peak and RMS level meter of the samples a stream plays or captures. Fed from the
+// stream thread with the buffer it has just produced, so that no copy is made; when
+// disabled, add() costs a test.
+class AudioLevelMeter
+{
+public:
+                        AudioLevelMeter();
+
+            void        setEnabled(bool enabled);
+            bool        enabled() const { return mEnabled != 0; }
+            void        add(const int16_t *samples, size_t count);
+            // "<peak dBFS>,<rms dBFS>,<clipped samples>" since the previous call
+            String8     read();
+
+private:
+            Mutex       mLock;
+    volatile int32_t    mEnabled;
+            AudioDsp::Levels mLevels;
+};
+
+}; // namespace android_audio_legacy
+
+#endif // ANDROID_AUDIO_STATS_H
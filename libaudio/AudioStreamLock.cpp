@@ -0,0 +1,44 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+
+#include "AudioStreamLock.h"
+
+namespace android_audio_legacy {
+
+AudioStreamLock::AudioStreamLock() :
+    mNextTicket(0), mServing(0)
+{
+}
+
+void AudioStreamLock::lock()
+{
+    Mutex::Autolock lock(mMutex);
+    uint32_t ticket = mNextTicket++;
+    while (ticket != mServing) {
+        mCond.wait(mMutex);
+    }
+}
+
+void AudioStreamLock::unlock()
+{
+    Mutex::Autolock lock(mMutex);
+    mServing++;
+    // There are at most a few waiters: wake them all, the next ticket goes.
+    mCond.broadcast();
+}
+
+}; // namespace android_audio_legacy
@@ -0,0 +1,70 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+
+#ifndef ANDROID_AUDIO_STREAM_LOCK_H
+#define ANDROID_AUDIO_STREAM_LOCK_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/threads.h>
+
+namespace android_audio_legacy {
+    using android::Mutex;
+    using android::Condition;
+
+// FIFO (ticket) lock for the stream state.
+//
+// read() and write() release the stream lock only between two buffers and take it
+// again right away; with a plain mutex the stream thread usually wins that race and
+// doRouting_l() can wait for many periods. Here the lock goes to the waiters in the
+// order they asked for it, so a routing change gets the stream at the next buffer
+// boundary.
+//
+// The lock is fair but not priority aware: a SCHED_FIFO writer can queue behind the
+// ticket of a normal priority thread, and nothing boosts that thread while it holds
+// the lock. The mutex of this bionic has no priority inheritance either, so the
+// owners other than the stream thread must not block while they hold the lock.
+class AudioStreamLock
+{
+public:
+                        AudioStreamLock();
+
+            void        lock();
+            void        unlock();
+
+    class Autolock {
+    public:
+        inline          Autolock(AudioStreamLock& lock) : mLock(lock) { mLock.lock(); }
+        inline          ~Autolock() { mLock.unlock(); }
+    private:
+                AudioStreamLock& mLock;
+    };
+
+private:
+                        AudioStreamLock(const AudioStreamLock&);
+            AudioStreamLock& operator=(const AudioStreamLock&);
+
+            Mutex       mMutex;
+            Condition   mCond;
+            uint32_t    mNextTicket;
+            uint32_t    mServing;       // ticket of the owner
+};
+
+}; // namespace android_audio_legacy
+
+#endif // ANDROID_AUDIO_STREAM_LOCK_H
@@ -0,0 +1,302 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "AudioTuningStore"
+#include <utils/Log.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "AudioTuningStore.h"
+
+namespace android_audio_legacy {
+
+using android::NO_ERROR;
+using android::NO_INIT;
+
+static const char *kFileNames[AudioTuningStore::NUM_TABLES] = {
+    AUDIO_TUNING_GAIN_FILE,
+    AUDIO_TUNING_ECNS_FILE,
+};
+
+// The gain file starts with format, version and barker words
+static const uint32_t kGainFormat = 0x30303032;
+static const size_t kGainHeaderBytes = 3 * sizeof(uint32_t);
+static const size_t kGainTableBytes =
+        AUDIO_HW_GAIN_NUM_DIRECTIONS * AUDIO_HW_GAIN_NUM_USECASES * AUDIO_HW_GAIN_NUM_PATHS;
+
+// CPCAP volume ranges
+static const uint8_t kMaxSpkrGain = 15;
+static const uint8_t kMaxMicGain = 31;
+
+// Larger files are not tuning tables
+static const size_t kMaxFileBytes = 1024 * 1024;
+
+// How often the watcher checks for exit while no file changes
+static const int kPollMs = 1000;
+
+AudioTuningStore::AudioTuningStore(const char *dir) :
+    Thread(false),
+    mDir(dir), mInotifyFd(-1), mWatch(-1), mGainHeaderSet(false), mGainVersion(0),
+    mGainBarker(0)
+{
+    memset(mTables, 0, sizeof(mTables));
+}
+
+AudioTuningStore::~AudioTuningStore()
+{
+    if (mInotifyFd >= 0) {
+        ::close(mInotifyFd);
+    }
+    for (int i = 0; i < NUM_TABLES; i++) {
+        free(mTables[i].data);
+    }
+}
+
+void AudioTuningStore::setMinSize(int table, size_t bytes)
+{
+    Mutex::Autolock lock(mLock);
+    mTables[table].minSize = bytes;
+}
+
+void AudioTuningStore::init()
+{
+    for (int i = 0; i < NUM_TABLES; i++) {
+        reload(i);
+    }
+    if (mTables[TABLE_GAIN].data == NULL) {
+        ALOGE("CPCAP gain file not valid. Using defaults.");
+    }
+
+    mInotifyFd = inotify_init();
+    if (mInotifyFd >= 0) {
+        mWatch = inotify_add_watch(mInotifyFd, mDir, IN_CLOSE_WRITE | IN_MOVED_TO);
+    }
+    if (mWatch < 0) {
+        ALOGW("%s: cannot watch %s: %s", __FUNCTION__, mDir, strerror(errno));
+        return;
+    }
+    run("AudioTuningStore", ANDROID_PRIORITY_BACKGROUND);
+}
+
+// The watcher polls for exit every kPollMs
+void AudioTuningStore::stop()
+{
+    requestExitAndWait();
+}
+
+uint8_t AudioTuningStore::gain(int direction, int usecase, int path) const
+{
+    Mutex::Autolock lock(mLock);
+    const Table& t = mTables[TABLE_GAIN];
+
+    if (t.data == NULL) {
+        return direction == AUDIO_HW_GAIN_SPKR_GAIN ? 11 : 31;
+    }
+    const uint8_t *gains = t.data + kGainHeaderBytes;
+    return gains[(direction * AUDIO_HW_GAIN_NUM_USECASES + usecase) * AUDIO_HW_GAIN_NUM_PATHS + path];
+}
+
+status_t AudioTuningStore::copyEcnsTable(void *table, size_t bytes, uint32_t *generation) const
+{
+    Mutex::Autolock lock(mLock);
+    const Table& t = mTables[TABLE_ECNS];
+
+    if (t.data == NULL || t.size < bytes) {
+        return NO_INIT;
+    }
+    if (*generation != t.generation) {
+        memcpy(table, t.data, bytes);
+        *generation = t.generation;
+    }
+    return NO_ERROR;
+}
+
+bool AudioTuningStore::threadLoop()
+{
+    struct pollfd pfd;
+    pfd.fd = mInotifyFd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, kPollMs) <= 0) {
+        return true;
+    }
+
+    char buffer[sizeof(struct inotify_event) + NAME_MAX + 1]
+            __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len = ::read(mInotifyFd, buffer, sizeof(buffer));
+    if (len <= 0) {
+        ALOGE("%s: inotify read returned %d: %s", __FUNCTION__, (int)len, strerror(errno));
+        return false;
+    }
+
+    int changed = 0;
+    for (char *p = buffer; p < buffer + len; ) {
+        struct inotify_event *event = (struct inotify_event *)p;
+        for (int i = 0; i < NUM_TABLES; i++) {
+            if (event->len && !strcmp(event->name, kFileNames[i])) {
+                changed |= 1 << i;
+            }
+        }
+        p += sizeof(struct inotify_event) + event->len;
+    }
+    for (int i = 0; i < NUM_TABLES; i++) {
+        if (changed & (1 << i)) {
+            reload(i);
+        }
+    }
+    return true;
+}
+
+// The file is read into a new buffer and swapped in only once it is validated:
+// a file caught while it is being written is rejected, the next close reloads it.
+void AudioTuningStore::reload(int table)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", mDir, kFileNames[table]);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        ALOGW("%s: cannot open %s: %s", __FUNCTION__, path, strerror(errno));
+        return;
+    }
+    uint8_t *data = NULL;
+    size_t size = 0;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0 && (size_t)st.st_size <= kMaxFileBytes) {
+        data = (uint8_t *)malloc(st.st_size);
+        while (data != NULL && size < (size_t)st.st_size) {
+            ssize_t ret = ::read(fd, data + size, st.st_size - size);
+            if (ret <= 0) {
+                break;
+            }
+            size += ret;
+        }
+    }
+    ::close(fd);
+
+    if (data == NULL || size != (size_t)st.st_size || !validate(table, data, size)) {
+        ALOGE("%s: %s is not valid, keeping the current table", __FUNCTION__, path);
+        free(data);
+        Mutex::Autolock lock(mLock);
+        mTables[table].rejects++;
+        return;
+    }
+
+    uint32_t checksum = adler32(data, size);
+    uint8_t *old;
+    {
+        Mutex::Autolock lock(mLock);
+        Table& t = mTables[table];
+        if (t.data != NULL && t.size == size && t.checksum == checksum) {
+            old = data;
+        } else {
+            old = t.data;
+            t.data = data;
+            t.size = size;
+            t.checksum = checksum;
+            t.generation++;
+            t.reloads++;
+            ALOGD("%s: loaded %s, %u bytes, checksum %08x", __FUNCTION__, path,
+                  (unsigned)size, checksum);
+        }
+    }
+    free(old);
+}
+
+// Only called by init() and the watcher thread, one at a time
+bool AudioTuningStore::validate(int table, const uint8_t *data, size_t size)
+{
+    if (size < mTables[table].minSize) {
+        ALOGE("%s: %s has %u bytes, needs %u", __FUNCTION__, kFileNames[table],
+              (unsigned)size, (unsigned)mTables[table].minSize);
+        return false;
+    }
+    switch (table) {
+    case TABLE_GAIN: {
+        if (size < kGainHeaderBytes + kGainTableBytes) {
+            return false;
+        }
+        uint32_t header[3];
+        memcpy(header, data, sizeof(header));
+        ALOGD("Read gain file, format %X version %X barker %X", header[0], header[1], header[2]);
+        if (header[0] != kGainFormat) {
+            return false;
+        }
+        // A table of another layout cannot be swapped in while running
+        if (mGainHeaderSet && (header[1] != mGainVersion || header[2] != mGainBarker)) {
+            ALOGE("%s: gain file version %X barker %X, expected %X %X", __FUNCTION__,
+                  header[1], header[2], mGainVersion, mGainBarker);
+            return false;
+        }
+        const uint8_t *gains = data + kGainHeaderBytes;
+        for (size_t i = 0; i < kGainTableBytes; i++) {
+            uint8_t max = i < kGainTableBytes / AUDIO_HW_GAIN_NUM_DIRECTIONS ?
+                          kMaxSpkrGain : kMaxMicGain;
+            if (gains[i] > max) {
+                ALOGE("%s: gain %u out of range at %u", __FUNCTION__, gains[i], (unsigned)i);
+                return false;
+            }
+        }
+        mGainHeaderSet = true;
+        mGainVersion = header[1];
+        mGainBarker = header[2];
+        return true;
+    }
+    case TABLE_ECNS:
+        // 16 bit parameter words
+        return size != 0 && size % sizeof(uint16_t) == 0;
+    default:
+        return false;
+    }
+}
+
+uint32_t AudioTuningStore::adler32(const uint8_t *data, size_t size)
+{
+    uint32_t a = 1;
+    uint32_t b = 0;
+    for (size_t i = 0; i < size; i++) {
+        a = (a + data[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    return (b << 16) | a;
+}
+
+void AudioTuningStore::dump(String8& result) const
+{
+    const size_t SIZE = 256;
+    char buffer[SIZE];
+    Mutex::Autolock lock(mLock);
+
+    for (int i = 0; i < NUM_TABLES; i++) {
+        const Table& t = mTables[i];
+        snprintf(buffer, SIZE, "\ttuning %s: %s, %u bytes, checksum %08x, generation %u, "
+                 "%u reloads, %u rejected\n", kFileNames[i], t.data ? "valid" : "none",
+                 (unsigned)t.size, t.checksum, t.generation, t.reloads, t.rejects);
+        result.append(buffer);
+    }
+}
+
+}; // namespace android_audio_legacy
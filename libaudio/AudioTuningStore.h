@@ -0,0 +1,131 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_AUDIO_TUNING_STORE_H
+#define ANDROID_AUDIO_TUNING_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <utils/threads.h>
+#include <utils/String8.h>
+
+namespace android_audio_legacy {
+    using android::Mutex;
+    using android::Thread;
+    using android::String8;
+    using android::status_t;
+
+#define AUDIO_TUNING_DIR "/system/etc"
+#define AUDIO_TUNING_GAIN_FILE "cpcap_gain.bin"
+#define AUDIO_TUNING_ECNS_FILE "voip_aud_params.bin"
+
+// CPCAP gain table layout
+enum {
+    AUDIO_HW_GAIN_SPKR_GAIN = 0,
+    AUDIO_HW_GAIN_MIC_GAIN,
+    AUDIO_HW_GAIN_NUM_DIRECTIONS
+};
+enum {
+    AUDIO_HW_GAIN_USECASE_VOICE= 0,
+    AUDIO_HW_GAIN_USECASE_MM,
+    AUDIO_HW_GAIN_USECASE_VOICE_REC,
+    AUDIO_HW_GAIN_NUM_USECASES
+};
+enum {
+    AUDIO_HW_GAIN_EARPIECE = 0,
+    AUDIO_HW_GAIN_SPEAKERPHONE,
+    AUDIO_HW_GAIN_HEADSET_W_MIC,
+    AUDIO_HW_GAIN_MONO_HEADSET,
+    AUDIO_HW_GAIN_HEADSET_NO_MIC,
+    AUDIO_HW_GAIN_EMU_DEVICE,
+    AUDIO_HW_GAIN_RSVD1,
+    AUDIO_HW_GAIN_RSVD2,
+    AUDIO_HW_GAIN_RSVD3,
+    AUDIO_HW_GAIN_RSVD4,
+    AUDIO_HW_GAIN_RSVD5,
+    AUDIO_HW_GAIN_NUM_PATHS
+};
+
+// Acoustic tuning shared by the gain logic and EC/NS: the CPCAP gain table and
+// the EC/NS parameter table.
+//
+// Each file is read and validated once per revision instead of by every user.
+// A watcher thread reloads a file when it is rewritten in AUDIO_TUNING_DIR and
+// swaps the new table in under the lock, so tuning changes apply from the next
+// route change or EC/NS start without restarting mediaserver. A file that fails
+// validation leaves the table in use unchanged: the gain file must have the format,
+// version and barker of the table loaded first, and gains within the CPCAP ranges;
+// the EC/NS table must hold the size its user set. The files carry no checksum, the
+// one computed on load only tells a rewrite of the same content from a change.
+class AudioTuningStore : public Thread
+{
+public:
+    enum {
+        TABLE_GAIN = 0,
+        TABLE_ECNS,
+        NUM_TABLES
+    };
+
+                        AudioTuningStore(const char *dir);
+    virtual             ~AudioTuningStore();
+
+            // Smallest valid size of a table file. Call before init().
+            void        setMinSize(int table, size_t bytes);
+            // Loads the tables and starts watching the files.
+            void        init();
+            // Stops watching the files.
+            void        stop();
+
+            // Gain of the current table, the built-in default if there is none.
+            uint8_t     gain(int direction, int usecase, int path) const;
+
+            // Copies the first bytes of the EC/NS table to table, unless it is already
+            // at *generation. Returns NO_ERROR when table is up to date, NO_INIT
+            // when there is no valid EC/NS table of at least bytes.
+            status_t    copyEcnsTable(void *table, size_t bytes, uint32_t *generation) const;
+
+            void        dump(String8& result) const;
+
+private:
+    struct Table {
+            uint8_t *   data;       // NULL if the file was never valid
+            size_t      size;
+            uint32_t    checksum;
+            uint32_t    generation; // bumped whenever the content changes
+            uint32_t    reloads;
+            uint32_t    rejects;
+            size_t      minSize;
+    };
+
+    virtual bool        threadLoop();
+            void        reload(int table);
+            bool        validate(int table, const uint8_t *data, size_t size);
+    static  uint32_t    adler32(const uint8_t *data, size_t size);
+
+            const char *mDir;
+    mutable Mutex       mLock;
+            Table       mTables[NUM_TABLES];
+            int         mInotifyFd;
+            int         mWatch;
+            bool        mGainHeaderSet;
+            uint32_t    mGainVersion;   // of the first gain table loaded
+            uint32_t    mGainBarker;
+};
+
+}; // namespace android_audio_legacy
+
+#endif // ANDROID_AUDIO_TUNING_STORE_H
@@ -0,0 +1,392 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "AudioSimDeviceIo"
+#include <utils/Log.h>
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <linux/cpcap_audio.h>
+#include <linux/tegra_audio.h>
+
+#include "AudioSimDeviceIo.h"
+
+namespace android_audio_legacy {
+
+// File descriptors returned by open() are FD_BASE + node, well above the real ones.
+#define FD_BASE 0x4000
+#define SIM_DEFAULT_NUM_BUFS 2
+#define SIM_TONE_HZ 1000
+
+static const char *kNodePaths[AudioSimDeviceIo::NODE_NUM] = {
+    "/dev/audio_ctl",
+    "/dev/audio0_out",
+    "/dev/audio0_out_ctl",
+    "/dev/audio1_out",
+    "/dev/audio1_out_ctl",
+    "/dev/audio1_ctl",
+    "/dev/spdif_out",
+    "/dev/spdif_out_ctl",
+    "/dev/audio1_in",
+    "/dev/audio1_in_ctl",
+};
+
+static void sleepNs(nsecs_t ns)
+{
+    if (ns <= 0) {
+        return;
+    }
+    struct timespec ts;
+    ts.tv_sec = ns / 1000000000LL;
+    ts.tv_nsec = ns % 1000000000LL;
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR) {
+    }
+}
+
+AudioSimDeviceIo::AudioSimDeviceIo() :
+    mOutId(CPCAP_AUDIO_OUT_SPEAKER), mOutOn(0), mInId(CPCAP_AUDIO_IN_MIC1), mInOn(0),
+    mOutRate(44100), mInRate(44100), mInConfigRate(44100), mInStereo(0),
+    mBtBitFormat(TEGRA_AUDIO_BIT_FORMAT_DEFAULT), mBtBypass(0)
+{
+    memset(mNodes, 0, sizeof(mNodes));
+    for (int i = 0; i < NODE_NUM; i++) {
+        mNodes[i].numBufs = SIM_DEFAULT_NUM_BUFS;
+    }
+    updateRates_l();
+}
+
+// The Bluetooth SCO and S/PDIF links run at fixed rates, the speaker and microphone
+// at the rates set on CPCAP and on the Tegra capture driver.
+void AudioSimDeviceIo::updateRates_l()
+{
+    mNodes[NODE_SPKR_OUT].rate = mOutRate;
+    mNodes[NODE_SPKR_OUT].frameSize = 2 * sizeof(int16_t);
+    mNodes[NODE_BT_OUT].rate = 8000;
+    mNodes[NODE_BT_OUT].frameSize = sizeof(int16_t);
+    mNodes[NODE_SPDIF_OUT].rate = 44100;
+    mNodes[NODE_SPDIF_OUT].frameSize = 2 * sizeof(int16_t);
+    mNodes[NODE_MIC_IN].rate = mInConfigRate;
+    mNodes[NODE_MIC_IN].frameSize = (mInStereo ? 2 : 1) * sizeof(int16_t);
+}
+
+int AudioSimDeviceIo::node(int fd)
+{
+    int n = fd - FD_BASE;
+    if (n < 0 || n >= NODE_NUM || !mNodes[n].open) {
+        return -1;
+    }
+    return n;
+}
+
+int AudioSimDeviceIo::dataNode(int ctlNode)
+{
+    switch (ctlNode) {
+    case NODE_SPKR_OUT_CTL:
+        return NODE_SPKR_OUT;
+    case NODE_BT_OUT_CTL:
+        return NODE_BT_OUT;
+    case NODE_SPDIF_OUT_CTL:
+        return NODE_SPDIF_OUT;
+    case NODE_MIC_IN_CTL:
+        return NODE_MIC_IN;
+    default:
+        return -1;
+    }
+}
+
+int AudioSimDeviceIo::open(const char *path, int flags)
+{
+    Mutex::Autolock lock(mLock);
+    for (int i = 0; i < NODE_NUM; i++) {
+        if (strcmp(path, kNodePaths[i]) == 0) {
+            mNodes[i].open = true;
+            mNodes[i].running = false;
+            return FD_BASE + i;
+        }
+    }
+    errno = ENOENT;
+    return -1;
+}
+
+int AudioSimDeviceIo::close(int fd)
+{
+    Mutex::Autolock lock(mLock);
+    int n = node(fd);
+    if (n < 0) {
+        errno = EBADF;
+        return -1;
+    }
+    mNodes[n].open = false;
+    mNodes[n].running = false;
+    return 0;
+}
+
+ssize_t AudioSimDeviceIo::write(int fd, const void *buffer, size_t bytes)
+{
+    nsecs_t stall;
+    {
+        Mutex::Autolock lock(mLock);
+        int n = node(fd);
+        if (n != NODE_SPKR_OUT && n != NODE_BT_OUT && n != NODE_SPDIF_OUT) {
+            errno = EBADF;
+            return -1;
+        }
+        stall = mNodes[n].stallNs;
+        mNodes[n].stallNs = 0;
+    }
+    sleepNs(stall);
+
+    nsecs_t wait;
+    {
+        Mutex::Autolock lock(mLock);
+        Node& out = mNodes[node(fd)];
+        nsecs_t now = systemTime();
+        nsecs_t duration = (nsecs_t)(bytes / out.frameSize) * 1000000000LL / out.rate;
+        nsecs_t start = now;
+        if (out.running) {
+            if (now > out.endNs) {
+                out.errors++;
+                out.totalErrors++;
+            } else {
+                start = out.endNs;
+            }
+        }
+        out.running = true;
+        out.endNs = start + duration;
+        out.lastBytes = bytes;
+        out.bytes += bytes;
+        out.lastTransferNs = now;
+        // Block until the queue has room for this buffer.
+        wait = out.endNs - now - out.numBufs * duration;
+    }
+    sleepNs(wait);
+    return bytes;
+}
+
+ssize_t AudioSimDeviceIo::read(int fd, void *buffer, size_t bytes)
+{
+    nsecs_t stall;
+    {
+        Mutex::Autolock lock(mLock);
+        int n = node(fd);
+        if (n != NODE_MIC_IN) {
+            errno = EBADF;
+            return -1;
+        }
+        stall = mNodes[n].stallNs;
+        mNodes[n].stallNs = 0;
+    }
+    sleepNs(stall);
+
+    nsecs_t ready;
+    nsecs_t now;
+    int rate;
+    int channels;
+    uint32_t phase;
+    {
+        Mutex::Autolock lock(mLock);
+        Node& in = mNodes[NODE_MIC_IN];
+        now = systemTime();
+        if (!in.running) {
+            in.running = true;
+            in.startNs = now;
+            in.runBytes = 0;
+        }
+        uint64_t bytesPerSec = (uint64_t)in.rate * in.frameSize;
+        uint64_t captured = (uint64_t)(now - in.startNs) * bytesPerSec / 1000000000LL;
+        captured -= captured % in.frameSize;
+        // The driver buffers are overwritten when the client does not read in time.
+        uint64_t capacity = (uint64_t)in.numBufs * (bytes > in.lastBytes ? bytes : in.lastBytes);
+        if (captured > in.runBytes + capacity) {
+            in.runBytes = captured - capacity;
+            in.errors++;
+            in.totalErrors++;
+        }
+        ready = in.startNs + (nsecs_t)((in.runBytes + bytes) * 1000000000LL / bytesPerSec);
+        in.runBytes += bytes;
+        in.lastBytes = bytes;
+        rate = in.rate;
+        channels = in.frameSize / sizeof(int16_t);
+        phase = in.phase;
+        in.phase += (uint32_t)(((uint64_t)SIM_TONE_HZ << 32) / rate) *
+                    (uint32_t)(bytes / in.frameSize);
+    }
+
+    // sawtooth at SIM_TONE_HZ, -12 dBFS
+    int16_t *samples = (int16_t *)buffer;
+    uint32_t step = (uint32_t)(((uint64_t)SIM_TONE_HZ << 32) / rate);
+    for (size_t i = 0; i < bytes / sizeof(int16_t); i += channels) {
+        int16_t s = (int16_t)((int32_t)phase >> 18);
+        for (int c = 0; c < channels; c++) {
+            samples[i + c] = s;
+        }
+        phase += step;
+    }
+
+    sleepNs(ready - now);
+
+    Mutex::Autolock lock(mLock);
+    mNodes[NODE_MIC_IN].bytes += bytes;
+    mNodes[NODE_MIC_IN].lastTransferNs = systemTime();
+    return bytes;
+}
+
+int AudioSimDeviceIo::ioctl(int fd, int request, void *arg)
+{
+    Mutex::Autolock lock(mLock);
+    int n = node(fd);
+    if (n < 0) {
+        errno = EBADF;
+        return -1;
+    }
+    int value = (int)(intptr_t)arg;
+
+    if (n == NODE_CPCAP_CTL) {
+        struct cpcap_audio_stream *stream = (struct cpcap_audio_stream *)arg;
+        switch ((unsigned)request) {
+        case CPCAP_AUDIO_OUT_SET_OUTPUT:
+            if (stream->id == CPCAP_AUDIO_OUT_STANDBY) {
+                mOutOn = !stream->on;
+            } else {
+                mOutId = stream->id;
+            }
+            return 0;
+        case CPCAP_AUDIO_OUT_GET_OUTPUT:
+            stream->id = mOutId;
+            stream->on = mOutOn;
+            return 0;
+        case CPCAP_AUDIO_IN_SET_INPUT:
+            if (stream->id == CPCAP_AUDIO_IN_STANDBY) {
+                mInOn = !stream->on;
+            } else {
+                mInId = stream->id;
+            }
+            return 0;
+        case CPCAP_AUDIO_IN_GET_INPUT:
+            stream->id = mInId;
+            stream->on = mInOn;
+            return 0;
+        case CPCAP_AUDIO_OUT_GET_RATE:
+            *(int *)arg = mOutRate;
+            return 0;
+        case CPCAP_AUDIO_IN_GET_RATE:
+            *(int *)arg = mInRate;
+            return 0;
+        case CPCAP_AUDIO_OUT_SET_RATE:
+            mOutRate = value;
+            updateRates_l();
+            return 0;
+        case CPCAP_AUDIO_IN_SET_RATE:
+            mInRate = value;
+            return 0;
+        case CPCAP_AUDIO_OUT_SET_VOLUME:
+        case CPCAP_AUDIO_IN_SET_VOLUME:
+            return 0;
+        case CPCAP_AUDIO_SET_BLUETOOTH_BYPASS:
+            mBtBypass = value;
+            return 0;
+        }
+    } else if (n == NODE_BT_CTL) {
+        if ((unsigned)request == TEGRA_AUDIO_SET_BIT_FORMAT) {
+            mBtBitFormat = *(int *)arg;
+            return 0;
+        }
+    } else if (dataNode(n) >= 0) {
+        Node& data = mNodes[dataNode(n)];
+        switch ((unsigned)request) {
+        case TEGRA_AUDIO_OUT_FLUSH:
+            if (n == NODE_MIC_IN_CTL) {
+                break;
+            }
+            data.running = false;
+            data.endNs = systemTime();
+            return 0;
+        case TEGRA_AUDIO_OUT_SET_NUM_BUFS:
+        case TEGRA_AUDIO_IN_SET_NUM_BUFS:
+            if (*(unsigned *)arg == 0) {
+                errno = EINVAL;
+                return -1;
+            }
+            data.numBufs = *(unsigned *)arg;
+            return 0;
+        case TEGRA_AUDIO_OUT_GET_NUM_BUFS:
+        case TEGRA_AUDIO_IN_GET_NUM_BUFS:
+            *(unsigned *)arg = data.numBufs;
+            return 0;
+#ifdef TEGRA_AUDIO_OUT_GET_ERROR_COUNT
+        case TEGRA_AUDIO_OUT_GET_ERROR_COUNT:
+        case TEGRA_AUDIO_IN_GET_ERROR_COUNT: {
+            struct tegra_audio_error_counts *counts = (struct tegra_audio_error_counts *)arg;
+            counts->late_dma = 0;
+            counts->full_empty = data.errors;
+            data.errors = 0;
+            return 0;
+        }
+#endif
+        case TEGRA_AUDIO_IN_GET_CONFIG: {
+            struct tegra_audio_in_config *config = (struct tegra_audio_in_config *)arg;
+            config->rate = mInConfigRate;
+            config->stereo = mInStereo;
+            return 0;
+        }
+        case TEGRA_AUDIO_IN_SET_CONFIG: {
+            struct tegra_audio_in_config *config = (struct tegra_audio_in_config *)arg;
+            if (data.running) {
+                errno = EBUSY;
+                return -1;
+            }
+            mInConfigRate = config->rate;
+            mInStereo = config->stereo;
+            updateRates_l();
+            return 0;
+        }
+        case TEGRA_AUDIO_IN_STOP:
+            data.running = false;
+            return 0;
+        }
+    }
+    ALOGW("%s: unsupported request %x on %s", __FUNCTION__, request, kNodePaths[n]);
+    errno = ENOTTY;
+    return -1;
+}
+
+void AudioSimDeviceIo::injectStall(int node, int ms)
+{
+    Mutex::Autolock lock(mLock);
+    mNodes[node].stallNs += (nsecs_t)ms * 1000000LL;
+}
+
+uint32_t AudioSimDeviceIo::errors(int node)
+{
+    Mutex::Autolock lock(mLock);
+    return mNodes[node].totalErrors;
+}
+
+uint64_t AudioSimDeviceIo::bytes(int node)
+{
+    Mutex::Autolock lock(mLock);
+    return mNodes[node].bytes;
+}
+
+nsecs_t AudioSimDeviceIo::lastTransferNs(int node)
+{
+    Mutex::Autolock lock(mLock);
+    return mNodes[node].lastTransferNs;
+}
+
+}; // namespace android_audio_legacy
@@ -0,0 +1,113 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_AUDIO_SIM_DEVICE_IO_H
+#define ANDROID_AUDIO_SIM_DEVICE_IO_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/threads.h>
+#include <utils/Timers.h>
+
+#include "AudioDeviceIo.h"
+
+namespace android_audio_legacy {
+    using android::Mutex;
+
+// Simulation of the CPCAP and Tegra audio drivers for running the HAL without the
+// hardware. Output nodes consume and input nodes produce audio in real time at the
+// rate configured through the CPCAP and Tegra ioctls; write() blocks while the
+// simulated DMA queue is full and read() until enough audio was captured. A stall
+// can be injected to delay the next read or write of a node, as a preempted client
+// thread would, and the resulting underruns and overruns are reported through the
+// TEGRA_AUDIO_{OUT,IN}_GET_ERROR_COUNT ioctls.
+class AudioSimDeviceIo : public AudioDeviceIo
+{
+public:
+    enum {
+        NODE_CPCAP_CTL = 0,     // /dev/audio_ctl
+        NODE_SPKR_OUT,          // /dev/audio0_out
+        NODE_SPKR_OUT_CTL,
+        NODE_BT_OUT,            // /dev/audio1_out
+        NODE_BT_OUT_CTL,
+        NODE_BT_CTL,            // /dev/audio1_ctl
+        NODE_SPDIF_OUT,         // /dev/spdif_out
+        NODE_SPDIF_OUT_CTL,
+        NODE_MIC_IN,            // /dev/audio1_in
+        NODE_MIC_IN_CTL,
+        NODE_NUM
+    };
+
+                        AudioSimDeviceIo();
+
+    virtual int         open(const char *path, int flags);
+    virtual int         close(int fd);
+    virtual ssize_t     read(int fd, void *buffer, size_t bytes);
+    virtual ssize_t     write(int fd, const void *buffer, size_t bytes);
+    virtual int         ioctl(int fd, int request, void *arg);
+    using AudioDeviceIo::ioctl;
+
+            // Delays the next read() or write() on node by ms.
+            void        injectStall(int node, int ms);
+
+            // Statistics of a data node
+            uint32_t    errors(int node);
+            uint64_t    bytes(int node);
+            // Time the last read() or write() on node reached (write) or left (read)
+            // the driver.
+            nsecs_t     lastTransferNs(int node);
+
+private:
+    struct Node {
+        bool        open;
+        int         rate;
+        int         frameSize;
+        int         numBufs;
+        size_t      lastBytes;      // size of the last transfer, the driver buffer size
+        bool        running;
+        nsecs_t     endNs;          // output: end of the queued audio
+        nsecs_t     startNs;        // input: start of capture
+        uint64_t    bytes;          // total transferred
+        uint64_t    runBytes;       // input: delivered since start of capture
+        uint32_t    errors;         // not yet reported by GET_ERROR_COUNT
+        uint32_t    totalErrors;
+        nsecs_t     stallNs;
+        nsecs_t     lastTransferNs;
+        uint32_t    phase;          // input: tone generator
+    };
+
+            int         node(int fd);
+            int         dataNode(int ctlNode);
+            void        updateRates_l();
+
+            Mutex       mLock;
+            Node        mNodes[NODE_NUM];
+            unsigned    mOutId;
+            unsigned    mOutOn;
+            unsigned    mInId;
+            unsigned    mInOn;
+            int         mOutRate;
+            int         mInRate;
+            int         mInConfigRate;
+            int         mInStereo;
+            int         mBtBitFormat;
+            int         mBtBypass;
+};
+
+}; // namespace android_audio_legacy
+
+#endif // ANDROID_AUDIO_SIM_DEVICE_IO_H
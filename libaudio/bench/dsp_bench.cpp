@@ -0,0 +1,574 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+// Microbenchmark for the AudioDsp kernels.
+// Checks every kernel against a plain C reference, then reports ns/sample, and
+// compares the cost of the 16-bit and Q31 output paths. The device EQ presets are
+// reported in cycles/sample at the given clock, against the proprietary multimedia
+// processing when the bench is built with it.
+//
+// usage: audio_dsp_bench [frames per buffer] [iterations] [cpu MHz]
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "AudioDsp.h"
+#include "AudioEqualizer.h"
+#include "AudioPolyphaseSrc.h"
+
+#ifdef USE_PROPRIETARY_AUDIO_EXTENSIONS
+extern "C" {
+#include "cto_audio_mm.h"
+}
+extern uint16_t HC_CTO_AUDIO_MM_PARAMETER_TABLE[];
+#endif
+
+using android_audio_legacy::AudioDsp;
+using android_audio_legacy::AudioEqualizer;
+using android_audio_legacy::AudioPolyphaseSrc;
+
+static int64_t nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void fillNoise(int16_t *buf, size_t samples)
+{
+    for (size_t i = 0; i < samples; i++) {
+        buf[i] = (int16_t)(rand() & 0xFFFF);
+    }
+}
+
+static void fillNoise32(int32_t *buf, size_t samples)
+{
+    for (size_t i = 0; i < samples; i++) {
+        buf[i] = (int32_t)(((uint32_t)rand() << 16) ^ (uint32_t)rand());
+    }
+}
+
+static int16_t refClamp(int32_t v)
+{
+    return v > 32767 ? 32767 : (v < -32768 ? -32768 : v);
+}
+
+static int32_t refClamp32(int64_t v)
+{
+    return v > 0x7FFFFFFFLL ? 0x7FFFFFFF : (v < -0x80000000LL ? (int32_t)0x80000000 : v);
+}
+
+static int check32(const char *name, const int32_t *got, const int32_t *exp, size_t samples)
+{
+    for (size_t i = 0; i < samples; i++) {
+        if (got[i] != exp[i]) {
+            printf("%-12s MISMATCH at %u: got %d expected %d\n", name, (unsigned)i,
+                   got[i], exp[i]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int check(const char *name, const int16_t *got, const int16_t *exp, size_t samples)
+{
+    for (size_t i = 0; i < samples; i++) {
+        if (got[i] != exp[i]) {
+            printf("%-12s MISMATCH at %u: got %d expected %d\n", name, (unsigned)i,
+                   got[i], exp[i]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Odd frame counts exercise the scalar tails of the vector loops.
+static int verify(size_t frames)
+{
+    int errors = 0;
+    int16_t *in = new int16_t[frames * 2];
+    int16_t *out = new int16_t[frames * 2];
+    int16_t *ref = new int16_t[frames * 2];
+    int16_t *l = new int16_t[frames];
+    int16_t *r = new int16_t[frames];
+    fillNoise(in, frames * 2);
+
+    for (size_t i = 0; i < frames; i++)
+        ref[i] = (in[2*i] >> 1) + (in[2*i+1] >> 1);
+    AudioDsp::downmixStereoToMono(out, in, frames);
+    errors += check("downmix", out, ref, frames);
+    memcpy(out, in, frames * 4);
+    AudioDsp::downmixStereoToMono(out, out, frames);
+    errors += check("downmix/ip", out, ref, frames);
+
+    for (size_t i = 0; i < frames; i++)
+        ref[2*i] = ref[2*i+1] = in[i];
+    AudioDsp::upmixMonoToStereo(out, in, frames);
+    errors += check("upmix", out, ref, frames * 2);
+    memcpy(out, in, frames * 2);
+    AudioDsp::upmixMonoToStereo(out, out, frames);
+    errors += check("upmix/ip", out, ref, frames * 2);
+
+    AudioDsp::deinterleave(l, r, in, frames);
+    for (size_t i = 0; i < frames; i++)
+        ref[i] = in[2*i];
+    errors += check("deinterleave", l, ref, frames);
+    for (size_t i = 0; i < frames; i++)
+        ref[i] = in[2*i+1];
+    errors += check("deinterleave", r, ref, frames);
+
+    AudioDsp::interleave(out, l, r, frames);
+    errors += check("interleave", out, in, frames * 2);
+
+    const int16_t gains[] = { 0, AudioDsp::UNITY_GAIN / 3, AudioDsp::UNITY_GAIN,
+                              3 * AudioDsp::UNITY_GAIN, -AudioDsp::UNITY_GAIN, 32767 };
+    for (size_t g = 0; g < sizeof(gains) / sizeof(gains[0]); g++) {
+        for (size_t i = 0; i < frames * 2; i++)
+            ref[i] = refClamp(((int32_t)in[i] * gains[g] + (1 << 11)) >> 12);
+        AudioDsp::applyGain(out, in, frames * 2, gains[g]);
+        errors += check("gain", out, ref, frames * 2);
+    }
+
+    for (size_t g = 0; g + 1 < sizeof(gains) / sizeof(gains[0]); g++) {
+        fillNoise(out, frames * 2);
+        for (size_t i = 0; i < frames * 2; i++)
+            ref[i] = refClamp(out[i] + refClamp(((int32_t)in[i] * gains[g + (i & 1)] +
+                                                 (1 << 11)) >> 12));
+        AudioDsp::mixStereo(out, in, frames, gains[g], gains[g + 1]);
+        errors += check("mix", out, ref, frames * 2);
+    }
+
+    // Full scale samples of both signs must count as clips
+    in[0] = -32768;
+    in[frames * 2 - 1] = 32767;
+    AudioDsp::Levels levels = { 5, 3, 1, 100 };
+    AudioDsp::Levels expected = levels;
+    for (size_t i = 0; i < frames * 2; i++) {
+        int32_t a = in[i] < 0 ? -in[i] : in[i];
+        if (a > 32767) a = 32767;
+        if (a > expected.peak) expected.peak = a;
+        if (a == 32767) expected.clips++;
+        expected.energy += (uint64_t)((int64_t)in[i] * in[i]);
+    }
+    expected.samples += frames * 2;
+    AudioDsp::accumulateLevels(&levels, in, frames * 2);
+    if (levels.peak != expected.peak || levels.energy != expected.energy ||
+            levels.clips != expected.clips || levels.samples != expected.samples) {
+        printf("levels: peak %d/%d energy %llu/%llu clips %u/%u\n", levels.peak,
+               expected.peak, (unsigned long long)levels.energy,
+               (unsigned long long)expected.energy, levels.clips, expected.clips);
+        errors++;
+    }
+
+    delete[] in;
+    delete[] out;
+    delete[] ref;
+    delete[] l;
+    delete[] r;
+    return errors;
+}
+
+static int verifyQ31(size_t frames)
+{
+    int errors = 0;
+    int16_t *in16 = new int16_t[frames * 2];
+    int16_t *out16 = new int16_t[frames * 2];
+    int16_t *ref16 = new int16_t[frames * 2];
+    int32_t *in = new int32_t[frames * 2];
+    int32_t *out = new int32_t[frames * 2];
+    int32_t *ref = new int32_t[frames * 2];
+    int32_t *l = new int32_t[frames];
+    int32_t *r = new int32_t[frames];
+    fillNoise(in16, frames * 2);
+    fillNoise32(in, frames * 2);
+
+    for (size_t i = 0; i < frames * 2; i++)
+        ref[i] = (int32_t)in16[i] << 16;
+    AudioDsp::expandToQ31(out, in16, frames * 2);
+    errors += check32("expand", out, ref, frames * 2);
+
+    for (size_t i = 0; i < frames * 2; i++)
+        ref[i] = refClamp32((int64_t)(in[i] >> (i & 7)) << 8);
+    for (size_t i = 0; i < frames * 2; i++)
+        out[i] = in[i] >> (i & 7);      // mostly out of the 8.24 range, some within
+    AudioDsp::q824ToQ31(out, out, frames * 2);
+    errors += check32("q824", out, ref, frames * 2);
+
+    for (size_t i = 0; i < frames; i++)
+        ref[i] = (int32_t)(((int64_t)in[2*i] + in[2*i+1]) >> 1);
+    AudioDsp::downmixStereoToMonoQ31(out, in, frames);
+    errors += check32("downmix32", out, ref, frames);
+    memcpy(out, in, frames * 8);
+    AudioDsp::downmixStereoToMonoQ31(out, out, frames);
+    errors += check32("downmix32/ip", out, ref, frames);
+
+    for (size_t i = 0; i < frames; i++)
+        ref[2*i] = ref[2*i+1] = in[i];
+    AudioDsp::upmixMonoToStereoQ31(out, in, frames);
+    errors += check32("upmix32", out, ref, frames * 2);
+    memcpy(out, in, frames * 4);
+    AudioDsp::upmixMonoToStereoQ31(out, out, frames);
+    errors += check32("upmix32/ip", out, ref, frames * 2);
+
+    AudioDsp::deinterleaveQ31(l, r, in, frames);
+    AudioDsp::interleaveQ31(out, l, r, frames);
+    errors += check32("interleave32", out, in, frames * 2);
+
+    const int16_t gains[] = { 0, AudioDsp::UNITY_GAIN / 3, AudioDsp::UNITY_GAIN,
+                              3 * AudioDsp::UNITY_GAIN, -AudioDsp::UNITY_GAIN, 32767 };
+    for (size_t g = 0; g + 1 < sizeof(gains) / sizeof(gains[0]); g++) {
+        fillNoise32(out, frames * 2);
+        for (size_t i = 0; i < frames * 2; i++)
+            ref[i] = refClamp32((int64_t)out[i] +
+                                refClamp32(((int64_t)in[i] * gains[g + (i & 1)] +
+                                            (1 << 11)) >> 12));
+        AudioDsp::mixStereoQ31(out, in, frames, gains[g], gains[g + 1]);
+        errors += check32("mix32", out, ref, frames * 2);
+    }
+
+    // Generator i % DITHER_LANES for sample i, with an odd number of samples so
+    // that the state is checked after a tail.
+    uint32_t state[AudioDsp::DITHER_LANES];
+    uint32_t refState[AudioDsp::DITHER_LANES];
+    for (int i = 0; i < AudioDsp::DITHER_LANES; i++)
+        state[i] = refState[i] = 12345 + i;
+    for (int pass = 0; pass < 2; pass++) {
+        size_t samples = frames * 2 - pass;
+        for (size_t i = 0; i < samples; i++) {
+            uint32_t x = refState[i % AudioDsp::DITHER_LANES];
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            refState[i % AudioDsp::DITHER_LANES] = x;
+            int64_t d = (int64_t)(x & 0xFFFF) - (int64_t)(x >> 16);
+            int64_t v = ((int64_t)in[i] + d + 0x8000) >> 16;
+            ref16[i] = v > 32767 ? 32767 : (v < -32768 ? -32768 : (int16_t)v);
+        }
+        AudioDsp::ditherToPcm16(out16, in, samples, state);
+        errors += check("dither", out16, ref16, samples);
+        if (memcmp(state, refState, sizeof(state)) != 0) {
+            printf("%-12s state MISMATCH\n", "dither");
+            errors++;
+        }
+    }
+
+    delete[] in16;
+    delete[] out16;
+    delete[] ref16;
+    delete[] in;
+    delete[] out;
+    delete[] ref;
+    delete[] l;
+    delete[] r;
+    return errors;
+}
+
+// The filters keep their history between buffers: any split of the input gives the
+// same output. A 1 kHz tone goes through the S/PDIF subsonic filter unchanged.
+static int verifyEqualizer(size_t frames)
+{
+    int errors = 0;
+    int32_t *in = new int32_t[frames * 2];
+    int32_t *whole = new int32_t[frames * 2];
+    int32_t *split = new int32_t[frames * 2];
+    fillNoise32(in, frames * 2);
+
+    for (int p = 0; p < AudioEqualizer::PRESET_NUM; p++) {
+        AudioEqualizer eq1, eq2;
+        eq1.setPreset(p);
+        eq2.setPreset(p);
+        memcpy(whole, in, frames * 8);
+        memcpy(split, in, frames * 8);
+        eq1.process(whole, frames);
+        size_t done = 0;
+        for (size_t n = 1; done < frames; n = n * 2 + 1) {
+            size_t count = frames - done < n ? frames - done : n;
+            eq2.process(split + done * 2, count);
+            done += count;
+        }
+        errors += check32(AudioEqualizer::presetName(p), split, whole, frames * 2);
+    }
+
+    AudioEqualizer eq;
+    eq.setPreset(AudioEqualizer::PRESET_SPDIF);
+    for (size_t i = 0; i < frames * 2; i++)
+        in[i] = (int32_t)(0x20000000 * sin(2.0 * M_PI * 1000.0 * (i / 2) / 44100.0));
+    memcpy(whole, in, frames * 8);
+    eq.process(whole, frames);
+    // Past the first millisecond, within 0.1 dB
+    double energyIn = 0, energyOut = 0;
+    for (size_t i = 88; i < frames * 2; i++) {
+        energyIn += (double)in[i] * in[i];
+        energyOut += (double)whole[i] * whole[i];
+    }
+    if (energyIn > 0 && fabs(10.0 * log10(energyOut / energyIn)) > 0.1) {
+        printf("spdif eq: 1 kHz gain %.2f dB\n", 10.0 * log10(energyOut / energyIn));
+        errors++;
+    }
+
+    delete[] in;
+    delete[] whole;
+    delete[] split;
+    return errors;
+}
+
+static void report(const char *name, int64_t ns, size_t samples, int iterations)
+{
+    printf("%-12s %8.3f ns/sample\n", name, (double)ns / ((double)samples * iterations));
+}
+
+static void reportCycles(const char *name, int64_t ns, size_t samples, int iterations,
+                         double mhz)
+{
+    double nsPerSample = (double)ns / ((double)samples * iterations);
+    printf("%-12s %8.3f ns/sample %8.1f cycles/sample\n", name, nsPerSample,
+           nsPerSample * mhz / 1000.0);
+}
+
+// Device EQ of the open builds against the multimedia processing it replaces, both on
+// a stereo buffer at 44.1 kHz; samples count the two channels.
+static void benchEqualizer(size_t frames, int iterations, double mhz)
+{
+    int16_t *pcm = new int16_t[frames * 2];
+    int32_t *q31 = new int32_t[frames * 2];
+    fillNoise(pcm, frames * 2);
+
+    for (int p = AudioEqualizer::PRESET_NONE + 1; p < AudioEqualizer::PRESET_NUM; p++) {
+        AudioEqualizer eq;
+        eq.setPreset(p);
+        char name[32];
+        snprintf(name, sizeof(name), "eq %s", AudioEqualizer::presetName(p));
+        int64_t t = nowNs();
+        for (int i = 0; i < iterations; i++) {
+            AudioDsp::expandToQ31(q31, pcm, frames * 2);
+            eq.process(q31, frames);
+        }
+        reportCycles(name, nowNs() - t, frames * 2, iterations, mhz);
+    }
+
+#ifdef USE_PROPRIETARY_AUDIO_EXTENSIONS
+    // Set up as AudioPostProcessor does for the loudspeaker
+    static int16_t pcmLogging[CTO_AUDIO_MM_DATALOGGING_BUFFER_BLOCK_BYTESIZE / 2];
+    static uint16_t runtimeParam[CTO_AUDIO_MM_RUNTIME_PARAM_BYTESIZE / 2];
+    static uint16_t staticMem[CTO_AUDIO_MM_STATICMEM_BLOCK_BYTESIZE / 2];
+    static uint16_t scratchMem[CTO_AUDIO_MM_SCRATCHMEM_BLOCK_BYTESIZE / 2];
+    CTO_AUDIO_MM_ENV_VAR env;
+    memset(&env, 0, sizeof(env));
+    env.cto_audio_mm_param_block_ptr = HC_CTO_AUDIO_MM_PARAMETER_TABLE;
+    env.cto_audio_mm_pcmlogging_buffer_block_ptr = pcmLogging;
+    env.pcmlogging_buffer_block_size = sizeof(pcmLogging) / sizeof(pcmLogging[0]);
+    env.cto_audio_mm_runtime_param_mem_ptr = runtimeParam;
+    env.cto_audio_mm_static_memory_block_ptr = staticMem;
+    env.cto_audio_mm_scratch_memory_block_ptr = scratchMem;
+    env.accy = CTO_AUDIO_MM_ACCY_LOUDSPEAKER;
+    env.sample_rate = CTO_AUDIO_MM_SAMPL_44100;
+    api_cto_audio_mm_param_parser(&env, (int16_t *)0, (int16_t *)0);
+    api_cto_audio_mm_init(&env, (int16_t *)0, (int16_t *)0);
+    int16_t *work = new int16_t[frames * 2];
+    int64_t t = nowNs();
+    for (int i = 0; i < iterations; i++) {
+        memcpy(work, pcm, frames * 4);
+        env.frame_size = frames;
+        api_cto_audio_mm_main(&env, work, work);
+    }
+    reportCycles("cto speaker", nowNs() - t, frames * 2, iterations, mhz);
+    delete[] work;
+#endif
+
+    delete[] pcm;
+    delete[] q31;
+}
+
+int main(int argc, char **argv)
+{
+    size_t frames = argc > 1 ? atoi(argv[1]) : 1024;
+    int iterations = argc > 2 ? atoi(argv[2]) : 20000;
+    // Tegra 2 runs at 1 GHz
+    double mhz = argc > 3 ? atof(argv[3]) : 1000.0;
+    int errors = 0;
+
+    if (frames == 0 || iterations <= 0) {
+        fprintf(stderr, "usage: %s [frames] [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    srand(1);
+    errors += verify(frames);
+    errors += verify(frames + 7);
+    errors += verify(3);
+    errors += verifyQ31(frames);
+    errors += verifyQ31(frames + 7);
+    errors += verifyQ31(3);
+    errors += verifyEqualizer(frames);
+    errors += verifyEqualizer(3);
+    if (errors) {
+        printf("%d kernel mismatches\n", errors);
+        return 1;
+    }
+
+    printf("AudioDsp implementation: %s, %u frames x %d iterations\n",
+           AudioDsp::implementation(), (unsigned)frames, iterations);
+
+    int16_t *stereo = new int16_t[frames * 2];
+    int16_t *mono = new int16_t[frames];
+    int16_t *l = new int16_t[frames];
+    int16_t *r = new int16_t[frames];
+    fillNoise(stereo, frames * 2);
+    fillNoise(mono, frames);
+
+    int64_t t = nowNs();
+    for (int i = 0; i < iterations; i++)
+        AudioDsp::downmixStereoToMono(mono, stereo, frames);
+    report("downmix", nowNs() - t, frames, iterations);
+
+    t = nowNs();
+    for (int i = 0; i < iterations; i++)
+        AudioDsp::upmixMonoToStereo(stereo, mono, frames);
+    report("upmix", nowNs() - t, frames, iterations);
+
+    t = nowNs();
+    for (int i = 0; i < iterations; i++)
+        AudioDsp::deinterleave(l, r, stereo, frames);
+    report("deinterleave", nowNs() - t, frames * 2, iterations);
+
+    t = nowNs();
+    for (int i = 0; i < iterations; i++)
+        AudioDsp::interleave(stereo, l, r, frames);
+    report("interleave", nowNs() - t, frames * 2, iterations);
+
+    t = nowNs();
+    for (int i = 0; i < iterations; i++)
+        AudioDsp::applyGain(stereo, stereo, frames * 2, AudioDsp::UNITY_GAIN / 2);
+    report("gain", nowNs() - t, frames * 2, iterations);
+
+    t = nowNs();
+    for (int i = 0; i < iterations; i++)
+        AudioDsp::mixStereo(stereo, stereo, frames, AudioDsp::UNITY_GAIN / 2,
+                            AudioDsp::UNITY_GAIN / 4);
+    report("mix", nowNs() - t, frames * 2, iterations);
+
+    AudioDsp::Levels levels = { 0, 0, 0, 0 };
+    t = nowNs();
+    for (int i = 0; i < iterations; i++)
+        AudioDsp::accumulateLevels(&levels, stereo, frames * 2);
+    report("levels", nowNs() - t, frames * 2, iterations);
+
+    int32_t *stereo32 = new int32_t[frames * 2];
+    int32_t *track32 = new int32_t[frames * 2];
+    int32_t *mono32 = new int32_t[frames];
+    uint32_t state[AudioDsp::DITHER_LANES] = { 1, 2, 3, 4 };
+    fillNoise32(track32, frames * 2);
+
+    t = nowNs();
+    for (int i = 0; i < iterations; i++)
+        AudioDsp::expandToQ31(stereo32, stereo, frames * 2);
+    report("expand", nowNs() - t, frames * 2, iterations);
+
+    t = nowNs();
+    for (int i = 0; i < iterations; i++)
+        AudioDsp::mixStereoQ31(stereo32, track32, frames, AudioDsp::UNITY_GAIN / 2,
+                               AudioDsp::UNITY_GAIN / 4);
+    report("mix32", nowNs() - t, frames * 2, iterations);
+
+    t = nowNs();
+    for (int i = 0; i < iterations; i++)
+        AudioDsp::downmixStereoToMonoQ31(mono32, stereo32, frames);
+    report("downmix32", nowNs() - t, frames, iterations);
+
+    t = nowNs();
+    for (int i = 0; i < iterations; i++)
+        AudioDsp::ditherToPcm16(stereo, stereo32, frames * 2, state);
+    report("dither", nowNs() - t, frames * 2, iterations);
+
+    // The write path of the primary output with a secondary stream mixed in, written
+    // to a 48 kHz sink: mix, downmix, SRC, upmix. pathq31 is what writeFrames() does
+    // once the mix widened, all the stages in Q31; pathmix narrows right after the
+    // mix, for reference.
+    AudioPolyphaseSrc src16;
+    AudioPolyphaseSrc src32;
+    src16.init(44100, 48000, AudioPolyphaseSrc::QUALITY_LOW);
+    src32.init(44100, 48000, AudioPolyphaseSrc::QUALITY_LOW);
+    size_t outFrames = frames * 2;
+    int16_t *track = new int16_t[frames * 2];
+    int16_t *path = new int16_t[outFrames * 2];
+    int32_t *path32 = new int32_t[outFrames * 2];
+    int16_t *sink = new int16_t[outFrames * 2];
+    fillNoise(track, frames * 2);
+    int iterationsPath = iterations / 4 > 0 ? iterations / 4 : 1;
+
+    t = nowNs();
+    for (int i = 0; i < iterationsPath; i++) {
+        AudioDsp::mixStereo(stereo, track, frames, AudioDsp::UNITY_GAIN / 2,
+                            AudioDsp::UNITY_GAIN / 2);
+        AudioDsp::downmixStereoToMono(mono, stereo, frames);
+        size_t inCount = frames;
+        size_t outCount = outFrames;
+        src16.convert(mono, &inCount, path, &outCount);
+        AudioDsp::upmixMonoToStereo(sink, path, outCount);
+    }
+    int64_t ns16 = nowNs() - t;
+    report("path16", ns16, frames, iterationsPath);
+
+    t = nowNs();
+    for (int i = 0; i < iterationsPath; i++) {
+        AudioDsp::expandToQ31(stereo32, stereo, frames * 2);
+        AudioDsp::mixStereoQ31(stereo32, track32, frames, AudioDsp::UNITY_GAIN / 2,
+                               AudioDsp::UNITY_GAIN / 2);
+        AudioDsp::ditherToPcm16(stereo, stereo32, frames * 2, state);
+        AudioDsp::downmixStereoToMono(mono, stereo, frames);
+        size_t inCount = frames;
+        size_t outCount = outFrames;
+        src16.convert(mono, &inCount, path, &outCount);
+        AudioDsp::upmixMonoToStereo(sink, path, outCount);
+    }
+    int64_t nsMix = nowNs() - t;
+    report("pathmix", nsMix, frames, iterationsPath);
+
+    t = nowNs();
+    for (int i = 0; i < iterationsPath; i++) {
+        AudioDsp::expandToQ31(stereo32, stereo, frames * 2);
+        AudioDsp::mixStereoQ31(stereo32, track32, frames, AudioDsp::UNITY_GAIN / 2,
+                               AudioDsp::UNITY_GAIN / 2);
+        AudioDsp::downmixStereoToMonoQ31(mono32, stereo32, frames);
+        size_t inCount = frames;
+        size_t outCount = outFrames;
+        src32.convert(mono32, &inCount, path32, &outCount);
+        AudioDsp::upmixMonoToStereoQ31(path32, path32, outCount);
+        AudioDsp::ditherToPcm16(sink, path32, outCount * 2, state);
+    }
+    int64_t ns32 = nowNs() - t;
+    report("pathq31", ns32, frames, iterationsPath);
+    printf("%-12s %8.2f x\n", "mix/16", (double)nsMix / (double)ns16);
+    printf("%-12s %8.2f x\n", "q31/16", (double)ns32 / (double)ns16);
+
+    benchEqualizer(frames, iterationsPath, mhz);
+
+    delete[] stereo32;
+    delete[] track32;
+    delete[] mono32;
+    delete[] track;
+    delete[] path;
+    delete[] path32;
+    delete[] sink;
+    delete[] stereo;
+    delete[] mono;
+    delete[] l;
+    delete[] r;
+    return 0;
+}
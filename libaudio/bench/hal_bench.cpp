@@ -0,0 +1,318 @@
+/*
+** Copyright 2012, The Android Open-Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+// Benchmark of the audio HAL running on the simulated CPCAP/Tegra drivers of
+// AudioSimDeviceIo: playback, playback over Bluetooth SCO (8 kHz SRC), routing
+// switches, client stalls, capture, and capture with echo cancellation toggled.
+// Reports the CPU used per second of audio and the time a buffer spends in the HAL
+// between the client call and the driver.
+//
+// usage: audio_hal_bench [seconds per scenario]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+#include <hardware_legacy/AudioHardwareInterface.h>
+#include <audio_effects/effect_aec.h>
+
+#include "AudioSimDeviceIo.h"
+
+using namespace android_audio_legacy;
+using android::String8;
+
+static AudioSimDeviceIo gSim;
+
+struct Result {
+    const char *name;
+    double      audioSec;
+    double      cpuSec;
+    uint32_t    transfers;
+    int64_t     addedTotalNs;
+    int64_t     addedMaxNs;
+    uint32_t    errors;
+};
+
+static double cpuSeconds()
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+           (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+static void addLatency(Result *r, nsecs_t ns)
+{
+    if (ns < 0) {
+        ns = 0;
+    }
+    r->transfers++;
+    r->addedTotalNs += ns;
+    if (ns > r->addedMaxNs) {
+        r->addedMaxNs = ns;
+    }
+}
+
+// cpuSec < 0: the CPU is accounted in another line
+static void report(const Result& r)
+{
+    char cpu[16] = "      -";
+    if (r.cpuSec >= 0 && r.audioSec > 0) {
+        snprintf(cpu, sizeof(cpu), "%7.2f", r.cpuSec * 1000 / r.audioSec);
+    }
+    printf("%-14s %6.1f s audio  %s ms cpu/s  added latency avg %6d us max %6d us  "
+           "driver errors %u\n", r.name, r.audioSec, cpu,
+           r.transfers ? (int)(r.addedTotalNs / r.transfers / 1000) : 0,
+           (int)(r.addedMaxNs / 1000), r.errors);
+}
+
+static void setRouting(AudioStreamOut *out, uint32_t devices)
+{
+    char kv[64];
+    snprintf(kv, sizeof(kv), "%s=%u", AudioParameter::keyRouting, devices);
+    out->setParameters(String8(kv));
+}
+
+static bool isBluetooth(uint32_t devices)
+{
+    return devices & (AudioSystem::DEVICE_OUT_BLUETOOTH_SCO |
+                      AudioSystem::DEVICE_OUT_BLUETOOTH_SCO_HEADSET |
+                      AudioSystem::DEVICE_OUT_BLUETOOTH_SCO_CARKIT);
+}
+
+struct PlaybackArgs {
+    AudioStreamOut *out;
+    double      seconds;
+    const uint32_t *routes;     // cycled through every switchWrites writes, or NULL
+    int         numRoutes;
+    int         switchWrites;
+    int         stallMs;        // client stall every stallWrites writes
+    int         stallWrites;
+    Result      result;
+};
+
+static void *playback(void *cookie)
+{
+    PlaybackArgs *args = (PlaybackArgs *)cookie;
+    AudioStreamOut *out = args->out;
+    size_t bytes = out->bufferSize();
+    size_t frames = bytes / out->frameSize();
+    int writes = (int)(args->seconds * out->sampleRate() / frames);
+    int16_t *tone = new int16_t[bytes / sizeof(int16_t)];
+    int16_t *buffer = new int16_t[bytes / sizeof(int16_t)];
+    for (size_t i = 0; i < bytes / sizeof(int16_t); i++) {
+        tone[i] = (int16_t)((i * 1500) & 0x3FFF) - 0x2000;
+    }
+    uint32_t devices = AudioSystem::DEVICE_OUT_SPEAKER;
+    uint32_t errors = gSim.errors(AudioSimDeviceIo::NODE_SPKR_OUT) +
+                      gSim.errors(AudioSimDeviceIo::NODE_BT_OUT);
+
+    for (int i = 0; i < writes; i++) {
+        if (args->routes != NULL && i % args->switchWrites == 0) {
+            devices = args->routes[(i / args->switchWrites) % args->numRoutes];
+            setRouting(out, devices);
+        }
+        if (args->stallMs && i % args->stallWrites == args->stallWrites - 1) {
+            gSim.injectStall(AudioSimDeviceIo::NODE_SPKR_OUT, args->stallMs);
+        }
+        // The HAL processes the client buffer in place
+        memcpy(buffer, tone, bytes);
+        int node = isBluetooth(devices) ? AudioSimDeviceIo::NODE_BT_OUT :
+                                          AudioSimDeviceIo::NODE_SPKR_OUT;
+        nsecs_t start = systemTime();
+        if (out->write(buffer, bytes) < 0) {
+            fprintf(stderr, "write failed\n");
+            break;
+        }
+        addLatency(&args->result, gSim.lastTransferNs(node) - start);
+    }
+    args->result.audioSec = (double)writes * frames / out->sampleRate();
+    args->result.errors = gSim.errors(AudioSimDeviceIo::NODE_SPKR_OUT) +
+                          gSim.errors(AudioSimDeviceIo::NODE_BT_OUT) - errors;
+    if (args->routes != NULL) {
+        setRouting(out, AudioSystem::DEVICE_OUT_SPEAKER);
+    }
+    delete[] tone;
+    delete[] buffer;
+    return NULL;
+}
+
+// Echo canceller handle, only its descriptor is looked at by the HAL
+static int aecGetDescriptor(effect_handle_t self, effect_descriptor_t *desc)
+{
+    memset(desc, 0, sizeof(*desc));
+    desc->type = *FX_IID_AEC;
+    strcpy(desc->name, "simulated AEC");
+    return 0;
+}
+
+static struct effect_interface_s gAecInterface;
+static struct effect_interface_s *gAecHandle = &gAecInterface;
+
+static Result capture(AudioStreamIn *in, double seconds, int toggleEcReads)
+{
+    Result r;
+    memset(&r, 0, sizeof(r));
+    size_t bytes = in->bufferSize();
+    int reads = (int)(seconds * in->sampleRate() * in->frameSize() / bytes);
+    char *buffer = new char[bytes];
+    uint32_t errors = gSim.errors(AudioSimDeviceIo::NODE_MIC_IN);
+    bool ec = false;
+
+    for (int i = 0; i < reads; i++) {
+        if (toggleEcReads && i % toggleEcReads == 0) {
+            ec = !ec;
+            if (ec) {
+                in->addAudioEffect(&gAecHandle);
+            } else {
+                in->removeAudioEffect(&gAecHandle);
+            }
+        }
+        if (in->read(buffer, bytes) < 0) {
+            fprintf(stderr, "read failed\n");
+            break;
+        }
+        addLatency(&r, systemTime() - gSim.lastTransferNs(AudioSimDeviceIo::NODE_MIC_IN));
+    }
+    if (ec) {
+        in->removeAudioEffect(&gAecHandle);
+    }
+    r.audioSec = (double)reads * bytes / in->frameSize() / in->sampleRate();
+    r.errors = gSim.errors(AudioSimDeviceIo::NODE_MIC_IN) - errors;
+    delete[] buffer;
+    return r;
+}
+
+static void runPlayback(AudioHardwareInterface *hw, PlaybackArgs *args)
+{
+    status_t status;
+    args->out = hw->openOutputStream(AudioSystem::DEVICE_OUT_SPEAKER, 0, 0, 0, &status);
+    if (args->out == NULL) {
+        fprintf(stderr, "%s: cannot open output: %d\n", args->result.name, status);
+        return;
+    }
+    double cpu = cpuSeconds();
+    playback(args);
+    args->result.cpuSec = cpuSeconds() - cpu;
+    report(args->result);
+    hw->closeOutputStream(args->out);
+}
+
+static void runCapture(AudioHardwareInterface *hw, const char *name, double seconds,
+                       int toggleEcReads)
+{
+    status_t status;
+    PlaybackArgs args;
+    memset(&args, 0, sizeof(args));
+    args.result.name = "  + playback";
+    args.result.cpuSec = -1;
+    args.seconds = seconds;
+    args.out = hw->openOutputStream(AudioSystem::DEVICE_OUT_SPEAKER, 0, 0, 0, &status);
+
+    int format = AudioSystem::PCM_16_BIT;
+    uint32_t channels = AudioSystem::CHANNEL_IN_MONO;
+    uint32_t rate = 16000;
+    AudioStreamIn *in = hw->openInputStream(AudioSystem::DEVICE_IN_BUILTIN_MIC, &format,
+                                            &channels, &rate, &status,
+                                            (AudioSystem::audio_in_acoustics)0);
+    if (args.out == NULL || in == NULL) {
+        fprintf(stderr, "%s: cannot open streams: %d\n", name, status);
+        if (in != NULL) {
+            hw->closeInputStream(in);
+        }
+        if (args.out != NULL) {
+            hw->closeOutputStream(args.out);
+        }
+        return;
+    }
+
+    // Playback runs alongside, as during a call; the CPU is that of both streams.
+    double cpu = cpuSeconds();
+    pthread_t thread;
+    pthread_create(&thread, NULL, playback, &args);
+    Result r = capture(in, seconds, toggleEcReads);
+    pthread_join(thread, NULL);
+    r.cpuSec = cpuSeconds() - cpu;
+    r.name = name;
+    report(r);
+    report(args.result);
+
+    hw->closeInputStream(in);
+    hw->closeOutputStream(args.out);
+}
+
+int main(int argc, char **argv)
+{
+    double seconds = argc > 1 ? atof(argv[1]) : 5.0;
+    if (seconds <= 0) {
+        fprintf(stderr, "usage: %s [seconds per scenario]\n", argv[0]);
+        return 1;
+    }
+
+    gAecInterface.get_descriptor = aecGetDescriptor;
+    AudioDeviceIo::setInstance(&gSim);
+    AudioHardwareInterface *hw = createAudioHardware();
+    if (hw == NULL) {
+        fprintf(stderr, "cannot create the audio HAL\n");
+        return 1;
+    }
+
+    static const uint32_t kBluetooth[] = { AudioSystem::DEVICE_OUT_BLUETOOTH_SCO };
+    static const uint32_t kRoutes[] = {
+        AudioSystem::DEVICE_OUT_SPEAKER,
+        AudioSystem::DEVICE_OUT_WIRED_HEADSET,
+        AudioSystem::DEVICE_OUT_BLUETOOTH_SCO,
+        AudioSystem::DEVICE_OUT_SPEAKER | AudioSystem::DEVICE_OUT_WIRED_HEADSET,
+    };
+    PlaybackArgs args;
+
+    memset(&args, 0, sizeof(args));
+    args.result.name = "playback";
+    args.seconds = seconds;
+    runPlayback(hw, &args);
+
+    memset(&args, 0, sizeof(args));
+    args.result.name = "playback_bt";
+    args.seconds = seconds;
+    args.routes = kBluetooth;
+    args.numRoutes = 1;
+    args.switchWrites = 1 << 30;
+    runPlayback(hw, &args);
+
+    memset(&args, 0, sizeof(args));
+    args.result.name = "routing";
+    args.seconds = seconds;
+    args.routes = kRoutes;
+    args.numRoutes = sizeof(kRoutes) / sizeof(kRoutes[0]);
+    args.switchWrites = 20;
+    runPlayback(hw, &args);
+
+    memset(&args, 0, sizeof(args));
+    args.result.name = "stalls";
+    args.seconds = seconds;
+    args.stallMs = 120;
+    args.stallWrites = 50;
+    runPlayback(hw, &args);
+
+    runCapture(hw, "capture", seconds, 0);
+    runCapture(hw, "capture_ec", seconds, 25);
+
+    delete hw;
+    AudioDeviceIo::setInstance(NULL);
+    return 0;
+}